@@ -0,0 +1,197 @@
+#ifndef ACTIVITY_MODULE_H
+#define ACTIVITY_MODULE_H
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include "deepStream.h"
+#include "channelScheduler.h"
+#include "packetSampler.h"
+#include "metrics.h"
+
+typedef struct {
+	float minFps = 1.f;		// floor of an idle channel
+	float maxFps = 30.f;	// full rate, restored on the first detection
+	float idleSec = 10.f;	// empty time before each halving of the rate
+} ACTIVITY_PARAMS;
+
+// Lowers the sampling rate of channels whose scene stayed empty and puts
+// it back to full rate as soon as something is detected. Only channels
+// registered with a TARGET_FPS sampler are controlled.
+class ActivityController {
+public:
+	explicit
+	ActivityController(const int nChannels, const ACTIVITY_PARAMS &params, simplelogger::Logger *logger)
+	: params_(params), logger_(logger), vChannels_(nChannels) {}
+
+	void addChannel(const int channel, PacketSampler *pSampler) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		CHANNEL_ACTIVITY &ch = vChannels_[channel];
+		ch.pSampler = pSampler;
+		ch.targetFps = params_.maxFps;
+		ch.lastActiveUs = metricsNowUs();
+		ch.lastStepUs = ch.lastActiveUs;
+		ch.lastReportUs = ch.lastActiveUs;
+		pSampler->setTargetFps(ch.targetFps);
+	}
+
+	// Before the sampler of the channel is deleted.
+	void removeChannel(const int channel) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		vChannels_[channel] = CHANNEL_ACTIVITY();
+	}
+
+	// One call per analysed frame of the channel.
+	void onFrame(const int channel, const int nObjects) {
+		if (channel < 0 || channel >= (int)vChannels_.size()) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mtx_);
+		CHANNEL_ACTIVITY &ch = vChannels_[channel];
+		if (nullptr == ch.pSampler) {
+			return;
+		}
+		uint64_t now = metricsNowUs();
+		uint64_t idleUs = (uint64_t)(params_.idleSec * 1e6);
+		if (nObjects > 0) {
+			ch.lastActiveUs = now;
+			ch.lastStepUs = now;
+			if (ch.targetFps < params_.maxFps) {
+				LOG_DEBUG(logger_, "Activity: channel " << channel << " back to " << params_.maxFps << " fps");
+				setTarget(ch, params_.maxFps);
+			}
+		} else if (now - ch.lastActiveUs >= idleUs && now - ch.lastStepUs >= idleUs
+					&& ch.targetFps > params_.minFps) {
+			ch.lastStepUs = now;
+			setTarget(ch, std::max(params_.minFps, ch.targetFps / 2.f));
+			LOG_DEBUG(logger_, "Activity: channel " << channel << " idle, " << ch.targetFps << " fps");
+		}
+		report(channel, ch, now);
+	}
+
+private:
+	typedef struct {
+		PacketSampler *pSampler = nullptr;
+		float targetFps = 0.f;
+		uint64_t lastActiveUs = 0;
+		uint64_t lastStepUs = 0;
+		uint64_t lastReportUs = 0;
+		uint64_t lastKept = 0;
+	} CHANNEL_ACTIVITY;
+
+	void setTarget(CHANNEL_ACTIVITY &ch, const float fps) {
+		ch.targetFps = fps;
+		ch.pSampler->setTargetFps(fps);
+	}
+
+	// effective fps is measured on the pictures the sampler let through
+	void report(const int channel, CHANNEL_ACTIVITY &ch, const uint64_t now) {
+		if (now - ch.lastReportUs < 1000000 || nullptr == g_pMetrics) {
+			return;
+		}
+		uint64_t kept = ch.pSampler->getNbKept();
+		double fps = (kept - ch.lastKept) * 1e6 / (now - ch.lastReportUs);
+		ch.lastKept = kept;
+		ch.lastReportUs = now;
+		g_pMetrics->setGauge("effective_fps", channel, fps);
+		g_pMetrics->setGauge("target_fps", channel, ch.targetFps);
+	}
+
+	ACTIVITY_PARAMS params_;
+	simplelogger::Logger *logger_{ nullptr };
+	std::vector<CHANNEL_ACTIVITY > vChannels_;
+	std::mutex mtx_;
+};
+
+// Feeds the detections of the parser into the activity controller.
+class ActivityModule : public IModule {
+public:
+	explicit
+	ActivityModule(PRE_MODULE_LIST &preModules,
+					ActivityController *pController,
+					simplelogger::Logger *logger,
+					ChannelScheduler *pScheduler = nullptr,
+					const int workerID = 0)
+	: preModules_(preModules), pController_(pController), logger_(logger), pScheduler_(pScheduler), workerID_(workerID) {}
+
+	~ActivityModule() {}
+
+	// override
+	void initialize() override {}
+
+	void execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) override;
+
+	void destroy() override {}
+
+	int getNbInputs() const override {
+		return preModules_.size();
+	}
+
+	PRE_MODULE getPreModule(const int tensorIndex) const override {
+		return preModules_[tensorIndex];
+	}
+
+	int getNbOutputs() const override {
+		return vpOutputTensors_.size();
+	}
+
+	IStreamTensor* getOutputTensor(const int tensorIndex) const override {
+		return vpOutputTensors_[tensorIndex];
+	}
+
+	void setProfiler(IModuleProfiler *pProfiler) override {
+		pProfiler_ = pProfiler;
+	}
+
+	IModuleProfiler* getProfiler() const override {
+		return pProfiler_;
+	}
+
+	void setCallback(void *pUserData, MODULE_CALLBACK callback) override {
+		pUserData_ = pUserData;
+		callback_ = callback;
+	}
+
+	std::pair<void *, MODULE_CALLBACK> getCallback() const override {
+		return std::pair<void*, MODULE_CALLBACK>(pUserData_, callback_);
+	}
+
+private:
+	ActivityController *pController_{ nullptr };
+	simplelogger::Logger *logger_{ nullptr };
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
+
+	void *pUserData_{ nullptr };
+	MODULE_CALLBACK callback_{ nullptr };
+	IModuleProfiler* pProfiler_{ nullptr };
+
+	PRE_MODULE_LIST preModules_;
+	std::vector<IStreamTensor*> vpOutputTensors_;
+};
+
+void ActivityModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
+	assert(1 == vpInputTensors.size());
+	assert(OBJ_COORD == vpInputTensors[0]->getTensorType());
+	int nFrames = vpInputTensors[0]->getShape()[0];
+	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(vpInputTensors[0]->getCpuData());
+	if (0 == nFrames || nullptr == pBBox_batch) {
+		return;
+	}
+	for (int iF = 0; iF < nFrames; ++iF) {
+		BBOXS_PER_FRAME &bboxs = pBBox_batch[iF];
+		int channel = bboxs.videoIndex;
+		if (nullptr != pScheduler_) {
+			channel = pScheduler_->getChannel(workerID_, channel);
+		}
+		int nObjects = 0;
+		for (int i = 0; i < bboxs.nBBox; ++i) {
+			if (!bboxs.bbox[i].bSkip) {
+				nObjects++;
+			}
+		}
+		pController_->onFrame(channel, nObjects);
+	}
+}
+
+#endif // ACTIVITY_MODULE_H
@@ -0,0 +1,119 @@
+#ifndef CHANNEL_INFO_H
+#define CHANNEL_INFO_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include "streamTaker.h"
+#include "common/logger.h"
+
+// A channel is analysed on one stream and reported in the geometry of
+// another. Cameras with a low resolution sub-stream are defined as
+// "analysisURL|mainURL" in -fileList, the detections are normalized and
+// scaled to the main stream on output.
+typedef struct {
+	std::string analysisURL;
+	std::string mainURL;		// empty without a main stream
+	int analysisWidth = 0;
+	int analysisHeight = 0;
+	int outputWidth = 0;		// geometry of the reported boxes
+	int outputHeight = 0;
+} CHANNEL_INFO;
+
+inline CHANNEL_INFO parseChannelDefinition(const std::string &definition) {
+	CHANNEL_INFO info;
+	size_t sep = definition.find('|');
+	info.analysisURL = definition.substr(0, sep);
+	if (std::string::npos != sep) {
+		info.mainURL = definition.substr(sep + 1);
+	}
+	return info;
+}
+
+// The channel infos, set by the registry thread when a channel is
+// attached while the sinks read them.
+class ChannelInfoTable {
+public:
+	explicit
+	ChannelInfoTable(const int nChannels = 0) : vInfos_(nChannels) {}
+
+	void resize(const int nChannels) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		vInfos_.resize(nChannels);
+	}
+
+	void set(const int channel, const CHANNEL_INFO &info) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (channel >= 0 && channel < (int)vInfos_.size()) {
+			vInfos_[channel] = info;
+		}
+	}
+
+	// Geometry the boxes of a channel are reported in, false while the
+	// size of its streams is unknown.
+	bool getOutputSize(const int channel, int &width, int &height) const {
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (channel < 0 || channel >= (int)vInfos_.size()
+			|| vInfos_[channel].outputWidth <= 0 || vInfos_[channel].outputHeight <= 0) {
+			return false;
+		}
+		width = vInfos_[channel].outputWidth;
+		height = vInfos_[channel].outputHeight;
+		return true;
+	}
+
+	// Sizes of the main streams by URL, they outlive the channels so a
+	// reattached channel does not open its main stream to probe it again.
+	bool getMainSize(const std::string &url, int &width, int &height) const {
+		std::lock_guard<std::mutex> lock(mtx_);
+		std::map<std::string, std::pair<int, int> >::const_iterator it = mainSizes_.find(url);
+		if (mainSizes_.end() == it) {
+			return false;
+		}
+		width = it->second.first;
+		height = it->second.second;
+		return true;
+	}
+
+	void setMainSize(const std::string &url, const int width, const int height) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		mainSizes_[url] = std::make_pair(width, height);
+	}
+
+private:
+	mutable std::mutex mtx_;
+	std::vector<CHANNEL_INFO > vInfos_;
+	std::map<std::string, std::pair<int, int> > mainSizes_;
+};
+
+// The coordinate-only sinks scale by the output size, so they do not
+// need the decoded frames.
+inline bool getChannelOutputSize(const ChannelInfoTable *pInfos, const int channel, int &width, int &height) {
+	return nullptr != pInfos && pInfos->getOutputSize(channel, width, height);
+}
+
+// Opens the main stream to learn its resolution, no packet is read. The
+// open blocks for the RTSP handshake, so a URL is probed once and later
+// attaches take its size from the table; a failed probe is tried again
+// on the next attach.
+inline bool probeMainStream(CHANNEL_INFO &info, ChannelInfoTable &table, simplelogger::Logger *logger) {
+	if (info.mainURL.empty()) {
+		return false;
+	}
+	if (table.getMainSize(info.mainURL, info.outputWidth, info.outputHeight)) {
+		return true;
+	}
+	StreamTaker taker(logger);
+	taker.setVideoOnly(true);
+	if (SUCCESS != taker.prepare(info.mainURL.c_str()) || taker.getFrameWidth() <= 0) {
+		LOG_ERROR(logger, "Failed to probe main stream " << info.mainURL);
+		return false;
+	}
+	info.outputWidth = taker.getFrameWidth();
+	info.outputHeight = taker.getFrameHeight();
+	table.setMainSize(info.mainURL, info.outputWidth, info.outputHeight);
+	return true;
+}
+
+#endif // CHANNEL_INFO_H
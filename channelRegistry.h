@@ -0,0 +1,208 @@
+#ifndef CHANNEL_REGISTRY_H
+#define CHANNEL_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include "dataProvider.h"
+#include "channelScheduler.h"
+#include "common/logger.h"
+#include "metrics.h"
+
+// Builds the provider of a channel from its definition, nullptr on failure.
+typedef DataProvider *(*ProviderFactory)(void *handle, const int channel, const std::string &definition);
+// Undoes what the factory registered elsewhere, before the provider is deleted.
+typedef void (*ProviderRelease)(void *handle, const int channel, DataProvider *pProvider);
+// Pushes the packets of a channel until *pbRun drops or the input ends.
+typedef void (*PushLoop)(DataProvider *pProvider, ChannelScheduler *pScheduler, const int channel,
+						const std::atomic<bool > *pbRun);
+
+// Channel slots of a running pipeline. The pipeline is sized for all
+// slots up front, attaching a channel creates its provider, places it on
+// a free lane and starts its push thread; detaching stops the thread,
+// gives the lane back and deletes the provider. Nothing else restarts.
+//
+// The slots can follow a channel file, reloaded when its mtime changes:
+//
+//   # slot  analysisURL[|mainURL]
+//   0 rtsp://10.0.0.1/sub|rtsp://10.0.0.1/main
+//   3 /data/clip.h264
+//
+// A slot whose definition changed is detached and attached again, slots
+// not listed are detached. attach() and detach() are not reentrant, they
+// run on the thread which polls the registry.
+class ChannelRegistry {
+public:
+	explicit
+	ChannelRegistry(const int nSlots, ChannelScheduler *pScheduler, ProviderFactory factory, ProviderRelease release,
+					void *handle, PushLoop pushLoop, simplelogger::Logger *logger)
+	: pScheduler_(pScheduler), factory_(factory), release_(release), handle_(handle), pushLoop_(pushLoop),
+	  logger_(logger), vSlots_(nSlots) {}
+
+	~ChannelRegistry() {
+		for (int i = 0; i < (int)vSlots_.size(); ++i) {
+			detach(i);
+		}
+	}
+
+	bool attach(const int slot, const std::string &definition) {
+		if (slot < 0 || slot >= (int)vSlots_.size()) {
+			LOG_ERROR(logger_, "ChannelRegistry: no slot " << slot);
+			return false;
+		}
+		detach(slot);
+		uint64_t t0 = metricsNowUs();
+		DataProvider *pProvider = factory_(handle_, slot, definition);
+		if (nullptr == pProvider) {
+			LOG_ERROR(logger_, "ChannelRegistry: failed to attach channel " << slot << " " << definition);
+			return false;
+		}
+		double weight = (double)pProvider->getFrameWidth() * pProvider->getFrameHeight();
+		if (!pScheduler_->addChannel(slot, weight)) {
+			release_(handle_, slot, pProvider);
+			delete pProvider;
+			return false;
+		}
+		SLOT &s = vSlots_[slot];
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			s.pProvider = pProvider;
+			s.definition = definition;
+		}
+		s.bRun = true;
+		s.bDone = false;
+		s.thread = std::thread([this, slot]() {
+			SLOT &s = vSlots_[slot];
+			pushLoop_(s.pProvider, pScheduler_, slot, &s.bRun);
+			s.bDone = true;
+		});
+		LOG_INFO(logger_, "ChannelRegistry: channel " << slot << " attached in "
+							<< (metricsNowUs() - t0) / 1000 << " ms, " << definition);
+		return true;
+	}
+
+	void detach(const int slot) {
+		if (slot < 0 || slot >= (int)vSlots_.size() || nullptr == vSlots_[slot].pProvider) {
+			return;
+		}
+		SLOT &s = vSlots_[slot];
+		uint64_t t0 = metricsNowUs();
+		s.bRun = false;
+		s.pProvider->stopPacing();
+		if (s.thread.joinable()) {
+			s.thread.join();
+		}
+		pScheduler_->removeChannel(slot);
+		DataProvider *pProvider = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			pProvider = s.pProvider;
+			s.pProvider = nullptr;
+			s.definition.clear();
+		}
+		release_(handle_, slot, pProvider);
+		delete pProvider;
+		LOG_INFO(logger_, "ChannelRegistry: channel " << slot << " detached in "
+							<< (metricsNowUs() - t0) / 1000 << " ms");
+	}
+
+	void setChannelFile(const char *szPath) {
+		channelFile_ = szPath;
+	}
+
+	// Applies the channel file, false when it cannot be read. Lines which
+	// fail to parse are skipped.
+	bool loadChannelFile() {
+		struct stat st;
+		std::ifstream file(channelFile_);
+		if (0 != stat(channelFile_.c_str(), &st) || !file.is_open()) {
+			LOG_ERROR(logger_, "ChannelRegistry: failed to read " << channelFile_);
+			return false;
+		}
+		mtime_ = st.st_mtime;
+		std::map<int, std::string > wanted;
+		std::string line;
+		int lineNo = 0;
+		while (std::getline(file, line)) {
+			lineNo++;
+			size_t first = line.find_first_not_of(" \t\r");
+			if (std::string::npos == first || '#' == line[first]) {
+				continue;
+			}
+			std::istringstream iss(line);
+			int slot = -1;
+			std::string definition;
+			if (!(iss >> slot >> definition) || slot < 0 || slot >= (int)vSlots_.size()) {
+				LOG_WARN(logger_, "ChannelRegistry: " << channelFile_ << ":" << lineNo << " ignored");
+				continue;
+			}
+			wanted[slot] = definition;
+		}
+		for (int i = 0; i < (int)vSlots_.size(); ++i) {
+			std::map<int, std::string >::const_iterator it = wanted.find(i);
+			if (wanted.end() == it) {
+				detach(i);
+			} else if (nullptr == vSlots_[i].pProvider || it->second != vSlots_[i].definition) {
+				attach(i, it->second);
+			}
+		}
+		return true;
+	}
+
+	// Called about once a second, reloads a changed channel file. False
+	// once no channel is left to run and the file did not change.
+	bool poll() {
+		struct stat st;
+		bool bReloaded = false;
+		if (!channelFile_.empty() && 0 == stat(channelFile_.c_str(), &st) && st.st_mtime != mtime_) {
+			LOG_INFO(logger_, "ChannelRegistry: reloading " << channelFile_);
+			bReloaded = loadChannelFile();
+		}
+		bool bRunning = false;
+		for (int i = 0; i < (int)vSlots_.size(); ++i) {
+			SLOT &s = vSlots_[i];
+			if (nullptr != s.pProvider && !s.bDone) {
+				bRunning = true;
+			}
+		}
+		return bRunning || bReloaded;
+	}
+
+	// Provider of the slot, nullptr while detached. Valid until the slot
+	// is detached, i.e. on the polling thread.
+	DataProvider *getProvider(const int slot) const {
+		std::lock_guard<std::mutex> lock(mtx_);
+		return vSlots_[slot].pProvider;
+	}
+
+	int getNbSlots() const { return (int)vSlots_.size(); }
+
+private:
+	typedef struct {
+		DataProvider *pProvider = nullptr;
+		std::string definition;
+		std::thread thread;
+		std::atomic<bool > bRun{ false };
+		std::atomic<bool > bDone{ false };
+	} SLOT;
+
+	ChannelScheduler *pScheduler_{ nullptr };
+	ProviderFactory factory_{ nullptr };
+	ProviderRelease release_{ nullptr };
+	void *handle_{ nullptr };
+	PushLoop pushLoop_{ nullptr };
+	simplelogger::Logger *logger_{ nullptr };
+
+	std::vector<SLOT > vSlots_;
+	std::string channelFile_;
+	time_t mtime_{ 0 };
+	mutable std::mutex mtx_;
+};
+
+#endif // CHANNEL_REGISTRY_H
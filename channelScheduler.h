@@ -0,0 +1,350 @@
+#ifndef CHANNEL_SCHEDULER_H
+#define CHANNEL_SCHEDULER_H
+
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "common/logger.h"
+
+// Minimal view of a device worker as seen by the channel scheduler.
+// The real pipeline wraps IDeviceWorker, tests can plug in a mock.
+class ILaneWorker {
+public:
+	virtual ~ILaneWorker() {}
+	virtual int getDeviceID() const = 0;
+	virtual int getNbLanes() const = 0;
+	virtual void pushPacket(uint8_t *pBuf, int nBuf, int laneID) = 0;
+	virtual void stopPushPacket(int laneID) = 0;
+};
+
+typedef struct {
+	float lagRatio = 0.9f;			// device lags when capacity < lagRatio * input rate
+	double rebalanceInterval = 5.0;	// seconds between two migrations
+	double fpsWindow = 2.0;			// seconds of input used to estimate a channel rate
+} SCHEDULER_PARAMS;
+
+// Places channels on the lanes of several device workers and moves
+// channels away from a device whose analysis throughput falls behind
+// the rate of the packets pushed into it.
+class ChannelScheduler {
+public:
+	explicit
+	ChannelScheduler(const std::vector<ILaneWorker *> &vpWorkers,
+					const int nChannels,
+					simplelogger::Logger *logger,
+					const SCHEDULER_PARAMS &params = SCHEDULER_PARAMS())
+	: vpWorkers_(vpWorkers), nChannels_(nChannels), params_(params), logger_(logger),
+	  vPlacement_(nChannels), vChannels_(nChannels), vDevices_(vpWorkers.size()) {
+		for (size_t iW = 0; iW < vpWorkers_.size(); ++iW) {
+			vDevices_[iW].vLaneOwner.resize(vpWorkers_[iW]->getNbLanes(), -1);
+			vDevices_[iW].vLaneStopped.resize(vpWorkers_[iW]->getNbLanes(), false);
+		}
+		for (int i = 0; i < nChannels_; ++i) {
+			vPlacement_[i].store(-1);
+		}
+		lastRebalance_ = now();
+	}
+
+	// Assign the channel to the least loaded device with a free lane.
+	// weight is the relative decode cost, e.g. the pixel count of a frame.
+	bool addChannel(const int channel, const double weight = 1.0) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		assert(channel >= 0 && channel < nChannels_);
+		vChannels_[channel].weight = weight > 0. ? weight : 1.0;
+		int worker = pickDevice(-1);
+		if (worker < 0) {
+			LOG_ERROR(logger_, "ChannelScheduler: no free lane for channel " << channel);
+			return false;
+		}
+		place(channel, worker);
+		return true;
+	}
+
+	// The channel leaves its lane, which is taken by the next channel
+	// added to the device. The lane is not stopped, the decoder behind it
+	// stays open for the next channel.
+	void removeChannel(const int channel) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		assert(channel >= 0 && channel < nChannels_);
+		int worker = -1, lane = -1;
+		getPlacement(channel, &worker, &lane);
+		if (worker < 0) {
+			return;
+		}
+		vPlacement_[channel].store(-1);
+		vChannels_[channel].inputFps = 0.;
+		LOG_DEBUG(logger_, "ChannelScheduler: channel " << channel << " left device "
+							<< vpWorkers_[worker]->getDeviceID() << " lane " << lane);
+	}
+
+	// Called from the channel's push thread. Reports the lane the packet
+	// went into, false when the channel is not placed. The push is
+	// announced before the placement is read, so a lane the channel moved
+	// away from is not given to another channel while the packet is still
+	// on its way into it, see freeLane().
+	bool pushPacket(const int channel, uint8_t *pBuf, int nBuf, int *pWorker = nullptr, int *pLane = nullptr) {
+		PushGuard guard(vChannels_[channel].nInPush);
+		int worker = -1, lane = -1;
+		getPlacement(channel, &worker, &lane);
+		if (nullptr != pWorker) {
+			*pWorker = worker;
+		}
+		if (nullptr != pLane) {
+			*pLane = lane;
+		}
+		if (worker < 0) {
+			return false;
+		}
+		vChannels_[channel].nPushed.fetch_add(1, std::memory_order_relaxed);
+		vpWorkers_[worker]->pushPacket(pBuf, nBuf, lane);
+		return true;
+	}
+
+	void stopPushPacket(const int channel) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		int worker = -1, lane = -1;
+		getPlacement(channel, &worker, &lane);
+		if (worker < 0) {
+			return;
+		}
+		vDevices_[worker].vLaneStopped[lane] = true;
+		vpWorkers_[worker]->stopPushPacket(lane);
+	}
+
+	// Lanes which never got a channel still have to see end of stream
+	// before the workers can be stopped.
+	void stopIdleLanes() {
+		std::lock_guard<std::mutex> lock(mtx_);
+		for (size_t iW = 0; iW < vDevices_.size(); ++iW) {
+			DEVICE_STATE &dev = vDevices_[iW];
+			for (size_t iL = 0; iL < dev.vLaneStopped.size(); ++iL) {
+				if (!dev.vLaneStopped[iL]) {
+					dev.vLaneStopped[iL] = true;
+					vpWorkers_[iW]->stopPushPacket((int)iL);
+				}
+			}
+		}
+	}
+
+	// Fed by the analysis profiler of each worker.
+	void reportAnalysis(const int worker, const int nFrames, const double ms) {
+		if (ms <= 0.) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mtx_);
+		DEVICE_STATE &dev = vDevices_[worker];
+		double fps = nFrames * 1000.0 / ms;
+		dev.capacityFps = dev.capacityFps > 0. ? 0.9 * dev.capacityFps + 0.1 * fps : fps;
+	}
+
+	// Lane to channel mapping used by the sinks of a worker.
+	int getChannel(const int worker, const int lane) const {
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (lane < 0 || lane >= (int)vDevices_[worker].vLaneOwner.size()) {
+			return -1;
+		}
+		return vDevices_[worker].vLaneOwner[lane];
+	}
+
+	void getPlacement(const int channel, int *pWorker, int *pLane) const {
+		int packed = vPlacement_[channel].load();
+		if (packed < 0) {
+			*pWorker = -1;
+			*pLane = -1;
+			return;
+		}
+		*pWorker = packed >> 16;
+		*pLane = packed & 0xffff;
+	}
+
+	// Move at most one channel off a lagging device. Returns the migrated
+	// channel, or -1 when nothing moved.
+	int rebalance() {
+		std::lock_guard<std::mutex> lock(mtx_);
+		double t = now();
+		updateInputRates(t);
+		if (t - lastRebalance_ < params_.rebalanceInterval) {
+			return -1;
+		}
+
+		// find the device falling furthest behind
+		int lagging = -1;
+		double worst = params_.lagRatio;
+		for (size_t iW = 0; iW < vDevices_.size(); ++iW) {
+			double ratio = capacityRatio((int)iW);
+			if (ratio < worst) {
+				worst = ratio;
+				lagging = (int)iW;
+			}
+		}
+		if (lagging < 0) {
+			return -1;
+		}
+
+		// move its cheapest channel to keep the disruption small
+		int victim = -1;
+		for (int c = 0; c < nChannels_; ++c) {
+			int worker = -1, lane = -1;
+			getPlacement(c, &worker, &lane);
+			if (worker != lagging || vDevices_[worker].vLaneStopped[lane]) {
+				continue;
+			}
+			if (victim < 0 || vChannels_[c].inputFps < vChannels_[victim].inputFps) {
+				victim = c;
+			}
+		}
+		if (victim < 0) {
+			return -1;
+		}
+		int target = pickDevice(lagging);
+		if (target < 0 || capacityRatio(target) < params_.lagRatio) {
+			return -1;
+		}
+
+		LOG_INFO(logger_, "ChannelScheduler: device " << vpWorkers_[lagging]->getDeviceID()
+							<< " falls behind (" << worst << "), moving channel " << victim
+							<< " to device " << vpWorkers_[target]->getDeviceID());
+		place(victim, target);
+		lastRebalance_ = t;
+		return victim;
+	}
+
+	double getDeviceLoad(const int worker) const {
+		std::lock_guard<std::mutex> lock(mtx_);
+		return deviceWeight(worker);
+	}
+
+private:
+	typedef struct {
+		std::vector<int > vLaneOwner;	// channel bound to the lane, -1 if never used
+		std::vector<bool > vLaneStopped;
+		double capacityFps{ 0. };
+	} DEVICE_STATE;
+
+	typedef struct CHANNEL_STATE {
+		double weight{ 1. };
+		double inputFps{ 0. };
+		long lastPushed{ 0 };
+		std::atomic<long > nPushed{ 0 };
+		std::atomic<int > nInPush{ 0 };	// pushes between reading the placement and returning
+	} CHANNEL_STATE;
+
+	class PushGuard {
+	public:
+		explicit
+		PushGuard(std::atomic<int > &n) : n_(n) { n_.fetch_add(1); }
+		~PushGuard() { n_.fetch_sub(1); }
+	private:
+		std::atomic<int > &n_;
+	};
+
+	static double now() {
+		return std::chrono::duration<double>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void updateInputRates(const double t) {
+		double dt = t - lastRateUpdate_;
+		if (dt < params_.fpsWindow) {
+			return;
+		}
+		for (int c = 0; c < nChannels_; ++c) {
+			long n = vChannels_[c].nPushed.load(std::memory_order_relaxed);
+			vChannels_[c].inputFps = (n - vChannels_[c].lastPushed) / dt;
+			vChannels_[c].lastPushed = n;
+		}
+		lastRateUpdate_ = t;
+	}
+
+	// analysis capacity over input rate, > 1 means the device keeps up
+	double capacityRatio(const int worker) const {
+		double input = 0.;
+		for (int c = 0; c < nChannels_; ++c) {
+			int w = -1, lane = -1;
+			getPlacement(c, &w, &lane);
+			if (w == worker) {
+				input += vChannels_[c].inputFps;
+			}
+		}
+		if (input <= 0. || vDevices_[worker].capacityFps <= 0.) {
+			return 1e9;
+		}
+		return vDevices_[worker].capacityFps / input;
+	}
+
+	double deviceWeight(const int worker) const {
+		double load = 0.;
+		for (int c = 0; c < nChannels_; ++c) {
+			int w = -1, lane = -1;
+			getPlacement(c, &w, &lane);
+			if (w == worker) {
+				load += vChannels_[c].weight;
+			}
+		}
+		return load;
+	}
+
+	int freeLane(const int worker) const {
+		const DEVICE_STATE &dev = vDevices_[worker];
+		int best = -1;
+		for (size_t iL = 0; iL < dev.vLaneOwner.size(); ++iL) {
+			if (dev.vLaneStopped[iL]) {
+				continue;
+			}
+			int owner = dev.vLaneOwner[iL];
+			if (owner < 0) {
+				return (int)iL;
+			}
+			int w = -1, lane = -1;
+			getPlacement(owner, &w, &lane);
+			// the previous owner moved away, the lane can be reused once
+			// no push of the owner can still go by its old placement
+			if ((w != worker || lane != (int)iL) && best < 0 && 0 == vChannels_[owner].nInPush.load()) {
+				best = (int)iL;
+			}
+		}
+		return best;
+	}
+
+	int pickDevice(const int exclude) const {
+		int best = -1;
+		double bestLoad = 0.;
+		for (size_t iW = 0; iW < vDevices_.size(); ++iW) {
+			if ((int)iW == exclude || freeLane((int)iW) < 0) {
+				continue;
+			}
+			double load = deviceWeight((int)iW);
+			if (best < 0 || load < bestLoad) {
+				best = (int)iW;
+				bestLoad = load;
+			}
+		}
+		return best;
+	}
+
+	void place(const int channel, const int worker) {
+		int lane = freeLane(worker);
+		assert(lane >= 0);
+		vDevices_[worker].vLaneOwner[lane] = channel;
+		vPlacement_[channel].store((worker << 16) | lane);
+		LOG_DEBUG(logger_, "ChannelScheduler: channel " << channel << " -> device "
+							<< vpWorkers_[worker]->getDeviceID() << " lane " << lane);
+	}
+
+	std::vector<ILaneWorker *> vpWorkers_;
+	int nChannels_{ 0 };
+	SCHEDULER_PARAMS params_;
+	simplelogger::Logger *logger_{ nullptr };
+
+	std::vector<std::atomic<int > > vPlacement_;
+	std::vector<CHANNEL_STATE > vChannels_;
+	std::vector<DEVICE_STATE > vDevices_;
+	double lastRebalance_{ 0. };
+	double lastRateUpdate_{ 0. };
+	mutable std::mutex mtx_;
+};
+
+#endif // CHANNEL_SCHEDULER_H
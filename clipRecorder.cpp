@@ -0,0 +1,467 @@
+#include "clipRecorder.h"
+#include "threadPlacement.h"
+#include <ctime>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+bool ClipRecorder::start() {
+	bRunning_ = true;
+	thWriter_ = std::thread(&ClipRecorder::writeLoop, this);
+	LOG_INFO(logger_, "ClipRecorder: " << params_.preSec << " s before, " << params_.postSec << " s after a detection, "
+						<< (params_.budgetBytes >> 20) << " MB per channel, clips in " << params_.dir);
+	return true;
+}
+
+void ClipRecorder::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		for (size_t i = 0; i < vChannels_.size(); ++i) {
+			clear((int)i);
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(jobMtx_);
+		bRunning_ = false;
+	}
+	jobCv_.notify_one();
+	if (thWriter_.joinable()) {
+		thWriter_.join();
+	}
+}
+
+void ClipRecorder::addChannel(const int channel, const VIDEO_CODEC codec) {
+	std::lock_guard<std::mutex> lock(mtx_);
+	clear(channel);
+	CHANNEL_CLIPS &ch = vChannels_[channel];
+	ch.codec = codec;
+	ch.bActive = true;
+}
+
+void ClipRecorder::removeChannel(const int channel) {
+	std::lock_guard<std::mutex> lock(mtx_);
+	clear(channel);
+}
+
+CLIP_RING_STATS ClipRecorder::getRingStats(const int channel) const {
+	CLIP_RING_STATS stats;
+	if (channel < 0 || channel >= (int)vChannels_.size()) {
+		return stats;
+	}
+	std::lock_guard<std::mutex> lock(mtx_);
+	const CHANNEL_CLIPS &ch = vChannels_[channel];
+	stats.nPackets = ch.ring.size();
+	stats.nBytes = ch.nBytes;
+	if (!ch.ring.empty()) {
+		stats.bKeyframeFirst = ch.ring.front().bKeyframe;
+		stats.firstRecvUs = ch.ring.front().recvUs;
+		stats.lastRecvUs = ch.ring.back().recvUs;
+	}
+	return stats;
+}
+
+// Closes the open clip, the ring goes with the channel.
+void ClipRecorder::clear(const int channel) {
+	CHANNEL_CLIPS &ch = vChannels_[channel];
+	if (ch.bOpen) {
+		close(channel, ch);
+	}
+	for (size_t i = 0; i < ch.ring.size(); ++i) {
+		av_packet_unref(&ch.ring[i].packet);
+	}
+	// the writer counts off what is still queued
+	size_t nQueuedBytes = ch.nQueuedBytes;
+	ch = CHANNEL_CLIPS();
+	ch.nQueuedBytes = nQueuedBytes;
+}
+
+void ClipRecorder::onPacket(const int channel, const AVPacket &packet, const int64_t ptsUs, const int64_t dtsUs,
+							const uint64_t recvUs, const int64_t wallclockUs) {
+	if (channel < 0 || channel >= (int)vChannels_.size()) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mtx_);
+	CHANNEL_CLIPS &ch = vChannels_[channel];
+	if (!ch.bActive) {
+		return;
+	}
+	PACKET_CLASS c = classifyPacket(packet.data, packet.size, ch.codec);
+	// parameter sets may come in packets of their own ahead of the
+	// slices, the SDP ones ahead of the first keyframe
+	if (hasParameterSets(packet.data, packet.size, ch.codec)) {
+		std::vector<uint8_t > vSets;
+		int width = 0, height = 0;
+		ch.bNewSps = extractParameterSets(packet.data, packet.size, ch.codec, vSets, width, height) || ch.bNewSps;
+		ch.vNewSets.insert(ch.vNewSets.end(), vSets.begin(), vSets.end());
+	}
+	if (c.bPicture && !ch.vNewSets.empty()) {
+		if (ch.bNewSps) {
+			ch.pParameterSets = std::make_shared<const std::vector<uint8_t > >(ch.vNewSets);
+		}
+		ch.vNewSets.clear();
+		ch.bNewSps = false;
+	}
+	// a clip cut from the ring has to start at a keyframe
+	if (ch.ring.empty() && !c.bKeyframe) {
+		return;
+	}
+	CLIP_PACKET p;
+	av_init_packet(&p.packet);
+	if (av_packet_ref(&p.packet, &packet) < 0) {
+		return;
+	}
+	p.ptsUs = ptsUs;
+	p.dtsUs = dtsUs;
+	p.recvUs = recvUs;
+	p.seq = ch.nextSeq++;
+	p.bKeyframe = c.bKeyframe;
+	p.bPicture = c.bPicture;
+	p.bNewPicture = c.bNewPicture;
+	if (c.bKeyframe) {
+		p.pParameterSets = ch.pParameterSets;
+	}
+	ch.ring.push_back(p);
+	ch.nBytes += packet.size;
+	if (ch.bOpen) {
+		pump(channel, ch);
+		// a detection still on its way could only merge up to here
+		uint64_t lateUs = (uint64_t)((params_.preSec + params_.latencySec) * 1e6);
+		if (ch.bOpen && recvUs > ch.endUs + lateUs) {
+			close(channel, ch);
+		}
+	}
+	trim(ch);
+}
+
+// Whole GOPs leave the front once the next GOP alone covers the pre-roll
+// of a detection still to come, or while the ring and the packets queued
+// for the writer are over budget. The last GOP always stays.
+void ClipRecorder::trim(CHANNEL_CLIPS &ch) {
+	uint64_t keepUs = (uint64_t)((params_.preSec + params_.latencySec) * 1e6);
+	uint64_t newestUs = ch.ring.back().recvUs;
+	while (true) {
+		size_t next = 1;
+		while (next < ch.ring.size() && !ch.ring[next].bKeyframe) {
+			next++;
+		}
+		if (next >= ch.ring.size()) {
+			return;
+		}
+		if (ch.ring[next].recvUs + keepUs > newestUs && ch.nBytes + ch.nQueuedBytes <= params_.budgetBytes) {
+			return;
+		}
+		// only the budget evicts packets an open clip still waits for
+		if (ch.bOpen && ch.ring[next - 1].seq >= ch.nextWriteSeq) {
+			LOG_WARN(logger_, "ClipRecorder: budget exceeded, " << ch.ring[next - 1].seq + 1 - ch.nextWriteSeq
+								<< " packets of an open clip dropped");
+		}
+		for (size_t i = 0; i < next; ++i) {
+			ch.nBytes -= ch.ring.front().packet.size;
+			av_packet_unref(&ch.ring.front().packet);
+			ch.ring.pop_front();
+		}
+	}
+}
+
+// Hands the packets due for the open clip to the writer. A writer which
+// holds the channel's budget already is not going to catch up, the clip
+// ends there.
+void ClipRecorder::pump(const int channel, CHANNEL_CLIPS &ch) {
+	if (!ch.bOpen || ch.ring.empty()) {
+		return;
+	}
+	uint64_t frontSeq = ch.ring.front().seq;
+	for (size_t i = ch.nextWriteSeq > frontSeq ? ch.nextWriteSeq - frontSeq : 0; i < ch.ring.size(); ++i) {
+		const CLIP_PACKET &p = ch.ring[i];
+		if (p.recvUs > ch.endUs) {
+			break;
+		}
+		if (ch.nQueuedBytes + p.packet.size > params_.budgetBytes) {
+			LOG_WARN(logger_, "ClipRecorder: channel " << channel << " is " << (ch.nQueuedBytes >> 20)
+								<< " MB behind the disk, clip closed");
+			close(channel, ch);
+			return;
+		}
+		CLIP_JOB job;
+		job.type = CLIP_JOB_PACKET;
+		job.channel = channel;
+		job.packet = p;
+		av_init_packet(&job.packet.packet);
+		if (av_packet_ref(&job.packet.packet, &p.packet) < 0) {
+			break;
+		}
+		post(job);
+		ch.nQueuedBytes += p.packet.size;
+		ch.nextWriteSeq = p.seq + 1;
+	}
+}
+
+void ClipRecorder::close(const int channel, CHANNEL_CLIPS &ch) {
+	CLIP_JOB job;
+	job.type = CLIP_JOB_CLOSE;
+	job.channel = channel;
+	post(job);
+	ch.bOpen = false;
+}
+
+void ClipRecorder::trigger(const int channel, const uint64_t eventUs, const int64_t wallclockUs) {
+	if (channel < 0 || channel >= (int)vChannels_.size()) {
+		return;
+	}
+	uint64_t endUs = eventUs + (uint64_t)(params_.postSec * 1e6);
+	std::lock_guard<std::mutex> lock(mtx_);
+	CHANNEL_CLIPS &ch = vChannels_[channel];
+	if (!ch.bActive || ch.ring.empty()) {
+		return;
+	}
+	if (ch.bOpen) {
+		if (endUs > ch.endUs) {
+			ch.endUs = endUs;
+			pump(channel, ch);
+		}
+		return;
+	}
+	// the last keyframe before the pre-roll, packets written already
+	// belong to the previous clip
+	uint64_t preUs = (uint64_t)(params_.preSec * 1e6);
+	uint64_t startUs = eventUs > preUs ? eventUs - preUs : 0;
+	size_t start = ch.ring.size();
+	for (size_t i = 0; i < ch.ring.size(); ++i) {
+		const CLIP_PACKET &p = ch.ring[i];
+		if (!p.bKeyframe || p.seq < ch.nextWriteSeq) {
+			continue;
+		}
+		if (start < ch.ring.size() && p.recvUs > startUs) {
+			break;
+		}
+		start = i;
+	}
+	ch.bOpen = true;
+	ch.endUs = endUs;
+	// without a keyframe since the last clip the writer waits for the next one
+	ch.nextWriteSeq = start < ch.ring.size() ? ch.ring[start].seq : ch.nextSeq;
+	CLIP_JOB job;
+	job.type = CLIP_JOB_OPEN;
+	job.channel = channel;
+	job.codec = ch.codec;
+	job.path = makePath(channel, wallclockUs);
+	LOG_INFO(logger_, "ClipRecorder: channel " << channel << " triggered, recording " << job.path);
+	post(job);
+	pump(channel, ch);
+}
+
+void ClipRecorder::post(CLIP_JOB &job) {
+	{
+		std::lock_guard<std::mutex> lock(jobMtx_);
+		jobs_.push_back(job);
+	}
+	jobCv_.notify_one();
+}
+
+// <dir>/ch<N>_<YYYYmmdd-HHMMSS.mmm>.<format>, named after the capture
+// time when the source has one
+std::string ClipRecorder::makePath(const int channel, const int64_t wallclockUs) const {
+	int64_t us = wallclockUs > 0 ? wallclockUs
+				: std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::system_clock::now().time_since_epoch()).count();
+	time_t seconds = (time_t)(us / 1000000);
+	struct tm local;
+	localtime_r(&seconds, &local);
+	char szTime[32];
+	strftime(szTime, sizeof(szTime), "%Y%m%d-%H%M%S", &local);
+	char szName[64];
+	snprintf(szName, sizeof(szName), "ch%d_%s.%03d.", channel, szTime, (int)(us / 1000 % 1000));
+	return params_.dir + "/" + szName + params_.format;
+}
+
+void ClipRecorder::writeLoop() {
+	placeThread(ROLE_IO, "clipWriter");
+	while (true) {
+		CLIP_JOB job;
+		{
+			std::unique_lock<std::mutex> lock(jobMtx_);
+			jobCv_.wait(lock, [this]() { return !jobs_.empty() || !bRunning_; });
+			if (jobs_.empty()) {
+				break;
+			}
+			job = jobs_.front();
+			jobs_.pop_front();
+		}
+		CLIP_MUXER &muxer = vMuxers_[job.channel];
+		if (CLIP_JOB_OPEN == job.type) {
+			closeMuxer(muxer);
+			muxer.path = job.path;
+			muxer.codec = job.codec;
+		} else if (CLIP_JOB_PACKET == job.type) {
+			writePacket(muxer, job.packet);
+			size_t nBytes = job.packet.packet.size;
+			av_packet_unref(&job.packet.packet);
+			std::lock_guard<std::mutex> lock(mtx_);
+			vChannels_[job.channel].nQueuedBytes -= nBytes;
+		} else {
+			closeMuxer(muxer);
+		}
+	}
+	for (size_t i = 0; i < vMuxers_.size(); ++i) {
+		closeMuxer(vMuxers_[i]);
+	}
+}
+
+// The container takes the parameter sets of the first keyframe as
+// extradata, in band or the last ones the channel had, the packets stay
+// Annex-B.
+bool ClipRecorder::openMuxer(CLIP_MUXER &muxer, const ACCESS_UNIT &first, const uint8_t *pData, const int nData) {
+	std::vector<uint8_t > vParameterSets;
+	int width = 0, height = 0;
+	if (!extractParameterSets(pData, nData, muxer.codec, vParameterSets, width, height)
+		&& (nullptr == first.pParameterSets
+			|| !extractParameterSets(first.pParameterSets->data(), (int)first.pParameterSets->size(), muxer.codec,
+									vParameterSets, width, height))) {
+		LOG_WARN(logger_, "ClipRecorder: no parameter sets for the keyframe, " << muxer.path << " skipped");
+		return false;
+	}
+
+	AVFormatContext *pCtx = nullptr;
+	if (avformat_alloc_output_context2(&pCtx, nullptr, nullptr, muxer.path.c_str()) < 0 || nullptr == pCtx) {
+		LOG_WARN(logger_, "ClipRecorder: no muxer for " << muxer.path);
+		return false;
+	}
+	AVStream *pStream = avformat_new_stream(pCtx, nullptr);
+	if (nullptr == pStream) {
+		avformat_free_context(pCtx);
+		return false;
+	}
+	pStream->time_base = { 1, 90000 };
+	AVCodecParameters *pPar = pStream->codecpar;
+	pPar->codec_type = AVMEDIA_TYPE_VIDEO;
+	pPar->codec_id = VIDEO_CODEC_HEVC == muxer.codec ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+	pPar->width = width;
+	pPar->height = height;
+	pPar->extradata = (uint8_t *)av_mallocz(vParameterSets.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+	if (nullptr == pPar->extradata) {
+		avformat_free_context(pCtx);
+		return false;
+	}
+	memcpy(pPar->extradata, vParameterSets.data(), vParameterSets.size());
+	pPar->extradata_size = (int)vParameterSets.size();
+
+	bool bFile = !(pCtx->oformat->flags & AVFMT_NOFILE);
+	if (bFile && avio_open(&pCtx->pb, muxer.path.c_str(), AVIO_FLAG_WRITE) < 0) {
+		LOG_WARN(logger_, "ClipRecorder: cannot write " << muxer.path);
+		avformat_free_context(pCtx);
+		return false;
+	}
+	if (avformat_write_header(pCtx, nullptr) < 0) {
+		LOG_WARN(logger_, "ClipRecorder: failed to start " << muxer.path);
+		if (bFile) {
+			avio_closep(&pCtx->pb);
+		}
+		avformat_free_context(pCtx);
+		return false;
+	}
+	muxer.pCtx = pCtx;
+	muxer.firstDtsUs = AV_NOPTS_VALUE != first.dtsUs ? first.dtsUs : (int64_t)first.recvUs;
+	muxer.lastDts = 0;
+	muxer.nPictures = 0;
+	return true;
+}
+
+// Collects the packets of a picture. Packets without slices after the
+// slices of a picture, or the first slice of the next one, start the
+// next access unit.
+void ClipRecorder::writePacket(CLIP_MUXER &muxer, CLIP_PACKET &packet) {
+	if (muxer.bFailed || muxer.path.empty()) {
+		return;
+	}
+	ACCESS_UNIT &au = muxer.au;
+	if (au.bPicture && (!packet.bPicture || packet.bNewPicture)) {
+		writeAccessUnit(muxer);
+	}
+	if (0 == au.nPackets) {
+		av_init_packet(&au.packet);
+		if (av_packet_ref(&au.packet, &packet.packet) < 0) {
+			return;
+		}
+	} else {
+		if (1 == au.nPackets) {
+			au.vData.assign(au.packet.data, au.packet.data + au.packet.size);
+			av_packet_unref(&au.packet);
+		}
+		au.vData.insert(au.vData.end(), packet.packet.data, packet.packet.data + packet.packet.size);
+	}
+	au.nPackets++;
+	if (packet.bPicture && !au.bPicture) {
+		au.ptsUs = packet.ptsUs;
+		au.dtsUs = packet.dtsUs;
+		au.recvUs = packet.recvUs;
+		au.bKeyframe = packet.bKeyframe;
+		au.pParameterSets = packet.pParameterSets;
+		au.bPicture = true;
+	}
+}
+
+// One sample per picture; the clip opens at its first keyframe.
+void ClipRecorder::writeAccessUnit(CLIP_MUXER &muxer) {
+	ACCESS_UNIT au = muxer.au;
+	muxer.au = ACCESS_UNIT();
+	// packets without a picture after the last one are dropped
+	if (!au.bPicture || muxer.bFailed || muxer.path.empty()) {
+		if (1 == au.nPackets) {
+			av_packet_unref(&au.packet);
+		}
+		return;
+	}
+	AVPacket pkt;
+	av_init_packet(&pkt);
+	if (1 == au.nPackets) {
+		av_packet_move_ref(&pkt, &au.packet);
+	} else if (0 == av_new_packet(&pkt, (int)au.vData.size())) {
+		memcpy(pkt.data, au.vData.data(), au.vData.size());
+	} else {
+		return;
+	}
+	if (nullptr == muxer.pCtx && (!au.bKeyframe || !openMuxer(muxer, au, pkt.data, pkt.size))) {
+		muxer.bFailed = muxer.bFailed || au.bKeyframe;
+		av_packet_unref(&pkt);
+		return;
+	}
+	// sources without timestamps are timed by their arrival
+	int64_t dtsUs = AV_NOPTS_VALUE != au.dtsUs ? au.dtsUs : (int64_t)au.recvUs;
+	int64_t ptsUs = AV_NOPTS_VALUE != au.ptsUs ? au.ptsUs : dtsUs;
+	AVStream *pStream = muxer.pCtx->streams[0];
+	AVRational us = { 1, 1000000 };
+	pkt.stream_index = 0;
+	pkt.dts = av_rescale_q(dtsUs - muxer.firstDtsUs, us, pStream->time_base);
+	pkt.pts = av_rescale_q(ptsUs - muxer.firstDtsUs, us, pStream->time_base);
+	// a reconnect restarts the timestamps, the clip keeps going forward
+	if (muxer.nPictures > 0 && pkt.dts <= muxer.lastDts) {
+		pkt.dts = muxer.lastDts + 1;
+	}
+	pkt.pts = std::max(pkt.pts, pkt.dts);
+	pkt.flags = au.bKeyframe ? AV_PKT_FLAG_KEY : 0;
+	pkt.pos = -1;
+	muxer.lastDts = pkt.dts;
+	// the muxer takes the reference
+	if (av_interleaved_write_frame(muxer.pCtx, &pkt) < 0) {
+		av_packet_unref(&pkt);
+		LOG_WARN(logger_, "ClipRecorder: write failed, " << muxer.path << " closed");
+		closeMuxer(muxer);
+		muxer.bFailed = true;
+		return;
+	}
+	muxer.nPictures++;
+}
+
+void ClipRecorder::closeMuxer(CLIP_MUXER &muxer) {
+	writeAccessUnit(muxer);
+	if (nullptr != muxer.pCtx) {
+		av_write_trailer(muxer.pCtx);
+		if (!(muxer.pCtx->oformat->flags & AVFMT_NOFILE)) {
+			avio_closep(&muxer.pCtx->pb);
+		}
+		avformat_free_context(muxer.pCtx);
+		nClips_.fetch_add(1, std::memory_order_relaxed);
+		LOG_INFO(logger_, "ClipRecorder: " << muxer.path << " written, " << muxer.nPictures << " pictures");
+	}
+	muxer = CLIP_MUXER();
+}
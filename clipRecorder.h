@@ -0,0 +1,181 @@
+#ifndef CLIP_RECORDER_H
+#define CLIP_RECORDER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+extern "C" {
+#include "libavformat/avformat.h"
+};
+#include "streamSource.h"
+#include "nalParser.h"
+#include "common/logger.h"
+
+typedef struct {
+	std::string dir = ".";
+	std::string format = "mp4";			// container by extension, mp4 or mkv
+	float preSec = 5.f;					// kept before the picture which triggered
+	float postSec = 5.f;				// recorded after the last trigger
+	float latencySec = 2.f;				// detections arrive this much after their picture
+	size_t budgetBytes = 32 << 20;		// packets kept per channel, in the ring and for the writer
+	uint32_t categoryMask = 0xffffffff;	// categories which trigger, bit per label line
+} CLIP_PARAMS;
+
+typedef struct {
+	size_t nPackets = 0;
+	size_t nBytes = 0;
+	bool bKeyframeFirst = false;
+	uint64_t firstRecvUs = 0;			// see metricsNowUs()
+	uint64_t lastRecvUs = 0;
+} CLIP_RING_STATS;
+
+// Keeps the last GOPs of every channel as received, compressed, and
+// writes the pre-roll and post-roll of a detection to a clip by remuxing
+// the packets, nothing is decoded. A trigger while the clip of the
+// channel is still open extends it, so overlapping events end up in one
+// file. The ring of a channel starts at a keyframe and is trimmed by
+// whole GOPs once it covers the pre-roll or exceeds the byte budget.
+// The packets queued for the writer count against the same budget; a
+// clip whose writer falls that far behind is closed.
+// Packets may be access units or single NAL units, as the native RTSP
+// client sends them; the writer muxes one sample per access unit.
+class ClipRecorder : public IPacketObserver {
+public:
+	explicit
+	ClipRecorder(const int nChannels, const CLIP_PARAMS &params, simplelogger::Logger *logger)
+	: params_(params), logger_(logger), vChannels_(nChannels), vMuxers_(nChannels) {}
+
+	~ClipRecorder() {
+		stop();
+	}
+
+	bool start();
+	// closes the open clips and waits until they are written
+	void stop();
+
+	void addChannel(const int channel, const VIDEO_CODEC codec);
+	// After the provider stopped calling onPacket(), closes the open clip.
+	void removeChannel(const int channel);
+
+	// override, on the taker thread of the channel
+	void onPacket(const int channel, const AVPacket &packet, const int64_t ptsUs, const int64_t dtsUs,
+				const uint64_t recvUs, const int64_t wallclockUs) override;
+
+	// A detection in the picture received at eventUs, see metricsNowUs().
+	void trigger(const int channel, const uint64_t eventUs, const int64_t wallclockUs);
+
+	bool triggers(const int category) const {
+		return category >= 0 && category < 32 && (params_.categoryMask & (1u << category));
+	}
+
+	uint64_t getNbClips() const { return nClips_.load(std::memory_order_relaxed); }
+
+	// what the ring of a channel keeps for the next pre-roll
+	CLIP_RING_STATS getRingStats(const int channel) const;
+
+private:
+	typedef struct {
+		AVPacket packet;
+		int64_t ptsUs;
+		int64_t dtsUs;
+		uint64_t recvUs;
+		uint64_t seq;
+		bool bKeyframe;
+		bool bPicture;
+		bool bNewPicture;
+		// in force at a keyframe, the clip's extradata when the keyframe
+		// does not carry its own
+		std::shared_ptr<const std::vector<uint8_t > > pParameterSets;
+	} CLIP_PACKET;
+
+	typedef struct {
+		bool bActive = false;
+		VIDEO_CODEC codec = VIDEO_CODEC_H264;
+		std::deque<CLIP_PACKET > ring;
+		size_t nBytes = 0;
+		uint64_t nextSeq = 0;
+		bool bOpen = false;				// a clip is being written
+		uint64_t endUs = 0;				// packets received up to here go into the clip
+		uint64_t nextWriteSeq = 0;		// first packet not handed to the writer yet
+		size_t nQueuedBytes = 0;		// handed to the writer, not written yet
+		// the last complete parameter sets, in band or of the SDP, and
+		// those collected since the last slice
+		std::shared_ptr<const std::vector<uint8_t > > pParameterSets;
+		std::vector<uint8_t > vNewSets;
+		bool bNewSps = false;
+	} CHANNEL_CLIPS;
+
+	enum CLIP_JOB_TYPE {
+		CLIP_JOB_OPEN,
+		CLIP_JOB_PACKET,
+		CLIP_JOB_CLOSE
+	};
+
+	typedef struct {
+		CLIP_JOB_TYPE type;
+		int channel;
+		VIDEO_CODEC codec;
+		std::string path;
+		CLIP_PACKET packet;				// a reference of its own
+	} CLIP_JOB;
+
+	// The packets of one picture, a reference to the packet while there
+	// is only one.
+	typedef struct {
+		AVPacket packet;
+		std::vector<uint8_t > vData;
+		int nPackets = 0;
+		int64_t ptsUs = 0;				// of its first slice
+		int64_t dtsUs = 0;
+		uint64_t recvUs = 0;
+		bool bKeyframe = false;
+		bool bPicture = false;
+		std::shared_ptr<const std::vector<uint8_t > > pParameterSets;
+	} ACCESS_UNIT;
+
+	// state of the writer thread
+	typedef struct {
+		AVFormatContext *pCtx = nullptr;
+		std::string path;
+		VIDEO_CODEC codec = VIDEO_CODEC_H264;
+		bool bFailed = false;
+		int64_t firstDtsUs = 0;
+		int64_t lastDts = 0;
+		int nPictures = 0;
+		ACCESS_UNIT au;					// being collected
+	} CLIP_MUXER;
+
+	void clear(const int channel);
+	void trim(CHANNEL_CLIPS &ch);
+	void pump(const int channel, CHANNEL_CLIPS &ch);
+	void close(const int channel, CHANNEL_CLIPS &ch);
+	void post(CLIP_JOB &job);
+	std::string makePath(const int channel, const int64_t wallclockUs) const;
+
+	void writeLoop();
+	bool openMuxer(CLIP_MUXER &muxer, const ACCESS_UNIT &first, const uint8_t *pData, const int nData);
+	void writePacket(CLIP_MUXER &muxer, CLIP_PACKET &packet);
+	void writeAccessUnit(CLIP_MUXER &muxer);
+	void closeMuxer(CLIP_MUXER &muxer);
+
+	CLIP_PARAMS params_;
+	simplelogger::Logger *logger_{ nullptr };
+	std::vector<CHANNEL_CLIPS > vChannels_;
+	mutable std::mutex mtx_;
+
+	std::deque<CLIP_JOB > jobs_;
+	std::mutex jobMtx_;
+	std::condition_variable jobCv_;
+	std::thread thWriter_;
+	bool bRunning_{ false };
+	std::vector<CLIP_MUXER > vMuxers_;
+	std::atomic<uint64_t > nClips_{ 0 };
+};
+
+#endif // CLIP_RECORDER_H
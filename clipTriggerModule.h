@@ -0,0 +1,111 @@
+#ifndef CLIP_TRIGGER_MODULE_H
+#define CLIP_TRIGGER_MODULE_H
+
+#include "common.h"
+#include "clipRecorder.h"
+
+// Triggers the clip recorder for every frame with a detection of a
+// recorded category. The trigger is timed by the arrival of the picture,
+// not by the end of the analysis.
+class ClipTriggerModule : public IModule {
+public:
+	explicit
+	ClipTriggerModule(PRE_MODULE_LIST &preModules,
+						ClipRecorder *pRecorder,
+						simplelogger::Logger *logger,
+						ChannelScheduler *pScheduler = nullptr,
+						const int workerID = 0)
+	: preModules_(preModules), pRecorder_(pRecorder), logger_(logger), pScheduler_(pScheduler), workerID_(workerID) {}
+
+	~ClipTriggerModule() {}
+
+	// override
+	void initialize() override {}
+
+	void execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) override;
+
+	void destroy() override {}
+
+	int getNbInputs() const override {
+		return preModules_.size();
+	}
+
+	PRE_MODULE getPreModule(const int tensorIndex) const override {
+		return preModules_[tensorIndex];
+	}
+
+	int getNbOutputs() const override {
+		return vpOutputTensors_.size();
+	}
+
+	IStreamTensor* getOutputTensor(const int tensorIndex) const override {
+		return vpOutputTensors_[tensorIndex];
+	}
+
+	void setProfiler(IModuleProfiler *pProfiler) override {
+		pProfiler_ = pProfiler;
+	}
+
+	IModuleProfiler* getProfiler() const override {
+		return pProfiler_;
+	}
+
+	void setCallback(void *pUserData, MODULE_CALLBACK callback) override {
+		pUserData_ = pUserData;
+		callback_ = callback;
+	}
+
+	std::pair<void *, MODULE_CALLBACK> getCallback() const override {
+		return std::pair<void*, MODULE_CALLBACK>(pUserData_, callback_);
+	}
+
+private:
+	ClipRecorder *pRecorder_{ nullptr };
+	simplelogger::Logger *logger_{ nullptr };
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
+
+	void *pUserData_{ nullptr };
+	MODULE_CALLBACK callback_{ nullptr };
+	IModuleProfiler* pProfiler_{ nullptr };
+
+	PRE_MODULE_LIST preModules_;
+	std::vector<IStreamTensor*> vpOutputTensors_;
+};
+
+void ClipTriggerModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
+	TRACE_RANGE("ClipTriggerModule::execute");
+	assert(1 == vpInputTensors.size());
+	assert(OBJ_COORD == vpInputTensors[0]->getTensorType());
+	int nFrames = vpInputTensors[0]->getShape()[0];
+	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(vpInputTensors[0]->getCpuData());
+	if (0 == nFrames || nullptr == pBBox_batch) {
+		return;
+	}
+	for (int iF = 0; iF < nFrames; ++iF) {
+		BBOXS_PER_FRAME &bboxs = pBBox_batch[iF];
+		bool bTrigger = false;
+		for (int i = 0; i < bboxs.nBBox && !bTrigger; ++i) {
+			bTrigger = !bboxs.bbox[i].bSkip && pRecorder_->triggers(bboxs.bbox[i].category);
+		}
+		if (!bTrigger) {
+			continue;
+		}
+		int lane = bboxs.videoIndex;
+		int channel = lane;
+		if (nullptr != pScheduler_) {
+			channel = pScheduler_->getChannel(workerID_, lane);
+			if (channel < 0) {
+				continue;
+			}
+		}
+		PACKET_STAMP stamp;
+		if (nullptr == g_pTracer || !g_pTracer->lookup(workerID_, lane, bboxs.frameIndex, stamp)) {
+			stamp.recvUs = metricsNowUs();
+			stamp.wallclockUs = 0;
+		}
+		pRecorder_->trigger(channel, stamp.recvUs, stamp.wallclockUs);
+	}
+}
+
+#endif // CLIP_TRIGGER_MODULE_H
@@ -33,12 +33,33 @@
 #include "logger.h"
 #include "ds_nvUtils.h"
 
+#ifndef CPU_ONLY
 #include "drawBbox.h"
+#endif
+#include "metrics.h"
+#include "threadPlacement.h"
+#include "common/trace.h"
+#include "frameTracer.h"
+#include "motionGate.h"
 #include "dataProvider.h"
-#include "presenterGL.h"
+#include "channelInfo.h"
+#include "channelScheduler.h"
+#include "channelRegistry.h"
+#include "workerBackend.h"
 #include "parserModule_resnet10.h"
+#ifndef CPU_ONLY
+#include "presenterGL.h"
 #include "playbackModule.h"
+#endif
 #include "kittiModule.h"
+#include "activityModule.h"
+#include "detectionRingModule.h"
+#include "resultStreamModule.h"
+#include "clipTriggerModule.h"
+#include "snapshotModule.h"
+#include "detectionArchiveModule.h"
+#include "offlineStitchModule.h"
+#include "segmentRecorder.h"
 
 #endif
 
@@ -0,0 +1,105 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Log-linear (HDR style) histogram of latencies in microseconds.
+// Every power of two is split into 16 linear sub-buckets, which keeps the
+// relative error under 6.25%. record() is wait-free and may be called
+// from any thread, readers take a snapshot of the counters.
+class LatencyHistogram {
+public:
+	static const int SUB_BITS = 4;
+	static const int SUB_COUNT = 1 << SUB_BITS;
+	static const int MAX_EXP = 32;	// ~71 minutes
+	static const int NUM_BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+
+	LatencyHistogram() {
+		reset();
+	}
+
+	void record(uint64_t us) {
+		counts_[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+		total_.fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(us, std::memory_order_relaxed);
+		uint64_t prev = max_.load(std::memory_order_relaxed);
+		while (us > prev && !max_.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {
+		}
+	}
+
+	void reset() {
+		for (int i = 0; i < NUM_BUCKETS; ++i) {
+			counts_[i].store(0, std::memory_order_relaxed);
+		}
+		total_.store(0, std::memory_order_relaxed);
+		sum_.store(0, std::memory_order_relaxed);
+		max_.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t getCount() const { return total_.load(std::memory_order_relaxed); }
+	uint64_t getSum() const { return sum_.load(std::memory_order_relaxed); }
+	uint64_t getMax() const { return max_.load(std::memory_order_relaxed); }
+
+	// Quantiles q in [0, 1], computed on one snapshot of the counters.
+	void getQuantiles(const std::vector<double> &vQ, std::vector<uint64_t> &vValues) const {
+		std::vector<uint64_t> vCounts(NUM_BUCKETS);
+		uint64_t n = 0;
+		for (int i = 0; i < NUM_BUCKETS; ++i) {
+			vCounts[i] = counts_[i].load(std::memory_order_relaxed);
+			n += vCounts[i];
+		}
+		vValues.assign(vQ.size(), 0);
+		if (0 == n) {
+			return;
+		}
+		uint64_t maxValue = getMax();
+		for (size_t iQ = 0; iQ < vQ.size(); ++iQ) {
+			uint64_t rank = (uint64_t)(vQ[iQ] * (n - 1)) + 1;
+			uint64_t seen = 0;
+			for (int i = 0; i < NUM_BUCKETS; ++i) {
+				seen += vCounts[i];
+				if (seen >= rank) {
+					vValues[iQ] = std::min(bucketValue(i), maxValue);
+					break;
+				}
+			}
+		}
+	}
+
+	static int bucketIndex(uint64_t v) {
+		if (v < (uint64_t)SUB_COUNT) {
+			return (int)v;
+		}
+		int e = 63 - __builtin_clzll(v);
+		if (e > MAX_EXP) {
+			return NUM_BUCKETS - 1;
+		}
+		int sub = (int)((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+		return (e - SUB_BITS + 1) * SUB_COUNT + sub;
+	}
+
+	// upper bound of the bucket, so quantiles never under-report
+	static uint64_t bucketValue(int index) {
+		if (index < SUB_COUNT) {
+			return index;
+		}
+		int e = index / SUB_COUNT + SUB_BITS - 1;
+		uint64_t sub = index % SUB_COUNT;
+		uint64_t lower = (SUB_COUNT + sub) << (e - SUB_BITS);
+		return lower + ((uint64_t)1 << (e - SUB_BITS)) - 1;
+	}
+
+private:
+	std::atomic<uint64_t> counts_[NUM_BUCKETS];
+	std::atomic<uint64_t> total_;
+	std::atomic<uint64_t> sum_;
+	std::atomic<uint64_t> max_;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,170 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#pragma once
+
+// Scoped spans on the hot path, written as a Chrome/Perfetto JSON trace
+// (chrome://tracing, ui.perfetto.dev) and forwarded to NVTX.
+//
+//   -DENABLE_TRACING	compile the spans in, recording starts with trace::start()
+//   -DUSE_NVTX			also push/pop NVTX ranges, link with -lnvToolsExt
+//
+// Without ENABLE_TRACING, TRACE_RANGE() expands to nothing.
+
+#ifdef ENABLE_TRACING
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifdef USE_NVTX
+#include <nvToolsExt.h>
+#endif
+
+namespace trace {
+
+typedef struct {
+	const char *name;	// string literal, never copied
+	uint64_t beginUs;
+	uint64_t durUs;
+} EVENT;
+
+// Events of one thread. The lock is only contended while writing the file.
+typedef struct THREAD_BUFFER {
+	int tid{ 0 };
+	std::string threadName;
+	std::vector<EVENT > vEvents;
+	std::mutex mtx;
+} THREAD_BUFFER;
+
+// per thread cap, ~24 MB of events
+static const size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+inline std::atomic<bool > &enabled() {
+	static std::atomic<bool > bEnabled{ false };
+	return bEnabled;
+}
+
+inline std::mutex &registryMutex() {
+	static std::mutex mtx;
+	return mtx;
+}
+
+// buffers outlive their threads, the demux threads exit before the file is written
+inline std::vector<std::shared_ptr<THREAD_BUFFER> > &registry() {
+	static std::vector<std::shared_ptr<THREAD_BUFFER> > vBuffers;
+	return vBuffers;
+}
+
+inline THREAD_BUFFER &threadBuffer() {
+	static thread_local std::shared_ptr<THREAD_BUFFER> pBuffer;
+	if (!pBuffer) {
+		pBuffer = std::make_shared<THREAD_BUFFER>();
+		pBuffer->tid = (int)syscall(SYS_gettid);
+		std::lock_guard<std::mutex> lock(registryMutex());
+		registry().push_back(pBuffer);
+	}
+	return *pBuffer;
+}
+
+inline uint64_t nowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void setThreadName(const char *name) {
+	THREAD_BUFFER &buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mtx);
+	buffer.threadName = name;
+}
+
+class ScopedRange {
+public:
+	explicit
+	ScopedRange(const char *name) : name_(name) {
+#ifdef USE_NVTX
+		nvtxRangePushA(name);
+#endif
+		if (enabled().load(std::memory_order_relaxed)) {
+			beginUs_ = nowUs();
+		}
+	}
+	~ScopedRange() {
+#ifdef USE_NVTX
+		nvtxRangePop();
+#endif
+		if (0 == beginUs_) {
+			return;
+		}
+		EVENT e = { name_, beginUs_, nowUs() - beginUs_ };
+		THREAD_BUFFER &buffer = threadBuffer();
+		std::lock_guard<std::mutex> lock(buffer.mtx);
+		if (buffer.vEvents.size() < MAX_EVENTS_PER_THREAD) {
+			buffer.vEvents.push_back(e);
+		}
+	}
+
+private:
+	const char *name_{ nullptr };
+	uint64_t beginUs_{ 0 };
+};
+
+inline void start() {
+	enabled().store(true);
+}
+
+// Stop recording and write every buffered event. Returns false when the
+// file can not be written.
+inline bool stopAndWrite(const char *path) {
+	enabled().store(false);
+	FILE *fp = fopen(path, "w");
+	if (nullptr == fp) {
+		return false;
+	}
+	int pid = (int)getpid();
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool bFirst = true;
+	std::lock_guard<std::mutex> lockRegistry(registryMutex());
+	for (size_t i = 0; i < registry().size(); ++i) {
+		THREAD_BUFFER &buffer = *registry()[i];
+		std::lock_guard<std::mutex> lock(buffer.mtx);
+		if (!buffer.threadName.empty()) {
+			fprintf(fp, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+					bFirst ? "" : ",\n", pid, buffer.tid, buffer.threadName.c_str());
+			bFirst = false;
+		}
+		for (size_t j = 0; j < buffer.vEvents.size(); ++j) {
+			const EVENT &e = buffer.vEvents[j];
+			fprintf(fp, "%s{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"dur\":%llu}",
+					bFirst ? "" : ",\n", e.name, pid, buffer.tid,
+					(unsigned long long)e.beginUs, (unsigned long long)e.durUs);
+			bFirst = false;
+		}
+		buffer.vEvents.clear();
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	return true;
+}
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_RANGE(name) trace::ScopedRange TRACE_CONCAT(traceRange_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) trace::setThreadName(name)
+
+#else
+
+#define TRACE_RANGE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif // ENABLE_TRACING
+
+#endif // TRACE_H
@@ -0,0 +1,476 @@
+#include "cpuWorker.h"
+#include "threadPlacement.h"
+#include "frameTracer.h"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+
+// Placeholder for the convertor and inference stages, it only owns the
+// output tensors so that customer modules can refer to them as PRE_MODULE.
+class CpuStageModule : public IModule {
+public:
+	explicit
+	CpuStageModule(const std::vector<IStreamTensor *> &vpOutputTensors, PRE_MODULE_LIST preModules)
+	: vpOutputTensors_(vpOutputTensors), preModules_(preModules) {}
+
+	void initialize() override {}
+	void execute(const ModuleContext&, const std::vector<IStreamTensor *>&, const std::vector<IStreamTensor *>&) override {}
+	void destroy() override {
+		for (size_t i = 0; i < vpOutputTensors_.size(); ++i) {
+			vpOutputTensors_[i]->destroy();
+		}
+		vpOutputTensors_.clear();
+	}
+	int getNbInputs() const override { return preModules_.size(); }
+	PRE_MODULE getPreModule(const int tensorIndex) const override { return preModules_[tensorIndex]; }
+	int getNbOutputs() const override { return vpOutputTensors_.size(); }
+	IStreamTensor* getOutputTensor(const int tensorIndex) const override { return vpOutputTensors_[tensorIndex]; }
+	void setProfiler(IModuleProfiler *pProfiler) override { pProfiler_ = pProfiler; }
+	IModuleProfiler* getProfiler() const override { return pProfiler_; }
+	void setCallback(void *pUserData, MODULE_CALLBACK callback) override {
+		pUserData_ = pUserData;
+		callback_ = callback;
+	}
+	std::pair<void *, MODULE_CALLBACK> getCallback() const override {
+		return std::pair<void*, MODULE_CALLBACK>(pUserData_, callback_);
+	}
+
+private:
+	std::vector<IStreamTensor *> vpOutputTensors_;
+	PRE_MODULE_LIST preModules_;
+	IModuleProfiler *pProfiler_{ nullptr };
+	void *pUserData_{ nullptr };
+	MODULE_CALLBACK callback_{ nullptr };
+};
+
+static double elapsedMs(const std::chrono::steady_clock::time_point &t0) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+CpuWorker::CpuWorker(const int nLanes, simplelogger::Logger *logger)
+: nLanes_(nLanes), logger_(logger), vLanes_(nLanes),
+  vpSwsNet_(nLanes, nullptr), vpSwsNv12_(nLanes, nullptr) {
+	maxBatch_ = nLanes;
+}
+
+CpuWorker::~CpuWorker() {
+	stop();
+}
+
+void CpuWorker::addDecodeTask(cudaVideoCodec codec) {
+	codecID_ = (cudaVideoCodec_HEVC == codec) ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+}
+
+IModule *CpuWorker::addColorSpaceConvertorTask(COLOR_FORMAT) {
+	pPlanar_ = new HostTensor(maxBatch_, sizeof(float), FLOAT_TENSOR);
+	pNv12_ = new HostTensor(maxBatch_, sizeof(uint8_t), NV12_FRAME);
+	pConvertor_ = new CpuStageModule(std::vector<IStreamTensor *>{pPlanar_, pNv12_}, PRE_MODULE_LIST());
+	return pConvertor_;
+}
+
+IModule *CpuWorker::addInferenceTask(PRE_MODULE preModule,
+									char *deployFile,
+									char *,
+									char *,
+									std::string &,
+									std::vector<std::string > &,
+									const int,
+									inferenceParams *pParams) {
+	// the network input size comes from the input_dim lines of the deploy file
+	std::ifstream iDeploy(deployFile);
+	std::vector<int > vDims;
+	std::string line;
+	while (iDeploy.is_open() && std::getline(iDeploy, line)) {
+		std::istringstream iss(line);
+		std::string key;
+		int value = 0;
+		if ((iss >> key >> value) && "input_dim:" == key) {
+			vDims.push_back(value);
+		}
+	}
+	if (4 == vDims.size()) {
+		netC_ = vDims[1];
+		netH_ = vDims[2];
+		netW_ = vDims[3];
+	} else {
+		LOG_WARN(logger_, "CpuWorker: no input_dim in " << (deployFile ? deployFile : "(null)")
+							<< ", using " << netW_ << "x" << netH_);
+	}
+	if (nullptr != pParams && pParams->bScale_) {
+		scale_ = pParams->scale_;
+		shift_ = pParams->shift_;
+	}
+
+	pPlanar_->reserve(netC_ * netH_ * netW_);
+	pPlanar_->setShape(0, netC_, netH_, netW_);
+
+	int gridH = netH_ / STUB_STRIDE, gridW = netW_ / STUB_STRIDE;
+	pCov_ = new HostTensor(maxBatch_, sizeof(float), FLOAT_TENSOR);
+	pCov_->reserve(STUB_CLASSES * gridH * gridW);
+	pBBox_ = new HostTensor(maxBatch_, sizeof(float), FLOAT_TENSOR);
+	pBBox_->reserve(STUB_CLASSES * 4 * gridH * gridW);
+	pInfer_ = new CpuStageModule(std::vector<IStreamTensor *>{pCov_, pBBox_}, PRE_MODULE_LIST{preModule});
+	LOG_DEBUG(logger_, "CpuWorker: stub inference " << netW_ << "x" << netH_
+						<< ", batch " << maxBatch_);
+	return pInfer_;
+}
+
+void CpuWorker::addCustomerTask(IModule *pModule) {
+	vpCustomers_.push_back(pModule);
+}
+
+void CpuWorker::setDecodeProfiler(IDecodeProfiler *pProfiler, const int laneID) {
+	vLanes_[laneID].pProfiler = pProfiler;
+}
+
+void CpuWorker::setAnalysisProfiler(IAnalysisProfiler *pProfiler) {
+	pAnalysisProfiler_ = pProfiler;
+}
+
+void CpuWorker::skipStaticFrames(const int workerID) {
+	staticWorkerID_ = workerID;
+}
+
+void CpuWorker::start() {
+	AVCodec *pCodec = avcodec_find_decoder(codecID_);
+	if (nullptr == pCodec) {
+		LOG_ERROR(logger_, "CpuWorker: no software decoder for codec " << codecID_);
+		exit(1);
+	}
+	for (int i = 0; i < nLanes_; ++i) {
+		LANE &lane = vLanes_[i];
+		lane.pCodecCtx = avcodec_alloc_context3(pCodec);
+		lane.pCodecCtx->thread_count = 1;
+		if (avcodec_open2(lane.pCodecCtx, pCodec, NULL) < 0) {
+			LOG_ERROR(logger_, "CpuWorker: failed to open decoder for lane " << i);
+			exit(1);
+		}
+	}
+	// the frames are scaled to NV12 only for the sinks which read them
+	bNv12Used_ = false;
+	for (size_t i = 0; i < vpCustomers_.size(); ++i) {
+		for (int j = 0; j < vpCustomers_[i]->getNbInputs(); ++j) {
+			PRE_MODULE pre = vpCustomers_[i]->getPreModule(j);
+			bNv12Used_ = bNv12Used_ || (pConvertor_ == pre.first && 1 == pre.second);
+		}
+	}
+	if (!bNv12Used_) {
+		LOG_DEBUG(logger_, "CpuWorker: no sink reads the NV12 frames, they are not converted");
+	}
+	for (size_t i = 0; i < vpCustomers_.size(); ++i) {
+		vpCustomers_[i]->initialize();
+	}
+	bStarted_ = true;
+	for (int i = 0; i < nLanes_; ++i) {
+		vLanes_[i].thDecode = std::thread(&CpuWorker::decodeLoop, this, i);
+	}
+	thAnalysis_ = std::thread(&CpuWorker::analysisLoop, this);
+}
+
+void CpuWorker::stop() {
+	if (!bStarted_) {
+		return;
+	}
+	// the pipeline drains once every lane has seen stopPushPacket
+	for (int i = 0; i < nLanes_; ++i) {
+		if (vLanes_[i].thDecode.joinable()) {
+			vLanes_[i].thDecode.join();
+		}
+	}
+	if (thAnalysis_.joinable()) {
+		thAnalysis_.join();
+	}
+	bStarted_ = false;
+}
+
+void CpuWorker::destroy() {
+	stop();
+	for (int i = 0; i < nLanes_; ++i) {
+		if (nullptr != vLanes_[i].pCodecCtx) {
+			avcodec_free_context(&vLanes_[i].pCodecCtx);
+		}
+		sws_freeContext(vpSwsNet_[i]);
+		sws_freeContext(vpSwsNv12_[i]);
+		vpSwsNet_[i] = vpSwsNv12_[i] = nullptr;
+	}
+	for (size_t i = 0; i < vpCustomers_.size(); ++i) {
+		vpCustomers_[i]->destroy();
+	}
+	vpCustomers_.clear();
+	if (nullptr != pInfer_) {
+		pInfer_->destroy();
+		delete pInfer_;
+		pInfer_ = nullptr;
+	}
+	if (nullptr != pConvertor_) {
+		pConvertor_->destroy();
+		delete pConvertor_;
+		pConvertor_ = nullptr;
+	}
+}
+
+void CpuWorker::pushPacket(uint8_t *pBuf, int nBuf, int laneID) {
+	if (nullptr == pBuf || nBuf <= 0) {
+		return;
+	}
+	const VIDEO_CODEC codec = AV_CODEC_ID_HEVC == codecID_ ? VIDEO_CODEC_HEVC : VIDEO_CODEC_H264;
+	const bool bNewPicture = classifyPacket(pBuf, nBuf, codec).bNewPicture;
+	LANE &lane = vLanes_[laneID];
+	std::unique_lock<std::mutex> lock(lane.mtx);
+	// same back pressure as a full NVDEC packet cache
+	lane.cv.wait(lock, [&lane]() { return lane.qPackets.size() < MAX_QUEUED_PACKETS || lane.bEos; });
+	if (lane.bEos) {
+		return;
+	}
+	// numbered as FrameTracer::onPacketPushed numbers them
+	QUEUED_PACKET queued;
+	queued.vData.assign(pBuf, pBuf + nBuf);
+	queued.picture = bNewPicture ? lane.nPictures++ : -1;
+	lane.qPackets.push_back(std::move(queued));
+	lane.cv.notify_all();
+}
+
+void CpuWorker::stopPushPacket(int laneID) {
+	LANE &lane = vLanes_[laneID];
+	std::lock_guard<std::mutex> lock(lane.mtx);
+	lane.bEos = true;
+	lane.cv.notify_all();
+}
+
+void CpuWorker::decodeLoop(const int laneID) {
+	placeThread(ROLE_WORKER, "decode", laneID);
+	LANE &lane = vLanes_[laneID];
+	AVPacket packet;
+	while (true) {
+		QUEUED_PACKET queued;
+		{
+			std::unique_lock<std::mutex> lock(lane.mtx);
+			lane.cv.wait(lock, [&lane]() { return !lane.qPackets.empty() || lane.bEos; });
+			if (lane.qPackets.empty()) {
+				break;
+			}
+			queued = std::move(lane.qPackets.front());
+			lane.qPackets.pop_front();
+			lane.cv.notify_all();
+		}
+		av_init_packet(&packet);
+		packet.data = queued.vData.data();
+		packet.size = queued.vData.size();
+		// frames come out in display order and skip what the decoder
+		// dropped, the pts tells which pushed picture each one is
+		packet.pts = queued.picture >= 0 ? queued.picture : AV_NOPTS_VALUE;
+		auto t0 = std::chrono::steady_clock::now();
+		if (avcodec_send_packet(lane.pCodecCtx, &packet) < 0) {
+			LOG_DEBUG(logger_, "CpuWorker: lane " << laneID << " dropped a corrupted packet");
+			continue;
+		}
+		receiveFrames(laneID, t0);
+	}
+	// flush the frames buffered for reordering
+	auto t0 = std::chrono::steady_clock::now();
+	avcodec_send_packet(lane.pCodecCtx, NULL);
+	receiveFrames(laneID, t0);
+
+	std::lock_guard<std::mutex> lock(mtxReady_);
+	lane.bFinished = true;
+	nFinishedLanes_++;
+	cvReady_.notify_all();
+}
+
+// t0 is taken before the packet went into the decoder, which does most
+// of its work in avcodec_send_packet; each frame reports the time since
+// the one before it, so a packet's frames add up to its decode time.
+void CpuWorker::receiveFrames(const int laneID, std::chrono::steady_clock::time_point t0) {
+	LANE &lane = vLanes_[laneID];
+	while (true) {
+		AVFrame *pFrame = av_frame_alloc();
+		if (avcodec_receive_frame(lane.pCodecCtx, pFrame) < 0) {
+			av_frame_free(&pFrame);
+			return;
+		}
+		// no dts goes in, so this is the pts of the packet the picture started in
+		int64_t picture = pFrame->best_effort_timestamp;
+		int frameIndex = AV_NOPTS_VALUE == picture ? -1 : (int)picture;
+		if (nullptr != lane.pProfiler) {
+			lane.pProfiler->reportDecodeTime(frameIndex, laneID, -1, elapsedMs(t0));
+		}
+		t0 = std::chrono::steady_clock::now();
+		READY_FRAME ready;
+		ready.pFrame = pFrame;
+		ready.trace.frameIndex = frameIndex;
+		ready.trace.videoIndex = laneID;
+		if (staticWorkerID_ >= 0 && nullptr != g_pTracer
+			&& g_pTracer->isStatic(staticWorkerID_, laneID, ready.trace.frameIndex)) {
+			av_frame_free(&pFrame);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mtxReady_);
+		cvReady_.wait(lock, [&lane]() { return lane.nQueuedFrames < MAX_QUEUED_FRAMES; });
+		lane.nQueuedFrames++;
+		qReady_.push_back(ready);
+		cvReady_.notify_all();
+	}
+}
+
+void CpuWorker::analysisLoop() {
+	placeThread(ROLE_WORKER, "analysis");
+	std::vector<READY_FRAME > vBatch;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mtxReady_);
+			cvReady_.wait(lock, [this]() { return !qReady_.empty() || nFinishedLanes_ == nLanes_; });
+			if (qReady_.empty()) {
+				break;
+			}
+			// the frames of a batch share the NV12 size, a lane of another
+			// resolution goes into the next batch
+			while (!qReady_.empty() && (int)vBatch.size() < maxBatch_
+				   && (vBatch.empty() || !bNv12Used_ || sameNv12Size(vBatch[0].pFrame, qReady_.front().pFrame))) {
+				vLanes_[qReady_.front().trace.videoIndex].nQueuedFrames--;
+				vBatch.push_back(qReady_.front());
+				qReady_.pop_front();
+			}
+			cvReady_.notify_all();
+		}
+		auto t0 = std::chrono::steady_clock::now();
+		runBatch(vBatch);
+		if (nullptr != pAnalysisProfiler_) {
+			pAnalysisProfiler_->reportTime(elapsedMs(t0), vBatch.size());
+		}
+		for (size_t i = 0; i < vBatch.size(); ++i) {
+			av_frame_free(&vBatch[i].pFrame);
+		}
+		vBatch.clear();
+	}
+}
+
+void CpuWorker::runBatch(std::vector<READY_FRAME > &vBatch) {
+	std::vector<TRACE_INFO > vTraces;
+	for (size_t i = 0; i < vBatch.size(); ++i) {
+		vTraces.push_back(vBatch[i].trace);
+	}
+	convert(vBatch);
+	pPlanar_->setTraceInfo(vTraces);
+	pNv12_->setTraceInfo(vTraces);
+
+	inferStub(vTraces);
+	pCov_->setTraceInfo(vTraces);
+	pBBox_->setTraceInfo(vTraces);
+
+	for (size_t i = 0; i < vpCustomers_.size(); ++i) {
+		runModule(vpCustomers_[i], vTraces);
+	}
+}
+
+void CpuWorker::convert(std::vector<READY_FRAME > &vBatch) {
+	const int nFrames = vBatch.size();
+	if (bNv12Used_) {
+		// sized per batch, its frames share the size, see analysisLoop()
+		nv12Width_ = vBatch[0].pFrame->width & ~1;
+		nv12Height_ = vBatch[0].pFrame->height & ~1;
+		pNv12_->reserve(nv12Width_ * nv12Height_ * 3 / 2);
+	}
+	const size_t nNetPlane = netH_ * netW_;
+	const size_t nNv12 = nv12Width_ * nv12Height_ * 3 / 2;
+	vBgr_.resize(nNetPlane * 3);
+
+	float *pPlanar = reinterpret_cast<float *>(pPlanar_->getCpuData());
+	uint8_t *pNv12 = reinterpret_cast<uint8_t *>(pNv12_->getCpuData());
+	for (int iF = 0; iF < nFrames; ++iF) {
+		AVFrame *pFrame = vBatch[iF].pFrame;
+		const int lane = vBatch[iF].trace.videoIndex;
+
+		vpSwsNet_[lane] = sws_getCachedContext(vpSwsNet_[lane],
+									pFrame->width, pFrame->height, (AVPixelFormat)pFrame->format,
+									netW_, netH_, AV_PIX_FMT_BGR24,
+									SWS_FAST_BILINEAR, NULL, NULL, NULL);
+		uint8_t *dstBgr[1] = { vBgr_.data() };
+		int dstBgrPitch[1] = { netW_ * 3 };
+		sws_scale(vpSwsNet_[lane], pFrame->data, pFrame->linesize, 0, pFrame->height, dstBgr, dstBgrPitch);
+
+		// packed BGR to planar float, as BGR_PLANAR from the GPU convertor
+		float *pB = pPlanar + iF * netC_ * nNetPlane;
+		float *pG = pB + nNetPlane;
+		float *pR = pG + nNetPlane;
+		const uint8_t *pSrc = vBgr_.data();
+		for (size_t i = 0; i < nNetPlane; ++i) {
+			pB[i] = (pSrc[3 * i + 0] - shift_) * scale_;
+			pG[i] = (pSrc[3 * i + 1] - shift_) * scale_;
+			pR[i] = (pSrc[3 * i + 2] - shift_) * scale_;
+		}
+
+		if (!bNv12Used_) {
+			continue;
+		}
+		vpSwsNv12_[lane] = sws_getCachedContext(vpSwsNv12_[lane],
+									pFrame->width, pFrame->height, (AVPixelFormat)pFrame->format,
+									nv12Width_, nv12Height_, AV_PIX_FMT_NV12,
+									SWS_FAST_BILINEAR, NULL, NULL, NULL);
+		uint8_t *pY = pNv12 + iF * nNv12;
+		uint8_t *dstNv12[2] = { pY, pY + nv12Width_ * nv12Height_ };
+		int dstNv12Pitch[2] = { nv12Width_, nv12Width_ };
+		sws_scale(vpSwsNv12_[lane], pFrame->data, pFrame->linesize, 0, pFrame->height, dstNv12, dstNv12Pitch);
+	}
+	pPlanar_->setShape(nFrames, netC_, netH_, netW_);
+	// NV12 shape follows the GPU convertor: height of a plane pair
+	pNv12_->setShape(nFrames, 1, nv12Height_ / 2, nv12Width_);
+}
+
+// Emits one object per class which walks across the grid, so the parser,
+// the clustering and the sinks see a realistic amount of work.
+void CpuWorker::inferStub(const std::vector<TRACE_INFO > &vTraces) {
+	const int nFrames = vTraces.size();
+	const int gridH = netH_ / STUB_STRIDE, gridW = netW_ / STUB_STRIDE;
+	const int gridSize = gridH * gridW;
+	const float norm = 35.f; // bbox_norm of the parser
+	float *pCov = reinterpret_cast<float *>(pCov_->getCpuData());
+	float *pBBox = reinterpret_cast<float *>(pBBox_->getCpuData());
+	memset(pCov, 0, nFrames * STUB_CLASSES * gridSize * sizeof(float));
+	memset(pBBox, 0, nFrames * STUB_CLASSES * 4 * gridSize * sizeof(float));
+
+	for (int iF = 0; iF < nFrames; ++iF) {
+		float *pCovF = pCov + iF * STUB_CLASSES * gridSize;
+		float *pBBoxF = pBBox + iF * STUB_CLASSES * 4 * gridSize;
+		const int t = vTraces[iF].frameIndex;
+		for (int c = 0; c < STUB_CLASSES; ++c) {
+			const int x0 = (t + c * 7) % (gridW - 1);
+			const int y0 = (c * 5 + t / gridW) % (gridH - 1);
+			float *pX1 = pBBoxF + c * 4 * gridSize;
+			float *pY1 = pX1 + gridSize;
+			float *pX2 = pY1 + gridSize;
+			float *pY2 = pX2 + gridSize;
+			for (int dy = 0; dy < 2; ++dy) {
+				for (int dx = 0; dx < 2; ++dx) {
+					const int i = (x0 + dx) + (y0 + dy) * gridW;
+					pCovF[c * gridSize + i] = 0.9f;
+					// a 64x64 box around the cell center after the parser decode
+					pX1[i] = (0.5f + 32.f) / norm;
+					pY1[i] = (0.5f + 32.f) / norm;
+					pX2[i] = (32.f - 0.5f) / norm;
+					pY2[i] = (32.f - 0.5f) / norm;
+				}
+			}
+		}
+	}
+	pCov_->setShape(nFrames, STUB_CLASSES, gridH, gridW);
+	pBBox_->setShape(nFrames, STUB_CLASSES * 4, gridH, gridW);
+}
+
+void CpuWorker::runModule(IModule *pModule, std::vector<TRACE_INFO > &vTraces) {
+	std::vector<IStreamTensor *> vpInputs, vpOutputs;
+	for (int i = 0; i < pModule->getNbInputs(); ++i) {
+		PRE_MODULE pre = pModule->getPreModule(i);
+		vpInputs.push_back(pre.first->getOutputTensor(pre.second));
+	}
+	for (int i = 0; i < pModule->getNbOutputs(); ++i) {
+		vpOutputs.push_back(pModule->getOutputTensor(i));
+	}
+	ModuleContext context;
+	memset(&context, 0, sizeof(context));
+	pModule->execute(context, vpInputs, vpOutputs);
+	for (size_t i = 0; i < vpOutputs.size(); ++i) {
+		vpOutputs[i]->setTraceInfo(vTraces);
+	}
+}
@@ -0,0 +1,179 @@
+#ifndef CPU_WORKER_H
+#define CPU_WORKER_H
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/frame.h"
+#include "libswscale/swscale.h"
+};
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "workerBackend.h"
+#include "common/logger.h"
+
+// Tensor in host memory, used for every output of the CPU pipeline.
+class HostTensor : public IStreamTensor {
+public:
+	HostTensor(const int maxBatch, const size_t elemSize, TENSOR_TYPE type)
+	: maxBatch_(maxBatch), elemSize_(elemSize), type_(type), vShape_(4, 0) {}
+
+	// grows the storage for maxBatch items of nElemsPerItem elements
+	void reserve(const size_t nElemsPerItem) {
+		size_t nBytes = maxBatch_ * nElemsPerItem * elemSize_;
+		if (vData_.size() < nBytes) {
+			vData_.resize(nBytes);
+		}
+	}
+
+	void *getGpuData() override { return nullptr; }
+	const void *getConstGpuData() override { return nullptr; }
+	void *getCpuData() override { return vData_.data(); }
+	const void *getConstCpuData() override { return vData_.data(); }
+	size_t getElemSize() const override { return elemSize_; }
+	MEMORY_TYPE getMemoryType() const override { return CPU_DATA; }
+	TENSOR_TYPE getTensorType() const override { return type_; }
+	std::vector<int> getShape() const override { return vShape_; }
+	std::vector<TRACE_INFO> getTraceInfos() override { return vTraceInfos_; }
+	int getMaxBatch() const override { return maxBatch_; }
+	int getDeviceId() const override { return -1; }
+	void setShape(const std::vector<int>& shape) override { vShape_ = shape; }
+	void setShape(const int n, const int c, const int h, const int w) override {
+		vShape_ = std::vector<int>{n, c, h, w};
+	}
+	void setTraceInfo(std::vector<TRACE_INFO> &vTraceInfos) override { vTraceInfos_ = vTraceInfos; }
+	void destroy() override { delete this; }
+
+private:
+	int maxBatch_{ 0 };
+	size_t elemSize_{ 0 };
+	TENSOR_TYPE type_;
+	std::vector<int> vShape_;
+	std::vector<TRACE_INFO> vTraceInfos_;
+	std::vector<uint8_t> vData_;
+};
+
+// Reference implementation of the device worker on the CPU:
+// one decode thread per lane (FFmpeg software decoder) and one analysis
+// thread which batches decoded frames, converts them with swscale, runs a
+// stub network emitting cov/bbox tensors and then the customer modules.
+class CpuWorker : public IWorkerBackend {
+public:
+	CpuWorker(const int nLanes, simplelogger::Logger *logger);
+	~CpuWorker();
+
+	// ILaneWorker
+	int getDeviceID() const override { return -1; }
+	int getNbLanes() const override { return nLanes_; }
+	void pushPacket(uint8_t *pBuf, int nBuf, int laneID) override;
+	void stopPushPacket(int laneID) override;
+
+	// IWorkerBackend
+	void addDecodeTask(cudaVideoCodec codec) override;
+	IModule *addColorSpaceConvertorTask(COLOR_FORMAT format) override;
+	IModule *addInferenceTask(PRE_MODULE preModule,
+							char *deployFile,
+							char *modelFile,
+							char *meanFile,
+							std::string &inputLayerName,
+							std::vector<std::string > &outputLayerNames,
+							const int maxBatchSize,
+							inferenceParams *pParams) override;
+	void addCustomerTask(IModule *pModule) override;
+	void setDecodeProfiler(IDecodeProfiler *pProfiler, const int laneID) override;
+	void setAnalysisProfiler(IAnalysisProfiler *pProfiler) override;
+	void skipStaticFrames(const int workerID) override;
+	void start() override;
+	void stop() override;
+	void destroy() override;
+
+private:
+	typedef struct {
+		AVFrame *pFrame;
+		TRACE_INFO trace;
+	} READY_FRAME;
+
+	// A packet waiting for the decoder. picture is the number of the
+	// picture it starts among those pushed into the lane, -1 when it
+	// starts none; it goes through the decoder as the pts and comes back
+	// as the frameIndex, the index the FrameTracer keeps the stamps by.
+	typedef struct {
+		std::vector<uint8_t > vData;
+		int64_t picture;
+	} QUEUED_PACKET;
+
+	typedef struct LANE {
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::deque<QUEUED_PACKET > qPackets;
+		bool bEos{ false };
+		bool bFinished{ false };
+		int nQueuedFrames{ 0 };
+		int nPictures{ 0 };
+		AVCodecContext *pCodecCtx{ nullptr };
+		IDecodeProfiler *pProfiler{ nullptr };
+		std::thread thDecode;
+	} LANE;
+
+	void decodeLoop(const int laneID);
+	void receiveFrames(const int laneID, std::chrono::steady_clock::time_point t0);
+	void analysisLoop();
+	void runBatch(std::vector<READY_FRAME > &vBatch);
+	void convert(std::vector<READY_FRAME > &vBatch);
+	void inferStub(const std::vector<TRACE_INFO > &vTraces);
+	void runModule(IModule *pModule, std::vector<TRACE_INFO > &vTraces);
+
+	static bool sameNv12Size(const AVFrame *pA, const AVFrame *pB) {
+		return (pA->width & ~1) == (pB->width & ~1) && (pA->height & ~1) == (pB->height & ~1);
+	}
+
+	static const int MAX_QUEUED_PACKETS = 64;
+	static const int MAX_QUEUED_FRAMES = 2;
+	static const int STUB_CLASSES = 4;
+	static const int STUB_STRIDE = 16;
+
+	int nLanes_{ 0 };
+	simplelogger::Logger *logger_{ nullptr };
+	AVCodecID codecID_{ AV_CODEC_ID_H264 };
+	std::vector<LANE > vLanes_;
+	int staticWorkerID_{ -1 };			// frames marked static are not analysed
+
+	// convertor
+	IModule *pConvertor_{ nullptr };
+	HostTensor *pPlanar_{ nullptr };	// output 0, net input
+	HostTensor *pNv12_{ nullptr };		// output 1, frames for the sinks
+	bool bNv12Used_{ true };			// false when only coordinate sinks run
+	int nv12Width_{ 0 };
+	int nv12Height_{ 0 };
+	std::vector<SwsContext *> vpSwsNet_;
+	std::vector<SwsContext *> vpSwsNv12_;
+	std::vector<uint8_t > vBgr_;
+
+	// stub inference
+	IModule *pInfer_{ nullptr };
+	HostTensor *pCov_{ nullptr };
+	HostTensor *pBBox_{ nullptr };
+	int netC_{ 3 };
+	int netH_{ 368 };
+	int netW_{ 640 };
+	int maxBatch_{ 0 };
+	float scale_{ 1.f };
+	float shift_{ 0.f };
+
+	std::vector<IModule *> vpCustomers_;
+	IAnalysisProfiler *pAnalysisProfiler_{ nullptr };
+
+	std::mutex mtxReady_;
+	std::condition_variable cvReady_;
+	std::deque<READY_FRAME > qReady_;
+	int nFinishedLanes_{ 0 };
+	std::thread thAnalysis_;
+	bool bStarted_{ false };
+};
+
+#endif // CPU_WORKER_H
@@ -30,27 +30,120 @@
 #define DATA_PROVIDER_H
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <cstring>
 #include <cassert>
+#include <random>
 #include "streamTaker.h"
+#include "rtspClient.h"
 #include "common/logger.h"
 #include "common/SSAutoLock.h"
+#include "metrics.h"
+#include "frameTracer.h"
+#include "packetSampler.h"
+#include "packetPacer.h"
+#include "sharedRecording.h"
+#include "recordingSegments.h"
+#include "packetPool.h"
+#include "common/trace.h"
 
 void videoPacketCallback(void *handle, AVPacket packet);
+void mainPacketCallback(void *handle, AVPacket packet);
 
 class DataProvider {
 public:
-    virtual ~DataProvider() {}
+    virtual ~DataProvider() {
+        if (pSampler_) {
+            delete pSampler_;
+        }
+        if (pPacer_) {
+            delete pPacer_;
+        }
+    }
     virtual bool getData(uint8_t **ppBuf, int *pnBuf) = 0;
     virtual void reload() = 0;
+
+    // Stamp of the packet returned by the last getData()
+    virtual PACKET_STAMP getLastStamp() const { return lastStamp_; }
+
+    // Packets the sampler rejects never leave getData(), the provider owns it
+    void setSampler(PacketSampler *pSampler) {
+        pSampler_ = pSampler;
+    }
+
+    PacketSampler *getSampler() const { return pSampler_; }
+
+    // Wakes a push thread waiting for its next paced packet, the provider
+    // is about to be detached.
+    void stopPacing() {
+        bAbortPacing_ = true;
+    }
+
+    // nullptr unless a recorded source is replayed in real time
+    PacketPacer *getPacer() const { return pPacer_; }
+
+    // false when the provider has no compressed packets to show, nullptr
+    // stops the observer before the provider goes away
+    virtual bool setPacketObserver(IPacketObserver *pObserver) { return false; }
+
+    // codec of the packets the observer sees
+    virtual VIDEO_CODEC getRecordedCodec() const { return getCodec(); }
+
+    // false when the provider does not queue packets, the pool outlives
+    // the provider and every packet it handed to an observer
+    virtual bool setPacketPool(PacketPool *pPool) { return false; }
+
+    virtual VIDEO_CODEC getCodec() const { return VIDEO_CODEC_H264; }
+
+    // 0 when the provider does not know the picture size
+    virtual int getFrameWidth() { return 0; }
+    virtual int getFrameHeight() { return 0; }
+
+    // Drop pictures up to the next keyframe, e.g. when the channel moved
+    // to another decoder.
+    void waitForKeyframe() {
+        if (pSampler_) {
+            pSampler_->waitForKeyframe();
+        }
+    }
+
+protected:
+    bool samplerAccepts(const uint8_t *pBuf, const int nBuf, const int64_t ptsUs) {
+        return nullptr == pSampler_ || pSampler_->accept(pBuf, nBuf, ptsUs);
+    }
+
+    // Holds the packet back until it is due, false when the wait was
+    // aborted by a reload or shutdown.
+    bool pace(const uint8_t *pBuf, const int nBuf, const int64_t dtsUs) {
+        return nullptr == pPacer_ || pPacer_->wait(pBuf, nBuf, getCodec(), dtsUs, bAbortPacing_);
+    }
+
+    // number of the last picture the sampler looked at
+    int64_t sourcePicture() const {
+        return nullptr == pSampler_ ? -1 : (int64_t)pSampler_->getNbSeen() - 1;
+    }
+
+    // the last picture passed only as a reference, see PACKET_STAMP
+    bool staticPicture() const {
+        return nullptr != pSampler_ && pSampler_->isLastStatic();
+    }
+
+    PACKET_STAMP lastStamp_;
+    PacketSampler *pSampler_{ nullptr };
+    PacketPacer *pPacer_{ nullptr };
+    std::atomic<bool > bAbortPacing_{ false };
 };
 
 // Define the file data provider
 class FileDataProvider : public DataProvider {
 public:
-    FileDataProvider(const char *_szFilePath, simplelogger::Logger *_logger)
-            : logger_(_logger)
+    FileDataProvider(const char *_szFilePath, simplelogger::Logger *_logger, const VIDEO_CODEC _codec = VIDEO_CODEC_H264,
+                     const PACING_PARAMS &_pacing = PACING_PARAMS())
+            : logger_(_logger), codec_(_codec)
     {
+        if (_pacing.bEnabled) {
+            pPacer_ = new PacketPacer(_pacing);
+        }
         fp_ = fopen(_szFilePath, "rb");
         if (nullptr == fp_) {
             LOG_ERROR(_logger, "Failed to open file " << _szFilePath);
@@ -94,6 +187,12 @@ public:
                     vCache_.clear();
                     return false;
                 }
+            } else if (!pace(vCache_.data(), nBytesToDecode, PacketPacer::NO_TIMESTAMP)
+                        || !samplerAccepts(vCache_.data(), nBytesToDecode, -1)) {
+                // sampled out, look for the next NAL unit. Pictures are paced
+                // before sampling, dropped ones keep their place in time
+                vCache_.erase(vCache_.begin(), vCache_.begin() + nBytesToDecode);
+                nBytesToDecode = 0;
             } else {
                 //std::cout << "Note: find a frame.\n";
                 //std::cout << "Warning: vCache.size() = " << vCache_.size() << std::endl;
@@ -102,6 +201,10 @@ public:
 
         //std::cout << "Warning: nBytesToDecode = " << nBytesToDecode << std::endl;
         assert(0 != nBytesToDecode);
+        lastStamp_.recvUs = metricsNowUs();
+        lastStamp_.wallclockUs = 0;
+        lastStamp_.sourcePicture = sourcePicture();
+        lastStamp_.bStatic = staticPicture();
         memcpy(pPktBuf_, vCache_.data(), nBytesToDecode);
         vCache_.erase(vCache_.begin(), vCache_.begin() + nBytesToDecode);
         *_ppBuf = pPktBuf_;
@@ -114,6 +217,8 @@ public:
         fseek(fp_, 0, SEEK_SET);
     }
 
+    VIDEO_CODEC getCodec() const { return codec_; }
+
 private:
     int loadDataFromFile(const int _count) {
         if (NULL == fp_) {
@@ -161,67 +266,140 @@ private:
 
     std::vector<uint8_t > vCache_;
     simplelogger::Logger *logger_{ nullptr };
+    VIDEO_CODEC codec_{ VIDEO_CODEC_H264 };
 };
 
 
 class StreamDataProvider:public DataProvider{
 public:
-    StreamDataProvider(const char* _szRtspURL,simplelogger::Logger *_logger)
-            : logger_(_logger)
+    StreamDataProvider(const char* _szRtspURL,simplelogger::Logger *_logger, const int _channel = -1,
+                       const STREAM_CLIENT _client = STREAM_CLIENT_FFMPEG,
+                       const JITTER_PARAMS &_jitter = JITTER_PARAMS(),
+                       const PACING_PARAMS &_pacing = PACING_PARAMS())
+            : logger_(_logger), channel_(_channel)
     {
-        stream_taker_ = new StreamTaker(logger_);
+        // live sources are not paced, they arrive in real time already
+        if (_pacing.bEnabled && isPacedUrl(_szRtspURL)) {
+            pPacer_ = new PacketPacer(_pacing);
+        }
+        stream_taker_ = createStreamSource(_szRtspURL, _client, logger_);
+        stream_taker_->setChannel(channel_);
+        stream_taker_->setJitterParams(_jitter);
+        // only video is consumed, audio is neither set up nor read
+        stream_taker_->setVideoOnly(true);
+        av_init_packet(&current_);
+        current_.data = nullptr;
+        current_.size = 0;
         int ret = stream_taker_->prepare(_szRtspURL);
 
+        // the owner checks isOpen() and deletes a provider which failed
         if (ret != SUCCESS) {
             LOG_ERROR(_logger, "Failed to open URL " << _szRtspURL);
             delete  stream_taker_;
             stream_taker_= nullptr;
-            exit(1);
+            return;
         }
 
 	LOG_DEBUG(logger_,this<<" Set callback function");
 
         stream_taker_->setVideoPacketCallback(this,videoPacketCallback);
-        pPktBuf_ = new uint8_t[nPktBuf_];
         stream_taker_->startTakeStream();
     }
 
     ~StreamDataProvider() {
+        bAbortPacing_ = true;
+        IStreamSource *pMain = main_taker_.exchange(nullptr);
+        if (pMain) {
+            delete pMain;
+        }
         if (stream_taker_) {
             delete stream_taker_;
             stream_taker_ = nullptr;
         }
-        if (pPktBuf_) {
-            delete [] pPktBuf_;
+        av_packet_unref(&current_);
+        for (size_t i = 0; i < vpVideoPkt_.size(); ++i) {
+            av_packet_unref(&vpVideoPkt_[i].packet);
         }
     }
 
+    // *_pnBuf is 0 when no packet arrived yet. The packet is the queued
+    // reference itself, it stays valid up to the next call. False once the
+    // source stopped, at the end of a file or when a camera went away,
+    // and its last packets are taken.
     bool getData(uint8_t **_ppBuf, int *_pnBuf)
     {
+        TRACE_RANGE("getData");
         if (!stream_taker_) {
             return 0;
         }
+        // the source stops after its last packet went into the queue
+        bool bStopped = stream_taker_->getIsStopTaking();
 	
-        CSSAutoLock cAutoLockShared(&criobj_);
-	if (stream_taker_->getReceiveVideoPacketCount() % 1000 ==0)
-                LOG_DEBUG(logger_,"Current Packet count="<<vpVideoPkt_.size()
-                                        <<", try to get a packet");
-        if(vpVideoPkt_.size()>0)
+        av_packet_unref(&current_);
+        *_ppBuf = nullptr;
+        *_pnBuf = 0;
         {
-           memcpy(pPktBuf_,vpVideoPkt_[0].data,vpVideoPkt_[0].size);
-           *_ppBuf = pPktBuf_;
-           *_pnBuf = vpVideoPkt_[0].size;
-	    vpVideoPkt_.erase(vpVideoPkt_.begin());
-        }
-	else
-	{
-		usleep(100);
-	}
+            CSSAutoLock cAutoLockShared(&criobj_);
+            // rejected pictures are released without a copy
+            while (vpVideoPkt_.size() > 0
+                    && !samplerAccepts(vpVideoPkt_.front().packet.data, vpVideoPkt_.front().packet.size,
+                                        vpVideoPkt_.front().ptsUs)) {
+                av_packet_unref(&vpVideoPkt_.front().packet);
+                vpVideoPkt_.pop_front();
+            }
+            if(vpVideoPkt_.size()>0)
+            {
+                QUEUED_PACKET &queued = vpVideoPkt_.front();
+                recordMetric(STAGE_QUEUE_WAIT, channel_, metricsNowUs() - queued.enqueueUs);
+                av_packet_move_ref(&current_, &queued.packet);
+                *_ppBuf = current_.data;
+                *_pnBuf = current_.size;
+                lastStamp_ = queued.stamp;
+                lastStamp_.sourcePicture = sourcePicture();
+                lastStamp_.bStatic = staticPicture();
+                vpVideoPkt_.pop_front();
+                return true;
+            }
+        }
+        if (bStopped) {
+            return false;
+        }
+	usleep(100);
 	return true;
     }
 
     void putData(AVPacket packet)
     {
+        TRACE_RANGE("putData");
+        // a paced file source is held back on its taker thread, the packet
+        // counts as received when it is released
+        uint64_t recvUs = stream_taker_->getLastReceiveUs();
+        if (nullptr != pPacer_) {
+            if (!pace(packet.data, packet.size, stream_taker_->getDtsUs(packet)) || !waitForRoom()) {
+                return;
+            }
+            recvUs = metricsNowUs();
+        }
+        // the taker unrefs its packet after the callback, keep a reference,
+        // with a pool to a copy of the payload in it
+        QUEUED_PACKET queued;
+        av_init_packet(&queued.packet);
+        PacketPool *pPool = pPool_.load();
+        if ((nullptr == pPool || !copyToPool(pPool, packet, queued.packet))
+            && av_packet_ref(&queued.packet, &packet) < 0) {
+            return;
+        }
+        queued.enqueueUs = metricsNowUs();
+        // putData runs on the taker thread right after av_read_frame
+        queued.stamp.recvUs = recvUs;
+        queued.stamp.wallclockUs = stream_taker_->getWallclockUs(packet);
+        queued.ptsUs = stream_taker_->getPtsUs(packet);
+
+        // with a main stream the observer records that one instead
+        if (nullptr == main_taker_.load()) {
+            observe(stream_taker_, queued.packet, packet, recvUs, queued.stamp.wallclockUs);
+        }
+
         CSSAutoLock cAutoLockShared(&criobj_);
 	hasReceiveVideoPacketCount++;
 	//if (stream_taker_->getReceiveVideoPacketCount() %100 ==0)
@@ -230,18 +408,99 @@ public:
 	//			<<",stream has receive count="<<stream_taker_->getReceiveVideoPacketCount()
 	//			<<",Callback recevice count="<<hasReceiveVideoPacketCount
 	//			<<", try to put a packet");
-        vpVideoPkt_.push_back(packet);
+        vpVideoPkt_.push_back(queued);
 	//vpVideoPktCount_.push_back(hasReceiveVideoPacketCount);
    
-	if (vpVideoPkt_.size()>1000){
+	if (vpVideoPkt_.size()>nMaxQueued_){
 		LOG_DEBUG(logger_,this<<"Current Packet count="<<vpVideoPkt_.size()
 					<<", buffer is full");
-		vpVideoPkt_.erase(vpVideoPkt_.begin());
+		av_packet_unref(&vpVideoPkt_.front().packet);
+		vpVideoPkt_.pop_front();
 	}
     }
 
 
+    // Packets of the main stream on its own taker thread, they only go to
+    // the observer and are not analysed.
+    void putMainData(AVPacket packet)
+    {
+        IStreamSource *pMain = main_taker_.load();
+        if (nullptr == pMain || nullptr == pObserver_.load()) {
+            return;
+        }
+        AVPacket kept;
+        av_init_packet(&kept);
+        PacketPool *pPool = pPool_.load();
+        if ((nullptr == pPool || !copyToPool(pPool, packet, kept)) && av_packet_ref(&kept, &packet) < 0) {
+            return;
+        }
+        observe(pMain, kept, packet, pMain->getLastReceiveUs(), pMain->getWallclockUs(packet));
+        av_packet_unref(&kept);
+    }
+
+    bool isOpen() const {
+        return nullptr != stream_taker_;
+    }
+
+    // Opens the main stream of an "analysisURL|mainURL" channel, the
+    // observer records it in place of the analysed stream. False when it
+    // cannot be opened, the analysed stream is recorded then.
+    bool openMainStream(const char *_szUrl, const STREAM_CLIENT _client, const JITTER_PARAMS &_jitter) {
+        IStreamSource *pMain = createStreamSource(_szUrl, _client, logger_);
+        pMain->setChannel(channel_);
+        pMain->setJitterParams(_jitter);
+        pMain->setVideoOnly(true);
+        if (SUCCESS != pMain->prepare(_szUrl)) {
+            LOG_ERROR(logger_, "Failed to open main stream " << _szUrl);
+            delete pMain;
+            return false;
+        }
+        pMain->setVideoPacketCallback(this, mainPacketCallback);
+        main_taker_ = pMain;
+        pMain->startTakeStream();
+        return true;
+    }
+
+    // 0 without a main stream or while its size is unknown
+    int getMainWidth() const {
+        IStreamSource *pMain = main_taker_.load();
+        return pMain ? pMain->getFrameWidth() : 0;
+    }
+
+    int getMainHeight() const {
+        IStreamSource *pMain = main_taker_.load();
+        return pMain ? pMain->getFrameHeight() : 0;
+    }
+
+    VIDEO_CODEC getRecordedCodec() const {
+        IStreamSource *pMain = main_taker_.load();
+        return pMain ? toVideoCodec(pMain) : getCodec();
+    }
+
+    int getFrameWidth() {
+        return stream_taker_ ? stream_taker_->getFrameWidth() : 0;
+    }
+
+    bool setPacketObserver(IPacketObserver *pObserver) {
+        pObserver_ = pObserver;
+        return true;
+    }
+
+    bool setPacketPool(PacketPool *pPool) {
+        pPool_ = pPool;
+        return true;
+    }
+
+    VIDEO_CODEC getCodec() const {
+        return stream_taker_ ? toVideoCodec(stream_taker_) : VIDEO_CODEC_H264;
+    }
+
+    int getFrameHeight() {
+        return stream_taker_ ? stream_taker_->getFrameHeight() : 0;
+    }
+
     void reload() {
+        bAbortPacing_ = true;
         stream_taker_->stopTakeStream();
 
 	LOG_DEBUG(logger_,"reload");
@@ -255,28 +514,249 @@ public:
                 usleep(100);
             }
         }
+        bAbortPacing_ = false;
         stream_taker_->startTakeStream();
     }
 
 private:
-    StreamTaker *stream_taker_{ nullptr };
-    vector<AVPacket> vpVideoPkt_;
+    static VIDEO_CODEC toVideoCodec(IStreamSource *pSource) {
+        return AV_CODEC_ID_HEVC == pSource->getVideoCodeID() ? VIDEO_CODEC_HEVC : VIDEO_CODEC_H264;
+    }
+
+    // Hands a packet of pSource to the observer. getDtsUs() falls back to
+    // the pts, which puts both on one time base, and the references the
+    // observer keeps share the payload of kept.
+    void observe(IStreamSource *pSource, const AVPacket &kept, const AVPacket &packet,
+                 const uint64_t recvUs, const int64_t wallclockUs) {
+        IPacketObserver *pObserver = pObserver_.load();
+        if (nullptr == pObserver) {
+            return;
+        }
+        AVPacket presented = packet;
+        presented.dts = AV_NOPTS_VALUE;
+        pObserver->onPacket(channel_, kept, pSource->getDtsUs(presented), pSource->getDtsUs(packet),
+                            recvUs, wallclockUs);
+    }
+
+    // A reference to a copy of the packet in the pool. The demuxer's buffer
+    // goes right after the callback; what the queue and the recorders keep
+    // for seconds lives in the pool, by size class, and not between the
+    // short-lived allocations of FFmpeg. False when the pool has no chunk.
+    static bool copyToPool(PacketPool *pPool, const AVPacket &src, AVPacket &dst) {
+        void *opaque = nullptr;
+        uint8_t *pData = pPool->allocate(src.size + AV_INPUT_BUFFER_PADDING_SIZE, &opaque);
+        if (nullptr == pData) {
+            return false;
+        }
+        memcpy(pData, src.data, src.size);
+        memset(pData + src.size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        dst.buf = av_buffer_create(pData, src.size + AV_INPUT_BUFFER_PADDING_SIZE, PacketPool::release, opaque, 0);
+        if (nullptr == dst.buf) {
+            PacketPool::release(opaque, pData);
+            return false;
+        }
+        if (av_packet_copy_props(&dst, &src) < 0) {
+            av_packet_unref(&dst);
+            return false;
+        }
+        dst.data = pData;
+        dst.size = src.size;
+        return true;
+    }
+
+    // Paced without a speed limit the file is read as fast as the pipeline
+    // takes it, the taker waits for room instead of overflowing the queue.
+    // At a set speed it behaves like a camera and overflows like one.
+    bool waitForRoom() {
+        if (pPacer_->getParams().speed > 0.f) {
+            return true;
+        }
+        while (!bAbortPacing_) {
+            {
+                CSSAutoLock cAutoLockShared(&criobj_);
+                if (vpVideoPkt_.size() < nMaxQueued_) {
+                    return true;
+                }
+            }
+            usleep(1000);
+        }
+        return false;
+    }
+
+    typedef struct {
+        AVPacket packet;
+        uint64_t enqueueUs;
+        PACKET_STAMP stamp;
+        int64_t ptsUs;
+    } QUEUED_PACKET;
+
+    IStreamSource *stream_taker_{ nullptr };
+    std::atomic<IStreamSource *> main_taker_{ nullptr };	// recorded in place of stream_taker_
+    std::deque<QUEUED_PACKET> vpVideoPkt_;
+    std::atomic<IPacketObserver *> pObserver_{ nullptr };
+    std::atomic<PacketPool *> pPool_{ nullptr };
+    AVPacket current_;                  // returned by the last getData()
 
     bool bIsStopProvide{false};
 
-    uint8_t *pPktBuf_{ nullptr };
-    int nPktBuf_{ 1 << 20 };
+    size_t nMaxQueued_{ 1000 };
 
     simplelogger::Logger *logger_{ nullptr };
+    int channel_{ -1 };
     long hasReceiveVideoPacketCount{0};
     CCritSec criobj_;
 };
 
 
+typedef struct {
+    int startFrame = 0;         // position in the recording, moved on to the next keyframe
+    float frameRate = 25.f;     // recordings carry no timestamps
+    float rateJitter = 0.f;     // each frame interval varies by up to +-rateJitter of itself
+    unsigned seed = 0;
+    PACING_PARAMS pacing;       // speed and start offset, fps is taken from frameRate
+} VIRTUAL_CAMERA_PARAMS;
+
+// One channel of a camera farm replaying a SharedRecording. It starts at
+// a keyframe at or after startFrame, wraps around at the end and ends
+// after one full pass, so all channels of a farm play the same number
+// of pictures. Packets point into the shared mapping, a channel costs a
+// cursor and its pacer, whatever the number of channels.
+class VirtualCameraProvider : public DataProvider {
+public:
+    VirtualCameraProvider(const SharedRecording *_pRecording, const VIRTUAL_CAMERA_PARAMS &_params)
+            : pRecording_(_pRecording), params_(_params), rng_(_params.seed),
+              frameUs_(1e6 / std::max(_params.frameRate, 0.1f))
+    {
+        cursor_ = pRecording_->keyframeAtOrAfter(_params.startFrame % pRecording_->getNbFrames());
+        nLeft_ = pRecording_->getNbFrames();
+        PACING_PARAMS pacing = _params.pacing;
+        pacing.bEnabled = true;
+        pacing.fps = 0.f;
+        pPacer_ = new PacketPacer(pacing);
+    }
+
+    bool getData(uint8_t **_ppBuf, int *_pnBuf) {
+        while (nLeft_ > 0) {
+            const RECORDED_FRAME &frame = pRecording_->getFrame(cursor_);
+            const uint8_t *pData = pRecording_->getData(frame);
+            if (++cursor_ == pRecording_->getNbFrames()) {
+                cursor_ = pRecording_->keyframeAtOrAfter(0);
+            }
+            nLeft_--;
+            if (nPictures_++ > 0) {
+                std::uniform_real_distribution<double > jitter(-params_.rateJitter, params_.rateJitter);
+                dtsUs_ += (int64_t)(frameUs_ * (1.0 + (params_.rateJitter > 0.f ? jitter(rng_) : 0.0)));
+            }
+            if (!pace(pData, frame.size, dtsUs_) || !samplerAccepts(pData, frame.size, dtsUs_)) {
+                continue;
+            }
+            lastStamp_.recvUs = metricsNowUs();
+            lastStamp_.wallclockUs = 0;
+            lastStamp_.sourcePicture = sourcePicture();
+            lastStamp_.bStatic = staticPicture();
+            // read-only mapping, the workers copy the packet in pushPacket
+            *_ppBuf = const_cast<uint8_t *>(pData);
+            *_pnBuf = frame.size;
+            return true;
+        }
+        *_ppBuf = nullptr;
+        *_pnBuf = 0;
+        return false;
+    }
+
+    // another pass from where the last one ended
+    void reload() {
+        nLeft_ = pRecording_->getNbFrames();
+    }
+
+    VIDEO_CODEC getCodec() const { return pRecording_->getCodec(); }
+    int getFrameWidth() { return pRecording_->getWidth(); }
+    int getFrameHeight() { return pRecording_->getHeight(); }
+
+private:
+    const SharedRecording *pRecording_{ nullptr };
+    VIRTUAL_CAMERA_PARAMS params_;
+    std::minstd_rand rng_;
+    double frameUs_{ 40000. };
+    int cursor_{ 0 };
+    int nLeft_{ 0 };
+    int64_t nPictures_{ 0 };
+    int64_t dtsUs_{ 0 };
+};
+
+
+// One lane of the offline mode. It decodes the segments of a recording it
+// takes from a queue shared by all lanes, back to back and as fast as the
+// decoder goes, and ends when the queue is empty. The stamp of a packet
+// carries its picture number in the recording, which is how the results
+// are put back in order, see OfflineStitcher. A keyframe is prefixed with
+// the parameter sets in force when it does not carry them.
+class RecordingSegmentProvider : public DataProvider {
+public:
+    RecordingSegmentProvider(const SharedRecording *_pRecording, RecordingSegmentQueue *_pQueue)
+            : pRecording_(_pRecording), pQueue_(_pQueue) {}
+
+    bool getData(uint8_t **_ppBuf, int *_pnBuf) {
+        while (true) {
+            if (cursor_ >= end_) {
+                RECORDING_SEGMENT segment;
+                if (!pQueue_->next(segment)) {
+                    *_ppBuf = nullptr;
+                    *_pnBuf = 0;
+                    return false;
+                }
+                cursor_ = segment.firstFrame;
+                end_ = segment.firstFrame + segment.nFrames;
+            }
+            const int picture = cursor_++;
+            const RECORDED_FRAME &frame = pRecording_->getFrame(picture);
+            const uint8_t *pData = pRecording_->getData(frame);
+            int nData = frame.size;
+            // nominal 25 fps, the sampler's rate modes need a clock
+            if (!samplerAccepts(pData, nData, (int64_t)picture * 40000)) {
+                continue;
+            }
+            const std::vector<uint8_t > *pParameterSets = frame.bKeyframe ? pRecording_->getParameterSets(picture) : nullptr;
+            if (nullptr != pParameterSets) {
+                vBuf_.assign(pParameterSets->begin(), pParameterSets->end());
+                vBuf_.insert(vBuf_.end(), pData, pData + nData);
+                pData = vBuf_.data();
+                nData = (int)vBuf_.size();
+            }
+            lastStamp_.recvUs = metricsNowUs();
+            lastStamp_.wallclockUs = 0;
+            lastStamp_.sourcePicture = picture;
+            lastStamp_.bStatic = staticPicture();
+            *_ppBuf = const_cast<uint8_t *>(pData);
+            *_pnBuf = nData;
+            return true;
+        }
+    }
+
+    // the queue is consumed once
+    void reload() {}
+
+    VIDEO_CODEC getCodec() const { return pRecording_->getCodec(); }
+    int getFrameWidth() { return pRecording_->getWidth(); }
+    int getFrameHeight() { return pRecording_->getHeight(); }
+
+private:
+    const SharedRecording *pRecording_{ nullptr };
+    RecordingSegmentQueue *pQueue_{ nullptr };
+    int cursor_{ 0 };
+    int end_{ 0 };
+    std::vector<uint8_t > vBuf_;
+};
+
+
 //视频码流回调
 void videoPacketCallback(void *handle, AVPacket packet) {
     StreamDataProvider *streamTaker = (StreamDataProvider *) handle;
     streamTaker->putData(packet);
 }
 
+void mainPacketCallback(void *handle, AVPacket packet) {
+    ((StreamDataProvider *)handle)->putMainData(packet);
+}
+
 #endif // DATA_PROVIDER_H
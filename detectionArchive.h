@@ -0,0 +1,455 @@
+#ifndef DETECTION_ARCHIVE_H
+#define DETECTION_ARCHIVE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+// On-disk layout of the detection archive, one directory per channel:
+//
+//   <dir>/ch<N>/<startMs>.det   ARCHIVE_DATA_HEADER, then the blocks
+//   <dir>/ch<N>/<startMs>.dix   ARCHIVE_INDEX_HEADER, then one
+//                               ARCHIVE_BLOCK_ENTRY per block
+//
+// startMs is the capture time of the first frame in ms since epoch. Both
+// files are append-only; a block is written before its entry, so an entry
+// never points past the data. Within a file the capture times and frame
+// indices never go back, the writer starts a new file when they do, and
+// the entries are searched by time or frame with a binary search. Each
+// entry carries a presence bitmap of the classes in its block, queries
+// for a class skip the blocks without it undecoded.
+//
+// A block is self-contained given its entry. It is deflated unless that
+// does not make it smaller, then rawBytes equals nBytes. Inflated, per
+// frame, little varints:
+//
+//   zigzag(timeUs - previous timeUs)      the first one against firstTimeUs
+//   zigzag(frameIndex - previous frame)   the first one against firstFrame
+//   nBoxes
+//   per box: category, then x, y, w, h quantized to 1/ARCHIVE_QUANT, each
+//   as zigzag(q - q of the box at the same position in the previous frame)
+//
+// Boxes of a tracked object barely move between frames, most deltas fit
+// one byte, and deflate about halves what the detector's jitter leaves. The header has no dependency on the pipeline: tools include
+// it alone.
+
+static const uint32_t ARCHIVE_DATA_MAGIC = 0x43524144;		// "DARC"
+static const uint32_t ARCHIVE_INDEX_MAGIC = 0x58494444;		// "DDIX"
+static const uint16_t ARCHIVE_VERSION = 1;
+static const int ARCHIVE_QUANT = 4095;
+static const int ARCHIVE_MAX_CLASSES = 32;					// classes from 31 up share the last bit
+
+#pragma pack(push, 1)
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+} ARCHIVE_DATA_HEADER;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t quant;
+	uint32_t entrySize;
+	uint32_t reserved;
+} ARCHIVE_INDEX_HEADER;
+
+typedef struct {
+	int64_t firstTimeUs;		// capture time since epoch
+	int64_t lastTimeUs;
+	int64_t firstFrame;
+	int64_t lastFrame;
+	uint64_t offset;			// of the block in the data file
+	uint32_t nBytes;			// in the data file
+	uint32_t nFrames;
+	uint32_t nBoxes;
+	uint32_t classMask;			// bit c: a box of class c in the block
+	uint32_t rawBytes;			// inflated
+	uint32_t reserved;
+} ARCHIVE_BLOCK_ENTRY;
+#pragma pack(pop)
+
+typedef struct {
+	float x;					// normalized like BBOX_INFO
+	float y;
+	float w;
+	float h;
+	int category;
+} ARCHIVE_BOX;
+
+typedef struct {
+	int64_t timeUs = 0;
+	int64_t frameIndex = 0;
+	std::vector<ARCHIVE_BOX > vBoxes;
+} ARCHIVE_FRAME;
+
+inline uint32_t archiveClassBit(const int category) {
+	return 1u << std::min(std::max(category, 0), ARCHIVE_MAX_CLASSES - 1);
+}
+
+inline void putVarint(std::vector<uint8_t > &vOut, uint64_t v) {
+	while (v >= 0x80) {
+		vOut.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	vOut.push_back((uint8_t)v);
+}
+
+// false past the end or on an overlong varint
+inline bool getVarint(const uint8_t *&p, const uint8_t *pEnd, uint64_t &v) {
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (p == pEnd) {
+			return false;
+		}
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if (0 == (b & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+inline uint64_t zigzag(const int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline int64_t unzigzag(const uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// Encodes the frames of one block, see the layout above.
+class ArchiveBlockEncoder {
+public:
+	void reset() {
+		vData_.clear();
+		vPrevious_.clear();
+		entry_ = ARCHIVE_BLOCK_ENTRY();
+	}
+
+	void add(const int64_t timeUs, const int64_t frameIndex, const ARCHIVE_BOX *pBoxes, const int nBoxes) {
+		if (0 == entry_.nFrames) {
+			entry_.firstTimeUs = entry_.lastTimeUs = timeUs;
+			entry_.firstFrame = entry_.lastFrame = frameIndex;
+		}
+		putVarint(vData_, zigzag(timeUs - entry_.lastTimeUs));
+		putVarint(vData_, zigzag(frameIndex - entry_.lastFrame));
+		putVarint(vData_, nBoxes);
+		for (int i = 0; i < nBoxes; ++i) {
+			const ARCHIVE_BOX &box = pBoxes[i];
+			uint16_t q[4] = { quantize(box.x), quantize(box.y), quantize(box.w), quantize(box.h) };
+			if (i == (int)vPrevious_.size()) {
+				vPrevious_.push_back(QUANT_BOX());
+			}
+			QUANT_BOX &previous = vPrevious_[i];
+			putVarint(vData_, std::max(box.category, 0));
+			for (int j = 0; j < 4; ++j) {
+				putVarint(vData_, zigzag((int64_t)q[j] - previous.q[j]));
+				previous.q[j] = q[j];
+			}
+			entry_.classMask |= archiveClassBit(box.category);
+		}
+		// positions past nBoxes keep their last box, the decoder does the same
+		entry_.lastTimeUs = timeUs;
+		entry_.lastFrame = frameIndex;
+		entry_.nFrames++;
+		entry_.nBoxes += nBoxes;
+	}
+
+	bool empty() const { return 0 == entry_.nFrames; }
+	size_t getRawBytes() const { return vData_.size(); }
+
+	// The block as it is written, deflated into vOut unless that is no
+	// smaller. The entry takes offset from the writer.
+	const std::vector<uint8_t > &finish(std::vector<uint8_t > &vOut, ARCHIVE_BLOCK_ENTRY &entry) {
+		entry = entry_;
+		entry.rawBytes = vData_.size();
+		uLongf nOut = compressBound(vData_.size());
+		vOut.resize(nOut);
+		if (Z_OK == compress2(vOut.data(), &nOut, vData_.data(), vData_.size(), 1) && nOut < vData_.size()) {
+			vOut.resize(nOut);
+			entry.nBytes = nOut;
+			return vOut;
+		}
+		entry.nBytes = vData_.size();
+		return vData_;
+	}
+
+	static uint16_t quantize(const float v) {
+		return (uint16_t)(std::min(std::max(v, 0.f), 1.f) * ARCHIVE_QUANT + 0.5f);
+	}
+
+private:
+	typedef struct {
+		uint16_t q[4] = { 0, 0, 0, 0 };
+	} QUANT_BOX;
+
+	std::vector<uint8_t > vData_;
+	std::vector<QUANT_BOX > vPrevious_;
+	ARCHIVE_BLOCK_ENTRY entry_ = ARCHIVE_BLOCK_ENTRY();
+};
+
+// The block as the encoder left it, inflated into vRaw if need be;
+// nullptr on a corrupt block.
+inline const uint8_t *inflateArchiveBlock(const uint8_t *pData, const ARCHIVE_BLOCK_ENTRY &entry,
+											std::vector<uint8_t > &vRaw) {
+	if (entry.rawBytes == entry.nBytes) {
+		return pData;
+	}
+	vRaw.resize(entry.rawBytes);
+	uLongf nRaw = entry.rawBytes;
+	if (Z_OK != uncompress(vRaw.data(), &nRaw, pData, entry.nBytes) || nRaw != entry.rawBytes) {
+		return nullptr;
+	}
+	return vRaw.data();
+}
+
+// Calls onFrame(const ARCHIVE_FRAME &) for every frame of the inflated
+// block, it returns false to stop. False on a corrupt block.
+template <typename F>
+bool decodeArchiveBlock(const uint8_t *pRaw, const ARCHIVE_BLOCK_ENTRY &entry, F onFrame) {
+	const uint8_t *p = pRaw, *pEnd = pRaw + entry.rawBytes;
+	ARCHIVE_FRAME frame;
+	frame.timeUs = entry.firstTimeUs;
+	frame.frameIndex = entry.firstFrame;
+	std::vector<uint16_t > vPrevious;
+	for (uint32_t iF = 0; iF < entry.nFrames; ++iF) {
+		uint64_t dt, df, nBoxes, category, dq;
+		if (!getVarint(p, pEnd, dt) || !getVarint(p, pEnd, df) || !getVarint(p, pEnd, nBoxes) || nBoxes > entry.nBoxes) {
+			return false;
+		}
+		frame.timeUs += unzigzag(dt);
+		frame.frameIndex += unzigzag(df);
+		frame.vBoxes.resize(nBoxes);
+		if (vPrevious.size() < 4 * nBoxes) {
+			vPrevious.resize(4 * nBoxes, 0);
+		}
+		for (uint64_t i = 0; i < nBoxes; ++i) {
+			if (!getVarint(p, pEnd, category)) {
+				return false;
+			}
+			float v[4];
+			for (int j = 0; j < 4; ++j) {
+				if (!getVarint(p, pEnd, dq)) {
+					return false;
+				}
+				uint16_t &q = vPrevious[4 * i + j];
+				q = (uint16_t)(q + unzigzag(dq));
+				v[j] = (float)q / ARCHIVE_QUANT;
+			}
+			ARCHIVE_BOX &box = frame.vBoxes[i];
+			box.x = v[0];
+			box.y = v[1];
+			box.w = v[2];
+			box.h = v[3];
+			box.category = (int)category;
+		}
+		if (!onFrame(frame)) {
+			break;
+		}
+	}
+	return true;
+}
+
+typedef struct {
+	int64_t startUs = 0;
+	int64_t endUs = 0;			// last write
+	uint64_t nBytes = 0;		// data and index
+	std::string path;
+	std::string indexPath;
+} ARCHIVE_FILE;
+
+inline std::string archiveChannelDir(const std::string &dir, const int channel) {
+	return dir + "/ch" + std::to_string(channel);
+}
+
+// The files of a channel directory, oldest first.
+inline void listArchiveFiles(const std::string &channelDir, std::vector<ARCHIVE_FILE > &vFiles) {
+	vFiles.clear();
+	DIR *pDir = opendir(channelDir.c_str());
+	if (nullptr == pDir) {
+		return;
+	}
+	struct dirent *pEntry = nullptr;
+	while (nullptr != (pEntry = readdir(pDir))) {
+		const char *szName = pEntry->d_name;
+		const char *szExt = strrchr(szName, '.');
+		if (nullptr == szExt || 0 != strcmp(szExt, ".det")) {
+			continue;
+		}
+		char *szEnd = nullptr;
+		long long startMs = strtoll(szName, &szEnd, 10);
+		if (szEnd != szExt) {
+			continue;
+		}
+		ARCHIVE_FILE file;
+		file.startUs = startMs * 1000;
+		file.path = channelDir + "/" + szName;
+		file.indexPath = channelDir + "/" + std::string(szName, szExt - szName) + ".dix";
+		struct stat st;
+		if (0 == stat(file.path.c_str(), &st)) {
+			file.nBytes = st.st_size;
+			file.endUs = (int64_t)st.st_mtime * 1000000 + st.st_mtim.tv_nsec / 1000;
+		}
+		if (0 == stat(file.indexPath.c_str(), &st)) {
+			file.nBytes += st.st_size;
+			file.endUs = std::max(file.endUs, (int64_t)st.st_mtime * 1000000 + st.st_mtim.tv_nsec / 1000);
+		}
+		vFiles.push_back(file);
+	}
+	closedir(pDir);
+	std::sort(vFiles.begin(), vFiles.end(),
+			[](const ARCHIVE_FILE &a, const ARCHIVE_FILE &b) { return a.startUs < b.startUs; });
+}
+
+// A file mapped read-only for the life of the object.
+class MappedFile {
+public:
+	explicit
+	MappedFile(const std::string &path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+		struct stat st;
+		if (0 == fstat(fd, &st) && st.st_size > 0) {
+			void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (MAP_FAILED != p) {
+				pData_ = reinterpret_cast<const uint8_t *>(p);
+				nData_ = st.st_size;
+			}
+		}
+		close(fd);
+	}
+
+	~MappedFile() {
+		if (nullptr != pData_) {
+			munmap(const_cast<uint8_t *>(pData_), nData_);
+		}
+	}
+
+	const uint8_t *data() const { return pData_; }
+	size_t size() const { return nData_; }
+
+private:
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	const uint8_t *pData_{ nullptr };
+	size_t nData_{ 0 };
+};
+
+typedef struct {
+	int channel = 0;
+	int64_t fromUs = INT64_MIN;		// capture time, inclusive
+	int64_t toUs = INT64_MAX;
+	int64_t firstFrame = INT64_MIN;	// frame indices, inclusive, within the time range
+	int64_t lastFrame = INT64_MAX;
+	uint32_t classMask = 0xFFFFFFFF;
+} ARCHIVE_QUERY;
+
+typedef struct {
+	uint64_t nFiles = 0;			// mapped
+	uint64_t nBlocks = 0;			// in the time and frame range
+	uint64_t nBlocksDecoded = 0;	// of those, with a class of the query
+	uint64_t nFrames = 0;			// returned
+	uint64_t nBoxes = 0;
+} ARCHIVE_QUERY_STATS;
+
+// Calls onFrame(const ARCHIVE_FRAME &) for every frame in the range with
+// a box of the query classes, the frame holds those boxes only. Files go
+// by start time, frames in time order within a file. onFrame returns
+// false to stop. The files are mapped one at a time; only the index
+// entries in the range are read, and only the blocks with a class of the
+// query are decoded.
+template <typename F>
+void queryDetectionArchive(const std::string &dir, const ARCHIVE_QUERY &query, F onFrame,
+							ARCHIVE_QUERY_STATS *pStats = nullptr) {
+	ARCHIVE_QUERY_STATS stats;
+	std::vector<ARCHIVE_FILE > vFiles;
+	listArchiveFiles(archiveChannelDir(dir, query.channel), vFiles);
+	ARCHIVE_FRAME matched;
+	std::vector<uint8_t > vRaw;
+	bool bStop = false;
+	for (size_t iFile = 0; iFile < vFiles.size() && !bStop; ++iFile) {
+		bool bPast = false;
+		const ARCHIVE_FILE &file = vFiles[iFile];
+		// A file ends where the next one starts, unless the clock stepped
+		// back in between; then it was last written after the step.
+		bool bBefore = iFile + 1 < vFiles.size() && vFiles[iFile + 1].startUs <= query.fromUs
+						&& file.endUs < query.fromUs;
+		if (file.startUs > query.toUs || bBefore) {
+			continue;
+		}
+		MappedFile index(file.indexPath);
+		const ARCHIVE_INDEX_HEADER *pHeader = reinterpret_cast<const ARCHIVE_INDEX_HEADER *>(index.data());
+		if (index.size() < sizeof(ARCHIVE_INDEX_HEADER) || ARCHIVE_INDEX_MAGIC != pHeader->magic
+			|| sizeof(ARCHIVE_BLOCK_ENTRY) != pHeader->entrySize || ARCHIVE_QUANT != pHeader->quant) {
+			continue;
+		}
+		// an index cut short by a crash ends at its last whole entry
+		const ARCHIVE_BLOCK_ENTRY *pBegin = reinterpret_cast<const ARCHIVE_BLOCK_ENTRY *>(index.data() + sizeof(ARCHIVE_INDEX_HEADER));
+		const ARCHIVE_BLOCK_ENTRY *pEnd = pBegin + (index.size() - sizeof(ARCHIVE_INDEX_HEADER)) / sizeof(ARCHIVE_BLOCK_ENTRY);
+		const ARCHIVE_BLOCK_ENTRY *pFirst = std::partition_point(pBegin, pEnd,
+			[&query](const ARCHIVE_BLOCK_ENTRY &e) { return e.lastTimeUs < query.fromUs || e.lastFrame < query.firstFrame; });
+		const ARCHIVE_BLOCK_ENTRY *pLast = std::partition_point(pFirst, pEnd,
+			[&query](const ARCHIVE_BLOCK_ENTRY &e) { return e.firstTimeUs <= query.toUs && e.firstFrame <= query.lastFrame; });
+		if (pFirst == pLast) {
+			continue;
+		}
+		MappedFile data(file.path);
+		stats.nFiles++;
+		for (const ARCHIVE_BLOCK_ENTRY *pEntry = pFirst; pEntry != pLast && !bStop && !bPast; ++pEntry) {
+			stats.nBlocks++;
+			if (0 == (pEntry->classMask & query.classMask) || pEntry->offset + pEntry->nBytes > data.size()) {
+				continue;
+			}
+			const uint8_t *pRaw = inflateArchiveBlock(data.data() + pEntry->offset, *pEntry, vRaw);
+			if (nullptr == pRaw) {
+				continue;
+			}
+			stats.nBlocksDecoded++;
+			decodeArchiveBlock(pRaw, *pEntry, [&](const ARCHIVE_FRAME &frame) {
+				if (frame.timeUs > query.toUs || frame.frameIndex > query.lastFrame) {
+					bPast = true;
+					return false;
+				}
+				if (frame.timeUs < query.fromUs || frame.frameIndex < query.firstFrame) {
+					return true;
+				}
+				matched.timeUs = frame.timeUs;
+				matched.frameIndex = frame.frameIndex;
+				matched.vBoxes.clear();
+				for (size_t i = 0; i < frame.vBoxes.size(); ++i) {
+					if (0 != (archiveClassBit(frame.vBoxes[i].category) & query.classMask)) {
+						matched.vBoxes.push_back(frame.vBoxes[i]);
+					}
+				}
+				if (matched.vBoxes.empty()) {
+					return true;
+				}
+				stats.nFrames++;
+				stats.nBoxes += matched.vBoxes.size();
+				bStop = !onFrame(matched);
+				return !bStop;
+			});
+		}
+	}
+	if (nullptr != pStats) {
+		*pStats = stats;
+	}
+}
+
+#endif // DETECTION_ARCHIVE_H
@@ -0,0 +1,129 @@
+#ifndef DETECTION_ARCHIVE_MODULE_H
+#define DETECTION_ARCHIVE_MODULE_H
+
+#include <chrono>
+#include "common.h"
+#include "detectionArchiveWriter.h"
+
+// Appends the detections of the parser to the detection archive, see
+// detectionArchive.h, stamped with the capture time of the picture. The
+// modules of all device workers share one writer.
+class DetectionArchiveModule : public IModule {
+public:
+	explicit
+	DetectionArchiveModule(PRE_MODULE_LIST &preModules,
+							DetectionArchiveWriter *pWriter,
+							simplelogger::Logger *logger,
+							ChannelScheduler *pScheduler = nullptr,
+							const int workerID = 0)
+	: preModules_(preModules), pWriter_(pWriter), logger_(logger), pScheduler_(pScheduler), workerID_(workerID) {}
+
+	~DetectionArchiveModule() {}
+
+	// override
+	void initialize() override {}
+
+	void execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) override;
+
+	void destroy() override {}
+
+	int getNbInputs() const override {
+		return preModules_.size();
+	}
+
+	PRE_MODULE getPreModule(const int tensorIndex) const override {
+		return preModules_[tensorIndex];
+	}
+
+	int getNbOutputs() const override {
+		return vpOutputTensors_.size();
+	}
+
+	IStreamTensor* getOutputTensor(const int tensorIndex) const override {
+		return vpOutputTensors_[tensorIndex];
+	}
+
+	void setProfiler(IModuleProfiler *pProfiler) override {
+		pProfiler_ = pProfiler;
+	}
+
+	IModuleProfiler* getProfiler() const override {
+		return pProfiler_;
+	}
+
+	void setCallback(void *pUserData, MODULE_CALLBACK callback) override {
+		pUserData_ = pUserData;
+		callback_ = callback;
+	}
+
+	std::pair<void *, MODULE_CALLBACK> getCallback() const override {
+		return std::pair<void*, MODULE_CALLBACK>(pUserData_, callback_);
+	}
+
+private:
+	DetectionArchiveWriter *pWriter_{ nullptr };
+	simplelogger::Logger *logger_{ nullptr };
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
+	// execute() runs on the worker's thread
+	std::vector<ARCHIVE_BOX > vBoxes_;
+
+	void *pUserData_{ nullptr };
+	MODULE_CALLBACK callback_{ nullptr };
+	IModuleProfiler* pProfiler_{ nullptr };
+
+	PRE_MODULE_LIST preModules_;
+	std::vector<IStreamTensor*> vpOutputTensors_;
+};
+
+void DetectionArchiveModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
+	TRACE_RANGE("DetectionArchiveModule::execute");
+	assert(1 == vpInputTensors.size());
+	assert(OBJ_COORD == vpInputTensors[0]->getTensorType());
+	int nFrames = vpInputTensors[0]->getShape()[0];
+	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(vpInputTensors[0]->getCpuData());
+	if (0 == nFrames || nullptr == pBBox_batch) {
+		return;
+	}
+	for (int iF = 0; iF < nFrames; ++iF) {
+		BBOXS_PER_FRAME &bboxs = pBBox_batch[iF];
+		vBoxes_.clear();
+		for (int i = 0; i < bboxs.nBBox; ++i) {
+			const BBOX_INFO &bbox = bboxs.bbox[i];
+			if (bbox.bSkip) {
+				continue;
+			}
+			ARCHIVE_BOX box;
+			box.x = bbox.x;
+			box.y = bbox.y;
+			box.w = bbox.w;
+			box.h = bbox.h;
+			box.category = bbox.category;
+			vBoxes_.push_back(box);
+		}
+		if (vBoxes_.empty()) {
+			continue;
+		}
+		int lane = bboxs.videoIndex;
+		int channel = lane;
+		if (nullptr != pScheduler_) {
+			channel = pScheduler_->getChannel(workerID_, lane);
+			if (channel < 0) {
+				continue;
+			}
+		}
+		// sources without a capture time are archived by the end of the analysis
+		PACKET_STAMP stamp;
+		int64_t timeUs = 0;
+		if (nullptr != g_pTracer && g_pTracer->lookup(workerID_, lane, bboxs.frameIndex, stamp)) {
+			timeUs = stamp.wallclockUs;
+		}
+		if (timeUs <= 0) {
+			timeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+						std::chrono::system_clock::now().time_since_epoch()).count();
+		}
+		pWriter_->append(channel, timeUs, bboxs.frameIndex, vBoxes_.data(), vBoxes_.size());
+	}
+}
+
+#endif // DETECTION_ARCHIVE_MODULE_H
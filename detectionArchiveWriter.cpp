@@ -0,0 +1,193 @@
+#include "detectionArchiveWriter.h"
+#include <cerrno>
+#include <chrono>
+
+static int64_t systemNowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t steadyNowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool makeDir(const std::string &dir) {
+	return 0 == mkdir(dir.c_str(), 0755) || EEXIST == errno;
+}
+
+bool DetectionArchiveWriter::start() {
+	if (!makeDir(params_.dir)) {
+		LOG_ERROR(logger_, "DetectionArchiveWriter: cannot create " << params_.dir);
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(mtx_);
+	for (int i = 0; i < (int)vChannels_.size(); ++i) {
+		applyRetention(i);
+	}
+	LOG_INFO(logger_, "DetectionArchiveWriter: archive in " << params_.dir << ", " << params_.fileSec << " s files, "
+						<< (params_.blockBytes >> 10) << " KB blocks");
+	return true;
+}
+
+void DetectionArchiveWriter::close() {
+	std::lock_guard<std::mutex> lock(mtx_);
+	for (int i = 0; i < (int)vChannels_.size(); ++i) {
+		closeFile(i);
+	}
+}
+
+void DetectionArchiveWriter::closeChannel(const int channel) {
+	std::lock_guard<std::mutex> lock(mtx_);
+	closeFile(channel);
+}
+
+uint64_t DetectionArchiveWriter::getNbBoxes() const {
+	std::lock_guard<std::mutex> lock(mtx_);
+	return nBoxes_;
+}
+
+uint64_t DetectionArchiveWriter::getNbBytes() const {
+	std::lock_guard<std::mutex> lock(mtx_);
+	return nBytes_;
+}
+
+void DetectionArchiveWriter::append(const int channel, const int64_t timeUs, const int64_t frameIndex,
+									const ARCHIVE_BOX *pBoxes, const int nBoxes) {
+	if (channel < 0 || channel >= (int)vChannels_.size() || nBoxes <= 0) {
+		return;
+	}
+	uint64_t nowUs = steadyNowUs();
+	std::lock_guard<std::mutex> lock(mtx_);
+	CHANNEL_ARCHIVE &ch = vChannels_[channel];
+	// jitter of the capture clock is held back, larger steps start a file
+	int64_t t = timeUs;
+	if (nullptr != ch.fp && t < ch.lastTimeUs && ch.lastTimeUs - t < 1000000) {
+		t = ch.lastTimeUs;
+	}
+	// the entries are searched by time and frame, neither goes back in a file
+	if (nullptr != ch.fp && (t < ch.lastTimeUs || frameIndex < ch.lastFrame
+		|| t - ch.fileStartUs >= (int64_t)(params_.fileSec * 1e6))) {
+		closeFile(channel);
+	}
+	if (nullptr == ch.fp && !openFile(channel, t)) {
+		return;
+	}
+	if (ch.encoder.empty()) {
+		ch.blockOpenedUs = nowUs;
+	}
+	ch.encoder.add(t, frameIndex, pBoxes, nBoxes);
+	ch.lastTimeUs = t;
+	ch.lastFrame = frameIndex;
+	nBoxes_ += nBoxes;
+	if (ch.encoder.getRawBytes() >= params_.blockBytes) {
+		writeBlock(ch);
+	}
+	// blocks of quiet channels, at most once a second
+	uint64_t blockUs = (uint64_t)(params_.blockSec * 1e6);
+	if (nowUs - lastSweepUs_ >= 1000000) {
+		lastSweepUs_ = nowUs;
+		for (size_t i = 0; i < vChannels_.size(); ++i) {
+			if (!vChannels_[i].encoder.empty() && nowUs - vChannels_[i].blockOpenedUs >= blockUs) {
+				writeBlock(vChannels_[i]);
+			}
+		}
+	}
+}
+
+// with mtx_ held
+void DetectionArchiveWriter::writeBlock(CHANNEL_ARCHIVE &ch) {
+	if (ch.encoder.empty()) {
+		return;
+	}
+	ARCHIVE_BLOCK_ENTRY entry;
+	const std::vector<uint8_t > &vData = ch.encoder.finish(vDeflated_, entry);
+	entry.offset = ch.offset;
+	// the block reaches the file before the entry which points to it
+	if (vData.size() != fwrite(vData.data(), 1, vData.size(), ch.fp) || 0 != fflush(ch.fp)
+		|| 1 != fwrite(&entry, sizeof(entry), 1, ch.fpIndex) || 0 != fflush(ch.fpIndex)) {
+		LOG_WARN(logger_, "DetectionArchiveWriter: write failed, " << entry.nBoxes << " boxes lost");
+	} else {
+		ch.offset += vData.size();
+		nBytes_ += vData.size() + sizeof(entry);
+	}
+	ch.encoder.reset();
+}
+
+// with mtx_ held
+bool DetectionArchiveWriter::openFile(const int channel, const int64_t timeUs) {
+	CHANNEL_ARCHIVE &ch = vChannels_[channel];
+	std::string channelDir = archiveChannelDir(params_.dir, channel);
+	if (!makeDir(channelDir)) {
+		LOG_WARN(logger_, "DetectionArchiveWriter: cannot create " << channelDir);
+		return false;
+	}
+	std::string base = channelDir + "/" + std::to_string(timeUs / 1000);
+	// a clock step back onto the name of an older file starts after it
+	std::string path = base + ".det";
+	for (int i = 1; 0 == access(path.c_str(), F_OK); ++i) {
+		base = channelDir + "/" + std::to_string(timeUs / 1000 + i);
+		path = base + ".det";
+	}
+	ch.fp = fopen(path.c_str(), "wb");
+	ch.fpIndex = fopen((base + ".dix").c_str(), "wb");
+	if (nullptr == ch.fp || nullptr == ch.fpIndex) {
+		LOG_WARN(logger_, "DetectionArchiveWriter: cannot write " << path);
+		if (nullptr != ch.fp) {
+			fclose(ch.fp);
+			ch.fp = nullptr;
+		}
+		if (nullptr != ch.fpIndex) {
+			fclose(ch.fpIndex);
+			ch.fpIndex = nullptr;
+		}
+		return false;
+	}
+	ARCHIVE_DATA_HEADER dataHeader;
+	dataHeader.magic = ARCHIVE_DATA_MAGIC;
+	dataHeader.version = ARCHIVE_VERSION;
+	dataHeader.reserved = 0;
+	fwrite(&dataHeader, sizeof(dataHeader), 1, ch.fp);
+	ARCHIVE_INDEX_HEADER indexHeader;
+	indexHeader.magic = ARCHIVE_INDEX_MAGIC;
+	indexHeader.version = ARCHIVE_VERSION;
+	indexHeader.quant = ARCHIVE_QUANT;
+	indexHeader.entrySize = sizeof(ARCHIVE_BLOCK_ENTRY);
+	indexHeader.reserved = 0;
+	fwrite(&indexHeader, sizeof(indexHeader), 1, ch.fpIndex);
+	ch.fileStartUs = timeUs;
+	ch.offset = sizeof(dataHeader);
+	ch.encoder.reset();
+	applyRetention(channel);
+	return true;
+}
+
+// with mtx_ held
+void DetectionArchiveWriter::closeFile(const int channel) {
+	CHANNEL_ARCHIVE &ch = vChannels_[channel];
+	if (nullptr == ch.fp) {
+		return;
+	}
+	writeBlock(ch);
+	fclose(ch.fp);
+	fclose(ch.fpIndex);
+	ch.fp = nullptr;
+	ch.fpIndex = nullptr;
+}
+
+// with mtx_ held, the open file of the channel is never old enough
+void DetectionArchiveWriter::applyRetention(const int channel) {
+	if (params_.keepHours <= 0.f) {
+		return;
+	}
+	int64_t expiredUs = systemNowUs() - (int64_t)(params_.keepHours * 3600e6);
+	std::vector<ARCHIVE_FILE > vFiles;
+	listArchiveFiles(archiveChannelDir(params_.dir, channel), vFiles);
+	for (size_t i = 0; i < vFiles.size(); ++i) {
+		if (vFiles[i].endUs < expiredUs) {
+			unlink(vFiles[i].path.c_str());
+			unlink(vFiles[i].indexPath.c_str());
+			LOG_DEBUG(logger_, "DetectionArchiveWriter: " << vFiles[i].path << " expired");
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef DETECTION_ARCHIVE_WRITER_H
+#define DETECTION_ARCHIVE_WRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "detectionArchive.h"
+#include "common/logger.h"
+
+typedef struct {
+	std::string dir = ".";
+	float fileSec = 3600.f;				// a new file per channel past this
+	size_t blockBytes = 64 << 10;		// before deflate, a block is written past this
+	float blockSec = 10.f;				// or once it is this old, which bounds what a crash loses
+	float keepHours = 0.f;				// files last written before this are deleted, 0 keeps them
+} ARCHIVE_PARAMS;
+
+// Appends the detections of every channel to the archive, see
+// detectionArchive.h. append() encodes into the open block of the channel;
+// full blocks are written with their index entry right away, blocks of
+// quiet channels once they are blockSec old.
+class DetectionArchiveWriter {
+public:
+	explicit
+	DetectionArchiveWriter(const int nChannels, const ARCHIVE_PARAMS &params, simplelogger::Logger *logger)
+	: params_(params), logger_(logger), vChannels_(nChannels) {}
+
+	~DetectionArchiveWriter() {
+		close();
+	}
+
+	// applies the retention to the files of earlier runs
+	bool start();
+	// writes the open blocks and closes the files
+	void close();
+
+	// One frame with at least one box; timeUs is the capture time since
+	// epoch. Frames of a channel come in order of their frame index.
+	void append(const int channel, const int64_t timeUs, const int64_t frameIndex,
+				const ARCHIVE_BOX *pBoxes, const int nBoxes);
+	// Writes the open block and closes the file of a detached channel.
+	void closeChannel(const int channel);
+
+	uint64_t getNbBoxes() const;
+	uint64_t getNbBytes() const;
+
+private:
+	typedef struct {
+		FILE *fp = nullptr;
+		FILE *fpIndex = nullptr;
+		int64_t fileStartUs = 0;
+		uint64_t offset = 0;
+		int64_t lastTimeUs = 0;				// of the file
+		int64_t lastFrame = 0;
+		ArchiveBlockEncoder encoder;
+		uint64_t blockOpenedUs = 0;			// steady clock
+	} CHANNEL_ARCHIVE;
+
+	bool openFile(const int channel, const int64_t timeUs);
+	void closeFile(const int channel);
+	void writeBlock(CHANNEL_ARCHIVE &ch);
+	void applyRetention(const int channel);
+
+	ARCHIVE_PARAMS params_;
+	simplelogger::Logger *logger_{ nullptr };
+	mutable std::mutex mtx_;
+	std::vector<CHANNEL_ARCHIVE > vChannels_;
+	std::vector<uint8_t > vDeflated_;
+	uint64_t lastSweepUs_{ 0 };
+	uint64_t nBoxes_{ 0 };
+	uint64_t nBytes_{ 0 };
+};
+
+#endif // DETECTION_ARCHIVE_WRITER_H
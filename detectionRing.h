@@ -0,0 +1,298 @@
+#ifndef DETECTION_RING_H
+#define DETECTION_RING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Detections published into POSIX shared memory, one record per analysed
+// frame. The header has no dependency on DeepStream: local consumers
+// include it alone and link with -lrt.
+//
+// Layout of the shared object, all fields native endian:
+//
+//   RING_HEADER                        headerSize bytes
+//   RING_SLOT[capacity]                slotSize bytes each
+//
+// A slot is a seqlock: its seq is 2 * pos + 1 while record pos is written
+// and 2 * pos + 2 once it is complete. Writers reserve positions from the
+// head, readers keep their own position and never block the writers; a
+// reader which falls more than capacity records behind loses the oldest.
+
+static const uint32_t DETECTION_RING_MAGIC = 0x47525344;	// "DSRG"
+static const uint32_t DETECTION_RING_VERSION = 1;
+static const int DETECTION_RING_MAX_BOXES = 64;
+static const int DETECTION_RING_MAX_CHANNELS = 128;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the ring needs lock-free 64-bit atomics");
+
+typedef struct {
+	float x, y, w, h;			// normalized to (0, 1) of the output geometry
+	int32_t category;			// line of the label file
+	uint32_t reserved;
+} RING_BOX;
+
+typedef struct {
+	uint64_t channelSeq;		// per channel from 1, a gap is a lost record
+	int64_t frameIndex;			// decoded frame of the lane
+	int64_t sourcePicture;		// picture number in the source, -1 if unknown
+	uint64_t recvUs;			// av_read_frame, steady clock, 0 if unknown
+	int64_t wallclockUs;		// capture time in us since epoch, 0 if unknown
+	uint64_t sinkUs;			// published, steady clock
+	int32_t channel;
+	int32_t outputWidth;		// scales the boxes, e.g. the main stream
+	int32_t outputHeight;
+	int32_t nBoxes;
+	int32_t nDropped;			// boxes beyond DETECTION_RING_MAX_BOXES
+	uint32_t reserved;
+	RING_BOX boxes[DETECTION_RING_MAX_BOXES];
+} DETECTION_RECORD;
+
+typedef struct alignas(64) {
+	uint32_t magic;				// written last, 0 while the writer sets up
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t slotSize;
+	uint32_t recordSize;
+	uint32_t capacity;			// a power of two
+	uint32_t maxChannels;
+	int32_t writerPid;
+	alignas(64) std::atomic<uint64_t > head;	// positions handed out so far
+	alignas(64) std::atomic<uint64_t > channelSeq[DETECTION_RING_MAX_CHANNELS];
+} RING_HEADER;
+
+typedef struct alignas(64) {
+	std::atomic<uint64_t > seq;
+	alignas(64) DETECTION_RECORD record;
+} RING_SLOT;
+
+// record bytes up to the last used box
+inline size_t detectionRecordBytes(const int nBoxes) {
+	return offsetof(DETECTION_RECORD, boxes) + nBoxes * sizeof(RING_BOX);
+}
+
+// Creates the shared object, any number of pipeline threads publish into it.
+class DetectionRingWriter {
+public:
+	explicit
+	DetectionRingWriter(const char *szName, const int capacity)
+	: name_(szName) {
+		capacity_ = 1;
+		while (capacity_ < (uint32_t)capacity) {
+			capacity_ <<= 1;
+		}
+	}
+
+	~DetectionRingWriter() {
+		if (nullptr != pHeader_) {
+			munmap(pHeader_, nBytes_);
+			shm_unlink(name_.c_str());
+		}
+	}
+
+	// Replaces an object left by an earlier run, its readers keep the old
+	// mapping and notice the writer is gone.
+	bool create() {
+		shm_unlink(name_.c_str());
+		int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd < 0) {
+			return false;
+		}
+		nBytes_ = sizeof(RING_HEADER) + (size_t)capacity_ * sizeof(RING_SLOT);
+		if (0 != ftruncate(fd, nBytes_)) {
+			close(fd);
+			shm_unlink(name_.c_str());
+			return false;
+		}
+		void *p = mmap(nullptr, nBytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (MAP_FAILED == p) {
+			shm_unlink(name_.c_str());
+			return false;
+		}
+		// the object is zero filled, the atomics start at 0
+		pHeader_ = (RING_HEADER *)p;
+		pSlots_ = (RING_SLOT *)((uint8_t *)p + sizeof(RING_HEADER));
+		pHeader_->version = DETECTION_RING_VERSION;
+		pHeader_->headerSize = sizeof(RING_HEADER);
+		pHeader_->slotSize = sizeof(RING_SLOT);
+		pHeader_->recordSize = sizeof(DETECTION_RECORD);
+		pHeader_->capacity = capacity_;
+		pHeader_->maxChannels = DETECTION_RING_MAX_CHANNELS;
+		pHeader_->writerPid = getpid();
+		std::atomic_thread_fence(std::memory_order_release);
+		__atomic_store_n(&pHeader_->magic, DETECTION_RING_MAGIC, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	// Stamps channelSeq and publishes the record, never blocks. Thread safe.
+	void publish(DETECTION_RECORD &record) {
+		if (record.channel < 0 || record.channel >= DETECTION_RING_MAX_CHANNELS) {
+			return;
+		}
+		record.channelSeq = pHeader_->channelSeq[record.channel].fetch_add(1, std::memory_order_relaxed) + 1;
+		uint64_t pos = pHeader_->head.fetch_add(1, std::memory_order_relaxed);
+		RING_SLOT &slot = pSlots_[pos & (capacity_ - 1)];
+		slot.seq.store(2 * pos + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(&slot.record, &record, detectionRecordBytes(record.nBoxes));
+		slot.seq.store(2 * pos + 2, std::memory_order_release);
+	}
+
+	const std::string &getName() const { return name_; }
+	uint32_t getCapacity() const { return capacity_; }
+
+private:
+	std::string name_;
+	uint32_t capacity_{ 0 };
+	size_t nBytes_{ 0 };
+	RING_HEADER *pHeader_{ nullptr };
+	RING_SLOT *pSlots_{ nullptr };
+};
+
+// One consumer of the ring, in any process. Not thread safe, every
+// thread which reads needs its own reader.
+class DetectionRingReader {
+public:
+	explicit
+	DetectionRingReader(const char *szName) : name_(szName) {}
+
+	~DetectionRingReader() {
+		close();
+	}
+
+	// Maps the ring read-only, false while it does not exist or is being
+	// set up, or when its layout differs from this header. bFromOldest
+	// starts at the oldest record still in the ring instead of the next.
+	bool open(const bool bFromOldest = false) {
+		close();
+		int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(RING_HEADER)) {
+			::close(fd);
+			return false;
+		}
+		void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (MAP_FAILED == p) {
+			return false;
+		}
+		pHeader_ = (const RING_HEADER *)p;
+		nBytes_ = st.st_size;
+		if (DETECTION_RING_MAGIC != __atomic_load_n(&pHeader_->magic, __ATOMIC_ACQUIRE)
+			|| DETECTION_RING_VERSION != pHeader_->version
+			|| sizeof(RING_HEADER) != pHeader_->headerSize
+			|| sizeof(RING_SLOT) != pHeader_->slotSize
+			|| sizeof(DETECTION_RECORD) != pHeader_->recordSize
+			|| nBytes_ < sizeof(RING_HEADER) + (size_t)pHeader_->capacity * sizeof(RING_SLOT)) {
+			close();
+			return false;
+		}
+		pSlots_ = (const RING_SLOT *)((const uint8_t *)p + pHeader_->headerSize);
+		capacity_ = pHeader_->capacity;
+		next_ = pHeader_->head.load(std::memory_order_acquire);
+		if (bFromOldest) {
+			next_ = next_ > capacity_ ? next_ - capacity_ : 0;
+		}
+		nLost_ = 0;
+		return true;
+	}
+
+	void close() {
+		if (nullptr != pHeader_) {
+			munmap((void *)pHeader_, nBytes_);
+			pHeader_ = nullptr;
+			pSlots_ = nullptr;
+		}
+	}
+
+	// Copies the next record, false when none is complete yet.
+	bool read(DETECTION_RECORD &record) {
+		while (true) {
+			uint64_t head = pHeader_->head.load(std::memory_order_acquire);
+			if (next_ >= head) {
+				return false;
+			}
+			if (head - next_ > capacity_) {
+				nLost_ += head - capacity_ - next_;
+				next_ = head - capacity_;
+			}
+			const RING_SLOT &slot = pSlots_[next_ & (capacity_ - 1)];
+			uint64_t seq = slot.seq.load(std::memory_order_acquire);
+			if (seq < 2 * next_ + 2) {
+				// reserved, still being written
+				return false;
+			}
+			if (seq == 2 * next_ + 2) {
+				memcpy(&record, &slot.record, offsetof(DETECTION_RECORD, boxes));
+				int nBoxes = record.nBoxes;
+				record.nBoxes = nBoxes < 0 ? 0 : nBoxes > DETECTION_RING_MAX_BOXES ? DETECTION_RING_MAX_BOXES : nBoxes;
+				memcpy(record.boxes, slot.record.boxes, record.nBoxes * sizeof(RING_BOX));
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (slot.seq.load(std::memory_order_relaxed) == seq) {
+					next_++;
+					return true;
+				}
+			}
+			// a writer lapped us
+			nLost_++;
+			next_++;
+		}
+	}
+
+	// Polls until a record arrives or timeoutUs passed, yielding first to
+	// keep the latency in microseconds, then sleeping in short slices.
+	bool readWait(DETECTION_RECORD &record, const int64_t timeoutUs) {
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		for (int i = 0; ; ++i) {
+			if (read(record)) {
+				return true;
+			}
+			int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+							std::chrono::steady_clock::now() - t0).count();
+			if (us >= timeoutUs) {
+				return false;
+			}
+			if (i < 1000) {
+				std::this_thread::yield();
+			} else {
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		}
+	}
+
+	// The ring stays mapped after the pipeline exits, open() again to
+	// follow the next run.
+	bool isWriterAlive() const {
+		return nullptr != pHeader_ && 0 == kill(pHeader_->writerPid, 0);
+	}
+
+	// records published but not read yet
+	uint64_t getLag() const { return pHeader_->head.load(std::memory_order_acquire) - next_; }
+	// overwritten before this reader got to them
+	uint64_t getNbLost() const { return nLost_; }
+	uint32_t getCapacity() const { return capacity_; }
+
+private:
+	std::string name_;
+	const RING_HEADER *pHeader_{ nullptr };
+	const RING_SLOT *pSlots_{ nullptr };
+	size_t nBytes_{ 0 };
+	uint32_t capacity_{ 0 };
+	uint64_t next_{ 0 };
+	uint64_t nLost_{ 0 };
+};
+
+#endif // DETECTION_RING_H
@@ -0,0 +1,144 @@
+#ifndef DETECTION_RING_MODULE_H
+#define DETECTION_RING_MODULE_H
+
+#include "common.h"
+#include "detectionRing.h"
+
+// Publishes the detections of the parser into a shared-memory ring, see
+// detectionRing.h. The modules of all device workers share one writer.
+class DetectionRingModule : public IModule {
+public:
+	explicit
+	DetectionRingModule(PRE_MODULE_LIST &preModules,
+						DetectionRingWriter *pWriter,
+						simplelogger::Logger *logger,
+						ChannelScheduler *pScheduler = nullptr,
+						const int workerID = 0)
+	: preModules_(preModules), pWriter_(pWriter), logger_(logger), pScheduler_(pScheduler), workerID_(workerID) {}
+
+	~DetectionRingModule() {}
+
+	// Records carry the output geometry of each channel to scale the boxes.
+	void setChannelInfos(const ChannelInfoTable *pChannelInfos) {
+		pChannelInfos_ = pChannelInfos;
+	}
+
+	// override
+	void initialize() override {}
+
+	void execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) override;
+
+	void destroy() override {}
+
+	int getNbInputs() const override {
+		return preModules_.size();
+	}
+
+	PRE_MODULE getPreModule(const int tensorIndex) const override {
+		return preModules_[tensorIndex];
+	}
+
+	int getNbOutputs() const override {
+		return vpOutputTensors_.size();
+	}
+
+	IStreamTensor* getOutputTensor(const int tensorIndex) const override {
+		return vpOutputTensors_[tensorIndex];
+	}
+
+	void setProfiler(IModuleProfiler *pProfiler) override {
+		pProfiler_ = pProfiler;
+	}
+
+	IModuleProfiler* getProfiler() const override {
+		return pProfiler_;
+	}
+
+	void setCallback(void *pUserData, MODULE_CALLBACK callback) override {
+		pUserData_ = pUserData;
+		callback_ = callback;
+	}
+
+	std::pair<void *, MODULE_CALLBACK> getCallback() const override {
+		return std::pair<void*, MODULE_CALLBACK>(pUserData_, callback_);
+	}
+
+private:
+	DetectionRingWriter *pWriter_{ nullptr };
+	simplelogger::Logger *logger_{ nullptr };
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
+	const ChannelInfoTable *pChannelInfos_{ nullptr };
+	// one record per module, execute() runs on the worker's thread
+	DETECTION_RECORD record_;
+
+	void *pUserData_{ nullptr };
+	MODULE_CALLBACK callback_{ nullptr };
+	IModuleProfiler* pProfiler_{ nullptr };
+
+	PRE_MODULE_LIST preModules_;
+	std::vector<IStreamTensor*> vpOutputTensors_;
+};
+
+void DetectionRingModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
+	TRACE_RANGE("DetectionRingModule::execute");
+	assert(1 == vpInputTensors.size());
+	assert(OBJ_COORD == vpInputTensors[0]->getTensorType());
+	int nFrames = vpInputTensors[0]->getShape()[0];
+	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(vpInputTensors[0]->getCpuData());
+	if (0 == nFrames || nullptr == pBBox_batch) {
+		return;
+	}
+	for (int iF = 0; iF < nFrames; ++iF) {
+		uint64_t tSink = metricsNowUs();
+		BBOXS_PER_FRAME &bboxs = pBBox_batch[iF];
+		int lane = bboxs.videoIndex;
+		int channel = lane;
+		if (nullptr != pScheduler_) {
+			channel = pScheduler_->getChannel(workerID_, lane);
+			if (channel < 0) {
+				continue;
+			}
+		}
+		DETECTION_RECORD &record = record_;
+		record.channel = channel;
+		record.frameIndex = bboxs.frameIndex;
+		record.sourcePicture = -1;
+		record.recvUs = 0;
+		record.wallclockUs = 0;
+		PACKET_STAMP stamp;
+		if (nullptr != g_pTracer && g_pTracer->lookup(workerID_, lane, bboxs.frameIndex, stamp)) {
+			record.sourcePicture = stamp.sourcePicture;
+			record.recvUs = stamp.recvUs;
+			record.wallclockUs = stamp.wallclockUs;
+		}
+		record.outputWidth = 0;
+		record.outputHeight = 0;
+		getChannelOutputSize(pChannelInfos_, channel, record.outputWidth, record.outputHeight);
+		record.nBoxes = 0;
+		record.nDropped = 0;
+		for (int i = 0; i < bboxs.nBBox; ++i) {
+			const BBOX_INFO &bbox = bboxs.bbox[i];
+			if (bbox.bSkip) {
+				continue;
+			}
+			if (record.nBoxes == DETECTION_RING_MAX_BOXES) {
+				record.nDropped++;
+				continue;
+			}
+			RING_BOX &box = record.boxes[record.nBoxes++];
+			box.x = bbox.x;
+			box.y = bbox.y;
+			box.w = bbox.w;
+			box.h = bbox.h;
+			box.category = bbox.category;
+			box.reserved = 0;
+		}
+		record.reserved = 0;
+		record.sinkUs = metricsNowUs();
+		pWriter_->publish(record);
+		recordMetric(STAGE_SINK, channel, metricsNowUs() - tSink);
+	}
+}
+
+#endif // DETECTION_RING_MODULE_H
@@ -0,0 +1,190 @@
+#ifndef FRAME_TRACER_H
+#define FRAME_TRACER_H
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "common/logger.h"
+#include "metrics.h"
+#include "nalParser.h"
+
+// Timestamps of a packet, taken when av_read_frame returned it.
+typedef struct {
+	uint64_t recvUs = 0;		// steady clock, see metricsNowUs()
+	int64_t wallclockUs = 0;	// capture time in us since epoch, 0 if unknown
+	int64_t sourcePicture = -1;	// picture number in the source, sampled out ones included
+	bool bStatic = false;		// no motion, decoded for the pictures referring to it only
+} PACKET_STAMP;
+
+inline int64_t wallclockNowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Correlates the packets pushed into a lane with the frames leaving the
+// pipeline. The stamps of the n-th picture pushed into a lane are kept
+// under index n, in a ring per lane; frames which come back after their
+// slot was overwritten are not accounted.
+//
+// With bPushIndexed the frames come back with that n as their
+// TRACE_INFO.frameIndex: CpuWorker hands it through the decoder as the
+// packet's pts. DeepStream numbers the frames as its decoder returns
+// them instead, which is display order and skips the pictures of corrupt
+// packets, so its frameIndex only meets the right stamps on streams
+// without B-frames or losses. The latencies are taken as they come
+// there, but lookup() never reports a picture static nor its source
+// picture, which would skip or misplace frames rather than just skew a
+// histogram.
+class FrameTracer {
+public:
+	static const int RING_SIZE = 1024;
+
+	explicit
+	FrameTracer(const int nWorkers,
+				const int nLanes,
+				const int nChannels,
+				const double sloMs,
+				const bool bPushIndexed,
+				simplelogger::Logger *logger)
+	: nLanes_(nLanes), nChannels_(nChannels), sloUs_((uint64_t)(sloMs * 1000.0)), bPushIndexed_(bPushIndexed),
+	  logger_(logger), vRings_(nWorkers * nLanes), vSlo_(nChannels) {}
+
+	// Called by the push thread right after the packet went into the lane.
+	void onPacketPushed(const int worker, const int lane, const PACKET_STAMP &stamp, const VIDEO_CODEC codec,
+						const uint8_t *pBuf, const int nBuf) {
+		if (!classifyPacket(pBuf, nBuf, codec).bNewPicture) {
+			return;
+		}
+		LANE_RING &ring = vRings_[worker * nLanes_ + lane];
+		uint32_t index = ring.nPictures.fetch_add(1, std::memory_order_relaxed);
+		STAMP_SLOT &slot = ring.slots[index % RING_SIZE];
+		slot.seq.store(0, std::memory_order_relaxed);
+		slot.recvUs.store(stamp.recvUs, std::memory_order_relaxed);
+		slot.wallclockUs.store(stamp.wallclockUs, std::memory_order_relaxed);
+		slot.sourcePicture.store(stamp.sourcePicture, std::memory_order_relaxed);
+		slot.bStatic.store(stamp.bStatic, std::memory_order_relaxed);
+		slot.seq.store(index + 1, std::memory_order_release);
+	}
+
+	// Stamp of the frameIndex-th picture pushed into the lane, false once
+	// the slot was reused. Without bPushIndexed bStatic is false and
+	// sourcePicture -1.
+	bool lookup(const int worker, const int lane, const int frameIndex, PACKET_STAMP &stamp) const {
+		if (lane < 0 || lane >= nLanes_ || frameIndex < 0) {
+			return false;
+		}
+		const STAMP_SLOT &slot = vRings_[worker * nLanes_ + lane].slots[frameIndex % RING_SIZE];
+		uint32_t seq = slot.seq.load(std::memory_order_acquire);
+		stamp.recvUs = slot.recvUs.load(std::memory_order_relaxed);
+		stamp.wallclockUs = slot.wallclockUs.load(std::memory_order_relaxed);
+		stamp.sourcePicture = slot.sourcePicture.load(std::memory_order_relaxed);
+		stamp.bStatic = slot.bStatic.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (!bPushIndexed_) {
+			stamp.sourcePicture = -1;
+			stamp.bStatic = false;
+		}
+		return seq == (uint32_t)frameIndex + 1 && seq == slot.seq.load(std::memory_order_relaxed);
+	}
+
+	// Frames of pictures the motion gate passed as references only, they
+	// are not analysed. False when the stamp is gone, the frame is kept.
+	bool isStatic(const int worker, const int lane, const int frameIndex) const {
+		PACKET_STAMP stamp;
+		return lookup(worker, lane, frameIndex, stamp) && stamp.bStatic;
+	}
+
+	// Called by the sinks once the detections of a frame are consumed.
+	void onFrameDone(const int worker, const int lane, const int frameIndex, const int channel) {
+		PACKET_STAMP stamp;
+		if (!lookup(worker, lane, frameIndex, stamp)) {
+			return;
+		}
+
+		uint64_t e2eUs = metricsNowUs() - stamp.recvUs;
+		recordMetric(STAGE_E2E, channel, e2eUs);
+		if (stamp.wallclockUs > 0) {
+			int64_t glassUs = wallclockNowUs() - stamp.wallclockUs;
+			// camera and host clocks disagree, nothing sensible to report
+			if (glassUs >= 0) {
+				recordMetric(STAGE_GLASS, channel, (uint64_t)glassUs);
+			}
+		}
+		checkSlo(channel, e2eUs);
+	}
+
+	bool isViolating(const int channel) const {
+		std::lock_guard<std::mutex> lock(mtxSlo_);
+		return channel >= 0 && channel < nChannels_ && vSlo_[channel].bViolating;
+	}
+
+private:
+	typedef struct STAMP_SLOT {
+		std::atomic<uint32_t > seq{ 0 };	// picture index + 1, 0 while written
+		std::atomic<uint64_t > recvUs{ 0 };
+		std::atomic<int64_t > wallclockUs{ 0 };
+		std::atomic<int64_t > sourcePicture{ -1 };
+		std::atomic<bool > bStatic{ false };
+	} STAMP_SLOT;
+
+	typedef struct LANE_RING {
+		std::atomic<uint32_t > nPictures{ 0 };
+		STAMP_SLOT slots[RING_SIZE];
+	} LANE_RING;
+
+	typedef struct {
+		int nFrames = 0;
+		int nOver = 0;
+		bool bViolating = false;
+	} SLO_WINDOW;
+
+	// A channel violates the SLO when more than 1% of the frames of a
+	// window took longer than the target.
+	void checkSlo(const int channel, const uint64_t e2eUs) {
+		if (0 == sloUs_ || channel < 0 || channel >= nChannels_) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mtxSlo_);
+		SLO_WINDOW &w = vSlo_[channel];
+		w.nFrames++;
+		if (e2eUs > sloUs_) {
+			w.nOver++;
+		}
+		if (w.nFrames < SLO_WINDOW_FRAMES) {
+			return;
+		}
+		bool bViolating = w.nOver * 100 > w.nFrames;
+		if (bViolating != w.bViolating) {
+			if (bViolating) {
+				LOG_WARN(logger_, "FrameTracer: channel " << channel << " exceeds the latency SLO of "
+									<< sloUs_ / 1000 << " ms on " << w.nOver << "/" << w.nFrames << " frames");
+			} else {
+				LOG_INFO(logger_, "FrameTracer: channel " << channel << " is back within the latency SLO");
+			}
+		}
+		w.bViolating = bViolating;
+		if (nullptr != g_pMetrics) {
+			g_pMetrics->setGauge("slo_violation", channel, bViolating ? 1. : 0.);
+		}
+		w.nFrames = 0;
+		w.nOver = 0;
+	}
+
+	static const int SLO_WINDOW_FRAMES = 200;
+
+	int nLanes_{ 0 };
+	int nChannels_{ 0 };
+	uint64_t sloUs_{ 0 };
+	bool bPushIndexed_{ false };
+	simplelogger::Logger *logger_{ nullptr };
+	std::vector<LANE_RING > vRings_;
+	std::vector<SLO_WINDOW > vSlo_;
+	mutable std::mutex mtxSlo_;
+};
+
+// Global tracer, null when nothing configured needs the stamps, see main
+extern FrameTracer *g_pTracer;
+
+#endif // FRAME_TRACER_H
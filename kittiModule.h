@@ -32,19 +32,35 @@
 
 #include "common.h"
 
+// Writes the boxes of each channel as Kitti lines to ./log/log_ch<N>.txt.
+// Its only input is the parser's coordinates; the boxes are scaled by the
+// output size of the channel from setChannelInfos(), so a headless
+// pipeline does not keep the decoded NV12 frames for it.
 class KittiLoggerModule : public IModule {
 public:
 	explicit
 	KittiLoggerModule(PRE_MODULE_LIST &preModules,
 					const int nChannels,
-					const int devID_display,
-					const int devID_infer,
 					char *labelFile,
-					simplelogger::Logger *logger) 
-	  : preModules_(preModules), nChannels_(nChannels), devID_display_(devID_display), devID_infer_(devID_infer), labelFile_(labelFile), logger_(logger) {}
+					simplelogger::Logger *logger,
+					ChannelScheduler *pScheduler = nullptr,
+					const int workerID = 0) 
+	  : preModules_(preModules), nChannels_(nChannels), labelFile_(labelFile), logger_(logger), pScheduler_(pScheduler), workerID_(workerID) {}
 
 	~KittiLoggerModule() {}
 
+	// Repeat the last detections for the pictures the provider dropped,
+	// so every source picture gets a line. Needs the frame tracer.
+	void setCarryForward(const bool bCarryForward) {
+		bCarryForward_ = bCarryForward;
+	}
+
+	// Boxes are written in the output geometry of each channel, e.g. the
+	// main stream of a dual-stream camera; normalized while it is unknown.
+	void setChannelInfos(const ChannelInfoTable *pChannelInfos) {
+		pChannelInfos_ = pChannelInfos;
+	}
+
 	// override
 	void initialize() override;
 
@@ -94,10 +110,9 @@ public:
 	}
 
 private:
+	void writeBoxes(const int videoIndex, const int64_t frameIndex, const BBOXS_PER_FRAME &bboxs, const int nWidth, const int nHeight);
+
 	int nChannels_{ 0 };
-	int devID_display_{ -1 };
-	int devID_infer_{ -1 };
-	demo_button demoButton_;
 	std::vector<std::string > vSynsets_;
 	
 	void *pUserData_{ nullptr };
@@ -105,19 +120,25 @@ private:
 	IModuleProfiler* pProfiler_{ nullptr };	
 	
 	char *labelFile_{ nullptr };
-	uint8_t *pFrameResized_{ nullptr };
-	
-	uint8_t * pBGRA_local_{ nullptr };
-	size_t pitchInbytes_{ 0 };
 
 	simplelogger::Logger *logger_{ nullptr };
 	
+	// maps the lanes of this worker back to channels, null for a single device
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
+	
 	PRE_MODULE_LIST preModules_;
 	std::vector<IStreamTensor*> vpOutputTensors_;
 
 	static const int MAX_SUPPORTED_CHANNELS = 128;
 
         std::ofstream *logFile[MAX_SUPPORTED_CHANNELS];
+
+	const ChannelInfoTable *pChannelInfos_{ nullptr };
+	bool bCarryForward_{ false };
+	int64_t lastSource_[MAX_SUPPORTED_CHANNELS];
+	BBOXS_PER_FRAME lastBoxes_[MAX_SUPPORTED_CHANNELS];
+	bool bSizeWarned_[MAX_SUPPORTED_CHANNELS];
 };
 	
 void KittiLoggerModule::initialize() {
@@ -137,48 +158,40 @@ void KittiLoggerModule::initialize() {
 
 	for(int i = 0; i < MAX_SUPPORTED_CHANNELS; i++)
 	  logFile[i] = NULL;
+	for (int i = 0; i < MAX_SUPPORTED_CHANNELS; i++) {
+		lastSource_[i] = -1;
+		lastBoxes_[i].nBBox = 0;
+		bSizeWarned_[i] = false;
+	}
 	
 }
 
 void KittiLoggerModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
-	assert(2 == vpInputTensors.size());
-	cudaStream_t stream = context.stream;
+	TRACE_RANGE("KittiLoggerModule::execute");
+	assert(1 == vpInputTensors.size());
 	//=================================================================
-	// NV12 frames
+	// nvhelnet Object Coords, the lane and frame of each are in the boxes
 	//=================================================================
-	std::vector<int> shape_nv12 = vpInputTensors[0]->getShape();
-	TENSOR_TYPE Ttype_0 = vpInputTensors[0]->getTensorType();
-	assert(NV12_FRAME == Ttype_0);
-	
-	int nFrames = shape_nv12[0];
-	int nHeight = shape_nv12[2] * 2; // NV12, YUV420
-	int nWidth = shape_nv12[3];
-	
-	if (0 == nFrames) {
+	assert(OBJ_COORD == vpInputTensors[0]->getTensorType());
+	int nFrames = vpInputTensors[0]->getShape()[0];
+	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(vpInputTensors[0]->getCpuData());	
+	if (0 == nFrames || nullptr == pBBox_batch) {
 		return;
 	}
 
-	uint8_t *dpFrames = reinterpret_cast<uint8_t*>(vpInputTensors[0]->getGpuData());
-	std::vector<TRACE_INFO > tensorInfo_nv12 = vpInputTensors[0]->getTraceInfos();
-	assert(shape_nv12[0] == tensorInfo_nv12.size());
-
-	//=================================================================
-	// nvhelnet Object Coords
-	//=================================================================
-	std::vector<int> shape_coord = vpInputTensors[1]->getShape();
-	TENSOR_TYPE Ttype_1 = vpInputTensors[1]->getTensorType();
-	assert(OBJ_COORD == Ttype_1);
-	assert(shape_coord[0] == nFrames);
-	
-	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(vpInputTensors[1]->getCpuData());	
-	assert(nullptr != pBBox_batch);
-	
-
 	for (int iF = 0; iF < nFrames; ++iF) {
-   	        int frameIndex = tensorInfo_nv12[iF].frameIndex;
-		int videoIndex = tensorInfo_nv12[iF].videoIndex;
+		uint64_t tSink = metricsNowUs();
+   	        int frameIndex = pBBox_batch[iF].frameIndex;
+		int lane = pBBox_batch[iF].videoIndex;
+		int videoIndex = lane;
+		if (nullptr != pScheduler_) {
+			videoIndex = pScheduler_->getChannel(workerID_, lane);
+			if (videoIndex < 0) {
+				continue;
+			}
+		}
 
-   	        if (videoIndex > MAX_SUPPORTED_CHANNELS) {
+   	        if (videoIndex >= MAX_SUPPORTED_CHANNELS) {
    	           LOG_ERROR(logger, "Can supoprt maximum of 128 channels. Exiting");
 	           exit(-1);
    	        }
@@ -203,16 +216,41 @@ void KittiLoggerModule::execute(const ModuleContext& context, const std::vector<
 		
 		// log that  bounding box
 		BBOXS_PER_FRAME &bboxs = pBBox_batch[iF];
-		for (int i = 0; i < bboxs.nBBox; ++i) {
-		  //			if (!bboxs.bbox[i].bSkip)
-			  {
-				*logFile[videoIndex] <<"Frame ["<<frameIndex<<"]"<<vSynsets_[bboxs.bbox[i].category]<<" 0.0 0 0.0 "<<bboxs.bbox[i].x*nWidth<<" "<<bboxs.bbox[i].y*nHeight<<" "<<(bboxs.bbox[i].x + bboxs.bbox[i].w)*nWidth<<" "<<(bboxs.bbox[i].y + bboxs.bbox[i].h)*nHeight<<" 0.0 0.0 0.0 0.0 0.0 0.0 0.0\n";
+		int outWidth = 1, outHeight = 1;
+		if (!getChannelOutputSize(pChannelInfos_, videoIndex, outWidth, outHeight) && !bSizeWarned_[videoIndex]) {
+			LOG_WARN(logger_, "KittiLoggerModule: size of channel " << videoIndex << " unknown, boxes are normalized");
+			bSizeWarned_[videoIndex] = true;
+		}
+		PACKET_STAMP stamp;
+		if (bCarryForward_ && nullptr != g_pTracer
+			&& g_pTracer->lookup(workerID_, lane, frameIndex, stamp) && stamp.sourcePicture >= 0) {
+			// frames are numbered by source picture, gated pictures keep the last result
+			for (int64_t src = lastSource_[videoIndex] + 1; lastSource_[videoIndex] >= 0 && src < stamp.sourcePicture; ++src) {
+				writeBoxes(videoIndex, src, lastBoxes_[videoIndex], outWidth, outHeight);
 			}
+			writeBoxes(videoIndex, stamp.sourcePicture, bboxs, outWidth, outHeight);
+			lastSource_[videoIndex] = stamp.sourcePicture;
+			lastBoxes_[videoIndex] = bboxs;
+		} else {
+			writeBoxes(videoIndex, frameIndex, bboxs, outWidth, outHeight);
 		}
 		//	logFile[videoIndex]->close();
 		logFile[videoIndex]->flush();
+		recordMetric(STAGE_SINK, videoIndex, metricsNowUs() - tSink);
+		if (nullptr != g_pTracer) {
+			g_pTracer->onFrameDone(workerID_, lane, frameIndex, videoIndex);
+		}
 	
 	}
 }
 
+void KittiLoggerModule::writeBoxes(const int videoIndex, const int64_t frameIndex, const BBOXS_PER_FRAME &bboxs, const int nWidth, const int nHeight) {
+	for (int i = 0; i < bboxs.nBBox; ++i) {
+	  //			if (!bboxs.bbox[i].bSkip)
+		  {
+			*logFile[videoIndex] <<"Frame ["<<frameIndex<<"]"<<vSynsets_[bboxs.bbox[i].category]<<" 0.0 0 0.0 "<<bboxs.bbox[i].x*nWidth<<" "<<bboxs.bbox[i].y*nHeight<<" "<<(bboxs.bbox[i].x + bboxs.bbox[i].w)*nWidth<<" "<<(bboxs.bbox[i].y + bboxs.bbox[i].h)*nHeight<<" 0.0 0.0 0.0 0.0 0.0 0.0 0.0\n";
+		}
+	}
+}
+
 #endif
@@ -36,9 +36,13 @@
 #include <fstream>
 #include <sstream>
 #include <thread>
+#include <atomic>
 #include <iomanip>
-#include <sys/time.h>
+#ifdef CPU_ONLY
+#include <helper_string.h>
+#else
 #include <helper_cuda.h>
+#endif
 
 #include "common.h"
 #define RESNET10
@@ -46,6 +50,8 @@
 simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger();
 
 int g_devID_infer 		= -1;
+std::vector<int > g_vDevID_infer;
+int g_spareLanes		= 1;
 int g_devID_display 	= -1;
 int  g_nChannels 		= 0;
 int g_tileWidth			= 0;
@@ -54,8 +60,32 @@ int g_tilesInRow		= 0;
 bool g_endlessLoop		= false;
 bool g_fullScreen		= false;
 bool g_gui                      = false;
+BACKEND_TYPE g_backend		= BACKEND_DEEPSTREAM;
+int g_metricsPort		= 0;
+int g_metricsInterval	= 10;
+char *g_metricsJson		= nullptr;
+char *g_traceFile		= nullptr;
+char *g_sampling		= nullptr;
+float g_motionRatio		= 0.f;
+bool g_carryForward		= false;
+RoiMaskSet *g_pRoiMasks	= nullptr;
+float g_sloMs			= 0.f;
+STREAM_CLIENT g_streamClient	= STREAM_CLIENT_FFMPEG;
+JITTER_PARAMS g_jitterParams;
+PACING_PARAMS g_pacingParams;
+char *g_pacingOffsets	= nullptr;
+std::vector<std::string > g_vPacingOffsets(1, "0");
+int g_pacingStaggerMs	= 0;
+float g_farmJitter		= 0.f;
+std::vector<std::string > g_vSamplingModes(1, "all");
+ACTIVITY_PARAMS g_activityParams;
 
 char *g_fileList 		= nullptr;
+char *g_farmFile		= nullptr;
+char *g_offlineFile		= nullptr;
+VIDEO_CODEC g_codec		= VIDEO_CODEC_H264;
+char *g_channelFile		= nullptr;
+std::vector<std::string > g_vFiles;
 char *g_deployFile 		= nullptr;
 char *g_modelFile 		= nullptr;
 char *g_meanFile 		= nullptr;
@@ -68,37 +98,46 @@ __inline__ bool PairCompare(const std::pair<float, int>& lhs, const std::pair<fl
 	return lhs.first > rhs.first;
 }
 
+// Decode times go to the stage histograms, logging each frame through
+// the locked logger was a hotspot of its own.
 class DecodeProfiler : public IDecodeProfiler {
 public:	
+	explicit
+	DecodeProfiler(ChannelScheduler *pScheduler = nullptr, const int workerID = 0)
+	: pScheduler_(pScheduler), workerID_(workerID) {}
+	
 	void reportDecodeTime(const int frameIdx, const int videoIdx, const int devID, double ms) {
 		nCount++;
-		timeElasped += ms;
-		if ((frameIdx+1) % interval == 0) {
-			LOG_DEBUG(logger, "Video[" << videoIdx << "] " 
-								<< std::fixed << std::setprecision(2) 
-								<< "Decoding" << " Performance: " << float(interval * 1000.0 / timeElasped) << " frames/second"
-								<< " || Total Frames: " << nCount);
-			timeElasped = 0.;
+		int channel = videoIdx;
+		if (nullptr != pScheduler_) {
+			channel = pScheduler_->getChannel(workerID_, videoIdx);
 		}
+		recordMetric(STAGE_DECODE, channel, (uint64_t)(ms * 1000.0));
 	}
 	
 	int nCount{ 0 };
-	int interval{ 1 };
-	double timeElasped{ 0 }; // ms
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
 };
 
 class AnalysisProfiler : public IAnalysisProfiler {
 public:
 	explicit
-	AnalysisProfiler(simplelogger::Logger *logger) {
+	AnalysisProfiler(simplelogger::Logger *logger, ChannelScheduler *pScheduler = nullptr, const int workerID = 0) {
 		logger_ = logger;
+		pScheduler_ = pScheduler;
+		workerID_ = workerID;
 	}
 	void reportTime(double ms, int batchSize) override {
+		if (nullptr != pScheduler_) {
+			pScheduler_->reportAnalysis(workerID_, batchSize, ms);
+		}
+		recordMetric(STAGE_INFER, -1, (uint64_t)(ms * 1000.0));
 		nCount += batchSize;
 		nTotalFrames += batchSize;
 		timeElasped += ms;
 		if (nCount >= interval) {
-			LOG_DEBUG(logger_, "Analysis Pipeline" << std::fixed << std::setprecision(2) 
+			LOG_DEBUG(logger_, "Analysis Pipeline[" << workerID_ << "]" << std::fixed << std::setprecision(2) 
 								<< " Performance: " << nCount * 1000.f / timeElasped << " frames/second"
 								<< " || Total Frames: " << nTotalFrames
 								<< " || Batch Size: " << batchSize);
@@ -109,6 +148,8 @@ public:
 
 private:
 	simplelogger::Logger *logger_{ nullptr };
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
 	
 	int nCount{ 0 };
 	int interval{ 200 };
@@ -117,28 +158,319 @@ private:
 };
 
 bool parseArg(int argc, char **argv);
+bool parseCommonArg(int argc, char **argv);
 void getFileNames(const int nFiles, char *fileList, std::vector<std::string> &files);
-void userPushPacket(DataProvider *pDataProvider, IDeviceWorker *pDeviceWorker, const int laneID);
+void getDeviceIDs(char *devList, std::vector<int> &devIDs);
+int getDeviceNode(const int devID);
+void userPushPacket(DataProvider *pDataProvider, ChannelScheduler *pScheduler, const int channel,
+					const std::atomic<bool > *pbRun);
+DataProvider *createChannelProvider(void *, const int channel, const std::string &definition);
+void releaseChannelProvider(void *, const int channel, DataProvider *pProvider);
+void removeRecorders(const int channel);
 
-std::vector<StreamDataProvider *> vpDataProviders;
-std::vector<DecodeProfiler *> g_vpDecProfilers;
-AnalysisProfiler *g_analysisProfiler;
+// Modules owned by the pipeline of one inference device
+typedef struct {
+	IWorkerBackend *pWorker = nullptr;
+	ParserModule *pParser = nullptr;
+#ifndef CPU_ONLY
+	PlaybackModule *pPlayback = nullptr;
+#endif
+	KittiLoggerModule *pKitti = nullptr;
+	ActivityModule *pActivity = nullptr;
+	DetectionRingModule *pRing = nullptr;
+	ResultStreamModule *pStream = nullptr;
+	ClipTriggerModule *pClip = nullptr;
+	SnapshotModule *pSnapshot = nullptr;
+	DetectionArchiveModule *pArchive = nullptr;
+	OfflineStitchModule *pStitch = nullptr;
+	AnalysisProfiler *pAnalysisProfiler = nullptr;
+	std::vector<DecodeProfiler *> vpDecProfilers;
+} DEVICE_PIPELINE;
 
-int main(int argc, char **argv) {
+void buildPipeline(DEVICE_PIPELINE &pipeline, const int devID, const int nLanes, const int workerID, ChannelScheduler *pScheduler);
+
+ChannelRegistry *g_pRegistry = nullptr;
+SharedRecording *g_pRecording = nullptr;
+RecordingSegmentQueue *g_pSegmentQueue = nullptr;
+OfflineStitcher *g_pStitcher = nullptr;
+ChannelInfoTable g_channelInfos;
+std::vector<DEVICE_PIPELINE > g_vPipelines;
+ChannelScheduler *g_pScheduler = nullptr;
+std::atomic<bool > g_bPushing{ false };
+MetricsExporter *g_pMetricsExporter = nullptr;
+FrameTracer *g_pTracer = nullptr;
+ActivityController *g_pActivity = nullptr;
+DetectionRingWriter *g_pDetectionRing = nullptr;
+ResultStreamer *g_pResultStreamer = nullptr;
+ClipRecorder *g_pClipRecorder = nullptr;
+SnapshotEncoderPool *g_pSnapshotPool = nullptr;
+SnapshotSelector *g_pSnapshotSelector = nullptr;
+DetectionArchiveWriter *g_pArchive = nullptr;
+SegmentRecorder *g_pSegmentRecorder = nullptr;
+PacketObserverList *g_pPacketObservers = nullptr;
+PacketPool *g_pPacketPool = nullptr;
 
-        deepStreamInit();
+int main(int argc, char **argv) {
 
 	bool ret = parseArg(argc, argv);
 	if (!ret) {
 		LOG_ERROR(logger, "Error in parseArg!");
 		return 0;
 	}
+#ifndef CPU_ONLY
+	if (BACKEND_DEEPSTREAM == g_backend) {
+	        deepStreamInit();
+	}
+#endif
+	
+#ifdef ENABLE_TRACING
+	if (nullptr != g_traceFile) {
+		trace::start();
+	}
+#endif
+	if (nullptr != g_pMetrics) {
+		g_pMetricsExporter = new MetricsExporter(g_pMetrics, logger);
+		// metrics asked for on a port which is taken would be silently off
+		if (g_metricsPort > 0 && !g_pMetricsExporter->startHttp(g_metricsPort)) {
+			LOG_ERROR(logger, "Warning: No metrics endpoint on port " << g_metricsPort << "!");
+			exit(1);
+		}
+		if (nullptr != g_metricsJson) {
+			g_pMetricsExporter->startJsonDump(g_metricsJson, g_metricsInterval);
+		}
+	}
+
+	// Lanes per device: an even share of the channels plus spare lanes
+	// so the scheduler can move channels between devices.
+	const int nDevs = g_vDevID_infer.size();
+	int nLanes = g_nChannels;
+	if (nDevs > 1) {
+		nLanes = std::min(g_nChannels, (g_nChannels + nDevs - 1) / nDevs + g_spareLanes);
+	}
+	
+	// Init a worker on each GPU device
+	g_vPipelines.resize(nDevs);
+	std::vector<ILaneWorker *> vpLaneWorkers;
+	// the inference library's threads inherit the mask of the thread which
+	// creates and starts the worker, so it moves to each device's node
+	for (int iW = 0; iW < nDevs; ++iW) {
+		if (nullptr != g_pPlacement) {
+			g_pPlacement->bindToNode(getDeviceNode(g_vDevID_infer[iW]));
+		}
+		g_vPipelines[iW].pWorker = createWorkerBackend(g_backend, nLanes, g_vDevID_infer[iW], logger);
+		assert(nullptr != g_vPipelines[iW].pWorker);
+		vpLaneWorkers.push_back(g_vPipelines[iW].pWorker);
+	}
+	g_pScheduler = new ChannelScheduler(vpLaneWorkers, g_nChannels, logger);
+	assert(nullptr != g_pScheduler);
+	if (nullptr != g_pMetrics || g_sloMs > 0.f || g_carryForward || nullptr != g_pDetectionRing
+		|| nullptr != g_pResultStreamer || nullptr != g_pClipRecorder || nullptr != g_pSnapshotPool
+		|| nullptr != g_pArchive || nullptr != g_pStitcher || g_motionRatio > 0.f) {
+		g_pTracer = new FrameTracer(nDevs, nLanes, g_nChannels, g_sloMs, BACKEND_CPU == g_backend, logger);
+	}
+	if (g_motionRatio > 0.f) {
+		for (int iW = 0; iW < nDevs; ++iW) {
+			g_vPipelines[iW].pWorker->skipStaticFrames(iW);
+		}
+	}
+	
+	for (int iW = 0; iW < nDevs; ++iW) {
+		buildPipeline(g_vPipelines[iW], g_vDevID_infer[iW], nLanes, iW, g_pScheduler);
+	}
+	
+	// start the device workers.
+	for (int iW = 0; iW < nDevs; ++iW) {
+		if (nullptr != g_pPlacement) {
+			g_pPlacement->bindToNode(getDeviceNode(g_vDevID_infer[iW]));
+		}
+		g_vPipelines[iW].pWorker->start();
+	}
+	if (nullptr != g_pPlacement) {
+		g_pPlacement->bindToNode(g_pPlacement->getHomeNode());
+	}
+		
+	// what the users need to do is 
+	// push video packets into a packet cache, one thread per channel.
+	// The registry places the channels by decode cost.
+	g_bPushing = true;
+	g_pRegistry = new ChannelRegistry(g_nChannels, g_pScheduler, createChannelProvider, releaseChannelProvider,
+									nullptr, userPushPacket, logger);
+	if (nullptr != g_channelFile) {
+		g_pRegistry->setChannelFile(g_channelFile);
+		if (!g_pRegistry->loadChannelFile()) {
+			LOG_ERROR(logger, "Warning: No channel file.");
+		}
+	} else {
+		// a camera which cannot be opened leaves its slot empty
+		for (int i = 0; i < g_nChannels; ++i) {
+			const char *szRecording = nullptr != g_offlineFile ? g_offlineFile : g_farmFile;
+			if (!g_pRegistry->attach(i, nullptr != g_pRecording ? std::string(szRecording) : g_vFiles[i])
+				&& nullptr != g_pRecording) {
+				exit(1);
+			}
+		}
+	}
+	
+	// move channels away from devices which fall behind; -offline needs
+	// none, a faster lane simply takes more segments
+	std::thread rebalanceThread;
+	if (nDevs > 1 && nullptr == g_offlineFile) {
+		rebalanceThread = std::thread([]() {
+			placeThread(ROLE_IO, "rebalance");
+			while (g_bPushing) {
+				g_pScheduler->rebalance();
+				std::this_thread::sleep_for(std::chrono::milliseconds(500));
+			}
+		});
+	}
+
+	while (g_pRegistry->poll()) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+	g_bPushing = false;
+	if (rebalanceThread.joinable()) {
+		rebalanceThread.join();
+	}
+	g_pScheduler->stopIdleLanes();
+	
+	for (int iW = 0; iW < nDevs; ++iW) {
+		g_vPipelines[iW].pWorker->stop();
+	}
+	// the sinks are done, the pictures still held are written
+	if (nullptr != g_pStitcher) {
+		g_pStitcher->finish();
+		LOG_INFO(logger, "Offline: " << g_pStitcher->getNbPictures() << " pictures, " << g_pStitcher->getNbBoxes()
+							<< " boxes, " << g_pStitcher->getNbLost() << " frames lost, " << g_pStitcher->getNbLate()
+							<< " late, at most " << g_pStitcher->getMaxPending() << " pictures held");
+		delete g_pStitcher;
+		delete g_pSegmentQueue;
+	}
+	
+	// free
+	for (int iW = 0; iW < nDevs; ++iW) {
+		g_vPipelines[iW].pWorker->destroy();
+	}
+	
+	delete g_pRegistry;
+	if (nullptr != g_pRecording) {
+		delete g_pRecording;
+	}
+	for (int iW = 0; iW < nDevs; ++iW) {
+		DEVICE_PIPELINE &pipeline = g_vPipelines[iW];
+		for (size_t i = 0; i < pipeline.vpDecProfilers.size(); ++i) {
+			delete pipeline.vpDecProfilers[i];
+		}
+		if (nullptr != pipeline.pParser) {
+			delete pipeline.pParser;
+		}
+#ifndef CPU_ONLY
+		if (nullptr != pipeline.pPlayback) {
+			delete pipeline.pPlayback;
+		}
+#endif
+		if (nullptr != pipeline.pAnalysisProfiler) {
+			delete pipeline.pAnalysisProfiler;
+		}
+		if (nullptr != pipeline.pKitti) {
+			delete pipeline.pKitti;
+		}
+		if (nullptr != pipeline.pActivity) {
+			delete pipeline.pActivity;
+		}
+		if (nullptr != pipeline.pRing) {
+			delete pipeline.pRing;
+		}
+		if (nullptr != pipeline.pStream) {
+			delete pipeline.pStream;
+		}
+		if (nullptr != pipeline.pClip) {
+			delete pipeline.pClip;
+		}
+		if (nullptr != pipeline.pSnapshot) {
+			delete pipeline.pSnapshot;
+		}
+		if (nullptr != pipeline.pArchive) {
+			delete pipeline.pArchive;
+		}
+		if (nullptr != pipeline.pStitch) {
+			delete pipeline.pStitch;
+		}
+		delete pipeline.pWorker;
+	}
+#ifdef ENABLE_TRACING
+	if (nullptr != g_traceFile && !trace::stopAndWrite(g_traceFile)) {
+		LOG_ERROR(logger, "Failed to write trace file " << g_traceFile);
+	}
+#endif
+	delete g_pScheduler;
+	if (nullptr != g_pTracer) {
+		delete g_pTracer;
+	}
+	if (nullptr != g_pActivity) {
+		delete g_pActivity;
+	}
+	if (nullptr != g_pDetectionRing) {
+		delete g_pDetectionRing;
+	}
+	if (nullptr != g_pResultStreamer) {
+		delete g_pResultStreamer;
+	}
+	// the providers are gone with the registry, the open clips and
+	// segments are finished here
+	if (nullptr != g_pClipRecorder) {
+		delete g_pClipRecorder;
+	}
+	if (nullptr != g_pSegmentRecorder) {
+		delete g_pSegmentRecorder;
+	}
+	// after everything which holds packets
+	if (nullptr != g_pPacketPool) {
+		PACKET_POOL_STATS stats = g_pPacketPool->getStats();
+		LOG_INFO(logger, "Packet pool: " << stats.nAllocs << " packets, " << stats.nFallbacks << " too large, "
+							<< (stats.reservedBytes >> 20) << " MB in " << stats.nSlabs << " slabs at the end");
+		delete g_pPacketPool;
+	}
+	// encodes the snapshots still queued
+	if (nullptr != g_pSnapshotPool) {
+		LOG_INFO(logger, "Snapshots: " << g_pSnapshotPool->getNbEncoded() << " encoded, "
+							<< g_pSnapshotPool->getNbDropped() << " frames dropped");
+		delete g_pSnapshotPool;
+	}
+	if (nullptr != g_pSnapshotSelector) {
+		delete g_pSnapshotSelector;
+	}
+	// writes the open blocks
+	if (nullptr != g_pArchive) {
+		LOG_INFO(logger, "Archive: " << g_pArchive->getNbBoxes() << " boxes in "
+							<< (g_pArchive->getNbBytes() >> 10) << " KB");
+		delete g_pArchive;
+	}
+	if (nullptr != g_pPacketObservers) {
+		delete g_pPacketObservers;
+	}
+	if (nullptr != g_pRoiMasks) {
+		delete g_pRoiMasks;
+	}
+	if (nullptr != g_pMetricsExporter) {
+		delete g_pMetricsExporter;
+	}
+	if (nullptr != g_pMetrics) {
+		delete g_pMetrics;
+	}
+	if (nullptr != g_pPlacement) {
+		delete g_pPlacement;
+	}
+	if (nullptr != logger) {
+		delete logger;
+	}
+	return 0;
+}
 
-	// Init a worker on a GPU device
-	IDeviceWorker *pDeviceWorker = createDeviceWorker(g_nChannels, g_devID_infer);
+void buildPipeline(DEVICE_PIPELINE &pipeline, const int devID, const int nLanes, const int workerID, ChannelScheduler *pScheduler) {
+	IWorkerBackend *pDeviceWorker = pipeline.pWorker;
 	
-	// Add decode task
-	pDeviceWorker->addDecodeTask(cudaVideoCodec_H264);
+	// Add decode task, the channels of another codec are refused on attach
+	pDeviceWorker->addDecodeTask(VIDEO_CODEC_HEVC == g_codec ? cudaVideoCodec_HEVC : cudaVideoCodec_H264);
 	
 	// Add color space convertor
 	IModule *pConvertor = pDeviceWorker->addColorSpaceConvertorTask(BGR_PLANAR);
@@ -164,108 +496,123 @@ int main(int argc, char **argv) {
 														g_meanFile,
 														inputLayerName,
 														outputLayerNames,
-														g_nChannels,
+														nLanes,
 														&param);
 
 	// Detection
 	PRE_MODULE_LIST preModules_parser;
 	preModules_parser.push_back(std::make_pair(pInfer, 0)); // cov
 	preModules_parser.push_back(std::make_pair(pInfer, 1)); // bbox
-	ParserModule *pParser = new ParserModule(preModules_parser,
-												g_nChannels,
-												g_devID_infer,
-												logger);
-	assert(nullptr != pParser);
-	pDeviceWorker->addCustomerTask(pParser);
-	
-	PlaybackModule *pPlayback = NULL;
-	KittiLoggerModule *pKitti = NULL;
+	pipeline.pParser = new ParserModule(preModules_parser,
+												nLanes,
+												devID,
+												logger,
+												pScheduler, workerID);
+	assert(nullptr != pipeline.pParser);
+	pipeline.pParser->setRoiMasks(g_pRoiMasks);
+	pDeviceWorker->addCustomerTask(pipeline.pParser);
+	
+	if (nullptr != g_pActivity) {
+		PRE_MODULE_LIST preModules_activity;
+		preModules_activity.push_back(std::make_pair(pipeline.pParser, 0)); // COORDS
+		pipeline.pActivity = new ActivityModule(preModules_activity, g_pActivity, logger, pScheduler, workerID);
+		assert(nullptr != pipeline.pActivity);
+		pDeviceWorker->addCustomerTask(pipeline.pActivity);
+	}
+	
+	if (nullptr != g_pDetectionRing) {
+		PRE_MODULE_LIST preModules_ring;
+		preModules_ring.push_back(std::make_pair(pipeline.pParser, 0)); // COORDS
+		pipeline.pRing = new DetectionRingModule(preModules_ring, g_pDetectionRing, logger, pScheduler, workerID);
+		assert(nullptr != pipeline.pRing);
+		pipeline.pRing->setChannelInfos(&g_channelInfos);
+		pDeviceWorker->addCustomerTask(pipeline.pRing);
+	}
+	
+	if (nullptr != g_pResultStreamer) {
+		PRE_MODULE_LIST preModules_stream;
+		preModules_stream.push_back(std::make_pair(pipeline.pParser, 0)); // COORDS
+		pipeline.pStream = new ResultStreamModule(preModules_stream, g_pResultStreamer, logger, pScheduler, workerID);
+		assert(nullptr != pipeline.pStream);
+		pDeviceWorker->addCustomerTask(pipeline.pStream);
+	}
+	
+	if (nullptr != g_pClipRecorder) {
+		PRE_MODULE_LIST preModules_clip;
+		preModules_clip.push_back(std::make_pair(pipeline.pParser, 0)); // COORDS
+		pipeline.pClip = new ClipTriggerModule(preModules_clip, g_pClipRecorder, logger, pScheduler, workerID);
+		assert(nullptr != pipeline.pClip);
+		pDeviceWorker->addCustomerTask(pipeline.pClip);
+	}
+	
+	if (nullptr != g_pSnapshotPool) {
+		PRE_MODULE_LIST preModules_snapshot;
+		preModules_snapshot.push_back(std::make_pair(pConvertor, 1)); // NV12
+		preModules_snapshot.push_back(std::make_pair(pipeline.pParser, 0)); // COORDS
+		pipeline.pSnapshot = new SnapshotModule(preModules_snapshot, g_pSnapshotPool, g_pSnapshotSelector, logger,
+												pScheduler, workerID);
+		assert(nullptr != pipeline.pSnapshot);
+		pDeviceWorker->addCustomerTask(pipeline.pSnapshot);
+	}
+	
+	if (nullptr != g_pArchive) {
+		PRE_MODULE_LIST preModules_archive;
+		preModules_archive.push_back(std::make_pair(pipeline.pParser, 0)); // COORDS
+		pipeline.pArchive = new DetectionArchiveModule(preModules_archive, g_pArchive, logger, pScheduler, workerID);
+		assert(nullptr != pipeline.pArchive);
+		pDeviceWorker->addCustomerTask(pipeline.pArchive);
+	}
+	
+#ifndef CPU_ONLY
 	if (g_gui) {
 	  // OpenGL playback
 	        PRE_MODULE_LIST preModules_playback;
 		preModules_playback.push_back(std::make_pair(pConvertor, 1)); // NV12
-		preModules_playback.push_back(std::make_pair(pParser, 0)); // COORDS
-		pPlayback = new PlaybackModule(preModules_playback,
-	               g_nChannels,
+		preModules_playback.push_back(std::make_pair(pipeline.pParser, 0)); // COORDS
+		pipeline.pPlayback = new PlaybackModule(preModules_playback,
+	               nLanes,
  	               g_devID_display,
-	               g_devID_infer,
+	               devID,
 	               g_labelFile,
 	               g_tileWidth,
 	               g_tileHeight,
 	               g_tilesInRow,
 	               g_fullScreen,
-	               logger);
-		assert(nullptr != pPlayback);
-		pDeviceWorker->addCustomerTask(pPlayback);
+	               logger,
+	               workerID);
+		assert(nullptr != pipeline.pPlayback);
+		pDeviceWorker->addCustomerTask(pipeline.pPlayback);
+	} else
+#endif
+	if (nullptr != g_pStitcher) {
+	// the offline mode writes one log of the recording instead
+		PRE_MODULE_LIST preModules_stitch;
+		preModules_stitch.push_back(std::make_pair(pipeline.pParser, 0)); // COORDS
+		pipeline.pStitch = new OfflineStitchModule(preModules_stitch, g_pStitcher, logger, pScheduler, workerID);
+		assert(nullptr != pipeline.pStitch);
+		pDeviceWorker->addCustomerTask(pipeline.pStitch);
 	} else {
-	// Kitti logging of results
+	// Kitti logging of results, coordinates only: without -gui and
+	// snapshots nothing reads the NV12 frames of the convertor
 	        PRE_MODULE_LIST preModules_kitti;
-		preModules_kitti.push_back(std::make_pair(pConvertor, 1)); // NV12
-		preModules_kitti.push_back(std::make_pair(pParser, 0)); // COORDS
-		pKitti = new KittiLoggerModule(preModules_kitti,
-			g_nChannels,
-                        g_devID_display,
-			g_devID_infer,
-			g_labelFile, logger);
-		assert(nullptr != pKitti);
-		pDeviceWorker->addCustomerTask(pKitti);
-	}
-		
-	for (int i = 0; i < g_nChannels; ++i) {
-		g_vpDecProfilers.push_back(new DecodeProfiler);
-		pDeviceWorker->setDecodeProfiler(g_vpDecProfilers[i], i);
+		preModules_kitti.push_back(std::make_pair(pipeline.pParser, 0)); // COORDS
+		pipeline.pKitti = new KittiLoggerModule(preModules_kitti,
+			nLanes,
+			g_labelFile, logger,
+			pScheduler, workerID);
+		assert(nullptr != pipeline.pKitti);
+		pipeline.pKitti->setCarryForward(g_carryForward);
+		pipeline.pKitti->setChannelInfos(&g_channelInfos);
+		pDeviceWorker->addCustomerTask(pipeline.pKitti);
 	}
-	
-	g_analysisProfiler = new AnalysisProfiler(logger);
-	pDeviceWorker->setAnalysisProfiler(g_analysisProfiler);
-	
-	// start the device worker.
-	pDeviceWorker->start();
 		
-	// what the users need to do is 
-	// push video packets into a packet cache
-	std::vector<std::thread > vUserThreads;
-	for (int i = 0; i < g_nChannels; ++i) {
-		vUserThreads.push_back( std::thread(userPushPacket,
-											vpDataProviders[i],
-											pDeviceWorker,
-											i
-											) );	
-	}
-
-	for (auto& th : vUserThreads) {
-		th.join();
+	for (int i = 0; i < nLanes; ++i) {
+		pipeline.vpDecProfilers.push_back(new DecodeProfiler(pScheduler, workerID));
+		pDeviceWorker->setDecodeProfiler(pipeline.vpDecProfilers[i], i);
 	}
 	
-	pDeviceWorker->stop();
-	
-	// free
-	pDeviceWorker->destroy();
-	
-	while (!vpDataProviders.empty()) {
-		StreamDataProvider *temp = vpDataProviders.back();
-		vpDataProviders.pop_back();
-		delete temp;
-	}
-	for (int i = 0; i < g_nChannels; ++i) {
-		delete g_vpDecProfilers[i];
-	}
-	if (nullptr != pParser) {
-		delete pParser;
-	}
-	if (nullptr != pPlayback) {
-		delete pPlayback;
-	}
-	if (nullptr != logger) {
-		delete logger;
-	}
-	if (nullptr != g_analysisProfiler) {
-		delete g_analysisProfiler;
-	}
-        if (nullptr != pKitti) {
-	        delete pKitti;
-	}
-	return 0;
+	pipeline.pAnalysisProfiler = new AnalysisProfiler(logger, pScheduler, workerID);
+	pDeviceWorker->setAnalysisProfiler(pipeline.pAnalysisProfiler);
 }
 	
 void getFileNames(const int nFiles, char *fileList, std::vector<std::string> &files) {
@@ -282,40 +629,88 @@ void getFileNames(const int nFiles, char *fileList, std::vector<std::string> &fi
 	}
 }
 
-void userPushPacket(DataProvider *pDataProvider, IDeviceWorker *pDeviceWorker, const int laneID) {
-	assert(NULL != pDeviceWorker);
+void getDeviceIDs(char *devList, std::vector<int> &devIDs) {
+	char *str;
+	str = strtok(devList, ",");
+	while (NULL != str) {
+		devIDs.push_back(atoi(str));
+		str = strtok(NULL, ",");
+	}
+}
+
+// NUMA node of the PCIe root of a device, -1 for the CPU backend or when unknown
+int getDeviceNode(const int devID) {
+	if (devID < 0) {
+		return -1;
+	}
+#ifdef CPU_ONLY
+	return -1;
+#else
+	char busId[32] = { 0 };
+	if (cudaSuccess != cudaDeviceGetPCIBusId(busId, sizeof(busId), devID)) {
+		return -1;
+	}
+	return ThreadPlacement::getPciNode(busId);
+#endif
+}
+
+void userPushPacket(DataProvider *pDataProvider, ChannelScheduler *pScheduler, const int channel,
+					const std::atomic<bool > *pbRun) {
+	assert(NULL != pScheduler);
 	assert(NULL != pDataProvider);
 	int nBuf = 0;
 	uint8_t *pBuf = nullptr;
-	int nPkts = 0;
-	struct timeval timerOfLastPkt;
-	struct timeval timerOfCurrPkt;
+	TRACE_THREAD_NAME("userPushPacket");
+	placeThread(ROLE_PUSH, "push", channel);
+	int lastWorker = -1, lastLane = -1;
 	
-	gettimeofday(&timerOfLastPkt, NULL);
-	while (true) {
+	// the registry clears *pbRun to detach the channel, the lane stays open
+	while (pbRun->load()) {
+		// a decoder which takes over the channel has to start at a keyframe
+		int placedWorker = -1, placedLane = -1;
+		pScheduler->getPlacement(channel, &placedWorker, &placedLane);
+		if (lastWorker >= 0 && (placedWorker != lastWorker || placedLane != lastLane)) {
+			pDataProvider->waitForKeyframe();
+		}
+		lastWorker = placedWorker;
+		lastLane = placedLane;
+		
 		// get a frame packet from a video file
 		int bStatus = pDataProvider->getData(&pBuf, &nBuf);
+		if (bStatus != 0 && 0 == nBuf) {
+			// live source without a new packet yet
+			continue;
+		}
 		if (bStatus == 0) {
 			if (g_endlessLoop) {
 				//LOG_DEBUG(logger, "User: Reloading...");
 				pDataProvider->reload();
 			} else {
 				LOG_DEBUG(logger, "User: Ending...");
-				// push the last NAL unit packet into deviceWorker
-				pDeviceWorker->pushPacket(pBuf, nBuf, laneID);
-				pDeviceWorker->stopPushPacket(laneID);
+				// push the last NAL unit packet into deviceWorker, the
+				// lane numbers its pictures on for the next channel
+				int worker = -1, lane = -1;
+				if (pScheduler->pushPacket(channel, pBuf, nBuf, &worker, &lane) && nullptr != g_pTracer) {
+					g_pTracer->onPacketPushed(worker, lane, pDataProvider->getLastStamp(), pDataProvider->getCodec(),
+											pBuf, nBuf);
+				}
+				// with a channel file the lane is kept for the next channel
+				if (nullptr == g_channelFile) {
+					pScheduler->stopPushPacket(channel);
+				}
 				break;
 			}
 		} else {
-			/*gettimeofday(&timerOfCurrPkt, NULL);
-			double t = (timerOfCurrPkt.tv_sec - timerOfLastPkt.tv_sec) * 1000.0
-						+ (timerOfCurrPkt.tv_usec - timerOfLastPkt.tv_usec) / 1000.0;
-			if (t < 40.0) {
-				std::this_thread::sleep_for(std::chrono::milliseconds((int)(40.0-t))); // ms
+			// Push packet into the deviceWorker the channel is placed on.
+			TRACE_RANGE("pushPacket");
+			uint64_t tPush = metricsNowUs();
+			int worker = -1, lane = -1;
+			bool bPushed = pScheduler->pushPacket(channel, pBuf, nBuf, &worker, &lane);
+			recordMetric(STAGE_PUSH_PACKET, channel, metricsNowUs() - tPush);
+			if (bPushed && nullptr != g_pTracer) {
+				g_pTracer->onPacketPushed(worker, lane, pDataProvider->getLastStamp(), pDataProvider->getCodec(),
+										pBuf, nBuf);
 			}
-			gettimeofday(&timerOfLastPkt, NULL);
-			*/// Push packet into deviceWorker.
-			pDeviceWorker->pushPacket(pBuf, nBuf, laneID);
 		}
 	}
 }
@@ -323,7 +718,23 @@ void userPushPacket(DataProvider *pDataProvider, IDeviceWorker *pDeviceWorker, c
 bool parseArg(int argc, char **argv) {
 	bool ret = false;
 	
+	// -backend=cpu runs the host-side pipeline without any GPU
+	char *backend = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "backend", &backend)
+		&& 0 == strcmp(backend, "cpu")) {
+		g_backend = BACKEND_CPU;
+		LOG_DEBUG(logger, "CPU reference backend.");
+	}
+	
+#ifdef CPU_ONLY
+	// built without CUDA, see make cpu
+	g_backend = BACKEND_CPU;
+#endif
 	int nDevs = 0;
+	if (BACKEND_CPU == g_backend) {
+		return parseCommonArg(argc, argv);
+	}
+#ifndef CPU_ONLY
 	cudaError_t err = cudaGetDeviceCount(&nDevs);
 	if (0 == nDevs) {
 		LOG_ERROR(logger, "Warning: No CUDA capable device!");
@@ -341,20 +752,54 @@ bool parseArg(int argc, char **argv) {
 
 	LOG_DEBUG(logger, "Device ID for display [" << g_devID_display << "]: " << deviceProp.name);
 	
-	g_devID_infer = getCmdLineArgumentInt(argc, (const char **)argv, "devID_infer");
-	if (g_devID_infer < 0 || g_devID_infer >= nDevs) { 
-		LOG_ERROR(logger, "Warning: No such GPU device!");
-		return false; 
+	// devID_infer is a comma separated list, e.g. -devID_infer=0,1
+	char *devList = nullptr;
+	ret = getCmdLineArgumentString(argc, (const char **)argv, "devID_infer", &devList);
+	if (!ret) {
+		LOG_ERROR(logger, "Warning: No inference device!");
+		return false;
+	}
+	getDeviceIDs(devList, g_vDevID_infer);
+	if (g_vDevID_infer.empty()) {
+		LOG_ERROR(logger, "Warning: No inference device!");
+		return false;
+	}
+	for (size_t i = 0; i < g_vDevID_infer.size(); ++i) {
+		if (g_vDevID_infer[i] < 0 || g_vDevID_infer[i] >= nDevs) { 
+			LOG_ERROR(logger, "Warning: No such GPU device!");
+			return false; 
+		}
+		cudaGetDeviceProperties(&deviceProp, g_vDevID_infer[i]);
+		LOG_DEBUG(logger, "Device ID for inference [" << g_vDevID_infer[i] << "]: " << deviceProp.name);
+	}
+	g_devID_infer = g_vDevID_infer[0];
+#endif
+
+	return parseCommonArg(argc, argv);
+}
+
+// Arguments shared by all backends
+bool parseCommonArg(int argc, char **argv) {
+	bool ret = false;
+	
+	if (BACKEND_CPU == g_backend) {
+		// a single CPU worker stands in for the inference devices
+		g_vDevID_infer.assign(1, -1);
+		g_devID_infer = -1;
 	}
-    cudaGetDeviceProperties(&deviceProp, g_devID_infer);
-	LOG_DEBUG(logger, "Device ID for inference [" << g_devID_infer << "]: " << deviceProp.name);
 
 	g_nChannels = getCmdLineArgumentInt(argc, (const char **)argv, "nChannels");
 	if (g_nChannels <= 0) { return false; }
 	LOG_DEBUG(logger, "Video channels: " << g_nChannels);
 	
+	// -farm=<recording> feeds all channels from one Annex-B recording,
+	// -offline=<recording> analyses one on all of them,
+	// -channelFile=<path> attaches and detaches channels at runtime
+	getCmdLineArgumentString(argc, (const char **)argv, "farm", &g_farmFile);
+	getCmdLineArgumentString(argc, (const char **)argv, "offline", &g_offlineFile);
+	getCmdLineArgumentString(argc, (const char **)argv, "channelFile", &g_channelFile);
 	ret = getCmdLineArgumentString(argc, (const char **)argv, "fileList", &g_fileList);
-	if (!ret) {
+	if (!ret && nullptr == g_farmFile && nullptr == g_offlineFile && nullptr == g_channelFile) {
 		LOG_ERROR(logger, "Warning: No h264 files.");
 		return false;
 	}
@@ -366,7 +811,7 @@ bool parseArg(int argc, char **argv) {
 	}
 	
 	ret = getCmdLineArgumentString(argc, (const char **)argv, "modelFile", &g_modelFile);
-	if (!ret) {
+	if (!ret && BACKEND_DEEPSTREAM == g_backend) {
 		LOG_ERROR(logger, "Warning: No model files.");
 		return false;
 	}
@@ -409,12 +854,29 @@ bool parseArg(int argc, char **argv) {
 	}
 
 	g_gui = (bool)getCmdLineArgumentInt(argc, (const char **)argv, "gui");
+	if (true == g_gui && BACKEND_CPU == g_backend) {
+		LOG_WARN(logger, "Warning: GUI playback needs a GPU, using KITTI logs instead.");
+		g_gui = false;
+	}
 	if (true == g_gui) {
 		LOG_DEBUG(logger, "GUI enabled.");
+		// PresenterGL is a single window, it can only be fed by one device
+		if (g_vDevID_infer.size() > 1) {
+			LOG_WARN(logger, "Warning: GUI playback uses only inference device " << g_devID_infer);
+			g_vDevID_infer.resize(1);
+		}
 	} else {
 	        LOG_DEBUG(logger, "GUI disabled. KITTI log files will be generated.");
 	}
 
+	if (checkCmdLineFlag(argc, (const char **)argv, "spareLanes")) {
+		g_spareLanes = getCmdLineArgumentInt(argc, (const char **)argv, "spareLanes");
+		if (g_spareLanes < 0) {
+			LOG_ERROR(logger, "Warning: Illegal number of spare lanes!");
+			return false;
+		}
+	}
+
 	g_endlessLoop = getCmdLineArgumentInt(argc, (const char **)argv, "endlessLoop");
 	assert(0 == g_endlessLoop || 1 == g_endlessLoop);
 	LOG_DEBUG(logger, "Endless Loop: " << g_endlessLoop);
@@ -426,15 +888,663 @@ bool parseArg(int argc, char **argv) {
 		g_dataType = FLOAT;
 	}
 	
-	// create data provider
-	std::vector<std::string > vFiles;
-	getFileNames(g_nChannels, g_fileList, vFiles);
-	for (int i = 0; i < g_nChannels; ++i) {
-		vpDataProviders.push_back(new StreamDataProvider(vFiles[i].c_str(), logger));
+	// -metricsPort serves Prometheus text, -metricsJson dumps p50/p99/p999
+	g_metricsPort = getCmdLineArgumentInt(argc, (const char **)argv, "metricsPort");
+	getCmdLineArgumentString(argc, (const char **)argv, "metricsJson", &g_metricsJson);
+	if (checkCmdLineFlag(argc, (const char **)argv, "metricsInterval")) {
+		g_metricsInterval = getCmdLineArgumentInt(argc, (const char **)argv, "metricsInterval");
+	}
+	if (g_metricsPort > 0 || nullptr != g_metricsJson) {
+		g_pMetrics = new MetricsRegistry(g_nChannels);
+		LOG_DEBUG(logger, "Stage latency metrics enabled.");
+	}
+	
+	// -trace writes a Chrome/Perfetto JSON timeline, needs a build with ENABLE_TRACING
+	if (getCmdLineArgumentString(argc, (const char **)argv, "trace", &g_traceFile)) {
+#ifndef ENABLE_TRACING
+		LOG_WARN(logger, "Warning: built without ENABLE_TRACING, -trace is ignored.");
+		g_traceFile = nullptr;
+#endif
+	}
+	
+	// -sloMs flags channels whose end-to-end latency exceeds the target
+	if (checkCmdLineFlag(argc, (const char **)argv, "sloMs")) {
+		g_sloMs = getCmdLineArgumentFloat(argc, (const char **)argv, "sloMs");
+		LOG_DEBUG(logger, "End-to-end latency SLO: " << g_sloMs << " ms");
+	}
+	
+	// -rtspClient=native replaces libavformat for rtsp:// inputs,
+	// -rtspTransport=tcp|udp and -rtspThreads=<N> reactor threads for all streams
+	char *rtspClient = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "rtspClient", &rtspClient)) {
+		if (0 == strcmp(rtspClient, "native")) {
+			g_streamClient = STREAM_CLIENT_NATIVE;
+		} else if (0 != strcmp(rtspClient, "ffmpeg")) {
+			LOG_ERROR(logger, "Warning: Unknown RTSP client " << rtspClient);
+			return false;
+		}
+	}
+	if (STREAM_CLIENT_NATIVE == g_streamClient) {
+		RTSP_TRANSPORT transport = RTSP_TRANSPORT_TCP;
+		char *rtspTransport = nullptr;
+		if (getCmdLineArgumentString(argc, (const char **)argv, "rtspTransport", &rtspTransport)
+			&& 0 == strcmp(rtspTransport, "udp")) {
+			transport = RTSP_TRANSPORT_UDP;
+		}
+		int nThreads = 1;
+		if (checkCmdLineFlag(argc, (const char **)argv, "rtspThreads")) {
+			nThreads = getCmdLineArgumentInt(argc, (const char **)argv, "rtspThreads");
+		}
+		RtspClient::configure(transport, nThreads);
+		LOG_DEBUG(logger, "Native RTSP client over " << (RTSP_TRANSPORT_UDP == transport ? "UDP" : "TCP")
+							<< ", " << std::max(1, nThreads) << " receive thread(s)");
+	}
+	
+	// -jitterProfile=low drops late packets without buffering, robust[:<packets>[:<ms>]]
+	// reorders within a window (default 64 packets, 100 ms)
+	char *jitterProfile = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "jitterProfile", &jitterProfile)) {
+		if (!parseJitterProfile(jitterProfile, g_jitterParams)) {
+			LOG_ERROR(logger, "Warning: Unknown jitter profile " << jitterProfile);
+			return false;
+		}
+		LOG_DEBUG(logger, "Jitter profile: " << jitterProfile);
+	}
+	
+	// -pacing=1x|2x|10x|<F>x|max replays file inputs in real time by their
+	// timestamps, or by -pacingFps=<F>. Channel i starts after
+	// -pacingOffsetMs=<ms>[,<ms>...] (the last value applies to the
+	// remaining channels) plus i times -pacingStaggerMs=<ms>
+	char *pacing = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "pacing", &pacing)) {
+		if (!parsePacingSpeed(pacing, g_pacingParams.speed)) {
+			LOG_ERROR(logger, "Warning: Unknown pacing speed " << pacing);
+			return false;
+		}
+		g_pacingParams.bEnabled = true;
+		if (checkCmdLineFlag(argc, (const char **)argv, "pacingFps")) {
+			g_pacingParams.fps = getCmdLineArgumentFloat(argc, (const char **)argv, "pacingFps");
+			if (g_pacingParams.fps <= 0.f) {
+				LOG_ERROR(logger, "Warning: Illegal pacing frame rate!");
+				return false;
+			}
+		}
+		if (getCmdLineArgumentString(argc, (const char **)argv, "pacingOffsetMs", &g_pacingOffsets)) {
+			g_vPacingOffsets.clear();
+			getFileNames(g_nChannels, g_pacingOffsets, g_vPacingOffsets);
+		}
+		g_pacingStaggerMs = getCmdLineArgumentInt(argc, (const char **)argv, "pacingStaggerMs");
+		for (size_t i = 0; i < g_vPacingOffsets.size(); ++i) {
+			if (atoi(g_vPacingOffsets[i].c_str()) < 0 || g_pacingStaggerMs < 0) {
+				LOG_ERROR(logger, "Warning: Illegal pacing offset!");
+				return false;
+			}
+		}
+		LOG_DEBUG(logger, "Pacing file inputs at " << pacing);
+	}
+	
+	// -farm spreads the channels evenly over the recording, each plays it
+	// once around at -pacing speed (1x by default) and -pacingFps (25 by
+	// default), every frame interval varied by up to -farmJitter (0..0.5)
+	if (nullptr != g_farmFile) {
+		g_pRecording = new SharedRecording(g_farmFile, logger);
+		if (!g_pRecording->load()) {
+			return false;
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "farmJitter")) {
+			g_farmJitter = getCmdLineArgumentFloat(argc, (const char **)argv, "farmJitter");
+			if (g_farmJitter < 0.f || g_farmJitter > 0.5f) {
+				LOG_ERROR(logger, "Warning: Illegal farm jitter!");
+				return false;
+			}
+		}
+	}
+	
+	// -offline cuts the recording at keyframes into segments of at least
+	// -offlineSegmentFrames pictures (a quarter of a channel's share by
+	// default) which the channels decode as fast as they can, and writes
+	// the detections in the order of the recording to ./log/log_offline.txt.
+	// The recording is held once in memory rather than read through a
+	// FileDataProvider per lane, so every lane seeks to its segment's
+	// keyframe without opening and parsing the file again. The results are
+	// placed by source picture, which only the CPU backend's frames carry,
+	// see FrameTracer.
+	if (nullptr != g_offlineFile) {
+		if (nullptr != g_farmFile || g_endlessLoop || g_gui) {
+			LOG_ERROR(logger, "Warning: -offline excludes -farm, -endlessLoop and -gui!");
+			return false;
+		}
+		if (BACKEND_CPU != g_backend) {
+			LOG_ERROR(logger, "Warning: -offline needs -backend=cpu!");
+			return false;
+		}
+		g_pRecording = new SharedRecording(g_offlineFile, logger);
+		if (!g_pRecording->load()) {
+			return false;
+		}
+		int segmentFrames = std::max(1, g_pRecording->getNbFrames() / (4 * g_nChannels));
+		if (checkCmdLineFlag(argc, (const char **)argv, "offlineSegmentFrames")) {
+			segmentFrames = getCmdLineArgumentInt(argc, (const char **)argv, "offlineSegmentFrames");
+			if (segmentFrames <= 0) {
+				LOG_ERROR(logger, "Warning: Illegal offline segment length!");
+				return false;
+			}
+		}
+		g_pSegmentQueue = new RecordingSegmentQueue(g_pRecording, segmentFrames);
+		if (g_pSegmentQueue->getSegments().empty()) {
+			LOG_ERROR(logger, "Warning: No keyframe in " << g_offlineFile);
+			return false;
+		}
+		g_pStitcher = new OfflineStitcher(g_pSegmentQueue, g_nChannels, g_pRecording->getWidth(),
+										g_pRecording->getHeight(), logger);
+		if (!g_pStitcher->open("./log/log_offline.txt", g_labelFile)) {
+			return false;
+		}
+		LOG_DEBUG(logger, "Offline: " << g_pRecording->getNbFrames() << " pictures in "
+							<< g_pSegmentQueue->getSegments().size() << " segments");
+	}
+	
+	// -codec=h264|hevc is the codec of every channel, the decode task of a
+	// device is of one codec; a recording brings its own. Channels of
+	// another codec are refused when they attach
+	char *codec = nullptr;
+	bool bCodec = getCmdLineArgumentString(argc, (const char **)argv, "codec", &codec);
+	if (bCodec) {
+		if (0 == strcmp(codec, "hevc") || 0 == strcmp(codec, "h265")) {
+			g_codec = VIDEO_CODEC_HEVC;
+		} else if (0 != strcmp(codec, "h264")) {
+			LOG_ERROR(logger, "Warning: Unknown codec " << codec);
+			return false;
+		}
+	}
+	if (nullptr != g_pRecording) {
+		if (bCodec && g_codec != g_pRecording->getCodec()) {
+			LOG_ERROR(logger, "Warning: -codec differs from the codec of the recording!");
+			return false;
+		}
+		g_codec = g_pRecording->getCodec();
+	}
+	LOG_DEBUG(logger, "Codec: " << (VIDEO_CODEC_HEVC == g_codec ? "HEVC" : "H.264"));
+	
+	// -channelFile=<path> attaches and detaches channels at runtime, see
+	// ChannelRegistry. -nChannels is then the number of channel slots the
+	// pipeline is sized for. Otherwise a channel is "analysisURL[|mainURL]"
+	// in -fileList
+	if (nullptr != g_channelFile) {
+		if (nullptr != g_pRecording) {
+			LOG_ERROR(logger, "Warning: -farm and -offline exclude -channelFile!");
+			return false;
+		}
+		LOG_DEBUG(logger, "Channel file: " << g_channelFile << ", " << g_nChannels << " slots");
+	} else if (nullptr == g_pRecording) {
+		getFileNames(g_nChannels, g_fileList, g_vFiles);
+		if ((int)g_vFiles.size() < g_nChannels) {
+			LOG_ERROR(logger, "Warning: fewer files than channels!");
+			return false;
+		}
+	}
+	g_channelInfos.resize(g_nChannels);
+	
+	// -adaptiveFps=1 lowers the rate of channels with an empty scene,
+	// bounded by -minFps and -maxFps, halved after every -idleSec seconds
+	if (1 == getCmdLineArgumentInt(argc, (const char **)argv, "adaptiveFps")) {
+		if (checkCmdLineFlag(argc, (const char **)argv, "minFps")) {
+			g_activityParams.minFps = getCmdLineArgumentFloat(argc, (const char **)argv, "minFps");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "maxFps")) {
+			g_activityParams.maxFps = getCmdLineArgumentFloat(argc, (const char **)argv, "maxFps");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "idleSec")) {
+			g_activityParams.idleSec = getCmdLineArgumentFloat(argc, (const char **)argv, "idleSec");
+		}
+		if (g_activityParams.minFps <= 0.f || g_activityParams.maxFps < g_activityParams.minFps || g_activityParams.idleSec <= 0.f) {
+			LOG_ERROR(logger, "Warning: Illegal adaptive frame rate bounds!");
+			return false;
+		}
+		g_pActivity = new ActivityController(g_nChannels, g_activityParams, logger);
+		LOG_DEBUG(logger, "Adaptive analysis rate: " << g_activityParams.minFps << " - " << g_activityParams.maxFps << " fps");
+	}
+	
+	// -roiFile has include/exclude polygons per channel, reloaded on change
+	char *roiFile = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "roiFile", &roiFile)) {
+		// 640x368 network input, one cell per 16x16 pixels
+		g_pRoiMasks = new RoiMaskSet(roiFile, g_nChannels, 40, 23, 16, 640, 368, logger);
+		if (!g_pRoiMasks->load()) {
+			return false;
+		}
+		LOG_DEBUG(logger, "ROI masks: " << roiFile);
+	}
+	
+	// -detectionRing=/<name> publishes the detections into POSIX shared
+	// memory for local consumers, -ringCapacity=<records> (4096 by default)
+	char *ringName = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "detectionRing", &ringName)) {
+		int capacity = 4096;
+		if (checkCmdLineFlag(argc, (const char **)argv, "ringCapacity")) {
+			capacity = getCmdLineArgumentInt(argc, (const char **)argv, "ringCapacity");
+		}
+		if ('/' != ringName[0] || nullptr != strchr(ringName + 1, '/') || capacity <= 0 || capacity > (1 << 20)) {
+			LOG_ERROR(logger, "Warning: Illegal detection ring " << ringName);
+			return false;
+		}
+		if (g_nChannels > DETECTION_RING_MAX_CHANNELS) {
+			LOG_ERROR(logger, "Warning: the detection ring holds at most " << DETECTION_RING_MAX_CHANNELS << " channels!");
+			return false;
+		}
+		g_pDetectionRing = new DetectionRingWriter(ringName, capacity);
+		if (!g_pDetectionRing->create()) {
+			LOG_ERROR(logger, "Warning: Failed to create detection ring " << ringName);
+			return false;
+		}
+		LOG_DEBUG(logger, "Detection ring: " << ringName << ", " << g_pDetectionRing->getCapacity() << " records");
+	}
+	
+	// -resultStream=unix:<path>|tcp:[<host>:]<port> streams the detections
+	// to socket subscribers. -streamPolicy=drop (default) drops batches for
+	// a subscriber more than -streamQueueKB (4096) behind, block keeps them
+	// and cuts the subscriber off at 16 times that
+	char *streamEndpoint = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "resultStream", &streamEndpoint)) {
+		STREAM_PARAMS streamParams;
+		char *policy = nullptr;
+		if (getCmdLineArgumentString(argc, (const char **)argv, "streamPolicy", &policy)) {
+			if (0 == strcmp(policy, "block")) {
+				streamParams.policy = STREAM_BLOCK;
+			} else if (0 != strcmp(policy, "drop")) {
+				LOG_ERROR(logger, "Warning: Unknown stream policy " << policy);
+				return false;
+			}
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "streamQueueKB")) {
+			int queueKB = getCmdLineArgumentInt(argc, (const char **)argv, "streamQueueKB");
+			if (queueKB <= 0) {
+				LOG_ERROR(logger, "Warning: Illegal stream queue size!");
+				return false;
+			}
+			streamParams.maxQueuedBytes = (size_t)queueKB << 10;
+		}
+		g_pResultStreamer = new ResultStreamer(streamParams, logger);
+		if (!g_pResultStreamer->start(streamEndpoint)) {
+			return false;
+		}
+	}
+	
+	// -clipDir=<dir> records the packets around each detection to clips,
+	// -clipPreSec and -clipPostSec (5) before and after the picture,
+	// -clipFormat=mp4|mkv, -clipBudgetMB (32) of packets kept per channel,
+	// -clipClasses=<c>[,<c>...] the label lines which trigger, all by default
+	char *clipDir = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "clipDir", &clipDir)) {
+		CLIP_PARAMS clipParams;
+		clipParams.dir = clipDir;
+		if (checkCmdLineFlag(argc, (const char **)argv, "clipPreSec")) {
+			clipParams.preSec = getCmdLineArgumentFloat(argc, (const char **)argv, "clipPreSec");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "clipPostSec")) {
+			clipParams.postSec = getCmdLineArgumentFloat(argc, (const char **)argv, "clipPostSec");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "clipBudgetMB")) {
+			int budgetMB = getCmdLineArgumentInt(argc, (const char **)argv, "clipBudgetMB");
+			if (budgetMB <= 0) {
+				LOG_ERROR(logger, "Warning: Illegal clip budget!");
+				return false;
+			}
+			clipParams.budgetBytes = (size_t)budgetMB << 20;
+		}
+		if (clipParams.preSec < 0.f || clipParams.postSec < 0.f) {
+			LOG_ERROR(logger, "Warning: Illegal clip pre-roll or post-roll!");
+			return false;
+		}
+		char *clipFormat = nullptr;
+		if (getCmdLineArgumentString(argc, (const char **)argv, "clipFormat", &clipFormat)) {
+			if (0 != strcmp(clipFormat, "mp4") && 0 != strcmp(clipFormat, "mkv")) {
+				LOG_ERROR(logger, "Warning: Unknown clip format " << clipFormat);
+				return false;
+			}
+			clipParams.format = clipFormat;
+		}
+		char *clipClasses = nullptr;
+		if (getCmdLineArgumentString(argc, (const char **)argv, "clipClasses", &clipClasses)) {
+			std::vector<std::string > vClasses;
+			getFileNames(32, clipClasses, vClasses);
+			clipParams.categoryMask = 0;
+			for (size_t i = 0; i < vClasses.size(); ++i) {
+				int category = atoi(vClasses[i].c_str());
+				if (category < 0 || category >= 32) {
+					LOG_ERROR(logger, "Warning: Illegal clip class " << vClasses[i]);
+					return false;
+				}
+				clipParams.categoryMask |= 1u << category;
+			}
+		}
+		g_pClipRecorder = new ClipRecorder(g_nChannels, clipParams, logger);
+		if (!g_pClipRecorder->start()) {
+			return false;
+		}
+	}
+	
+	// -snapshotDir=<dir> writes a JPEG per new object, at most one per
+	// channel and class every -snapshotIntervalSec (10): a crop with
+	// -snapshotSize (320) px on its longer side, -snapshotFull=1 adds the
+	// full frame. -snapshotQuality (85), -snapshotWorkers (2) encoder
+	// threads, -snapshotClasses=<c>[,<c>...] as -clipClasses
+	char *snapshotDir = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "snapshotDir", &snapshotDir)) {
+		SNAPSHOT_PARAMS snapshotParams;
+		snapshotParams.dir = snapshotDir;
+		if (checkCmdLineFlag(argc, (const char **)argv, "snapshotIntervalSec")) {
+			snapshotParams.intervalSec = getCmdLineArgumentFloat(argc, (const char **)argv, "snapshotIntervalSec");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "snapshotSize")) {
+			snapshotParams.maxSide = getCmdLineArgumentInt(argc, (const char **)argv, "snapshotSize");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "snapshotQuality")) {
+			snapshotParams.quality = getCmdLineArgumentInt(argc, (const char **)argv, "snapshotQuality");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "snapshotWorkers")) {
+			snapshotParams.nWorkers = getCmdLineArgumentInt(argc, (const char **)argv, "snapshotWorkers");
+		}
+		snapshotParams.bFullFrame = 1 == getCmdLineArgumentInt(argc, (const char **)argv, "snapshotFull");
+		if (snapshotParams.intervalSec < 0.f || snapshotParams.maxSide < 0 || snapshotParams.nWorkers <= 0
+			|| snapshotParams.quality <= 0 || snapshotParams.quality > 100) {
+			LOG_ERROR(logger, "Warning: Illegal snapshot interval, size, quality or workers!");
+			return false;
+		}
+		snapshotParams.maxFrames = 4 * snapshotParams.nWorkers;
+		char *snapshotClasses = nullptr;
+		if (getCmdLineArgumentString(argc, (const char **)argv, "snapshotClasses", &snapshotClasses)) {
+			std::vector<std::string > vClasses;
+			getFileNames(32, snapshotClasses, vClasses);
+			snapshotParams.categoryMask = 0;
+			for (size_t i = 0; i < vClasses.size(); ++i) {
+				int category = atoi(vClasses[i].c_str());
+				if (category < 0 || category >= 32) {
+					LOG_ERROR(logger, "Warning: Illegal snapshot class " << vClasses[i]);
+					return false;
+				}
+				snapshotParams.categoryMask |= 1u << category;
+			}
+		}
+		g_pSnapshotSelector = new SnapshotSelector(g_nChannels, snapshotParams);
+		g_pSnapshotPool = new SnapshotEncoderPool(snapshotParams, logger);
+		if (!g_pSnapshotPool->start()) {
+			return false;
+		}
+	}
+	
+	// -archiveDir=<dir> keeps every detection in a per channel archive,
+	// queried with tools/archiveQuery: one file per channel and
+	// -archiveFileSec (3600), deleted after -archiveKeepHours (0, kept)
+	char *archiveDir = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "archiveDir", &archiveDir)) {
+		ARCHIVE_PARAMS archiveParams;
+		archiveParams.dir = archiveDir;
+		if (checkCmdLineFlag(argc, (const char **)argv, "archiveFileSec")) {
+			archiveParams.fileSec = getCmdLineArgumentFloat(argc, (const char **)argv, "archiveFileSec");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "archiveKeepHours")) {
+			archiveParams.keepHours = getCmdLineArgumentFloat(argc, (const char **)argv, "archiveKeepHours");
+		}
+		if (archiveParams.fileSec <= 0.f || archiveParams.keepHours < 0.f) {
+			LOG_ERROR(logger, "Warning: Illegal archive file length or retention!");
+			return false;
+		}
+		g_pArchive = new DetectionArchiveWriter(g_nChannels, archiveParams, logger);
+		if (!g_pArchive->start()) {
+			return false;
+		}
+	}
+	
+	// -recordDir=<dir> records every channel to -segmentSec (60) segments
+	// from the analysis connection, deleted after -recordKeepHours or
+	// beyond -recordMaxGB over all channels, both off by default
+	char *recordDir = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "recordDir", &recordDir)) {
+		RECORD_PARAMS recordParams;
+		recordParams.dir = recordDir;
+		if (checkCmdLineFlag(argc, (const char **)argv, "segmentSec")) {
+			recordParams.segmentSec = getCmdLineArgumentFloat(argc, (const char **)argv, "segmentSec");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "recordKeepHours")) {
+			recordParams.keepHours = getCmdLineArgumentFloat(argc, (const char **)argv, "recordKeepHours");
+		}
+		if (checkCmdLineFlag(argc, (const char **)argv, "recordMaxGB")) {
+			recordParams.maxBytes = (uint64_t)(getCmdLineArgumentFloat(argc, (const char **)argv, "recordMaxGB") * (1 << 30));
+		}
+		if (recordParams.segmentSec <= 0.f || recordParams.keepHours < 0.f) {
+			LOG_ERROR(logger, "Warning: Illegal recording segment length or retention!");
+			return false;
+		}
+		g_pSegmentRecorder = new SegmentRecorder(g_nChannels, recordParams, logger);
+		if (!g_pSegmentRecorder->start()) {
+			return false;
+		}
+	}
+	
+	// -pin=node keeps the threads on the CPUs of the NUMA node of the
+	// inference device, -pin=role splits the node's cores between ingest,
+	// push and host workers and moves the I/O threads to the other nodes,
+	// -pin=cpu also pins each thread to one CPU of its role. -pinIngest,
+	// -pinPush, -pinWorker, -pinIo and -pinPresenter=<cpulist> replace the
+	// CPUs of a role. The threads are named with or without -pin.
+	char *pinMode = nullptr;
+	if (getCmdLineArgumentString(argc, (const char **)argv, "pin", &pinMode) && 0 != strcmp(pinMode, "off")) {
+		PLACEMENT_PARAMS placementParams;
+		if (0 == strcmp(pinMode, "node")) {
+			placementParams.mode = PLACEMENT_NODE;
+		} else if (0 == strcmp(pinMode, "role")) {
+			placementParams.mode = PLACEMENT_ROLE;
+		} else if (0 == strcmp(pinMode, "cpu")) {
+			placementParams.mode = PLACEMENT_CPU;
+		} else {
+			LOG_ERROR(logger, "Warning: Illegal -pin " << pinMode << ", use off, node, role or cpu!");
+			return false;
+		}
+		const char *szRoleFlags[ROLE_COUNT] = { "pinIngest", "pinPush", "pinWorker", "pinIo", "pinPresenter" };
+		for (int i = 0; i < ROLE_COUNT; ++i) {
+			char *cpuList = nullptr;
+			std::vector<int> vCpus;
+			if (!getCmdLineArgumentString(argc, (const char **)argv, szRoleFlags[i], &cpuList)) {
+				continue;
+			}
+			if (!ThreadPlacement::parseCpuList(cpuList, vCpus) || vCpus.empty()) {
+				LOG_ERROR(logger, "Warning: Illegal CPU list -" << szRoleFlags[i] << "=" << cpuList << "!");
+				return false;
+			}
+			placementParams.cpuLists[i] = cpuList;
+		}
+		placementParams.gpuNode = getDeviceNode(g_devID_infer);
+		g_pPlacement = new ThreadPlacement(placementParams, logger);
+		// the threads started from here on, the library's too, inherit it
+		g_pPlacement->bindToNode(g_pPlacement->getHomeNode());
+	}
+	
+	// -packetPool=1 copies the packets of the stream channels into a
+	// size-classed pool as they arrive, so the queues and recorders do
+	// not hold the demuxer's buffers; -packetPoolHugePages=1 maps its
+	// slabs on 2 MB pages, reserved with vm.nr_hugepages
+	if (1 == getCmdLineArgumentInt(argc, (const char **)argv, "packetPool")) {
+		PACKET_POOL_PARAMS poolParams;
+		poolParams.bHugePages = 1 == getCmdLineArgumentInt(argc, (const char **)argv, "packetPoolHugePages");
+		// the takers write the packets, on the node of the device with -pin
+		poolParams.numaNode = nullptr != g_pPlacement ? g_pPlacement->getHomeNode() : -1;
+		g_pPacketPool = new PacketPool(poolParams, logger);
+	}
+	
+	// the providers take one observer, the recorders share it
+	if (nullptr != g_pClipRecorder || nullptr != g_pSegmentRecorder) {
+		g_pPacketObservers = new PacketObserverList();
+		if (nullptr != g_pClipRecorder) {
+			g_pPacketObservers->add(g_pClipRecorder);
+		}
+		if (nullptr != g_pSegmentRecorder) {
+			g_pPacketObservers->add(g_pSegmentRecorder);
+		}
+	}
+	
+	// -motionGate=<ratio> skips inter pictures whose size stays below ratio
+	// times the static noise floor, within the -roiFile regions if given.
+	// -carryForward=1 repeats the last detections in the Kitti logs for
+	// the skipped pictures. Under DeepStream the gate only drops the
+	// pictures nothing refers to, see FrameTracer, and the logs keep
+	// numbering analysed frames.
+	if (checkCmdLineFlag(argc, (const char **)argv, "motionGate")) {
+		g_motionRatio = getCmdLineArgumentFloat(argc, (const char **)argv, "motionGate");
+		if (g_motionRatio <= 1.f) {
+			LOG_ERROR(logger, "Warning: motionGate ratio must be above 1!");
+			return false;
+		}
+		LOG_DEBUG(logger, "Motion gate ratio: " << g_motionRatio);
+	}
+	g_carryForward = 1 == getCmdLineArgumentInt(argc, (const char **)argv, "carryForward");
+	if (g_carryForward && BACKEND_CPU != g_backend) {
+		LOG_WARN(logger, "Warning: DeepStream frames have no source picture, -carryForward is ignored.");
+	}
+	
+	// -sampling=<mode>[,<mode>...] per channel, the last mode applies to
+	// the remaining channels. Modes: all, idr, ref, nth:<N>, fps:<F>
+	if (getCmdLineArgumentString(argc, (const char **)argv, "sampling", &g_sampling)) {
+		g_vSamplingModes.clear();
+		getFileNames(g_nChannels, g_sampling, g_vSamplingModes);
+	}
+	for (size_t i = 0; i < g_vSamplingModes.size(); ++i) {
+		SAMPLING_PARAMS params;
+		if (!parseSamplingMode(g_vSamplingModes[i].c_str(), params)) {
+			LOG_ERROR(logger, "Warning: Unknown sampling mode " << g_vSamplingModes[i]);
+			return false;
+		}
 	}
 	
 	return true;
 }
 
+void removeRecorders(const int channel) {
+	if (nullptr != g_pClipRecorder) {
+		g_pClipRecorder->removeChannel(channel);
+	}
+	if (nullptr != g_pSegmentRecorder) {
+		g_pSegmentRecorder->removeChannel(channel);
+	}
+}
 
+// Provider of a channel slot with its sampler, called by the registry on
+// attach. The definition is "analysisURL[|mainURL]", or the recording of
+// the farm or the offline mode. nullptr when the source cannot be opened.
+DataProvider *createChannelProvider(void *, const int channel, const std::string &definition) {
+	PACING_PARAMS pacingParams = g_pacingParams;
+	pacingParams.startOffsetMs = atoi(g_vPacingOffsets[std::min(channel, (int)g_vPacingOffsets.size() - 1)].c_str())
+									+ channel * g_pacingStaggerMs;
+	DataProvider *pProvider = nullptr;
+	CHANNEL_INFO info;
+	if (nullptr != g_pSegmentQueue) {
+		pProvider = new RecordingSegmentProvider(g_pRecording, g_pSegmentQueue);
+		info.analysisURL = definition;
+		info.outputWidth = info.analysisWidth = pProvider->getFrameWidth();
+		info.outputHeight = info.analysisHeight = pProvider->getFrameHeight();
+	} else if (nullptr != g_pRecording) {
+		VIRTUAL_CAMERA_PARAMS cameraParams;
+		cameraParams.startFrame = (int)((int64_t)channel * g_pRecording->getNbFrames() / g_nChannels);
+		if (g_pacingParams.fps > 0.f) {
+			cameraParams.frameRate = g_pacingParams.fps;
+		}
+		cameraParams.rateJitter = g_farmJitter;
+		cameraParams.seed = channel + 1;
+		cameraParams.pacing = pacingParams;
+		pProvider = new VirtualCameraProvider(g_pRecording, cameraParams);
+		info.analysisURL = definition;
+		info.outputWidth = info.analysisWidth = pProvider->getFrameWidth();
+		info.outputHeight = info.analysisHeight = pProvider->getFrameHeight();
+	} else {
+		info = parseChannelDefinition(definition);
+		StreamDataProvider *pStream = new StreamDataProvider(info.analysisURL.c_str(), logger, channel, g_streamClient,
+															g_jitterParams, pacingParams);
+		if (!pStream->isOpen()) {
+			delete pStream;
+			return nullptr;
+		}
+		pProvider = pStream;
+		if (nullptr != g_pPacketPool) {
+			pProvider->setPacketPool(g_pPacketPool);
+		}
+		info.analysisWidth = pProvider->getFrameWidth();
+		info.analysisHeight = pProvider->getFrameHeight();
+		// the recorders keep the main stream, its size comes with it
+		if (!info.mainURL.empty() && nullptr != g_pPacketObservers) {
+			if (!pStream->openMainStream(info.mainURL.c_str(), g_streamClient, g_jitterParams)) {
+				LOG_WARN(logger, "Warning: Channel " << channel << " records its analysed stream, the main stream did not open.");
+			} else if (pStream->getMainWidth() > 0) {
+				info.outputWidth = pStream->getMainWidth();
+				info.outputHeight = pStream->getMainHeight();
+				g_channelInfos.setMainSize(info.mainURL, info.outputWidth, info.outputHeight);
+			}
+		}
+		if (info.outputWidth <= 0 && !probeMainStream(info, g_channelInfos, logger)) {
+			info.outputWidth = info.analysisWidth;
+			info.outputHeight = info.analysisHeight;
+		}
+	}
+	if (pProvider->getCodec() != g_codec) {
+		LOG_ERROR(logger, "Channel " << channel << " is " << (VIDEO_CODEC_HEVC == pProvider->getCodec() ? "HEVC" : "H.264")
+							<< ", the decoders are not, see -codec");
+		delete pProvider;
+		return nullptr;
+	}
+	LOG_DEBUG(logger, "Channel " << channel << ": analysis " << info.analysisWidth << "x" << info.analysisHeight
+						<< ", output " << info.outputWidth << "x" << info.outputHeight);
+	if (nullptr != pProvider->getPacer()) {
+		LOG_DEBUG(logger, "Channel " << channel << " paced, starts after " << pacingParams.startOffsetMs << " ms");
+	}
+	// the sinks only read the output size, it is set before the channel is placed
+	g_channelInfos.set(channel, info);
+	
+	const std::string &mode = g_vSamplingModes[std::min(channel, (int)g_vSamplingModes.size() - 1)];
+	SAMPLING_PARAMS params;
+	parseSamplingMode(mode.c_str(), params);
+	// adaptive channels sample by rate, the fixed modes stay as they are
+	if (nullptr != g_pActivity && SAMPLE_ALL == params.mode) {
+		params.mode = SAMPLE_TARGET_FPS;
+		params.targetFps = g_activityParams.maxFps;
+	}
+	if (SAMPLE_ALL != params.mode) {
+		LOG_DEBUG(logger, "Channel " << channel << " sampling: " << mode);
+	}
+	PacketSampler *pSampler = new PacketSampler(params, pProvider->getCodec());
+	if (g_motionRatio > 0.f) {
+		MOTION_GATE_PARAMS gateParams;
+		gateParams.motionRatio = g_motionRatio;
+		pSampler->setMotionGate(new MotionGate(pProvider->getCodec(), gateParams, g_pRoiMasks, channel));
+	}
+	pProvider->setSampler(pSampler);
+	if (nullptr != g_pActivity && SAMPLE_TARGET_FPS == params.mode) {
+		g_pActivity->addChannel(channel, pSampler);
+	}
+	if (nullptr != g_pPacketObservers) {
+		if (nullptr != g_pClipRecorder) {
+			g_pClipRecorder->addChannel(channel, pProvider->getRecordedCodec());
+		}
+		if (nullptr != g_pSegmentRecorder) {
+			g_pSegmentRecorder->addChannel(channel, pProvider->getRecordedCodec());
+		}
+		if (!pProvider->setPacketObserver(g_pPacketObservers)) {
+			removeRecorders(channel);
+			LOG_DEBUG(logger, "Channel " << channel << " has no packets to record");
+		}
+	}
+	return pProvider;
+}
 
+// Called by the registry before the provider of a detached channel is deleted.
+void releaseChannelProvider(void *, const int channel, DataProvider *pProvider) {
+	if (nullptr != g_pPacketObservers) {
+		pProvider->setPacketObserver(nullptr);
+		removeRecorders(channel);
+	}
+	if (nullptr != g_pActivity) {
+		g_pActivity->removeChannel(channel);
+	}
+	// a later source of the channel starts a new file
+	if (nullptr != g_pArchive) {
+		g_pArchive->closeChannel(channel);
+	}
+}
@@ -0,0 +1,212 @@
+#include "metrics.h"
+#include "threadPlacement.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+MetricsRegistry *g_pMetrics = nullptr;
+
+static const std::vector<double> kQuantiles{0.5, 0.99, 0.999};
+static const char *kQuantileNames[] = {"0.5", "0.99", "0.999"};
+static const char *kQuantileKeys[] = {"p50", "p99", "p999"};
+
+const char *MetricsRegistry::stageName(METRIC_STAGE stage) {
+	static const char *szStages[] = {"demux", "queue_wait", "push_packet", "decode", "infer", "parse", "sink", "e2e", "glass_to_detection"};
+	if (stage < 0 || stage >= STAGE_COUNT) {
+		return "unknown";
+	}
+	return szStages[stage];
+}
+
+static std::string channelLabel(const int channel, const int nChannels) {
+	return channel < nChannels ? std::to_string(channel) : std::string("all");
+}
+
+void MetricsRegistry::writePrometheus(std::ostream &os) const {
+	std::vector<uint64_t> vValues;
+	os << "# TYPE rtsp_stage_latency_us summary\n";
+	for (int s = 0; s < STAGE_COUNT; ++s) {
+		for (int c = 0; c <= nChannels_; ++c) {
+			const LatencyHistogram &h = vHistograms_[s * (nChannels_ + 1) + c];
+			if (0 == h.getCount()) {
+				continue;
+			}
+			std::string labels = std::string("stage=\"") + stageName((METRIC_STAGE)s)
+								+ "\",channel=\"" + channelLabel(c, nChannels_) + "\"";
+			h.getQuantiles(kQuantiles, vValues);
+			for (size_t q = 0; q < kQuantiles.size(); ++q) {
+				os << "rtsp_stage_latency_us{" << labels << ",quantile=\"" << kQuantileNames[q] << "\"} "
+					<< vValues[q] << "\n";
+			}
+			os << "rtsp_stage_latency_us_sum{" << labels << "} " << h.getSum() << "\n";
+			os << "rtsp_stage_latency_us_count{" << labels << "} " << h.getCount() << "\n";
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mtxGauges_);
+	std::string lastName;
+	for (auto it = mGauges_.begin(); it != mGauges_.end(); ++it) {
+		if (it->first.first != lastName) {
+			lastName = it->first.first;
+			os << "# TYPE rtsp_" << lastName << " gauge\n";
+		}
+		os << "rtsp_" << lastName << "{channel=\"" << channelLabel(it->first.second < 0 ? nChannels_ : it->first.second, nChannels_)
+			<< "\"} " << it->second << "\n";
+	}
+}
+
+void MetricsRegistry::writeJson(std::ostream &os) const {
+	std::vector<uint64_t> vValues;
+	os << "{\"timestamp\":" << time(NULL) << ",\"stages\":{";
+	bool bFirstStage = true;
+	for (int s = 0; s < STAGE_COUNT; ++s) {
+		bool bFirstChannel = true;
+		for (int c = 0; c <= nChannels_; ++c) {
+			const LatencyHistogram &h = vHistograms_[s * (nChannels_ + 1) + c];
+			if (0 == h.getCount()) {
+				continue;
+			}
+			if (bFirstChannel) {
+				os << (bFirstStage ? "" : ",") << "\"" << stageName((METRIC_STAGE)s) << "\":{";
+				bFirstStage = false;
+			}
+			h.getQuantiles(kQuantiles, vValues);
+			os << (bFirstChannel ? "" : ",") << "\"" << channelLabel(c, nChannels_) << "\":{"
+				<< "\"count\":" << h.getCount() << ",\"max\":" << h.getMax();
+			for (size_t q = 0; q < kQuantiles.size(); ++q) {
+				os << ",\"" << kQuantileKeys[q] << "\":" << vValues[q];
+			}
+			os << "}";
+			bFirstChannel = false;
+		}
+		if (!bFirstChannel) {
+			os << "}";
+		}
+	}
+	os << "},\"gauges\":{";
+
+	std::lock_guard<std::mutex> lock(mtxGauges_);
+	bool bFirst = true;
+	for (auto it = mGauges_.begin(); it != mGauges_.end(); ++it) {
+		os << (bFirst ? "" : ",") << "\"" << it->first.first << "/"
+			<< channelLabel(it->first.second < 0 ? nChannels_ : it->first.second, nChannels_)
+			<< "\":" << it->second;
+		bFirst = false;
+	}
+	os << "}}\n";
+}
+
+bool MetricsExporter::startHttp(const int port) {
+	listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenFd_ < 0) {
+		LOG_ERROR(logger_, "Metrics: socket() failed");
+		return false;
+	}
+	int on = 1;
+	setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd_, 4) < 0) {
+		LOG_ERROR(logger_, "Metrics: failed to listen on 127.0.0.1:" << port);
+		close(listenFd_);
+		listenFd_ = -1;
+		return false;
+	}
+	LOG_INFO(logger_, "Metrics: serving http://127.0.0.1:" << port << "/metrics");
+	bRunning_ = true;
+	thHttp_ = std::thread(&MetricsExporter::httpLoop, this);
+	return true;
+}
+
+void MetricsExporter::startJsonDump(const std::string &path, const int intervalSec) {
+	jsonPath_ = path;
+	jsonInterval_ = intervalSec > 0 ? intervalSec : 10;
+	bRunning_ = true;
+	thJson_ = std::thread(&MetricsExporter::jsonLoop, this);
+}
+
+void MetricsExporter::stop() {
+	bRunning_ = false;
+	if (thHttp_.joinable()) {
+		thHttp_.join();
+	}
+	if (thJson_.joinable()) {
+		thJson_.join();
+	}
+	if (listenFd_ >= 0) {
+		close(listenFd_);
+		listenFd_ = -1;
+	}
+}
+
+void MetricsExporter::httpLoop() {
+	placeThread(ROLE_IO, "metricsHttp");
+	while (bRunning_) {
+		struct pollfd pfd = { listenFd_, POLLIN, 0 };
+		if (poll(&pfd, 1, 200) <= 0) {
+			continue;
+		}
+		int fd = accept(listenFd_, NULL, NULL);
+		if (fd < 0) {
+			continue;
+		}
+		// the request itself does not matter, every path returns the metrics
+		char request[1024];
+		struct pollfd cfd = { fd, POLLIN, 0 };
+		if (poll(&cfd, 1, 200) > 0) {
+			ssize_t nRead = read(fd, request, sizeof(request));
+			(void)nRead;
+		}
+		std::ostringstream body;
+		pRegistry_->writePrometheus(body);
+		std::string strBody = body.str();
+		std::ostringstream response;
+		response << "HTTP/1.0 200 OK\r\n"
+				<< "Content-Type: text/plain; version=0.0.4\r\n"
+				<< "Content-Length: " << strBody.size() << "\r\n\r\n"
+				<< strBody;
+		std::string strResponse = response.str();
+		size_t nSent = 0;
+		while (nSent < strResponse.size()) {
+			ssize_t n = send(fd, strResponse.data() + nSent, strResponse.size() - nSent, MSG_NOSIGNAL);
+			if (n <= 0) {
+				break;
+			}
+			nSent += n;
+		}
+		close(fd);
+	}
+}
+
+void MetricsExporter::jsonLoop() {
+	placeThread(ROLE_IO, "metricsJson");
+	int elapsedMs = 0;
+	while (bRunning_) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		elapsedMs += 100;
+		if (elapsedMs < jsonInterval_ * 1000 && bRunning_) {
+			continue;
+		}
+		elapsedMs = 0;
+		// write then rename, readers never see a partial snapshot
+		std::string tmpPath = jsonPath_ + ".tmp";
+		std::ofstream ofs(tmpPath.c_str(), std::ios::trunc);
+		if (!ofs.is_open()) {
+			LOG_ERROR(logger_, "Metrics: failed to open " << tmpPath);
+			continue;
+		}
+		pRegistry_->writeJson(ofs);
+		ofs.close();
+		rename(tmpPath.c_str(), jsonPath_.c_str());
+	}
+}
@@ -0,0 +1,113 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include "common/histogram.h"
+#include "common/logger.h"
+
+enum METRIC_STAGE {
+	STAGE_DEMUX = 0,	// av_read_frame
+	STAGE_QUEUE_WAIT,	// putData -> getData
+	STAGE_PUSH_PACKET,	// IDeviceWorker::pushPacket
+	STAGE_DECODE,
+	STAGE_INFER,		// analysis pipeline per batch
+	STAGE_PARSE,		// ParserModule per frame
+	STAGE_SINK,			// result sinks per frame
+	STAGE_E2E,			// av_read_frame -> result sink
+	STAGE_GLASS,		// capture wallclock -> result sink
+	STAGE_COUNT
+};
+
+// Per stage and per channel latency histograms. Channel -1 (or any channel
+// out of range) is accounted as "all", for stages which work on batches.
+class MetricsRegistry {
+public:
+	explicit
+	MetricsRegistry(const int nChannels)
+	: nChannels_(nChannels), vHistograms_(STAGE_COUNT * (nChannels + 1)) {}
+
+	void record(METRIC_STAGE stage, const int channel, const uint64_t us) {
+		vHistograms_[index(stage, channel)].record(us);
+	}
+
+	// Values sampled by a controller, e.g. the effective fps of a channel
+	void setGauge(const std::string &name, const int channel, const double value) {
+		std::lock_guard<std::mutex> lock(mtxGauges_);
+		mGauges_[std::make_pair(name, channel)] = value;
+	}
+
+	const LatencyHistogram &getHistogram(METRIC_STAGE stage, const int channel) const {
+		return vHistograms_[index(stage, channel)];
+	}
+
+	int getNbChannels() const { return nChannels_; }
+
+	void writePrometheus(std::ostream &os) const;
+	void writeJson(std::ostream &os) const;
+
+	static const char *stageName(METRIC_STAGE stage);
+
+private:
+	int index(METRIC_STAGE stage, int channel) const {
+		if (channel < 0 || channel >= nChannels_) {
+			channel = nChannels_;
+		}
+		return stage * (nChannels_ + 1) + channel;
+	}
+
+	int nChannels_{ 0 };
+	std::vector<LatencyHistogram > vHistograms_;
+	mutable std::mutex mtxGauges_;
+	std::map<std::pair<std::string, int>, double> mGauges_;
+};
+
+// Serves the registry as Prometheus text on 127.0.0.1:port and/or writes
+// JSON snapshots to a file every interval seconds.
+class MetricsExporter {
+public:
+	MetricsExporter(MetricsRegistry *pRegistry, simplelogger::Logger *logger)
+	: pRegistry_(pRegistry), logger_(logger) {}
+	~MetricsExporter() {
+		stop();
+	}
+
+	bool startHttp(const int port);
+	void startJsonDump(const std::string &path, const int intervalSec);
+	void stop();
+
+private:
+	void httpLoop();
+	void jsonLoop();
+
+	MetricsRegistry *pRegistry_{ nullptr };
+	simplelogger::Logger *logger_{ nullptr };
+	std::atomic<bool > bRunning_{ false };
+	int listenFd_{ -1 };
+	std::thread thHttp_;
+	std::thread thJson_;
+	std::string jsonPath_;
+	int jsonInterval_{ 10 };
+};
+
+// Global registry, null when metrics are disabled
+extern MetricsRegistry *g_pMetrics;
+
+inline uint64_t metricsNowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void recordMetric(METRIC_STAGE stage, const int channel, const uint64_t us) {
+	if (nullptr != g_pMetrics) {
+		g_pMetrics->record(stage, channel, us);
+	}
+}
+
+#endif // METRICS_H
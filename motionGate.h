@@ -0,0 +1,243 @@
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include "nalParser.h"
+#include "roiMask.h"
+
+typedef struct {
+	float motionRatio = 2.0f;	// a picture moves when its size exceeds motionRatio * baseline
+	int holdPictures = 25;		// pictures kept open after the last motion
+	int warmupPictures = 50;	// pictures used to learn the baseline
+} MOTION_GATE_PARAMS;
+
+// Compressed-domain motion detector. On a static scene an encoder codes
+// inter pictures almost entirely as skipped macroblocks, their size stays
+// at a noise floor. The gate tracks that floor per channel, following
+// drops quickly and rises slowly, and calls a picture static while its
+// size stays close to it. Reference and non-reference pictures have
+// separate floors, B pictures are much smaller than P pictures.
+// Keyframes are never gated.
+//
+// Sizes are taken in bytes per macroblock or CTB of the regions looked
+// at: the cells an ROI mask of the channel keeps, see RoiMaskSet, or the
+// whole picture. The slice is the finest unit whose size is known without
+// parsing macroblocks, its bytes are taken as spread evenly over its
+// blocks; with one slice per picture every region sees the whole picture.
+// Streams whose slice layout is not known (field coding) are measured by
+// the size of their first slice.
+//
+// The decision on a picture is taken at its first slice packet. When the
+// slices of a picture come in separate packets only the first one is
+// seen by then, its end taken from the slice layout of the previous
+// picture. Motion in the slices still to come is found once the picture
+// is complete and opens the gate from the next picture on, one picture
+// late.
+class MotionGate {
+public:
+	explicit
+	MotionGate(const VIDEO_CODEC codec, const MOTION_GATE_PARAMS &params = MOTION_GATE_PARAMS(),
+				RoiMaskSet *pRoiMasks = nullptr, const int channel = 0)
+	: codec_(codec), params_(params), pRoiMasks_(pRoiMasks), channel_(channel) {}
+
+	// Every packet of the channel in stream order, before the sampler
+	// decides on it: parameter sets update the slice layout, slices are
+	// added to the picture they belong to.
+	void measure(const uint8_t *pBuf, const int nBuf) {
+		int pos = startsWithStartCode(pBuf, nBuf) ? findNalStart(pBuf, nBuf, 0) : 0;
+		while (pos >= 0 && pos < nBuf) {
+			int next = findNalStart(pBuf, nBuf, pos);
+			int end = next < 0 ? nBuf : next - 3;
+			if (end > pos) {
+				addNal(pBuf + pos, end - pos);
+			}
+			pos = next;
+		}
+	}
+
+	// At the first slice of a picture, after measure() saw it.
+	bool isStatic(const PACKET_CLASS &c) {
+		if (c.bKeyframe) {
+			return false;
+		}
+		nPictures_++;
+		double baseline = c.bReference ? vBaseline_[0] : vBaseline_[1];
+		double size = 0.;
+		bPictureMoving_ = baseline > 0. && regionSize(false, size) && size > baseline * params_.motionRatio;
+		if (bPictureMoving_ || nPictures_ <= params_.warmupPictures) {
+			holdLeft_ = params_.holdPictures;
+			return false;
+		}
+		if (holdLeft_ > 0) {
+			holdLeft_--;
+			return false;
+		}
+		nStatic_.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	uint64_t getNbStatic() const { return nStatic_.load(std::memory_order_relaxed); }
+
+private:
+	void addNal(const uint8_t *pNal, const int nNal) {
+		if (updateSliceLayout(pNal, nNal, codec_, layout_)) {
+			return;
+		}
+		PACKET_CLASS c;
+		if (VIDEO_CODEC_HEVC == codec_) {
+			classifyNalHEVC(pNal, nNal, c);
+		} else {
+			classifyNalH264(pNal, nNal, c);
+		}
+		if (!c.bPicture) {
+			return;
+		}
+		if (c.bNewPicture) {
+			finishPicture();
+			updateRegions();
+			bInPicture_ = !c.bKeyframe;
+			bReference_ = c.bReference;
+			bPictureMoving_ = false;
+			bytes_ = 0.;
+			blocks_ = 0;
+			sliceAddress_ = 0;
+			sliceBytes_ = nNal;
+			vStarts_.assign(1, 0);
+			return;
+		}
+		if (!bInPicture_ || vInRegion_.empty()) {
+			return;
+		}
+		int address = sliceAddress(pNal, nNal, codec_, layout_);
+		// out of order or not readable, counted with the slice before
+		if (address <= sliceAddress_) {
+			sliceBytes_ += nNal;
+			return;
+		}
+		addSlice(sliceAddress_, address, sliceBytes_, bytes_, blocks_);
+		sliceAddress_ = address;
+		sliceBytes_ = nNal;
+		vStarts_.push_back(address);
+	}
+
+	void addSlice(const int begin, const int end, const int nBytes, double &bytes, int &blocks) const {
+		int nIn = vInRegion_[end] - vInRegion_[begin];
+		bytes += (double)nBytes * nIn / (end - begin);
+		blocks += nIn;
+	}
+
+	// Bytes per block of the regions so far. Until the picture is complete
+	// the last slice seen ends where the previous picture had its next
+	// slice. False while no block of the regions was seen.
+	bool regionSize(const bool bComplete, double &size) const {
+		if (vInRegion_.empty()) {
+			size = sliceBytes_;
+			return true;
+		}
+		const int nBlocks = (int)vInRegion_.size() - 1;
+		int end = nBlocks;
+		for (size_t i = 0; i < vLastStarts_.size() && !bComplete; ++i) {
+			if (vLastStarts_[i] > sliceAddress_) {
+				end = vLastStarts_[i];
+				break;
+			}
+		}
+		double bytes = bytes_;
+		int blocks = blocks_;
+		addSlice(sliceAddress_, end, sliceBytes_, bytes, blocks);
+		if (0 == blocks) {
+			return false;
+		}
+		size = bytes / blocks;
+		return true;
+	}
+
+	// The picture is complete, its size goes into the floor. Motion the
+	// first slice did not show holds the gate open from now on.
+	void finishPicture() {
+		if (!bInPicture_) {
+			return;
+		}
+		bInPicture_ = false;
+		vLastStarts_.swap(vStarts_);
+		double size = 0.;
+		if (!regionSize(true, size)) {
+			return;
+		}
+		double &baseline = bReference_ ? vBaseline_[0] : vBaseline_[1];
+		if (baseline <= 0.) {
+			baseline = size;
+		}
+		if (!bPictureMoving_ && size > baseline * params_.motionRatio) {
+			holdLeft_ = params_.holdPictures;
+		}
+		// follow the noise floor down fast, up slowly
+		baseline = size < baseline ? 0.8 * baseline + 0.2 * size : 0.99 * baseline + 0.01 * size;
+	}
+
+	// Marks the blocks of the picture which lie in kept cells of the
+	// channel's mask, all of them without a mask; again when the layout
+	// or the mask changed.
+	void updateRegions() {
+		std::shared_ptr<const RoiMaskSet::MASK> pMask;
+		if (nullptr != pRoiMasks_) {
+			pMask = pRoiMasks_->getMask(channel_);
+		}
+		if (pMask == pMask_ && layout_.widthBlocks == regionWidth_ && layout_.heightBlocks == regionHeight_) {
+			return;
+		}
+		pMask_ = pMask;
+		regionWidth_ = layout_.widthBlocks;
+		regionHeight_ = layout_.heightBlocks;
+		vInRegion_.clear();
+		vLastStarts_.clear();
+		if (regionWidth_ <= 0 || regionHeight_ <= 0) {
+			return;
+		}
+		// prefix count of the blocks in kept cells, by block centers
+		vInRegion_.assign(regionWidth_ * regionHeight_ + 1, 0);
+		for (int i = 0; i < regionWidth_ * regionHeight_; ++i) {
+			int bIn = 1;
+			if (pMask_) {
+				const int gridW = pRoiMasks_->getGridWidth();
+				const int gridH = pRoiMasks_->getGridHeight();
+				int cellX = (int)(((i % regionWidth_) + 0.5) * gridW / regionWidth_);
+				int cellY = (int)(((i / regionWidth_) + 0.5) * gridH / regionHeight_);
+				bIn = (*pMask_)[cellX + cellY * gridW];
+			}
+			vInRegion_[i + 1] = vInRegion_[i] + bIn;
+		}
+	}
+
+	VIDEO_CODEC codec_{ VIDEO_CODEC_H264 };
+	MOTION_GATE_PARAMS params_;
+	RoiMaskSet *pRoiMasks_{ nullptr };
+	int channel_{ 0 };
+
+	SLICE_LAYOUT layout_;
+	std::shared_ptr<const RoiMaskSet::MASK> pMask_;
+	int regionWidth_{ 0 };
+	int regionHeight_{ 0 };
+	std::vector<int > vInRegion_;	// empty while the layout is not known
+
+	// the picture being measured
+	bool bInPicture_{ false };
+	bool bReference_{ false };
+	bool bPictureMoving_{ false };
+	double bytes_{ 0. };			// in the regions, slices before the last one
+	int blocks_{ 0 };
+	int sliceAddress_{ 0 };			// the last slice seen
+	int sliceBytes_{ 0 };
+	std::vector<int > vStarts_;		// slice addresses of this picture
+	std::vector<int > vLastStarts_;	// and of the previous one
+
+	double vBaseline_[2] = { 0., 0. };	// reference, non-reference
+	int64_t nPictures_{ 0 };
+	int holdLeft_{ 0 };
+	std::atomic<uint64_t > nStatic_{ 0 };
+};
+
+#endif // MOTION_GATE_H
@@ -0,0 +1,452 @@
+#ifndef NAL_PARSER_H
+#define NAL_PARSER_H
+
+#include <cstdint>
+#include <vector>
+
+// Annex-B helpers shared by the providers.
+
+enum VIDEO_CODEC {
+	VIDEO_CODEC_H264 = 0,
+	VIDEO_CODEC_HEVC
+};
+
+// What a packet (one or more NAL units) carries, as far as sampling cares.
+typedef struct {
+	bool bPicture = false;		// holds a coded slice
+	bool bNewPicture = false;	// holds the first slice of a picture
+	bool bKeyframe = false;		// IDR, or HEVC IRAP
+	bool bReference = false;	// other pictures may predict from it
+	bool bSkippedLeading = false;	// HEVC RASL, not decodable when starting at a CRA
+} PACKET_CLASS;
+
+// Where the slices of a picture sit, from the SPS and PPS of the stream.
+typedef struct {
+	int widthBlocks = 0;		// macroblocks or CTBs per row, 0 while unknown
+	int heightBlocks = 0;
+	int addressBits = 0;		// HEVC slice_segment_address
+	bool bDependentSlices = false;	// HEVC dependent_slice_segments_enabled_flag
+} SLICE_LAYOUT;
+
+// Returns the offset of the NAL header following the next start code at
+// or after pos, -1 if there is none.
+inline int findNalStart(const uint8_t *pBuf, const int nBuf, int pos) {
+	for (int i = pos; i + 2 < nBuf; ++i) {
+		if (0 == pBuf[i] && 0 == pBuf[i + 1] && 1 == pBuf[i + 2]) {
+			return i + 3;
+		}
+	}
+	return -1;
+}
+
+// H.264: nal_ref_idc == 0 marks a non-reference picture, type 5 is IDR.
+inline void classifyNalH264(const uint8_t *pNal, const int nNal, PACKET_CLASS &c) {
+	int nalType = pNal[0] & 0x1f;
+	int nalRefIdc = (pNal[0] >> 5) & 0x3;
+	if (nalType < 1 || nalType > 5) {
+		return;
+	}
+	c.bPicture = true;
+	// ue(v) first_mb_in_slice is 0 when its first bit is set
+	if (nNal > 1 && (pNal[1] & 0x80)) {
+		c.bNewPicture = true;
+	}
+	if (5 == nalType) {
+		c.bKeyframe = true;
+	}
+	if (0 != nalRefIdc) {
+		c.bReference = true;
+	}
+}
+
+// HEVC: VCL types 0-31, the even types below 16 are sub-layer
+// non-reference pictures (TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N, RSV_VCL_N*).
+inline void classifyNalHEVC(const uint8_t *pNal, const int nNal, PACKET_CLASS &c) {
+	if (nNal < 3) {
+		return;
+	}
+	int nalType = (pNal[0] >> 1) & 0x3f;
+	if (nalType > 31) {
+		return;
+	}
+	c.bPicture = true;
+	// first_slice_segment_in_pic_flag
+	if (pNal[2] & 0x80) {
+		c.bNewPicture = true;
+	}
+	if (nalType >= 16 && nalType <= 23) {
+		c.bKeyframe = true;
+	}
+	if (nalType >= 16 || 1 == (nalType & 1)) {
+		c.bReference = true;
+	}
+	if (8 == nalType || 9 == nalType) {
+		c.bSkippedLeading = true;
+	}
+}
+
+inline bool startsWithStartCode(const uint8_t *pBuf, const int nBuf) {
+	return (nBuf >= 3 && 0 == pBuf[0] && 0 == pBuf[1] && 1 == pBuf[2])
+		|| (nBuf >= 4 && 0 == pBuf[0] && 0 == pBuf[1] && 0 == pBuf[2] && 1 == pBuf[3]);
+}
+
+// The file provider cuts packets at the start code which follows a NAL
+// unit, so a packet may begin with a NAL header instead of a start code.
+inline PACKET_CLASS classifyPacket(const uint8_t *pBuf, const int nBuf, const VIDEO_CODEC codec) {
+	PACKET_CLASS c;
+	int pos = startsWithStartCode(pBuf, nBuf) ? findNalStart(pBuf, nBuf, 0) : 0;
+	while (pos >= 0 && pos < nBuf) {
+		// the classifiers only look at the first bytes of a NAL unit
+		if (VIDEO_CODEC_HEVC == codec) {
+			classifyNalHEVC(pBuf + pos, nBuf - pos, c);
+		} else {
+			classifyNalH264(pBuf + pos, nBuf - pos, c);
+		}
+		// the slices of a packet belong to one picture, skip the slice data
+		if (c.bPicture) {
+			break;
+		}
+		pos = findNalStart(pBuf, nBuf, pos);
+	}
+	return c;
+}
+
+// SPS and PPS, and the HEVC VPS, from the first byte of the NAL header.
+inline bool isParameterSetNal(const uint8_t nalHeader, const VIDEO_CODEC codec) {
+	if (VIDEO_CODEC_HEVC == codec) {
+		int nalType = (nalHeader >> 1) & 0x3f;
+		return nalType >= 32 && nalType <= 34;
+	}
+	int nalType = nalHeader & 0x1f;
+	return 7 == nalType || 8 == nalType;
+}
+
+// VCL NAL units, the slices of a picture.
+inline bool isPictureNal(const uint8_t nalHeader, const VIDEO_CODEC codec) {
+	if (VIDEO_CODEC_HEVC == codec) {
+		return ((nalHeader >> 1) & 0x3f) <= 31;
+	}
+	int nalType = nalHeader & 0x1f;
+	return nalType >= 1 && nalType <= 5;
+}
+
+// Exp-Golomb reader over a NAL payload, emulation prevention bytes are
+// skipped on the fly. Reads past the end return zeros.
+class NalBitReader {
+public:
+	NalBitReader(const uint8_t *pBuf, const int nBuf)
+	: pBuf_(pBuf), nBuf_(nBuf) {}
+
+	uint32_t u(int nBits) {
+		uint32_t v = 0;
+		while (nBits-- > 0) {
+			v = (v << 1) | bit();
+		}
+		return v;
+	}
+
+	uint32_t ue() {
+		int nZeros = 0;
+		while (0 == bit() && nZeros < 31) {
+			nZeros++;
+		}
+		return ((1u << nZeros) - 1) + u(nZeros);
+	}
+
+	int32_t se() {
+		uint32_t v = ue();
+		return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+	}
+
+	void skip(int nBits) {
+		u(nBits);
+	}
+
+	bool overrun() const { return pos_ > nBuf_; }
+
+private:
+	uint32_t bit() {
+		if (0 == bitPos_) {
+			// 00 00 03 -> 00 00
+			if (pos_ >= 2 && pos_ < nBuf_ && 3 == pBuf_[pos_] && 0 == pBuf_[pos_ - 1] && 0 == pBuf_[pos_ - 2]) {
+				pos_++;
+			}
+			if (pos_ >= nBuf_) {
+				pos_ = nBuf_ + 1;
+				return 0;
+			}
+			cur_ = pBuf_[pos_++];
+			bitPos_ = 8;
+		}
+		return (cur_ >> --bitPos_) & 1;
+	}
+
+	const uint8_t *pBuf_{ nullptr };
+	int nBuf_{ 0 };
+	int pos_{ 0 };
+	int bitPos_{ 0 };
+	uint8_t cur_{ 0 };
+};
+
+// Cropped picture size from an H.264 SPS NAL unit (header included), and
+// the macroblock grid if pLayout is given. Field coded streams leave the
+// grid unknown, their slice addresses count macroblock pairs.
+inline bool parseSpsH264(const uint8_t *pNal, const int nNal, int &width, int &height,
+						SLICE_LAYOUT *pLayout = nullptr) {
+	if (nNal < 4 || 7 != (pNal[0] & 0x1f)) {
+		return false;
+	}
+	NalBitReader br(pNal + 1, nNal - 1);
+	uint32_t profile = br.u(8);
+	br.skip(16);	// constraint flags, level_idc
+	br.ue();		// seq_parameter_set_id
+	uint32_t chromaFormat = 1;
+	if (100 == profile || 110 == profile || 122 == profile || 244 == profile || 44 == profile
+		|| 83 == profile || 86 == profile || 118 == profile || 128 == profile || 138 == profile
+		|| 139 == profile || 134 == profile || 135 == profile) {
+		chromaFormat = br.ue();
+		if (3 == chromaFormat) {
+			br.skip(1);	// separate_colour_plane_flag
+		}
+		br.ue();		// bit_depth_luma_minus8
+		br.ue();		// bit_depth_chroma_minus8
+		br.skip(1);		// qpprime_y_zero_transform_bypass_flag
+		if (br.u(1)) {	// seq_scaling_matrix_present_flag
+			for (int i = 0; i < (3 != chromaFormat ? 8 : 12); ++i) {
+				if (!br.u(1)) {
+					continue;
+				}
+				int last = 8, next = 8;
+				for (int j = 0; j < (i < 6 ? 16 : 64) && 0 != next; ++j) {
+					next = (last + br.se() + 256) % 256;
+					last = 0 == next ? last : next;
+				}
+			}
+		}
+	}
+	br.ue();		// log2_max_frame_num_minus4
+	uint32_t pocType = br.ue();
+	if (0 == pocType) {
+		br.ue();	// log2_max_pic_order_cnt_lsb_minus4
+	} else if (1 == pocType) {
+		br.skip(1);
+		br.se();
+		br.se();
+		uint32_t nCycle = br.ue();
+		for (uint32_t i = 0; i < nCycle && !br.overrun(); ++i) {
+			br.se();
+		}
+	}
+	br.ue();		// max_num_ref_frames
+	br.skip(1);		// gaps_in_frame_num_value_allowed_flag
+	uint32_t widthMbs = br.ue() + 1;
+	uint32_t heightMapUnits = br.ue() + 1;
+	uint32_t frameMbsOnly = br.u(1);
+	if (!frameMbsOnly) {
+		br.skip(1);	// mb_adaptive_frame_field_flag
+	}
+	br.skip(1);		// direct_8x8_inference_flag
+	uint32_t cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+	if (br.u(1)) {
+		cropLeft = br.ue();
+		cropRight = br.ue();
+		cropTop = br.ue();
+		cropBottom = br.ue();
+	}
+	if (br.overrun()) {
+		return false;
+	}
+	int cropUnitX = 0 == chromaFormat || 3 == chromaFormat ? 1 : 2;
+	int cropUnitY = (1 == chromaFormat ? 2 : 1) * (2 - frameMbsOnly);
+	width = widthMbs * 16 - cropUnitX * (cropLeft + cropRight);
+	height = (2 - frameMbsOnly) * heightMapUnits * 16 - cropUnitY * (cropTop + cropBottom);
+	if (nullptr != pLayout) {
+		pLayout->widthBlocks = frameMbsOnly ? widthMbs : 0;
+		pLayout->heightBlocks = frameMbsOnly ? heightMapUnits : 0;
+	}
+	return width > 0 && height > 0;
+}
+
+// Cropped picture size from an HEVC SPS NAL unit (header included), and
+// the CTB grid if pLayout is given.
+inline bool parseSpsHEVC(const uint8_t *pNal, const int nNal, int &width, int &height,
+						SLICE_LAYOUT *pLayout = nullptr) {
+	if (nNal < 4 || 33 != ((pNal[0] >> 1) & 0x3f)) {
+		return false;
+	}
+	NalBitReader br(pNal + 2, nNal - 2);
+	br.skip(4);		// sps_video_parameter_set_id
+	uint32_t maxSubLayersMinus1 = br.u(3);
+	br.skip(1);		// sps_temporal_id_nesting_flag
+	// profile_tier_level: general profile 88 bits, general_level_idc 8 bits
+	br.skip(96);
+	bool vProfile[8] = { false }, vLevel[8] = { false };
+	for (uint32_t i = 0; i < maxSubLayersMinus1; ++i) {
+		vProfile[i] = br.u(1);
+		vLevel[i] = br.u(1);
+	}
+	if (maxSubLayersMinus1 > 0) {
+		br.skip(2 * (8 - maxSubLayersMinus1));
+	}
+	for (uint32_t i = 0; i < maxSubLayersMinus1; ++i) {
+		br.skip((vProfile[i] ? 88 : 0) + (vLevel[i] ? 8 : 0));
+	}
+	br.ue();		// sps_seq_parameter_set_id
+	uint32_t chromaFormat = br.ue();
+	if (3 == chromaFormat) {
+		br.skip(1);	// separate_colour_plane_flag
+	}
+	uint32_t lumaWidth = br.ue();
+	uint32_t lumaHeight = br.ue();
+	uint32_t cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+	if (br.u(1)) {	// conformance_window_flag
+		cropLeft = br.ue();
+		cropRight = br.ue();
+		cropTop = br.ue();
+		cropBottom = br.ue();
+	}
+	if (br.overrun()) {
+		return false;
+	}
+	int subWidth = 1 == chromaFormat || 2 == chromaFormat ? 2 : 1;
+	int subHeight = 1 == chromaFormat ? 2 : 1;
+	width = lumaWidth - subWidth * (cropLeft + cropRight);
+	height = lumaHeight - subHeight * (cropTop + cropBottom);
+	if (nullptr != pLayout) {
+		br.ue();		// bit_depth_luma_minus8
+		br.ue();		// bit_depth_chroma_minus8
+		br.ue();		// log2_max_pic_order_cnt_lsb_minus4
+		for (uint32_t i = br.u(1) ? 0 : maxSubLayersMinus1; i <= maxSubLayersMinus1; ++i) {
+			br.ue();	// sps_max_dec_pic_buffering_minus1
+			br.ue();	// sps_max_num_reorder_pics
+			br.ue();	// sps_max_latency_increase_plus1
+		}
+		uint32_t log2Ctb = br.ue() + 3;
+		log2Ctb += br.ue();
+		if (br.overrun() || log2Ctb < 4 || log2Ctb > 6) {
+			return false;
+		}
+		uint32_t ctb = 1u << log2Ctb;
+		pLayout->widthBlocks = (lumaWidth + ctb - 1) / ctb;
+		pLayout->heightBlocks = (lumaHeight + ctb - 1) / ctb;
+		pLayout->addressBits = 0;
+		while ((1 << pLayout->addressBits) < pLayout->widthBlocks * pLayout->heightBlocks) {
+			pLayout->addressBits++;
+		}
+	}
+	return width > 0 && height > 0;
+}
+
+inline bool parseSps(const uint8_t *pNal, const int nNal, const VIDEO_CODEC codec, int &width, int &height) {
+	return VIDEO_CODEC_HEVC == codec ? parseSpsHEVC(pNal, nNal, width, height)
+									: parseSpsH264(pNal, nNal, width, height);
+}
+
+// Takes the slice layout from an SPS or PPS NAL unit (header included),
+// other NAL units leave it alone. False when the NAL unit is none of them
+// or does not parse.
+inline bool updateSliceLayout(const uint8_t *pNal, const int nNal, const VIDEO_CODEC codec, SLICE_LAYOUT &layout) {
+	int width = 0, height = 0;
+	if (VIDEO_CODEC_H264 == codec) {
+		return nNal > 0 && 7 == (pNal[0] & 0x1f) && parseSpsH264(pNal, nNal, width, height, &layout);
+	}
+	if (nNal < 3) {
+		return false;
+	}
+	int nalType = (pNal[0] >> 1) & 0x3f;
+	if (33 == nalType) {
+		return parseSpsHEVC(pNal, nNal, width, height, &layout);
+	}
+	if (34 != nalType) {
+		return false;
+	}
+	NalBitReader br(pNal + 2, nNal - 2);
+	br.ue();		// pps_pic_parameter_set_id
+	br.ue();		// pps_seq_parameter_set_id
+	bool bDependentSlices = br.u(1);
+	if (br.overrun()) {
+		return false;
+	}
+	layout.bDependentSlices = bDependentSlices;
+	return true;
+}
+
+// First macroblock or CTB of a slice NAL unit (header included) in raster
+// order, -1 while the layout is unknown.
+inline int sliceAddress(const uint8_t *pNal, const int nNal, const VIDEO_CODEC codec, const SLICE_LAYOUT &layout) {
+	if (layout.widthBlocks <= 0) {
+		return -1;
+	}
+	uint32_t address = 0;
+	if (VIDEO_CODEC_H264 == codec) {
+		NalBitReader br(pNal + 1, nNal - 1);
+		address = br.ue();	// first_mb_in_slice
+		if (br.overrun()) {
+			return -1;
+		}
+	} else {
+		NalBitReader br(pNal + 2, nNal - 2);
+		int nalType = (pNal[0] >> 1) & 0x3f;
+		if (br.u(1)) {		// first_slice_segment_in_pic_flag
+			return 0;
+		}
+		if (nalType >= 16 && nalType <= 23) {
+			br.skip(1);		// no_output_of_prior_pics_flag
+		}
+		br.ue();			// slice_pic_parameter_set_id
+		if (layout.bDependentSlices) {
+			br.skip(1);		// dependent_slice_segment_flag
+		}
+		address = br.u(layout.addressBits);
+		if (br.overrun()) {
+			return -1;
+		}
+	}
+	return address < (uint32_t)(layout.widthBlocks * layout.heightBlocks) ? (int)address : -1;
+}
+
+// Copies the parameter sets of an Annex-B packet, each behind a 4-byte
+// start code, and reads the picture size from the SPS. False when the
+// packet has no SPS.
+inline bool extractParameterSets(const uint8_t *pBuf, const int nBuf, const VIDEO_CODEC codec,
+								std::vector<uint8_t > &vParameterSets, int &width, int &height) {
+	static const uint8_t startCode[4] = { 0, 0, 0, 1 };
+	vParameterSets.clear();
+	width = height = 0;
+	for (int pos = findNalStart(pBuf, nBuf, 0); pos >= 0; ) {
+		int next = findNalStart(pBuf, nBuf, pos);
+		int end = next < 0 ? nBuf : next - 3;
+		// the leading zero of a 4-byte start code
+		while (end > pos && 0 == pBuf[end - 1]) {
+			end--;
+		}
+		if (end > pos && isParameterSetNal(pBuf[pos], codec)) {
+			vParameterSets.insert(vParameterSets.end(), startCode, startCode + 4);
+			vParameterSets.insert(vParameterSets.end(), pBuf + pos, pBuf + end);
+			if (0 == width) {
+				parseSps(pBuf + pos, end - pos, codec, width, height);
+			}
+		}
+		// parameter sets come ahead of the slices
+		if (end > pos && isPictureNal(pBuf[pos], codec)) {
+			break;
+		}
+		pos = next;
+	}
+	return width > 0;
+}
+
+// True when parameter sets come ahead of the first slice of the packet.
+inline bool hasParameterSets(const uint8_t *pBuf, const int nBuf, const VIDEO_CODEC codec) {
+	for (int pos = findNalStart(pBuf, nBuf, 0); pos >= 0 && pos < nBuf; pos = findNalStart(pBuf, nBuf, pos)) {
+		if (isParameterSetNal(pBuf[pos], codec)) {
+			return true;
+		}
+		if (isPictureNal(pBuf[pos], codec)) {
+			return false;
+		}
+	}
+	return false;
+}
+
+#endif // NAL_PARSER_H
@@ -0,0 +1,242 @@
+#ifndef NV12_IMAGE_H
+#define NV12_IMAGE_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Host-side NV12 crop and downscale into planar 4:2:0, the layout a JPEG
+// encoder takes in raw mode without any colour conversion. Scaling halves
+// the planes with a 2x2 box filter as long as the picture stays at least
+// the target size, then one bilinear pass covers the remaining factor
+// below 2. The box passes, the chroma split and the vertical blend run on
+// SSE2, with scalar fallbacks.
+
+// Planes are padded to whole 16x16 MCUs by repeating the edge pixels.
+typedef struct {
+	int width = 0;
+	int height = 0;
+	int pitchY = 0;				// width padded to 16
+	int pitchC = 0;				// pitchY / 2
+	int rowsY = 0;				// height padded to 16
+	int rowsC = 0;				// rowsY / 2
+	std::vector<uint8_t > y;
+	std::vector<uint8_t > u;
+	std::vector<uint8_t > v;
+} I420_IMAGE;
+
+// in pixels of the luma plane
+typedef struct {
+	int x = 0;
+	int y = 0;
+	int w = 0;
+	int h = 0;
+} IMAGE_RECT;
+
+// work buffers of one caller, kept between pictures
+typedef struct {
+	std::vector<uint8_t > a;
+	std::vector<uint8_t > b;
+	std::vector<uint8_t > u;
+	std::vector<uint8_t > v;
+} NV12_SCRATCH;
+
+// Splits n interleaved UV pairs.
+inline void deinterleaveUV(const uint8_t *pUV, uint8_t *pU, uint8_t *pV, const int n) {
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pUV + 2 * i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pUV + 2 * i + 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pU + i),
+						_mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pV + i),
+						_mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+	}
+#endif
+	for (; i < n; ++i) {
+		pU[i] = pUV[2 * i];
+		pV[i] = pUV[2 * i + 1];
+	}
+}
+
+// nDst pixels, each the rounded mean of a 2x2 block of rows p0 and p1.
+inline void halveRow(const uint8_t *p0, const uint8_t *p1, uint8_t *pDst, const int nDst) {
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	const __m128i one = _mm_set1_epi16(1);
+	for (; i + 16 <= nDst; i += 16) {
+		__m128i v0 = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p0 + 2 * i)),
+								_mm_loadu_si128(reinterpret_cast<const __m128i *>(p1 + 2 * i)));
+		__m128i v1 = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p0 + 2 * i + 16)),
+								_mm_loadu_si128(reinterpret_cast<const __m128i *>(p1 + 2 * i + 16)));
+		__m128i s0 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_and_si128(v0, mask), _mm_srli_epi16(v0, 8)), one), 1);
+		__m128i s1 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_and_si128(v1, mask), _mm_srli_epi16(v1, 8)), one), 1);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + i), _mm_packus_epi16(s0, s1));
+	}
+#endif
+	for (; i < nDst; ++i) {
+		pDst[i] = (uint8_t)((p0[2 * i] + p0[2 * i + 1] + p1[2 * i] + p1[2 * i + 1] + 2) >> 2);
+	}
+}
+
+inline void copyPlane(const uint8_t *pSrc, const int srcPitch, const int w, const int h, uint8_t *pDst, const int dstPitch) {
+	for (int y = 0; y < h; ++y) {
+		memcpy(pDst + y * dstPitch, pSrc + y * srcPitch, w);
+	}
+}
+
+// Bilinear with 8-bit weights, meant for factors below 2, where every
+// destination pixel still sees all the source pixels it covers. The
+// vertical blend runs first over whole source rows on SSE2, so the scalar
+// horizontal gather touches each destination pixel once.
+inline void resizePlaneBilinear(const uint8_t *pSrc, const int srcPitch, const int sw, const int sh,
+								uint8_t *pDst, const int dstPitch, const int dw, const int dh) {
+	std::vector<int > vX0(dw);
+	std::vector<int > vFx(dw);
+	for (int x = 0; x < dw; ++x) {
+		float fx = std::max(0.f, (x + 0.5f) * sw / dw - 0.5f);
+		vX0[x] = std::min((int)fx, sw - 1);
+		vFx[x] = vX0[x] + 1 < sw ? (int)((fx - vX0[x]) * 256.f) : 0;
+	}
+	// one source row blended vertically, scaled by 256
+	std::vector<uint16_t > vRow(sw + 1);
+	uint16_t *pRow = vRow.data();
+	for (int y = 0; y < dh; ++y) {
+		float fy = std::max(0.f, (y + 0.5f) * sh / dh - 0.5f);
+		int y0 = std::min((int)fy, sh - 1);
+		int y1 = std::min(y0 + 1, sh - 1);
+		uint32_t fy8 = y1 > y0 ? (uint32_t)((fy - y0) * 256.f) : 0;
+		const uint8_t *r0 = pSrc + y0 * srcPitch;
+		const uint8_t *r1 = pSrc + y1 * srcPitch;
+		int x = 0;
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i w0 = _mm_set1_epi16((short)(256 - fy8));
+		const __m128i w1 = _mm_set1_epi16((short)fy8);
+		for (; x + 16 <= sw; x += 16) {
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r0 + x));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r1 + x));
+			// at most 255 * 256, the 16-bit sums do not wrap
+			__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+									_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+			__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+									_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pRow + x), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pRow + x + 8), hi);
+		}
+#endif
+		for (; x < sw; ++x) {
+			pRow[x] = (uint16_t)(r0[x] * (256 - fy8) + r1[x] * fy8);
+		}
+		pRow[sw] = pRow[sw - 1];
+		uint8_t *pOut = pDst + y * dstPitch;
+		for (int x = 0; x < dw; ++x) {
+			uint32_t x0 = vX0[x], fx8 = vFx[x];
+			pOut[x] = (uint8_t)((pRow[x0] * (256 - fx8) + pRow[x0 + 1] * fx8 + (1 << 15)) >> 16);
+		}
+	}
+}
+
+// Box halvings down to at most twice (dw, dh), then bilinear to the exact
+// size. The source is left untouched, the intermediate planes use the
+// scratch buffers a and b.
+inline void scalePlane(const uint8_t *pSrc, const int srcPitch, const int sw, const int sh,
+						uint8_t *pDst, const int dstPitch, const int dw, const int dh, NV12_SCRATCH &scratch) {
+	const uint8_t *p = pSrc;
+	int pitch = srcPitch, w = sw, h = sh;
+	bool bInA = false;
+	while (w / 2 >= dw && h / 2 >= dh) {
+		std::vector<uint8_t > &vOut = bInA ? scratch.b : scratch.a;
+		int w2 = w / 2, h2 = h / 2;
+		if (vOut.size() < (size_t)w2 * h2) {
+			vOut.resize((size_t)w2 * h2);
+		}
+		for (int y = 0; y < h2; ++y) {
+			halveRow(p + 2 * y * pitch, p + (2 * y + 1) * pitch, vOut.data() + y * w2, w2);
+		}
+		p = vOut.data();
+		pitch = w2;
+		w = w2;
+		h = h2;
+		bInA = !bInA;
+	}
+	if (w == dw && h == dh) {
+		copyPlane(p, pitch, w, h, pDst, dstPitch);
+	} else {
+		resizePlaneBilinear(p, pitch, w, h, pDst, dstPitch, dw, dh);
+	}
+}
+
+// Repeats the last column and row of a w x h plane into its padding.
+inline void padPlane(uint8_t *p, const int pitch, const int w, const int h, const int rows) {
+	if (pitch > w) {
+		for (int y = 0; y < h; ++y) {
+			uint8_t *pRow = p + y * pitch;
+			memset(pRow + w, pRow[w - 1], pitch - w);
+		}
+	}
+	for (int y = h; y < rows; ++y) {
+		memcpy(p + y * pitch, p + (h - 1) * pitch, pitch);
+	}
+}
+
+inline void allocI420(I420_IMAGE &image, const int width, const int height) {
+	image.width = width;
+	image.height = height;
+	image.pitchY = (width + 15) & ~15;
+	image.pitchC = image.pitchY / 2;
+	image.rowsY = (height + 15) & ~15;
+	image.rowsC = image.rowsY / 2;
+	image.y.resize((size_t)image.pitchY * image.rowsY);
+	image.u.resize((size_t)image.pitchC * image.rowsC);
+	image.v.resize((size_t)image.pitchC * image.rowsC);
+}
+
+// Crops rect out of a packed NV12 picture of width x height (pitch width,
+// chroma plane right after the luma plane) and scales it so its longer
+// side is at most maxSide, 0 keeps the size. The rect is clamped to the
+// picture and aligned to the chroma grid.
+inline bool cropNv12(const uint8_t *pNv12, const int width, const int height, const IMAGE_RECT &rect,
+					const int maxSide, I420_IMAGE &dst, NV12_SCRATCH &scratch) {
+	int x0 = std::max(0, std::min(rect.x, width)) & ~1;
+	int y0 = std::max(0, std::min(rect.y, height)) & ~1;
+	int x1 = std::max(x0, std::min(rect.x + rect.w, width)) & ~1;
+	int y1 = std::max(y0, std::min(rect.y + rect.h, height)) & ~1;
+	int w = x1 - x0, h = y1 - y0;
+	if (w < 2 || h < 2) {
+		return false;
+	}
+	int dw = w, dh = h;
+	if (maxSide > 0 && std::max(w, h) > maxSide) {
+		float scale = (float)maxSide / std::max(w, h);
+		dw = std::max(2, (int)(w * scale + 0.5f) & ~1);
+		dh = std::max(2, (int)(h * scale + 0.5f) & ~1);
+	}
+	allocI420(dst, dw, dh);
+	scalePlane(pNv12 + (size_t)y0 * width + x0, width, w, h, dst.y.data(), dst.pitchY, dw, dh, scratch);
+	// chroma: deinterleave the rect, then the same chain at half size
+	const uint8_t *pUV = pNv12 + (size_t)width * height;
+	int cw = w / 2, ch = h / 2;
+	if (scratch.u.size() < (size_t)cw * ch) {
+		scratch.u.resize((size_t)cw * ch);
+		scratch.v.resize((size_t)cw * ch);
+	}
+	for (int y = 0; y < ch; ++y) {
+		deinterleaveUV(pUV + (size_t)(y0 / 2 + y) * width + x0, scratch.u.data() + y * cw, scratch.v.data() + y * cw, cw);
+	}
+	scalePlane(scratch.u.data(), cw, cw, ch, dst.u.data(), dst.pitchC, dw / 2, dh / 2, scratch);
+	scalePlane(scratch.v.data(), cw, cw, ch, dst.v.data(), dst.pitchC, dw / 2, dh / 2, scratch);
+	padPlane(dst.y.data(), dst.pitchY, dw, dh, dst.rowsY);
+	padPlane(dst.u.data(), dst.pitchC, dw / 2, dh / 2, dst.rowsC);
+	padPlane(dst.v.data(), dst.pitchC, dw / 2, dh / 2, dst.rowsC);
+	return true;
+}
+
+#endif // NV12_IMAGE_H
@@ -0,0 +1,121 @@
+#ifndef OFFLINE_STITCH_MODULE_H
+#define OFFLINE_STITCH_MODULE_H
+
+#include "common.h"
+#include "offlineStitcher.h"
+
+// Sink of the offline mode in place of KittiLoggerModule: hands the
+// detections of every frame to the stitcher by the picture of the
+// recording it was decoded from. The modules of all device workers share
+// one stitcher.
+class OfflineStitchModule : public IModule {
+public:
+	explicit
+	OfflineStitchModule(PRE_MODULE_LIST &preModules,
+						OfflineStitcher *pStitcher,
+						simplelogger::Logger *logger,
+						ChannelScheduler *pScheduler = nullptr,
+						const int workerID = 0)
+	: preModules_(preModules), pStitcher_(pStitcher), logger_(logger), pScheduler_(pScheduler), workerID_(workerID) {}
+
+	~OfflineStitchModule() {}
+
+	// override
+	void initialize() override {}
+
+	void execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) override;
+
+	void destroy() override {}
+
+	int getNbInputs() const override {
+		return preModules_.size();
+	}
+
+	PRE_MODULE getPreModule(const int tensorIndex) const override {
+		return preModules_[tensorIndex];
+	}
+
+	int getNbOutputs() const override {
+		return vpOutputTensors_.size();
+	}
+
+	IStreamTensor* getOutputTensor(const int tensorIndex) const override {
+		return vpOutputTensors_[tensorIndex];
+	}
+
+	void setProfiler(IModuleProfiler *pProfiler) override {
+		pProfiler_ = pProfiler;
+	}
+
+	IModuleProfiler* getProfiler() const override {
+		return pProfiler_;
+	}
+
+	void setCallback(void *pUserData, MODULE_CALLBACK callback) override {
+		pUserData_ = pUserData;
+		callback_ = callback;
+	}
+
+	std::pair<void *, MODULE_CALLBACK> getCallback() const override {
+		return std::pair<void*, MODULE_CALLBACK>(pUserData_, callback_);
+	}
+
+private:
+	OfflineStitcher *pStitcher_{ nullptr };
+	simplelogger::Logger *logger_{ nullptr };
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
+	// execute() runs on the worker's thread
+	std::vector<OFFLINE_BOX > vBoxes_;
+
+	void *pUserData_{ nullptr };
+	MODULE_CALLBACK callback_{ nullptr };
+	IModuleProfiler* pProfiler_{ nullptr };
+
+	PRE_MODULE_LIST preModules_;
+	std::vector<IStreamTensor*> vpOutputTensors_;
+};
+
+void OfflineStitchModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
+	TRACE_RANGE("OfflineStitchModule::execute");
+	assert(1 == vpInputTensors.size());
+	assert(OBJ_COORD == vpInputTensors[0]->getTensorType());
+	int nFrames = vpInputTensors[0]->getShape()[0];
+	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(vpInputTensors[0]->getCpuData());
+	if (0 == nFrames || nullptr == pBBox_batch) {
+		return;
+	}
+	for (int iF = 0; iF < nFrames; ++iF) {
+		uint64_t tSink = metricsNowUs();
+		BBOXS_PER_FRAME &bboxs = pBBox_batch[iF];
+		int lane = bboxs.videoIndex;
+		int channel = lane;
+		if (nullptr != pScheduler_) {
+			channel = pScheduler_->getChannel(workerID_, lane);
+		}
+		// the tracer is always there in the offline mode, see main
+		PACKET_STAMP stamp;
+		if (nullptr == g_pTracer || !g_pTracer->lookup(workerID_, lane, bboxs.frameIndex, stamp)
+			|| stamp.sourcePicture < 0) {
+			pStitcher_->addLost();
+			continue;
+		}
+		// all boxes, as KittiLoggerModule writes them
+		vBoxes_.clear();
+		for (int i = 0; i < bboxs.nBBox; ++i) {
+			const BBOX_INFO &bbox = bboxs.bbox[i];
+			OFFLINE_BOX box;
+			box.x = bbox.x;
+			box.y = bbox.y;
+			box.w = bbox.w;
+			box.h = bbox.h;
+			box.category = bbox.category;
+			vBoxes_.push_back(box);
+		}
+		pStitcher_->add(channel, stamp.sourcePicture, vBoxes_.data(), vBoxes_.size());
+		recordMetric(STAGE_SINK, channel, metricsNowUs() - tSink);
+		g_pTracer->onFrameDone(workerID_, lane, bboxs.frameIndex, channel);
+	}
+}
+
+#endif // OFFLINE_STITCH_MODULE_H
@@ -0,0 +1,116 @@
+#include "offlineStitcher.h"
+#include <algorithm>
+
+OfflineStitcher::OfflineStitcher(const RecordingSegmentQueue *pQueue, const int nChannels, const int width,
+								const int height, simplelogger::Logger *logger)
+: pQueue_(pQueue), width_(std::max(1, width)), height_(std::max(1, height)), logger_(logger),
+  vMaxReported_(pQueue->getSegments().size()), vComplete_(pQueue->getSegments().size(), false),
+  vLastSegment_(nChannels, -1) {
+	const std::vector<RECORDING_SEGMENT > &vSegments = pQueue_->getSegments();
+	for (size_t i = 0; i < vSegments.size(); ++i) {
+		vMaxReported_[i] = vSegments[i].firstFrame - 1;
+	}
+	next_ = pQueue_->getFirstFrame();
+	nextProgress_ = next_;
+}
+
+OfflineStitcher::~OfflineStitcher() {
+	finish();
+}
+
+bool OfflineStitcher::open(const std::string &path, const char *szLabelFile) {
+	std::ifstream iLabel(nullptr == szLabelFile ? "" : szLabelFile);
+	std::string line;
+	while (std::getline(iLabel, line)) {
+		vLabels_.push_back(line);
+	}
+	if (vLabels_.empty()) {
+		LOG_ERROR(logger_, "OfflineStitcher: no labels in " << (nullptr == szLabelFile ? "(null)" : szLabelFile));
+		return false;
+	}
+	file_.open(path, std::ios::trunc);
+	if (!file_.is_open()) {
+		LOG_ERROR(logger_, "OfflineStitcher: failed to open " << path);
+		return false;
+	}
+	return true;
+}
+
+void OfflineStitcher::add(const int channel, const int64_t picture, const OFFLINE_BOX *pBoxes, const size_t nBoxes) {
+	std::lock_guard<std::mutex> lock(mtx_);
+	int segment = pQueue_->segmentOf(picture);
+	if (segment < 0 || picture >= pQueue_->getEndFrame()) {
+		return;
+	}
+	// after its segment was taken as complete, e.g. a channel moved lanes
+	if (picture < next_ || vComplete_[segment]) {
+		nLate_++;
+		return;
+	}
+	if (nBoxes > 0) {
+		mPending_[picture].assign(pBoxes, pBoxes + nBoxes);
+		maxPending_ = std::max(maxPending_, mPending_.size());
+	}
+	vMaxReported_[segment] = std::max(vMaxReported_[segment], picture);
+	if (channel >= 0 && channel < (int)vLastSegment_.size()) {
+		int &last = vLastSegment_[channel];
+		if (last >= 0 && last != segment) {
+			vComplete_[last] = true;
+		}
+		last = segment;
+	}
+	writeSettled();
+}
+
+void OfflineStitcher::finish() {
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (!file_.is_open()) {
+		return;
+	}
+	for (size_t i = 0; i < vComplete_.size(); ++i) {
+		vComplete_[i] = true;
+	}
+	writeSettled();
+	file_.close();
+}
+
+void OfflineStitcher::writeSettled() {
+	const std::vector<RECORDING_SEGMENT > &vSegments = pQueue_->getSegments();
+	const int64_t nPictures = pQueue_->getEndFrame() - pQueue_->getFirstFrame();
+	bool bWritten = false;
+	while (segment_ < (int)vSegments.size()) {
+		const RECORDING_SEGMENT &segment = vSegments[segment_];
+		const int64_t end = (int64_t)segment.firstFrame + segment.nFrames;
+		const int64_t limit = vComplete_[segment_] ? end : vMaxReported_[segment_] + 1;
+		if (limit <= next_) {
+			break;
+		}
+		for (std::map<int64_t, std::vector<OFFLINE_BOX > >::iterator it = mPending_.begin();
+			 it != mPending_.end() && it->first < limit; it = mPending_.erase(it)) {
+			for (size_t i = 0; i < it->second.size(); ++i) {
+				const OFFLINE_BOX &box = it->second[i];
+				const std::string &label = box.category >= 0 && box.category < (int)vLabels_.size()
+											? vLabels_[box.category] : vLabels_.back();
+				file_ << "Frame [" << it->first << "]" << label << " 0.0 0 0.0 " << box.x * width_ << " "
+					  << box.y * height_ << " " << (box.x + box.w) * width_ << " " << (box.y + box.h) * height_
+					  << " 0.0 0.0 0.0 0.0 0.0 0.0 0.0\n";
+			}
+			nBoxes_ += it->second.size();
+		}
+		next_ = limit;
+		bWritten = true;
+		if (next_ < end) {
+			break;
+		}
+		segment_++;
+	}
+	if (!bWritten) {
+		return;
+	}
+	file_.flush();
+	while (nPictures > 0 && next_ >= nextProgress_ && nextProgress_ < pQueue_->getEndFrame()) {
+		LOG_INFO(logger_, "OfflineStitcher: " << 100 * (next_ - pQueue_->getFirstFrame()) / nPictures
+							<< "% of the recording written");
+		nextProgress_ = next_ + std::max<int64_t>(1, nPictures / 10);
+	}
+}
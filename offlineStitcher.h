@@ -0,0 +1,81 @@
+#ifndef OFFLINE_STITCHER_H
+#define OFFLINE_STITCHER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include "recordingSegments.h"
+#include "common/logger.h"
+
+typedef struct {
+	float x;			// normalized to the picture
+	float y;
+	float w;
+	float h;
+	int category;
+} OFFLINE_BOX;
+
+// Puts the detections of the offline mode back in the order of the
+// recording. The lanes decode different segments at once and report the
+// pictures of a segment in order, so a picture is settled once it was
+// reported, or a later picture of its segment was, or the channel which
+// decoded the segment moved on to another one; pictures the sampler or
+// the decoder dropped do not hold the output up. Settled pictures are
+// written in Kitti lines, numbered by their picture in the recording
+// and scaled to its size, the format of KittiLoggerModule.
+class OfflineStitcher {
+public:
+	OfflineStitcher(const RecordingSegmentQueue *pQueue, const int nChannels, const int width, const int height,
+					simplelogger::Logger *logger);
+	~OfflineStitcher();
+
+	bool open(const std::string &path, const char *szLabelFile);
+
+	// Detections of a picture of the recording, from the sink of the lane
+	// which decoded it; by the channel whose provider pushed it.
+	void add(const int channel, const int64_t picture, const OFFLINE_BOX *pBoxes, const size_t nBoxes);
+
+	// a frame whose picture was not known any more, see FrameTracer
+	void addLost() {
+		std::lock_guard<std::mutex> lock(mtx_);
+		nLost_++;
+	}
+
+	// all lanes are done, writes what is left
+	void finish();
+
+	uint64_t getNbPictures() const { return (uint64_t)(next_ - pQueue_->getFirstFrame()); }
+	uint64_t getNbBoxes() const { return nBoxes_; }
+	uint64_t getNbLost() const { return nLost_; }
+	uint64_t getNbLate() const { return nLate_; }
+	size_t getMaxPending() const { return maxPending_; }
+
+private:
+	void writeSettled();
+
+	const RecordingSegmentQueue *pQueue_{ nullptr };
+	int width_{ 0 };
+	int height_{ 0 };
+	simplelogger::Logger *logger_{ nullptr };
+	std::vector<std::string > vLabels_;
+	std::ofstream file_;
+
+	std::mutex mtx_;
+	std::map<int64_t, std::vector<OFFLINE_BOX > > mPending_;	// reported, not written, with boxes
+	std::vector<int64_t > vMaxReported_;		// per segment
+	std::vector<bool > vComplete_;				// per segment
+	std::vector<int > vLastSegment_;			// per channel
+	int64_t next_{ 0 };							// next picture to write
+	int segment_{ 0 };							// of next_
+	int64_t nextProgress_{ 0 };
+
+	uint64_t nBoxes_{ 0 };
+	uint64_t nLost_{ 0 };
+	uint64_t nLate_{ 0 };
+	size_t maxPending_{ 0 };
+};
+
+#endif // OFFLINE_STITCHER_H
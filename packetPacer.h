@@ -0,0 +1,129 @@
+#ifndef PACKET_PACER_H
+#define PACKET_PACER_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "nalParser.h"
+#include "metrics.h"
+
+typedef struct {
+	bool bEnabled = false;
+	float speed = 1.f;			// media seconds per second, 0 releases packets without waiting
+	float fps = 0.f;			// > 0 paces by pictures instead of timestamps
+	int startOffsetMs = 0;		// delay of the first packet
+} PACING_PARAMS;
+
+// "max" or "<speed>[x]", e.g. "1x", "2x", "10x", "0.5x", false if malformed.
+inline bool parsePacingSpeed(const char *szSpeed, float &speed) {
+	if (0 == strcmp(szSpeed, "max") || 0 == strcmp(szSpeed, "unlimited")) {
+		speed = 0.f;
+		return true;
+	}
+	char *pEnd = nullptr;
+	speed = strtof(szSpeed, &pEnd);
+	if ('x' == *pEnd) {
+		pEnd++;
+	}
+	return pEnd != szSpeed && 0 == *pEnd && speed > 0.f;
+}
+
+// Network sources arrive in real time by themselves, only files are paced.
+inline bool isPacedUrl(const char *url) {
+	return nullptr == strstr(url, "://") || 0 == strncmp(url, "file:", 5);
+}
+
+// Releases the packets of a recorded source the way a camera would send
+// them: a packet waits until startOffsetMs plus its dts, divided by the
+// speed, have passed on the steady clock since the first packet. Sources
+// without timestamps, or with fps set, advance by one frame interval per
+// picture, other packets (parameter sets, SEI) go with their picture.
+//
+// A timestamp going backwards (the file looped) or jumping far ahead
+// starts a new timeline after the last packet. A pacer which fell more
+// than a second behind, e.g. on a slow disk, restarts its timeline too,
+// rather than bursting to catch up.
+class PacketPacer {
+public:
+	// matches AV_NOPTS_VALUE
+	static const int64_t NO_TIMESTAMP = INT64_MIN;
+
+	explicit
+	PacketPacer(const PACING_PARAMS &params)
+	: params_(params),
+	  frameUs_(params.fps > 0.f ? (int64_t)(1e6 / params.fps) : NOMINAL_FRAME_US) {}
+
+	// Blocks until the packet is due, false when abort was raised meanwhile.
+	bool wait(const uint8_t *pBuf, const int nBuf, const VIDEO_CODEC codec,
+				const int64_t dtsUs, const std::atomic<bool > &abort) {
+		int64_t mediaUs = dtsUs;
+		if (params_.fps > 0.f || NO_TIMESTAMP == dtsUs) {
+			if (classifyPacket(pBuf, nBuf, codec).bNewPicture && nPictures_++ > 0) {
+				pictureUs_ += frameUs_;
+			}
+			mediaUs = pictureUs_;
+		}
+		int64_t nowUs = (int64_t)metricsNowUs();
+		if (!bStarted_) {
+			bStarted_ = true;
+			originUs_ = nowUs + (int64_t)params_.startOffsetMs * 1000;
+			baseMediaUs_ = mediaUs;
+		} else if (mediaUs < lastMediaUs_ - MAX_BACKWARD_US || mediaUs > lastMediaUs_ + MAX_FORWARD_US) {
+			originUs_ = std::max(nowUs, lastDueUs_ + frameUs_);
+			baseMediaUs_ = mediaUs;
+		}
+		lastMediaUs_ = mediaUs;
+
+		int64_t dueUs = originUs_;
+		if (params_.speed > 0.f) {
+			dueUs += (int64_t)((mediaUs - baseMediaUs_) / params_.speed);
+		}
+		if (nowUs > dueUs + MAX_LAG_US) {
+			nRestarts_.fetch_add(1, std::memory_order_relaxed);
+			originUs_ = nowUs;
+			baseMediaUs_ = mediaUs;
+			dueUs = nowUs;
+		}
+		lastDueUs_ = dueUs;
+
+		// short slices so a reload or shutdown is not held up
+		while (nowUs < dueUs) {
+			if (abort.load(std::memory_order_relaxed)) {
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(std::min<int64_t>(dueUs - nowUs, 50000)));
+			nowUs = (int64_t)metricsNowUs();
+		}
+		return !abort.load(std::memory_order_relaxed);
+	}
+
+	const PACING_PARAMS &getParams() const { return params_; }
+
+	// timelines restarted because the source could not keep up
+	uint64_t getNbRestarts() const { return nRestarts_.load(std::memory_order_relaxed); }
+
+private:
+	// frame interval of sources without timestamps when fps is not set
+	static const int64_t NOMINAL_FRAME_US = 40000;
+	// pts in place of a missing dts goes back by a few frames around B pictures
+	static const int64_t MAX_BACKWARD_US = 200000;
+	static const int64_t MAX_FORWARD_US = 10000000;
+	static const int64_t MAX_LAG_US = 1000000;
+
+	PACING_PARAMS params_;
+	int64_t frameUs_{ NOMINAL_FRAME_US };
+	bool bStarted_{ false };
+	int64_t originUs_{ 0 };		// steady clock of baseMediaUs_
+	int64_t baseMediaUs_{ 0 };
+	int64_t lastMediaUs_{ 0 };
+	int64_t lastDueUs_{ 0 };
+	int64_t nPictures_{ 0 };
+	int64_t pictureUs_{ 0 };
+	std::atomic<uint64_t > nRestarts_{ 0 };
+};
+
+#endif // PACKET_PACER_H
@@ -0,0 +1,386 @@
+#include "packetPool.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "metrics.h"
+
+static const size_t kHugePageBytes = 2 << 20;
+
+struct PacketPool::SLAB {
+	PacketPool *pPool = nullptr;
+	int iClass = 0;
+	uint8_t *pBase = nullptr;
+	size_t nBytes = 0;
+	bool bHuge = false;
+	uint32_t nChunks = 0;
+	uint32_t nUsed = 0;						// handed out or in a thread cache
+	std::vector<uint32_t > vFree;			// chunk indices
+	std::vector<uint32_t > vRequested;		// bytes asked for, per chunk in use
+};
+
+// The counters are written by the owning thread only, other threads read
+// them for the stats. Chunks released on another thread than the one which
+// allocated them leave one count negative and the other positive.
+struct PacketPool::THREAD_CACHE {
+	PacketPool *pPool = nullptr;			// nullptr once the pool is gone
+	uint64_t serial = 0;
+	std::vector<std::vector<CHUNK > > vvChunks;
+	std::atomic<int64_t > nAllocs{ 0 };
+	std::atomic<int64_t > requestedBytes{ 0 };
+	std::atomic<int64_t > usedBytes{ 0 };
+	std::atomic<int64_t > cachedBytes{ 0 };
+
+	static void add(std::atomic<int64_t > &counter, const int64_t delta) {
+		counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+};
+
+// Guards the caches of all pools against threads which exit while a pool
+// is deleted. Never destroyed, threads may exit after main().
+static std::mutex &registryMutex() {
+	static std::mutex *pMutex = new std::mutex;
+	return *pMutex;
+}
+
+static std::atomic<uint64_t > g_poolSerial{ 0 };
+
+static std::vector<size_t > makeClassSizes(const PACKET_POOL_PARAMS &params) {
+	std::vector<size_t > vSizes;
+	for (size_t base = 256; vSizes.empty() || vSizes.back() < params.maxBytes; base *= 2) {
+		for (size_t m = 4; m < 8 && (vSizes.empty() || vSizes.back() < params.maxBytes); ++m) {
+			size_t size = base * m / 4;
+			if (size >= params.minBytes) {
+				vSizes.push_back(size);
+			}
+		}
+	}
+	return vSizes;
+}
+
+PacketPool::PacketPool(const PACKET_POOL_PARAMS &params, simplelogger::Logger *logger)
+: params_(params), logger_(logger), serial_(++g_poolSerial), vClasses_(makeClassSizes(params).size()) {
+	std::vector<size_t > vSizes = makeClassSizes(params);
+	size_t unit = params_.bHugePages ? kHugePageBytes : 4096;
+	for (size_t i = 0; i < vSizes.size(); ++i) {
+		SIZE_CLASS &sizeClass = vClasses_[i];
+		sizeClass.chunkBytes = vSizes[i];
+		size_t slabBytes = std::max(params_.slabBytes, 4 * vSizes[i]);
+		sizeClass.slabBytes = (slabBytes + unit - 1) / unit * unit;
+		sizeClass.nPerBatch = (int)std::max<size_t>(1, std::min<size_t>(32, params_.cacheBytes / 2 / vSizes[i]));
+	}
+}
+
+PacketPool::~PacketPool() {
+	{
+		std::lock_guard<std::mutex> lock(registryMutex());
+		for (size_t i = 0; i < vpCaches_.size(); ++i) {
+			vpCaches_[i]->pPool = nullptr;
+			vpCaches_[i]->vvChunks.clear();
+		}
+		vpCaches_.clear();
+	}
+	for (size_t i = 0; i < vpSlabs_.size(); ++i) {
+		munmap(vpSlabs_[i]->pBase, vpSlabs_[i]->nBytes);
+		delete vpSlabs_[i];
+	}
+}
+
+int PacketPool::classOf(const size_t nBytes) const {
+	// a binary search over a few dozen classes
+	int lo = 0, hi = (int)vClasses_.size();
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (vClasses_[mid].chunkBytes < nBytes) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo < (int)vClasses_.size() && nBytes <= params_.maxBytes ? lo : -1;
+}
+
+PacketPool::THREAD_CACHE *PacketPool::getCache() {
+	// the caches of this thread, one per pool it used
+	struct CACHE_LIST {
+		std::vector<THREAD_CACHE *> vpCaches;
+		~CACHE_LIST() {
+			std::lock_guard<std::mutex> lock(registryMutex());
+			for (size_t i = 0; i < vpCaches.size(); ++i) {
+				if (nullptr != vpCaches[i]->pPool) {
+					vpCaches[i]->pPool->detachCache(vpCaches[i]);
+				}
+				delete vpCaches[i];
+			}
+		}
+	};
+	static thread_local CACHE_LIST tl_caches;
+	for (size_t i = 0; i < tl_caches.vpCaches.size(); ++i) {
+		if (serial_ == tl_caches.vpCaches[i]->serial) {
+			return tl_caches.vpCaches[i];
+		}
+	}
+	std::lock_guard<std::mutex> lock(registryMutex());
+	// the caches of deleted pools go with the first new one
+	std::vector<THREAD_CACHE *> &vpCaches = tl_caches.vpCaches;
+	for (size_t i = 0; i < vpCaches.size(); ) {
+		if (nullptr == vpCaches[i]->pPool) {
+			delete vpCaches[i];
+			vpCaches.erase(vpCaches.begin() + i);
+		} else {
+			++i;
+		}
+	}
+	THREAD_CACHE *pCache = new THREAD_CACHE();
+	pCache->pPool = this;
+	pCache->serial = serial_;
+	pCache->vvChunks.resize(vClasses_.size());
+	vpCaches.push_back(pCache);
+	vpCaches_.push_back(pCache);
+	return pCache;
+}
+
+// with the registry mutex held, the thread of the cache exits
+void PacketPool::detachCache(THREAD_CACHE *pCache) {
+	for (size_t i = 0; i < pCache->vvChunks.size(); ++i) {
+		THREAD_CACHE::add(pCache->cachedBytes, -(int64_t)(pCache->vvChunks[i].size() * vClasses_[i].chunkBytes));
+		flush((int)i, pCache->vvChunks[i], 0);
+	}
+	// what the thread counted stays in the pool's counts
+	nAllocs_ += pCache->nAllocs.load();
+	requestedBytes_ += pCache->requestedBytes.load();
+	usedBytes_ += pCache->usedBytes.load();
+	cachedBytes_ += pCache->cachedBytes.load();
+	vpCaches_.erase(std::find(vpCaches_.begin(), vpCaches_.end(), pCache));
+	pCache->pPool = nullptr;
+}
+
+uint8_t *PacketPool::allocate(const size_t nBytes, void **pOpaque) {
+	int iClass = classOf(nBytes);
+	if (iClass < 0) {
+		nFallbacks_++;
+		return nullptr;
+	}
+	THREAD_CACHE *pCache = getCache();
+	std::vector<CHUNK > &vCache = pCache->vvChunks[iClass];
+	if (vCache.empty()) {
+		refill(iClass, vCache);
+		if (vCache.empty()) {
+			return nullptr;
+		}
+		THREAD_CACHE::add(pCache->cachedBytes, (int64_t)(vCache.size() * vClasses_[iClass].chunkBytes));
+	}
+	CHUNK chunk = vCache.back();
+	vCache.pop_back();
+	size_t chunkBytes = vClasses_[iClass].chunkBytes;
+	chunk.pSlab->vRequested[(chunk.pData - chunk.pSlab->pBase) / chunkBytes] = (uint32_t)nBytes;
+	THREAD_CACHE::add(pCache->nAllocs, 1);
+	THREAD_CACHE::add(pCache->requestedBytes, (int64_t)nBytes);
+	THREAD_CACHE::add(pCache->usedBytes, (int64_t)chunkBytes);
+	THREAD_CACHE::add(pCache->cachedBytes, -(int64_t)chunkBytes);
+	if (nullptr != g_pMetrics) {
+		publish();
+	}
+	*pOpaque = chunk.pSlab;
+	return chunk.pData;
+}
+
+void PacketPool::release(void *opaque, uint8_t *pData) {
+	SLAB *pSlab = reinterpret_cast<SLAB *>(opaque);
+	CHUNK chunk;
+	chunk.pData = pData;
+	chunk.pSlab = pSlab;
+	pSlab->pPool->releaseChunk(chunk);
+}
+
+void PacketPool::releaseChunk(const CHUNK &chunk) {
+	int iClass = chunk.pSlab->iClass;
+	const SIZE_CLASS &sizeClass = vClasses_[iClass];
+	THREAD_CACHE *pCache = getCache();
+	std::vector<CHUNK > &vCache = pCache->vvChunks[iClass];
+	uint32_t requested = chunk.pSlab->vRequested[(chunk.pData - chunk.pSlab->pBase) / sizeClass.chunkBytes];
+	THREAD_CACHE::add(pCache->requestedBytes, -(int64_t)requested);
+	THREAD_CACHE::add(pCache->usedBytes, -(int64_t)sizeClass.chunkBytes);
+	vCache.push_back(chunk);
+	THREAD_CACHE::add(pCache->cachedBytes, (int64_t)sizeClass.chunkBytes);
+	// a thread which only releases keeps one batch
+	if ((int)vCache.size() > 2 * sizeClass.nPerBatch) {
+		size_t nBefore = vCache.size();
+		flush(iClass, vCache, sizeClass.nPerBatch);
+		THREAD_CACHE::add(pCache->cachedBytes, -(int64_t)((nBefore - vCache.size()) * sizeClass.chunkBytes));
+	}
+}
+
+// Moves a batch from the slabs into the cache, from the fullest slab first
+// so that the emptier ones get a chance to drain.
+void PacketPool::refill(const int iClass, std::vector<CHUNK > &vCache) {
+	SIZE_CLASS &sizeClass = vClasses_[iClass];
+	std::lock_guard<std::mutex> lock(sizeClass.mtx);
+	while ((int)vCache.size() < sizeClass.nPerBatch) {
+		if (sizeClass.vpPartial.empty()) {
+			SLAB *pSlab = createSlab(iClass);
+			if (nullptr == pSlab) {
+				return;
+			}
+			sizeClass.vpPartial.push_back(pSlab);
+			sizeClass.nEmpty++;
+		}
+		std::vector<SLAB *>::iterator it = std::max_element(sizeClass.vpPartial.begin(), sizeClass.vpPartial.end(),
+			[](const SLAB *a, const SLAB *b) { return a->nUsed < b->nUsed; });
+		SLAB *pSlab = *it;
+		if (0 == pSlab->nUsed) {
+			sizeClass.nEmpty--;
+		}
+		while ((int)vCache.size() < sizeClass.nPerBatch && !pSlab->vFree.empty()) {
+			CHUNK chunk;
+			chunk.pData = pSlab->pBase + (size_t)pSlab->vFree.back() * sizeClass.chunkBytes;
+			chunk.pSlab = pSlab;
+			pSlab->vFree.pop_back();
+			pSlab->nUsed++;
+			vCache.push_back(chunk);
+		}
+		if (pSlab->vFree.empty()) {
+			sizeClass.vpPartial.erase(it);
+		}
+	}
+}
+
+// Returns all but nKeep chunks of the cache to their slabs.
+void PacketPool::flush(const int iClass, std::vector<CHUNK > &vCache, const size_t nKeep) {
+	if (vCache.size() <= nKeep) {
+		return;
+	}
+	SIZE_CLASS &sizeClass = vClasses_[iClass];
+	std::lock_guard<std::mutex> lock(sizeClass.mtx);
+	while (vCache.size() > nKeep) {
+		CHUNK chunk = vCache.back();
+		vCache.pop_back();
+		SLAB *pSlab = chunk.pSlab;
+		if (pSlab->vFree.empty()) {
+			sizeClass.vpPartial.push_back(pSlab);
+		}
+		pSlab->vFree.push_back((uint32_t)((chunk.pData - pSlab->pBase) / sizeClass.chunkBytes));
+		if (0 == --pSlab->nUsed && ++sizeClass.nEmpty > params_.keepEmptySlabs) {
+			sizeClass.vpPartial.erase(std::find(sizeClass.vpPartial.begin(), sizeClass.vpPartial.end(), pSlab));
+			sizeClass.nEmpty--;
+			destroySlab(pSlab);
+		}
+	}
+}
+
+// with the class mutex held
+PacketPool::SLAB *PacketPool::createSlab(const int iClass) {
+	const SIZE_CLASS &sizeClass = vClasses_[iClass];
+	void *p = MAP_FAILED;
+	bool bHuge = false;
+	if (params_.bHugePages) {
+		p = mmap(nullptr, sizeClass.slabBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		bHuge = MAP_FAILED != p;
+		if (!bHuge && !bHugeWarned_.exchange(true)) {
+			LOG_WARN(logger_, "PacketPool: no huge pages reserved (vm.nr_hugepages), transparent huge pages instead");
+		}
+	}
+	if (MAP_FAILED == p) {
+		p = mmap(nullptr, sizeClass.slabBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == p) {
+			LOG_ERROR(logger_, "PacketPool: out of memory for a " << (sizeClass.slabBytes >> 10) << " KB slab");
+			return nullptr;
+		}
+		if (params_.bHugePages) {
+			madvise(p, sizeClass.slabBytes, MADV_HUGEPAGE);
+		}
+	}
+	// before the first touch; by syscall, libnuma is not needed for one call
+	if (params_.numaNode >= 0 && params_.numaNode < 64) {
+		unsigned long nodeMask = 1UL << params_.numaNode;
+		// maxnode counts one past the bits of the mask
+		if (0 != syscall(SYS_mbind, p, sizeClass.slabBytes, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8 + 1, 0U)
+			&& !bMbindWarned_.exchange(true)) {
+			LOG_WARN(logger_, "PacketPool: cannot prefer node " << params_.numaNode << ": " << strerror(errno));
+		}
+	}
+	SLAB *pSlab = new SLAB();
+	pSlab->pPool = this;
+	pSlab->iClass = iClass;
+	pSlab->pBase = reinterpret_cast<uint8_t *>(p);
+	pSlab->nBytes = sizeClass.slabBytes;
+	pSlab->bHuge = bHuge;
+	pSlab->nChunks = (uint32_t)(sizeClass.slabBytes / sizeClass.chunkBytes);
+	pSlab->vRequested.resize(pSlab->nChunks);
+	// handed out from the low addresses up
+	pSlab->vFree.resize(pSlab->nChunks);
+	for (uint32_t i = 0; i < pSlab->nChunks; ++i) {
+		pSlab->vFree[i] = pSlab->nChunks - 1 - i;
+	}
+	reservedBytes_ += pSlab->nBytes;
+	nSlabs_++;
+	nHugeSlabs_ += bHuge ? 1 : 0;
+	std::lock_guard<std::mutex> lock(mtxSlabs_);
+	vpSlabs_.push_back(pSlab);
+	return pSlab;
+}
+
+// with the class mutex held
+void PacketPool::destroySlab(SLAB *pSlab) {
+	{
+		std::lock_guard<std::mutex> lock(mtxSlabs_);
+		std::vector<SLAB *>::iterator it = std::find(vpSlabs_.begin(), vpSlabs_.end(), pSlab);
+		*it = vpSlabs_.back();
+		vpSlabs_.pop_back();
+	}
+	reservedBytes_ -= pSlab->nBytes;
+	nSlabs_--;
+	nHugeSlabs_ -= pSlab->bHuge ? 1 : 0;
+	munmap(pSlab->pBase, pSlab->nBytes);
+	delete pSlab;
+}
+
+PACKET_POOL_STATS PacketPool::getStats() const {
+	int64_t nAllocs = nAllocs_, requested = requestedBytes_, used = usedBytes_, cached = cachedBytes_;
+	{
+		std::lock_guard<std::mutex> lock(registryMutex());
+		for (size_t i = 0; i < vpCaches_.size(); ++i) {
+			nAllocs += vpCaches_[i]->nAllocs.load(std::memory_order_relaxed);
+			requested += vpCaches_[i]->requestedBytes.load(std::memory_order_relaxed);
+			used += vpCaches_[i]->usedBytes.load(std::memory_order_relaxed);
+			cached += vpCaches_[i]->cachedBytes.load(std::memory_order_relaxed);
+		}
+	}
+	PACKET_POOL_STATS stats;
+	stats.nAllocs = std::max<int64_t>(0, nAllocs);
+	stats.nFallbacks = nFallbacks_;
+	stats.requestedBytes = std::max<int64_t>(0, requested);
+	stats.usedBytes = std::max<int64_t>(0, used);
+	stats.cachedBytes = std::max<int64_t>(0, cached);
+	stats.reservedBytes = std::max<int64_t>(0, reservedBytes_.load());
+	stats.nSlabs = std::max<int64_t>(0, nSlabs_.load());
+	stats.nHugeSlabs = std::max<int64_t>(0, nHugeSlabs_.load());
+	if (stats.usedBytes > 0) {
+		stats.internalFragmentation = 1. - (double)stats.requestedBytes / stats.usedBytes;
+	}
+	if (stats.reservedBytes > 0) {
+		stats.externalFragmentation = 1. - (double)stats.usedBytes / stats.reservedBytes;
+	}
+	return stats;
+}
+
+void PacketPool::publish() {
+	uint64_t nowUs = metricsNowUs();
+	uint64_t lastUs = lastPublishUs_.load(std::memory_order_relaxed);
+	if (nowUs - lastUs < 1000000
+		|| !lastPublishUs_.compare_exchange_strong(lastUs, nowUs)) {
+		return;
+	}
+	PACKET_POOL_STATS stats = getStats();
+	g_pMetrics->setGauge("packet_pool_reserved_bytes", -1, (double)stats.reservedBytes);
+	g_pMetrics->setGauge("packet_pool_used_bytes", -1, (double)stats.usedBytes);
+	g_pMetrics->setGauge("packet_pool_requested_bytes", -1, (double)stats.requestedBytes);
+	g_pMetrics->setGauge("packet_pool_cached_bytes", -1, (double)stats.cachedBytes);
+	g_pMetrics->setGauge("packet_pool_internal_fragmentation", -1, stats.internalFragmentation);
+	g_pMetrics->setGauge("packet_pool_external_fragmentation", -1, stats.externalFragmentation);
+	g_pMetrics->setGauge("packet_pool_fallbacks", -1, (double)stats.nFallbacks);
+	g_pMetrics->setGauge("packet_pool_slabs", -1, (double)stats.nSlabs);
+}
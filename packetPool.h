@@ -0,0 +1,117 @@
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include "common/logger.h"
+
+typedef struct {
+	size_t minBytes = 512;				// smallest size class
+	size_t maxBytes = 4 << 20;			// larger packets are left to the caller
+	size_t slabBytes = 256 << 10;		// at least, and at least 4 chunks
+	size_t cacheBytes = 128 << 10;		// per thread and size class
+	int keepEmptySlabs = 1;				// per size class, the others are unmapped
+	bool bHugePages = false;			// 2 MB pages, slabs are rounded up to them
+	int numaNode = -1;					// preferred node of the slabs, -1 for first touch
+} PACKET_POOL_PARAMS;
+
+typedef struct {
+	uint64_t nAllocs = 0;
+	uint64_t nFallbacks = 0;			// too large for the pool
+	uint64_t requestedBytes = 0;		// in use, as asked for
+	uint64_t usedBytes = 0;				// in use, whole chunks
+	uint64_t cachedBytes = 0;			// free in the thread caches
+	uint64_t reservedBytes = 0;			// mapped slabs
+	uint64_t nSlabs = 0;
+	uint64_t nHugeSlabs = 0;
+	double internalFragmentation = 0.;	// 1 - requested / used
+	double externalFragmentation = 0.;	// 1 - used / reserved
+} PACKET_POOL_STATS;
+
+// Size-classed slab allocator for compressed packet payloads. There are
+// four classes per power of two between minBytes and maxBytes; each class
+// carves chunks out of its own slabs, so packets of one bitrate never
+// split the free space of another and a slab whose chunks all came back
+// is returned to the system. Each thread keeps a few free chunks per
+// class and trades them with the slabs in batches, so the takers which
+// allocate and the workers and recorders which release do not meet on a
+// lock per packet.
+//
+// Chunks are handed out with an opaque handle which release() takes back,
+// in the shape of an AVBuffer free callback:
+//
+//   void *opaque = nullptr;
+//   uint8_t *p = pool.allocate(n, &opaque);
+//   AVBufferRef *pRef = av_buffer_create(p, n, PacketPool::release, opaque, 0);
+//
+// The pool outlives every chunk and every thread which used it, except
+// the one which deletes it.
+class PacketPool {
+public:
+	explicit
+	PacketPool(const PACKET_POOL_PARAMS &params, simplelogger::Logger *logger);
+	~PacketPool();
+
+	// nullptr when nBytes is past maxBytes or no memory is left
+	uint8_t *allocate(const size_t nBytes, void **pOpaque);
+	static void release(void *opaque, uint8_t *pData);
+
+	// also metrics gauges, set from allocate() at most once per second
+	PACKET_POOL_STATS getStats() const;
+
+	const PACKET_POOL_PARAMS &getParams() const { return params_; }
+
+private:
+	struct SLAB;
+	struct THREAD_CACHE;
+	typedef struct {
+		uint8_t *pData;
+		SLAB *pSlab;
+	} CHUNK;
+
+	typedef struct {
+		size_t chunkBytes = 0;
+		size_t slabBytes = 0;
+		int nPerBatch = 1;
+		std::mutex mtx;
+		std::vector<SLAB *> vpPartial;	// with free chunks, fullest first when refilling
+		int nEmpty = 0;
+	} SIZE_CLASS;
+
+	int classOf(const size_t nBytes) const;
+	THREAD_CACHE *getCache();
+	void refill(const int iClass, std::vector<CHUNK > &vCache);
+	void flush(const int iClass, std::vector<CHUNK > &vCache, const size_t nKeep);
+	void releaseChunk(const CHUNK &chunk);
+	SLAB *createSlab(const int iClass);
+	void destroySlab(SLAB *pSlab);
+	void detachCache(THREAD_CACHE *pCache);
+	void publish();
+
+	PACKET_POOL_PARAMS params_;
+	simplelogger::Logger *logger_{ nullptr };
+	const uint64_t serial_;
+	std::vector<SIZE_CLASS > vClasses_;
+	std::vector<SLAB *> vpSlabs_;			// all of them, under mtxSlabs_
+	std::mutex mtxSlabs_;
+	std::vector<THREAD_CACHE *> vpCaches_;	// under the registry mutex
+	std::atomic<bool > bHugeWarned_{ false };
+	std::atomic<bool > bMbindWarned_{ false };
+	std::atomic<uint64_t > lastPublishUs_{ 0 };
+
+	std::atomic<uint64_t > nAllocs_{ 0 };
+	std::atomic<uint64_t > nFallbacks_{ 0 };
+	std::atomic<int64_t > requestedBytes_{ 0 };
+	std::atomic<int64_t > usedBytes_{ 0 };
+	std::atomic<int64_t > cachedBytes_{ 0 };
+	std::atomic<int64_t > reservedBytes_{ 0 };
+	std::atomic<int64_t > nSlabs_{ 0 };
+	std::atomic<int64_t > nHugeSlabs_{ 0 };
+
+	friend struct THREAD_CACHE;
+};
+
+#endif // PACKET_POOL_H
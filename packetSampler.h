@@ -0,0 +1,237 @@
+#ifndef PACKET_SAMPLER_H
+#define PACKET_SAMPLER_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include "nalParser.h"
+#include "motionGate.h"
+
+enum SAMPLING_MODE {
+	SAMPLE_ALL = 0,
+	SAMPLE_IDR_ONLY,	// keyframes only
+	SAMPLE_REF_ONLY,	// drop non-reference pictures
+	SAMPLE_EVERY_NTH,	// about one picture in N
+	SAMPLE_TARGET_FPS	// about targetFps pictures per second
+};
+
+typedef struct {
+	SAMPLING_MODE mode = SAMPLE_ALL;
+	int nth = 1;
+	float targetFps = 0.f;
+} SAMPLING_PARAMS;
+
+// "all", "idr", "ref", "nth:<N>" or "fps:<F>", false if malformed.
+inline bool parseSamplingMode(const char *szMode, SAMPLING_PARAMS &params) {
+	params = SAMPLING_PARAMS();
+	if (0 == strcmp(szMode, "all")) {
+		params.mode = SAMPLE_ALL;
+	} else if (0 == strcmp(szMode, "idr")) {
+		params.mode = SAMPLE_IDR_ONLY;
+	} else if (0 == strcmp(szMode, "ref")) {
+		params.mode = SAMPLE_REF_ONLY;
+	} else if (0 == strncmp(szMode, "nth:", 4)) {
+		params.mode = SAMPLE_EVERY_NTH;
+		params.nth = atoi(szMode + 4);
+		return params.nth >= 1;
+	} else if (0 == strncmp(szMode, "fps:", 4)) {
+		params.mode = SAMPLE_TARGET_FPS;
+		params.targetFps = (float)atof(szMode + 4);
+		return params.targetFps > 0.f;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Decides per packet whether it is pushed into the decoder. Only drops
+// what keeps the remaining pictures decodable: non-reference pictures go
+// first, once a reference picture is dropped the rest of the GOP goes
+// too and decoding resumes at the next keyframe. Packets without a
+// slice (parameter sets, SEI) always pass.
+//
+// The motion gate drops static non-reference pictures. Static reference
+// pictures still go to the decoder, the pictures after them refer to
+// them, and are only marked so that they are not analysed. The decode
+// chain stays intact, the gate reopens at the next picture with motion
+// instead of the next keyframe.
+//
+// EVERY_NTH and TARGET_FPS spend a credit per kept picture, earned per
+// picture or per second of pts. The credit a GOP may spend is bounded by
+// what the previous GOP earned, so the kept pictures are a decodable
+// prefix of each GOP.
+class PacketSampler {
+public:
+	explicit
+	PacketSampler(const SAMPLING_PARAMS &params, const VIDEO_CODEC codec)
+	: params_(params), codec_(codec), targetFps_(params.targetFps) {}
+
+	~PacketSampler() {
+		if (pGate_) {
+			delete pGate_;
+		}
+	}
+
+	// Static pictures are dropped or marked on top of the sampling mode,
+	// the sampler owns the gate.
+	void setMotionGate(MotionGate *pGate) {
+		pGate_ = pGate;
+	}
+
+	MotionGate *getMotionGate() const { return pGate_; }
+
+	// ptsUs < 0 when the packet has no timestamp
+	bool accept(const uint8_t *pBuf, const int nBuf, const int64_t ptsUs) {
+		if (nullptr != pGate_) {
+			pGate_->measure(pBuf, nBuf);
+		}
+		PACKET_CLASS c = classifyPacket(pBuf, nBuf, codec_);
+		if (!c.bPicture) {
+			return true;
+		}
+		// further slices of a picture follow its first slice
+		if (!c.bNewPicture) {
+			return bLastAccepted_;
+		}
+		nSeen_.fetch_add(1, std::memory_order_relaxed);
+		bLastAccepted_ = acceptPicture(c, ptsUs);
+		if (bLastAccepted_) {
+			nKept_.fetch_add(1, std::memory_order_relaxed);
+		}
+		return bLastAccepted_;
+	}
+
+	// The last picture accepted is static and passed for the pictures
+	// referring to it only.
+	bool isLastStatic() const { return bLastStatic_; }
+
+	// The next lane of a migrated channel must start at a keyframe.
+	void waitForKeyframe() {
+		bWaitKeyframe_.store(true);
+	}
+
+	// Adjusted at runtime by controllers, TARGET_FPS only.
+	void setTargetFps(const float fps) {
+		targetFps_.store(fps);
+	}
+
+	float getTargetFps() const { return targetFps_.load(); }
+	const SAMPLING_PARAMS &getParams() const { return params_; }
+	uint64_t getNbSeen() const { return nSeen_.load(std::memory_order_relaxed); }
+	uint64_t getNbKept() const { return nKept_.load(std::memory_order_relaxed); }
+
+private:
+	// assumed frame interval of sources without pts, e.g. raw files
+	static const int64_t NOMINAL_FRAME_US = 40000;
+
+	bool acceptPicture(const PACKET_CLASS &c, const int64_t ptsUs) {
+		// the gate sees every picture to keep its floor current
+		bool bStatic = nullptr != pGate_ && pGate_->isStatic(c);
+		bLastStatic_ = false;
+		if (bWaitKeyframe_.load(std::memory_order_relaxed)) {
+			if (!c.bKeyframe) {
+				return false;
+			}
+			bWaitKeyframe_.store(false);
+			bChainBroken_ = true;
+		}
+		if (c.bKeyframe) {
+			// leading pictures of a CRA refer to pictures we did not decode
+			bDropLeading_ = bChainBroken_;
+			bChainBroken_ = false;
+		} else if (c.bSkippedLeading && bDropLeading_) {
+			return false;
+		}
+
+		bool bKeep = true;
+		switch (params_.mode) {
+		case SAMPLE_ALL:
+			break;
+		case SAMPLE_IDR_ONLY:
+			bKeep = c.bKeyframe;
+			break;
+		case SAMPLE_REF_ONLY:
+			bKeep = c.bKeyframe || c.bReference;
+			break;
+		case SAMPLE_EVERY_NTH:
+		case SAMPLE_TARGET_FPS:
+			bKeep = spendCredit(c, ptsUs);
+			break;
+		}
+		if (bKeep && bStatic) {
+			bKeep = c.bReference;
+			bLastStatic_ = c.bReference;
+		}
+		if (!bKeep && c.bReference) {
+			bChainBroken_ = true;
+		}
+		return bKeep;
+	}
+
+	bool spendCredit(const PACKET_CLASS &c, const int64_t ptsUs) {
+		double earned = 0.;
+		if (SAMPLE_EVERY_NTH == params_.mode) {
+			earned = 1.0 / params_.nth;
+		} else {
+			int64_t dt = NOMINAL_FRAME_US;
+			if (ptsUs >= 0 && lastPtsUs_ >= 0 && ptsUs > lastPtsUs_ && ptsUs - lastPtsUs_ < 1000000) {
+				dt = ptsUs - lastPtsUs_;
+			}
+			lastPtsUs_ = ptsUs;
+			earned = targetFps_.load(std::memory_order_relaxed) * dt / 1e6;
+		}
+		gopEarned_ += earned;
+		credit_ = std::min(credit_ + earned, std::max(2.0, lastGopEarned_));
+
+		if (c.bKeyframe) {
+			lastGopEarned_ = gopEarned_;
+			gopEarned_ = 0.;
+			bInGop_ = credit_ >= 1.0;
+			if (bInGop_) {
+				credit_ -= 1.0;
+			}
+			return bInGop_;
+		}
+		if (!bInGop_) {
+			return false;
+		}
+		if (c.bReference) {
+			if (credit_ < 1.0) {
+				// the rest of the GOP depends on this picture
+				bInGop_ = false;
+				return false;
+			}
+			credit_ -= 1.0;
+			return true;
+		}
+		// keep one credit back for the next reference picture
+		if (credit_ < 2.0) {
+			return false;
+		}
+		credit_ -= 1.0;
+		return true;
+	}
+
+	SAMPLING_PARAMS params_;
+	VIDEO_CODEC codec_{ VIDEO_CODEC_H264 };
+	std::atomic<float > targetFps_{ 0.f };
+	std::atomic<bool > bWaitKeyframe_{ false };
+	std::atomic<uint64_t > nSeen_{ 0 };
+	std::atomic<uint64_t > nKept_{ 0 };
+
+	bool bLastAccepted_{ true };
+	bool bChainBroken_{ false };
+	bool bDropLeading_{ false };
+	bool bInGop_{ false };
+	bool bLastStatic_{ false };
+	MotionGate *pGate_{ nullptr };
+	double credit_{ 1. };
+	double gopEarned_{ 0. };
+	double lastGopEarned_{ 0. };
+	int64_t lastPtsUs_{ -1 };
+};
+
+#endif // PACKET_SAMPLER_H
@@ -33,6 +33,10 @@
 #include "opencv2/highgui/highgui.hpp"
 #include <opencv2/objdetect/objdetect.hpp>
 #include "deepStream.h"
+#include "channelScheduler.h"
+#include "metrics.h"
+#include "roiMask.h"
+#include "frameTracer.h"
 
 typedef struct {
 	int c;
@@ -54,11 +58,18 @@ public:
 	ParserModule(PRE_MODULE_LIST &preModules,
 					const int nChannels,
 					const int devID,
-					simplelogger::Logger *logger) 
-	: preModules_(preModules), nChannels_(nChannels), devID_(devID), logger_(logger) {}
+					simplelogger::Logger *logger,
+					ChannelScheduler *pScheduler = nullptr,
+					const int workerID = 0) 
+	: preModules_(preModules), nChannels_(nChannels), devID_(devID), logger_(logger), pScheduler_(pScheduler), workerID_(workerID) {}
 
 	~ParserModule() {}
 
+	// Cells outside the channel's region of interest are skipped before box decode.
+	void setRoiMasks(RoiMaskSet *pRoiMasks) {
+		pRoiMasks_ = pRoiMasks;
+	}
+
 	// override
 	void initialize() override;
 
@@ -104,7 +115,7 @@ public:
 	}
 
 private:
-	void parseNvhelnet(Dims3 outputDims, const float *outputCov, Dims3 outputDimsBBOX, const float *outputBBOX, std::vector<cv::Rect> *rectList, const int class_num);
+	void parseNvhelnet(Dims3 outputDims, const float *outputCov, Dims3 outputDimsBBOX, const float *outputBBOX, std::vector<cv::Rect> *rectList, const int class_num, const uint8_t *pMask = nullptr);
 	
 	int net_height =  368;
 	int net_width = 640;
@@ -117,6 +128,12 @@ private:
 	void *pUserData_{ nullptr };
 	MODULE_CALLBACK callback_{ nullptr };
 	IModuleProfiler* pProfiler_{ nullptr };	
+	
+	// maps lanes back to channels for the metrics, null for a single device
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
+
+	RoiMaskSet *pRoiMasks_{ nullptr };
 
 	std::vector<int > vFrameCount_;
 	PRE_MODULE_LIST preModules_;
@@ -132,6 +149,7 @@ void ParserModule::initialize() {
 }
 
 void ParserModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
+	TRACE_RANGE("ParserModule::execute");
 	assert(2 == vpInputTensors.size());
 	Dims3 outputDims;
 	Dims3 outputDimsBBOX;
@@ -160,13 +178,36 @@ void ParserModule::execute(const ModuleContext& context, const std::vector<IStre
 	const float *pBBOX = reinterpret_cast<const float*>(vpInputTensors[1]->getConstCpuData());
 	
 	
+	bool bUseMasks = nullptr != pRoiMasks_ && pRoiMasks_->getGridWidth() == outputDims.w
+						&& pRoiMasks_->getGridHeight() == outputDims.h;
+	if (bUseMasks) {
+		pRoiMasks_->maybeReload();
+	}
+	
 	std::vector<BBOXS_PER_FRAME > bboxs_batch;
 	for (int iB = 0; iB < nFrames; ++iB) {
+		// the motion gate passed the picture as a reference only, the sinks
+		// do not see it; DeepStream has converted and inferred it anyway.
+		// Only frames of the CPU backend are ever reported static, see
+		// FrameTracer.
+		if (nullptr != g_pTracer && g_pTracer->isStatic(workerID_, trace_0[iB].videoIndex, trace_0[iB].frameIndex)) {
+			continue;
+		}
+		uint64_t tParse = metricsNowUs();
+		int channel = trace_0[iB].videoIndex;
+		if (nullptr != pScheduler_) {
+			channel = pScheduler_->getChannel(workerID_, channel);
+		}
+		std::shared_ptr<const RoiMaskSet::MASK> pMask;
+		if (bUseMasks) {
+			pMask = pRoiMasks_->getMask(channel);
+		}
     	std::vector<cv::Rect> *rectListCLass;
     	rectListCLass = new std::vector<cv::Rect>[class_num];
 		const float *outputCov  = pCov  + iB * shape_0[1] * shape_0[2] * shape_0[3];
 		const float *outputBBOX = pBBOX + iB * shape_1[1] * shape_1[2] * shape_1[3];
-		parseNvhelnet(outputDims, outputCov, outputDimsBBOX, outputBBOX, rectListCLass, class_num);
+		parseNvhelnet(outputDims, outputCov, outputDimsBBOX, outputBBOX, rectListCLass, class_num,
+						pMask ? pMask->data() : nullptr);
 		
 		BBOXS_PER_FRAME bboxs;
 		bboxs.frameIndex = trace_0[iB].frameIndex;
@@ -192,6 +233,8 @@ void ParserModule::execute(const ModuleContext& context, const std::vector<IStre
 		}
 		bboxs_batch.push_back(bboxs);
 		delete [] rectListCLass;
+		
+		recordMetric(STAGE_PARSE, channel, metricsNowUs() - tParse);
 	}
 
 	assert(1 == vpOutputTensors.size());
@@ -207,14 +250,14 @@ void ParserModule::execute(const ModuleContext& context, const std::vector<IStre
 	}
 
 	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(pOutputTensor->getCpuData());	
-	for (int iF = 0; iF < nFrames; ++iF) {
+	for (size_t iF = 0; iF < bboxs_batch.size(); ++iF) {
 		pBBox_batch[iF] = bboxs_batch[iF];
 	}
 	// batch size changes at runtime, so we need to set the shape
-	pOutputTensor->setShape(nFrames, 1, 1, 1);
+	pOutputTensor->setShape(bboxs_batch.size(), 1, 1, 1);
 }
 
-void ParserModule::parseNvhelnet(Dims3 outputDims, const float *outputCov, Dims3 outputDimsBBOX, const float *outputBBOX, std::vector<cv::Rect> *rectList, const int class_num) {
+void ParserModule::parseNvhelnet(Dims3 outputDims, const float *outputCov, Dims3 outputDimsBBOX, const float *outputBBOX, std::vector<cv::Rect> *rectList, const int class_num, const uint8_t *pMask) {
   int grid_x_ = outputDims.w;
   int grid_y_ = outputDims.h;
   int gridsize_ = grid_x_ * grid_y_;
@@ -258,6 +301,9 @@ void ParserModule::parseNvhelnet(Dims3 outputDims, const float *outputCov, Dims3
             for (int w = 0; w < grid_x_; w++)
             {
                 int i = w + h * grid_x_;
+                // outside the region of interest
+                if (nullptr != pMask && 0 == pMask[i])
+                    continue;
                 if (outputCov[c*gridsize_+i] >= class_attrs[c].threshold)
                 {
                     float rectx1_f, recty1_f, rectx2_f, recty2_f;
@@ -44,8 +44,9 @@ public:
 					int tileHeight,
 					int tilesInRow,
 					bool bFullScreen,
-					simplelogger::Logger *logger) 
-	: preModules_(preModules), nChannels_(nChannels), devID_display_(devID_display), devID_infer_(devID_infer), labelFile_(labelFile), tileWidth_(tileWidth), tileHeight_(tileHeight), tilesInRow_(tilesInRow), bFullScreen_(bFullScreen), logger_(logger) {}
+					simplelogger::Logger *logger,
+					const int workerID = 0) 
+	: preModules_(preModules), nChannels_(nChannels), devID_display_(devID_display), devID_infer_(devID_infer), labelFile_(labelFile), tileWidth_(tileWidth), tileHeight_(tileHeight), tilesInRow_(tilesInRow), bFullScreen_(bFullScreen), logger_(logger), workerID_(workerID) {}
 
 	~PlaybackModule() {}
 
@@ -118,6 +119,7 @@ private:
 	size_t pitchInbytes_{ 0 };
 
 	simplelogger::Logger *logger_{ nullptr };
+	int workerID_{ 0 };
 	PresenterGL	*pPresenterGL_{ nullptr };
 	
 	PRE_MODULE_LIST preModules_;
@@ -151,6 +153,7 @@ void PlaybackModule::initialize() {
 }
 
 void PlaybackModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
+	TRACE_RANGE("PlaybackModule::execute");
 	assert(2 == vpInputTensors.size());
 	cudaStream_t stream = context.stream;
 	//=================================================================
@@ -240,6 +243,9 @@ void PlaybackModule::execute(const ModuleContext& context, const std::vector<ISt
 		}
 		// sync
 		ck(cudaStreamSynchronize(stream));
+		if (nullptr != g_pTracer) {
+			g_pTracer->onFrameDone(workerID_, videoIndex, frameIndex, videoIndex);
+		}
 	}
 	
 	int nBgraPitch = 0;
@@ -29,6 +29,8 @@
 
 #include "presenterGL.h"
 #include <nvToolsExt.h>
+#include "common/trace.h"
+#include "threadPlacement.h"
 
 template <class T>
 std::string convert(T src) {
@@ -40,6 +42,7 @@ std::string convert(T src) {
 PresenterGL *PresenterGL::pInstance;
 
 void PresenterGL::ThreadProc(PresenterGL *This) {
+    placeThread(ROLE_PRESENTER, "presenter");
     This->Run();
 }
 
@@ -226,6 +229,7 @@ void PresenterGL::Run() {
 }
 
 void PresenterGL::Display(void) {
+	TRACE_RANGE("PresenterGL::Display");
 	pInstance->mutex.lock();
 	glClearColor(0.0, 0.0, 0.0, 1.0);
 	glClear(GL_COLOR_BUFFER_BIT);
@@ -0,0 +1,148 @@
+#ifndef RECORD_INDEX_H
+#define RECORD_INDEX_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// On-disk layout of the continuous recording, one directory per channel:
+//
+//   <dir>/ch<N>/<startMs>.h264|.h265   Annex-B, starts at a keyframe with
+//                                      its parameter sets
+//   <dir>/ch<N>/<startMs>.idx          RECORD_INDEX_HEADER, then one
+//                                      RECORD_INDEX_ENTRY per keyframe
+//
+// startMs is the capture time of the first picture in ms since epoch.
+// Every indexed offset starts a decodable stream, parameter sets
+// included. The header has no dependency on the pipeline: players and
+// tools include it alone.
+
+static const uint32_t RECORD_INDEX_MAGIC = 0x58444953;	// "SIDX"
+static const uint16_t RECORD_INDEX_VERSION = 1;
+
+#pragma pack(push, 1)
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t codec;				// 0 H.264, 1 HEVC
+	uint32_t entrySize;
+	uint32_t reserved;
+} RECORD_INDEX_HEADER;
+
+typedef struct {
+	int64_t timeUs;				// capture time since epoch
+	uint64_t offset;			// in the segment file
+} RECORD_INDEX_ENTRY;
+#pragma pack(pop)
+
+typedef struct {
+	int64_t startUs = 0;
+	int64_t endUs = 0;			// last write
+	uint64_t nBytes = 0;		// segment and index
+	std::string path;
+	std::string indexPath;
+} RECORD_SEGMENT;
+
+typedef struct {
+	std::string path;
+	uint64_t offset = 0;
+	int64_t timeUs = 0;			// of the keyframe at offset
+} RECORD_POSITION;
+
+inline std::string recordChannelDir(const std::string &dir, const int channel) {
+	return dir + "/ch" + std::to_string(channel);
+}
+
+// Closed and open segments of a channel directory, oldest first.
+inline void listRecordSegments(const std::string &channelDir, std::vector<RECORD_SEGMENT > &vSegments) {
+	vSegments.clear();
+	DIR *pDir = opendir(channelDir.c_str());
+	if (nullptr == pDir) {
+		return;
+	}
+	struct dirent *pEntry = nullptr;
+	while (nullptr != (pEntry = readdir(pDir))) {
+		const char *szName = pEntry->d_name;
+		const char *szExt = strrchr(szName, '.');
+		if (nullptr == szExt || (0 != strcmp(szExt, ".h264") && 0 != strcmp(szExt, ".h265"))) {
+			continue;
+		}
+		char *szEnd = nullptr;
+		long long startMs = strtoll(szName, &szEnd, 10);
+		if (szEnd != szExt) {
+			continue;
+		}
+		RECORD_SEGMENT segment;
+		segment.startUs = startMs * 1000;
+		segment.path = channelDir + "/" + szName;
+		segment.indexPath = channelDir + "/" + std::string(szName, szExt - szName) + ".idx";
+		struct stat st;
+		if (0 == stat(segment.path.c_str(), &st)) {
+			segment.nBytes = st.st_size;
+			segment.endUs = (int64_t)st.st_mtime * 1000000;
+		}
+		if (0 == stat(segment.indexPath.c_str(), &st)) {
+			segment.nBytes += st.st_size;
+		}
+		vSegments.push_back(segment);
+	}
+	closedir(pDir);
+	std::sort(vSegments.begin(), vSegments.end(),
+			[](const RECORD_SEGMENT &a, const RECORD_SEGMENT &b) { return a.startUs < b.startUs; });
+}
+
+inline bool readRecordIndex(const std::string &indexPath, std::vector<RECORD_INDEX_ENTRY > &vEntries) {
+	vEntries.clear();
+	FILE *fp = fopen(indexPath.c_str(), "rb");
+	if (nullptr == fp) {
+		return false;
+	}
+	RECORD_INDEX_HEADER header;
+	bool bOk = 1 == fread(&header, sizeof(header), 1, fp) && RECORD_INDEX_MAGIC == header.magic
+				&& sizeof(RECORD_INDEX_ENTRY) == header.entrySize;
+	RECORD_INDEX_ENTRY entry;
+	// an index cut short by a crash ends at its last whole entry
+	while (bOk && 1 == fread(&entry, sizeof(entry), 1, fp)) {
+		vEntries.push_back(entry);
+	}
+	fclose(fp);
+	return bOk;
+}
+
+// The last keyframe at or before timeUs, else the first one after it.
+// False when the channel has no recording.
+inline bool seekRecording(const std::string &dir, const int channel, const int64_t timeUs, RECORD_POSITION &pos) {
+	std::vector<RECORD_SEGMENT > vSegments;
+	listRecordSegments(recordChannelDir(dir, channel), vSegments);
+	std::vector<RECORD_INDEX_ENTRY > vEntries;
+	// segments whose name is past timeUs are only looked at when nothing earlier is indexed
+	int iFirst = 0;
+	for (int i = 0; i < (int)vSegments.size(); ++i) {
+		if (vSegments[i].startUs <= timeUs) {
+			iFirst = i;
+		}
+	}
+	for (int i = iFirst; i < (int)vSegments.size(); ++i) {
+		if (!readRecordIndex(vSegments[i].indexPath, vEntries) || vEntries.empty()) {
+			continue;
+		}
+		auto it = std::upper_bound(vEntries.begin(), vEntries.end(), timeUs,
+					[](const int64_t t, const RECORD_INDEX_ENTRY &e) { return t < e.timeUs; });
+		if (it != vEntries.begin()) {
+			--it;
+		}
+		pos.path = vSegments[i].path;
+		pos.offset = it->offset;
+		pos.timeUs = it->timeUs;
+		return true;
+	}
+	return false;
+}
+
+#endif // RECORD_INDEX_H
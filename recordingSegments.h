@@ -0,0 +1,66 @@
+#ifndef RECORDING_SEGMENTS_H
+#define RECORDING_SEGMENTS_H
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "sharedRecording.h"
+
+typedef struct {
+	int firstFrame = 0;		// a keyframe
+	int nFrames = 0;
+} RECORDING_SEGMENT;
+
+// A SharedRecording cut at keyframes into segments of at least
+// segmentFrames pictures, or one GOP when the GOPs are longer. The lanes
+// of the offline mode take them first come first served, so a lane which
+// decodes faster takes more of them. Pictures ahead of the first
+// keyframe cannot be decoded and are left out.
+class RecordingSegmentQueue {
+public:
+	RecordingSegmentQueue(const SharedRecording *pRecording, const int segmentFrames) {
+		const std::vector<int > &vKeyframes = pRecording->getKeyframes();
+		const int nFrames = pRecording->getNbFrames();
+		for (size_t i = 0; i < vKeyframes.size(); ) {
+			RECORDING_SEGMENT segment;
+			segment.firstFrame = vKeyframes[i];
+			size_t j = i + 1;
+			while (j < vKeyframes.size() && vKeyframes[j] - segment.firstFrame < segmentFrames) {
+				++j;
+			}
+			segment.nFrames = (j < vKeyframes.size() ? vKeyframes[j] : nFrames) - segment.firstFrame;
+			vSegments_.push_back(segment);
+			i = j;
+		}
+	}
+
+	// false once all segments were taken
+	bool next(RECORDING_SEGMENT &segment) {
+		size_t i = nTaken_.fetch_add(1);
+		if (i >= vSegments_.size()) {
+			return false;
+		}
+		segment = vSegments_[i];
+		return true;
+	}
+
+	const std::vector<RECORDING_SEGMENT > &getSegments() const { return vSegments_; }
+
+	// segment of a picture, -1 ahead of the first keyframe
+	int segmentOf(const int64_t picture) const {
+		std::vector<RECORDING_SEGMENT >::const_iterator it = std::upper_bound(vSegments_.begin(), vSegments_.end(),
+			picture, [](const int64_t p, const RECORDING_SEGMENT &s) { return p < s.firstFrame; });
+		return it == vSegments_.begin() ? -1 : (int)(it - vSegments_.begin()) - 1;
+	}
+
+	int64_t getFirstFrame() const { return vSegments_.empty() ? 0 : vSegments_.front().firstFrame; }
+	int64_t getEndFrame() const {
+		return vSegments_.empty() ? 0 : (int64_t)vSegments_.back().firstFrame + vSegments_.back().nFrames;
+	}
+
+private:
+	std::vector<RECORDING_SEGMENT > vSegments_;
+	std::atomic<size_t > nTaken_{ 0 };
+};
+
+#endif // RECORDING_SEGMENTS_H
@@ -0,0 +1,131 @@
+#ifndef RESULT_STREAM_MODULE_H
+#define RESULT_STREAM_MODULE_H
+
+#include "common.h"
+#include "resultStreamer.h"
+
+// Serializes the detections of a batch into one buffer and hands it to
+// the result streamer, which sends it to every subscriber.
+class ResultStreamModule : public IModule {
+public:
+	explicit
+	ResultStreamModule(PRE_MODULE_LIST &preModules,
+						ResultStreamer *pStreamer,
+						simplelogger::Logger *logger,
+						ChannelScheduler *pScheduler = nullptr,
+						const int workerID = 0)
+	: preModules_(preModules), pStreamer_(pStreamer), logger_(logger), pScheduler_(pScheduler), workerID_(workerID) {}
+
+	~ResultStreamModule() {}
+
+	// override
+	void initialize() override {}
+
+	void execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) override;
+
+	void destroy() override {}
+
+	int getNbInputs() const override {
+		return preModules_.size();
+	}
+
+	PRE_MODULE getPreModule(const int tensorIndex) const override {
+		return preModules_[tensorIndex];
+	}
+
+	int getNbOutputs() const override {
+		return vpOutputTensors_.size();
+	}
+
+	IStreamTensor* getOutputTensor(const int tensorIndex) const override {
+		return vpOutputTensors_[tensorIndex];
+	}
+
+	void setProfiler(IModuleProfiler *pProfiler) override {
+		pProfiler_ = pProfiler;
+	}
+
+	IModuleProfiler* getProfiler() const override {
+		return pProfiler_;
+	}
+
+	void setCallback(void *pUserData, MODULE_CALLBACK callback) override {
+		pUserData_ = pUserData;
+		callback_ = callback;
+	}
+
+	std::pair<void *, MODULE_CALLBACK> getCallback() const override {
+		return std::pair<void*, MODULE_CALLBACK>(pUserData_, callback_);
+	}
+
+private:
+	ResultStreamer *pStreamer_{ nullptr };
+	simplelogger::Logger *logger_{ nullptr };
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
+	std::vector<STREAM_BOX > vBoxes_;
+	size_t lastBatchBytes_{ 0 };
+
+	void *pUserData_{ nullptr };
+	MODULE_CALLBACK callback_{ nullptr };
+	IModuleProfiler* pProfiler_{ nullptr };
+
+	PRE_MODULE_LIST preModules_;
+	std::vector<IStreamTensor*> vpOutputTensors_;
+};
+
+void ResultStreamModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
+	TRACE_RANGE("ResultStreamModule::execute");
+	assert(1 == vpInputTensors.size());
+	assert(OBJ_COORD == vpInputTensors[0]->getTensorType());
+	int nFrames = vpInputTensors[0]->getShape()[0];
+	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(vpInputTensors[0]->getCpuData());
+	if (0 == nFrames || nullptr == pBBox_batch) {
+		return;
+	}
+	uint64_t tSink = metricsNowUs();
+	// the buffer moves to the streamer, the next one starts at the last size
+	std::vector<uint8_t > batch;
+	batch.reserve(lastBatchBytes_);
+	int nResults = 0;
+	for (int iF = 0; iF < nFrames; ++iF) {
+		BBOXS_PER_FRAME &bboxs = pBBox_batch[iF];
+		int lane = bboxs.videoIndex;
+		int channel = lane;
+		if (nullptr != pScheduler_) {
+			channel = pScheduler_->getChannel(workerID_, lane);
+			if (channel < 0) {
+				continue;
+			}
+		}
+		int64_t timestampUs = 0;
+		PACKET_STAMP stamp;
+		if (nullptr != g_pTracer && g_pTracer->lookup(workerID_, lane, bboxs.frameIndex, stamp)) {
+			timestampUs = stamp.wallclockUs;
+		}
+		if (0 == timestampUs) {
+			timestampUs = wallclockNowUs();
+		}
+		vBoxes_.clear();
+		for (int i = 0; i < bboxs.nBBox; ++i) {
+			const BBOX_INFO &bbox = bboxs.bbox[i];
+			if (bbox.bSkip) {
+				continue;
+			}
+			STREAM_BOX box;
+			box.category = (uint16_t)bbox.category;
+			box.x = streamCoord(bbox.x);
+			box.y = streamCoord(bbox.y);
+			box.w = streamCoord(bbox.w);
+			box.h = streamCoord(bbox.h);
+			vBoxes_.push_back(box);
+		}
+		ResultStreamer::appendResult(batch, channel, bboxs.frameIndex, timestampUs, vBoxes_.data(), (int)vBoxes_.size());
+		nResults++;
+	}
+	lastBatchBytes_ = batch.size();
+	pStreamer_->publish(std::move(batch), nResults);
+	recordMetric(STAGE_SINK, -1, metricsNowUs() - tSink);
+}
+
+#endif // RESULT_STREAM_MODULE_H
@@ -0,0 +1,286 @@
+#include "resultStreamer.h"
+#include "threadPlacement.h"
+#include <cstdlib>
+#include <cerrno>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+static bool setNonBlocking(const int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && 0 == fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+bool ResultStreamer::start(const char *szEndpoint) {
+	struct sockaddr_storage addr;
+	socklen_t addrLen = 0;
+	if (!parseStreamEndpoint(szEndpoint, addr, addrLen)) {
+		LOG_ERROR(logger_, "ResultStreamer: bad endpoint " << szEndpoint);
+		return false;
+	}
+	listenFd_ = socket(addr.ss_family, SOCK_STREAM, 0);
+	if (listenFd_ < 0) {
+		LOG_ERROR(logger_, "ResultStreamer: socket() failed");
+		return false;
+	}
+	if (AF_UNIX == addr.ss_family) {
+		unixPath_ = ((struct sockaddr_un *)&addr)->sun_path;
+		unlink(unixPath_.c_str());
+	} else {
+		int on = 1;
+		setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	}
+	if (bind(listenFd_, (struct sockaddr *)&addr, addrLen) < 0 || listen(listenFd_, 16) < 0
+		|| !setNonBlocking(listenFd_) || 0 != pipe(wakeFd_)) {
+		LOG_ERROR(logger_, "ResultStreamer: failed to listen on " << szEndpoint);
+		close(listenFd_);
+		listenFd_ = -1;
+		return false;
+	}
+	setNonBlocking(wakeFd_[0]);
+	setNonBlocking(wakeFd_[1]);
+	LOG_INFO(logger_, "ResultStreamer: serving " << szEndpoint << ", "
+						<< (STREAM_DROP == params_.policy ? "drop" : "block") << " policy");
+	bRunning_ = true;
+	thIo_ = std::thread(&ResultStreamer::ioLoop, this);
+	return true;
+}
+
+void ResultStreamer::stop() {
+	if (bRunning_.exchange(false)) {
+		wake();
+	}
+	if (thIo_.joinable()) {
+		thIo_.join();
+	}
+	for (size_t i = 0; i < vSubscribers_.size(); ++i) {
+		close(vSubscribers_[i].fd);
+	}
+	vSubscribers_.clear();
+	if (listenFd_ >= 0) {
+		close(listenFd_);
+		listenFd_ = -1;
+		if (!unixPath_.empty()) {
+			unlink(unixPath_.c_str());
+		}
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (wakeFd_[i] >= 0) {
+			close(wakeFd_[i]);
+			wakeFd_[i] = -1;
+		}
+	}
+}
+
+void ResultStreamer::appendResult(std::vector<uint8_t > &batch, const int channel, const int64_t frameIndex,
+								const int64_t timestampUs, const STREAM_BOX *pBoxes, const int nBoxes) {
+	STREAM_MSG_HEADER header;
+	header.length = sizeof(STREAM_RESULT) + nBoxes * sizeof(STREAM_BOX);
+	header.type = STREAM_MSG_RESULT;
+	header.version = STREAM_VERSION;
+	header.channel = (uint16_t)channel;
+	STREAM_RESULT result;
+	result.frameIndex = frameIndex;
+	result.timestampUs = timestampUs;
+	result.nBoxes = (uint16_t)nBoxes;
+	size_t pos = batch.size();
+	batch.resize(pos + sizeof(header) + header.length);
+	memcpy(&batch[pos], &header, sizeof(header));
+	memcpy(&batch[pos + sizeof(header)], &result, sizeof(result));
+	if (nBoxes > 0) {
+		memcpy(&batch[pos + sizeof(header) + sizeof(result)], pBoxes, nBoxes * sizeof(STREAM_BOX));
+	}
+}
+
+ResultStreamer::BUFFER ResultStreamer::makeMessage(const STREAM_MSG_TYPE type, const void *pPayload, const uint32_t nPayload) {
+	std::vector<uint8_t > *pMessage = new std::vector<uint8_t >(sizeof(STREAM_MSG_HEADER) + nPayload);
+	STREAM_MSG_HEADER header;
+	header.length = nPayload;
+	header.type = type;
+	header.version = STREAM_VERSION;
+	header.channel = 0;
+	memcpy(pMessage->data(), &header, sizeof(header));
+	if (nPayload > 0) {
+		memcpy(pMessage->data() + sizeof(header), pPayload, nPayload);
+	}
+	return BUFFER(pMessage);
+}
+
+void ResultStreamer::publish(std::vector<uint8_t > &&batch, const int nFrames) {
+	if (batch.empty()) {
+		return;
+	}
+	BUFFER pBatch = std::make_shared<const std::vector<uint8_t > >(std::move(batch));
+	bool bWake = false;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		for (size_t i = 0; i < vSubscribers_.size(); ++i) {
+			SUBSCRIBER &sub = vSubscribers_[i];
+			if (sub.bClosed) {
+				continue;
+			}
+			size_t limit = STREAM_DROP == params_.policy ? params_.maxQueuedBytes : 16 * params_.maxQueuedBytes;
+			if (sub.nQueued + pBatch->size() > limit) {
+				if (STREAM_BLOCK == params_.policy) {
+					LOG_WARN(logger_, "ResultStreamer: subscriber " << sub.fd << " fell "
+										<< (sub.nQueued >> 10) << " KB behind, disconnecting");
+					sub.bClosed = true;
+					bWake = true;
+				} else {
+					sub.nDropped += nFrames;
+					nDropped_.fetch_add(nFrames, std::memory_order_relaxed);
+				}
+				continue;
+			}
+			bWake = bWake || sub.queue.empty();
+			if (sub.nDropped > 0) {
+				BUFFER pNotice = makeMessage(STREAM_MSG_DROPPED, &sub.nDropped, sizeof(sub.nDropped));
+				sub.queue.push_back(pNotice);
+				sub.nQueued += pNotice->size();
+				sub.nDropped = 0;
+			}
+			sub.queue.push_back(pBatch);
+			sub.nQueued += pBatch->size();
+		}
+	}
+	// queues which were not empty are polled for POLLOUT already
+	if (bWake) {
+		wake();
+	}
+}
+
+int ResultStreamer::getNbSubscribers() const {
+	std::lock_guard<std::mutex> lock(mtx_);
+	return (int)vSubscribers_.size();
+}
+
+void ResultStreamer::wake() {
+	char c = 0;
+	if (write(wakeFd_[1], &c, 1) < 0) {
+		// the pipe is full, the I/O thread is awake anyway
+	}
+}
+
+void ResultStreamer::accept() {
+	while (true) {
+		int fd = ::accept(listenFd_, NULL, NULL);
+		if (fd < 0) {
+			return;
+		}
+		setNonBlocking(fd);
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		SUBSCRIBER sub;
+		sub.fd = fd;
+		BUFFER pHello = makeMessage(STREAM_MSG_HELLO, nullptr, 0);
+		sub.queue.push_back(pHello);
+		sub.nQueued = pHello->size();
+		std::lock_guard<std::mutex> lock(mtx_);
+		vSubscribers_.push_back(sub);
+		LOG_INFO(logger_, "ResultStreamer: subscriber " << fd << " connected, "
+							<< vSubscribers_.size() << " in total");
+	}
+}
+
+// Sends as much of the queue as the socket takes, false when it broke.
+bool ResultStreamer::flush(SUBSCRIBER &sub) {
+	static const int MAX_IOV = 64;
+	while (!sub.queue.empty()) {
+		struct iovec iov[MAX_IOV];
+		int nIov = 0;
+		for (size_t i = 0; i < sub.queue.size() && nIov < MAX_IOV; ++i) {
+			const std::vector<uint8_t > &buf = *sub.queue[i];
+			size_t skip = 0 == i ? sub.offset : 0;
+			iov[nIov].iov_base = (void *)(buf.data() + skip);
+			iov[nIov].iov_len = buf.size() - skip;
+			nIov++;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = nIov;
+		ssize_t nSent = sendmsg(sub.fd, &msg, MSG_NOSIGNAL);
+		if (nSent < 0) {
+			return EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno;
+		}
+		size_t left = nSent;
+		sub.nQueued -= left;
+		while (left > 0) {
+			size_t rest = sub.queue.front()->size() - sub.offset;
+			if (left < rest) {
+				sub.offset += left;
+				break;
+			}
+			left -= rest;
+			sub.queue.pop_front();
+			sub.offset = 0;
+		}
+	}
+	return true;
+}
+
+void ResultStreamer::ioLoop() {
+	placeThread(ROLE_IO, "resultIo");
+	std::vector<struct pollfd > vPfds;
+	while (bRunning_) {
+		vPfds.clear();
+		vPfds.push_back({ wakeFd_[0], POLLIN, 0 });
+		vPfds.push_back({ listenFd_, POLLIN, 0 });
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			for (size_t i = 0; i < vSubscribers_.size(); ++i) {
+				short events = POLLIN;
+				if (!vSubscribers_[i].queue.empty()) {
+					events |= POLLOUT;
+				}
+				vPfds.push_back({ vSubscribers_[i].fd, events, 0 });
+			}
+		}
+		if (poll(vPfds.data(), vPfds.size(), 200) < 0) {
+			continue;
+		}
+		if (vPfds[0].revents & POLLIN) {
+			char drain[256];
+			while (read(wakeFd_[0], drain, sizeof(drain)) > 0) {
+			}
+		}
+		if (vPfds[1].revents & POLLIN) {
+			accept();
+		}
+
+		// subscribers are only added and removed by this thread, the ones
+		// polled are still at the same index
+		std::lock_guard<std::mutex> lock(mtx_);
+		for (size_t i = 0; i + 2 < vPfds.size(); ++i) {
+			SUBSCRIBER &sub = vSubscribers_[i];
+			short revents = vPfds[i + 2].revents;
+			if (revents & POLLIN) {
+				// subscribers have nothing to say, EOF or an error ends the stream
+				char drain[256];
+				ssize_t n = recv(sub.fd, drain, sizeof(drain), 0);
+				if (0 == n || (n < 0 && EAGAIN != errno && EWOULDBLOCK != errno)) {
+					sub.bClosed = true;
+				}
+			}
+			if (revents & (POLLERR | POLLHUP)) {
+				sub.bClosed = true;
+			}
+		}
+		// queues filled since the poll are sent right away
+		for (size_t i = 0; i < vSubscribers_.size(); ++i) {
+			SUBSCRIBER &sub = vSubscribers_[i];
+			if (!sub.bClosed && !sub.queue.empty() && !flush(sub)) {
+				sub.bClosed = true;
+			}
+		}
+		for (size_t i = 0; i < vSubscribers_.size(); ) {
+			if (vSubscribers_[i].bClosed) {
+				close(vSubscribers_[i].fd);
+				LOG_INFO(logger_, "ResultStreamer: subscriber " << vSubscribers_[i].fd << " left");
+				vSubscribers_.erase(vSubscribers_.begin() + i);
+			} else {
+				++i;
+			}
+		}
+	}
+}
@@ -0,0 +1,260 @@
+#ifndef RESULT_STREAMER_H
+#define RESULT_STREAMER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include "common/logger.h"
+
+// Detections streamed to subscribers on a Unix-domain or TCP socket. The
+// stream is a sequence of length-prefixed messages, native endian:
+//
+//   STREAM_MSG_HEADER, then length bytes of payload
+//
+//   HELLO     sent once on connect, no payload
+//   RESULT    STREAM_RESULT followed by nBoxes STREAM_BOX, one per frame
+//   DROPPED   uint64_t, frames this subscriber lost since its last message
+//
+// The header has no dependency on DeepStream: clients include it alone
+// and use ResultStreamClient.
+
+static const uint8_t STREAM_VERSION = 1;
+
+enum STREAM_MSG_TYPE {
+	STREAM_MSG_HELLO = 1,
+	STREAM_MSG_RESULT = 2,
+	STREAM_MSG_DROPPED = 3
+};
+
+#pragma pack(push, 1)
+typedef struct {
+	uint32_t length;			// payload bytes after the header
+	uint8_t type;				// STREAM_MSG_TYPE
+	uint8_t version;
+	uint16_t channel;
+} STREAM_MSG_HEADER;
+
+typedef struct {
+	int64_t frameIndex;
+	int64_t timestampUs;		// capture time since epoch, else when the result was streamed
+	uint16_t nBoxes;
+} STREAM_RESULT;
+
+typedef struct {
+	uint16_t category;			// line of the label file
+	uint16_t x, y, w, h;		// normalized, 65535 is 1.0
+} STREAM_BOX;
+#pragma pack(pop)
+
+inline uint16_t streamCoord(const float v) {
+	return (uint16_t)(v <= 0.f ? 0 : v >= 1.f ? 65535 : v * 65535.f + 0.5f);
+}
+
+// "unix:/path", "tcp:<port>" (all interfaces) or "tcp:<host>:<port>".
+inline bool parseStreamEndpoint(const char *szEndpoint, struct sockaddr_storage &addr, socklen_t &addrLen) {
+	memset(&addr, 0, sizeof(addr));
+	if (0 == strncmp(szEndpoint, "unix:", 5)) {
+		struct sockaddr_un *pUn = (struct sockaddr_un *)&addr;
+		const char *szPath = szEndpoint + 5;
+		if (0 == *szPath || strlen(szPath) >= sizeof(pUn->sun_path)) {
+			return false;
+		}
+		pUn->sun_family = AF_UNIX;
+		strcpy(pUn->sun_path, szPath);
+		addrLen = sizeof(struct sockaddr_un);
+		return true;
+	}
+	if (0 != strncmp(szEndpoint, "tcp:", 4)) {
+		return false;
+	}
+	std::string host, port = szEndpoint + 4;
+	size_t colon = port.rfind(':');
+	if (std::string::npos != colon) {
+		host = port.substr(0, colon);
+		port = port.substr(colon + 1);
+	}
+	int nPort = atoi(port.c_str());
+	if (nPort <= 0 || nPort > 65535) {
+		return false;
+	}
+	struct sockaddr_in *pIn = (struct sockaddr_in *)&addr;
+	pIn->sin_family = AF_INET;
+	pIn->sin_port = htons((unsigned short)nPort);
+	pIn->sin_addr.s_addr = htonl(INADDR_ANY);
+	if (!host.empty()) {
+		struct addrinfo hints, *pInfo = nullptr;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		if (0 != getaddrinfo(host.c_str(), nullptr, &hints, &pInfo) || nullptr == pInfo) {
+			return false;
+		}
+		pIn->sin_addr = ((struct sockaddr_in *)pInfo->ai_addr)->sin_addr;
+		freeaddrinfo(pInfo);
+	}
+	addrLen = sizeof(struct sockaddr_in);
+	return true;
+}
+
+enum STREAM_POLICY {
+	STREAM_DROP,				// batches beyond maxQueuedBytes are dropped and reported
+	STREAM_BLOCK				// nothing is dropped, the subscriber is cut off at 16x maxQueuedBytes
+};
+
+typedef struct {
+	STREAM_POLICY policy = STREAM_DROP;
+	size_t maxQueuedBytes = 4 << 20;	// per subscriber
+} STREAM_PARAMS;
+
+// Serves the batches of all device workers to any number of subscribers.
+// publish() only queues a shared buffer per subscriber; one I/O thread
+// writes each subscriber's queue with a single sendmsg per wakeup, so a
+// slow subscriber never holds up execute() or the other subscribers.
+class ResultStreamer {
+public:
+	explicit
+	ResultStreamer(const STREAM_PARAMS &params, simplelogger::Logger *logger)
+	: params_(params), logger_(logger) {}
+
+	~ResultStreamer() {
+		stop();
+	}
+
+	bool start(const char *szEndpoint);
+	void stop();
+
+	// Appends the RESULT message of one frame to a batch.
+	static void appendResult(std::vector<uint8_t > &batch, const int channel, const int64_t frameIndex,
+							const int64_t timestampUs, const STREAM_BOX *pBoxes, const int nBoxes);
+
+	// Queues a batch of nFrames RESULT messages for every subscriber.
+	void publish(std::vector<uint8_t > &&batch, const int nFrames);
+
+	int getNbSubscribers() const;
+	// frames dropped over all subscribers
+	uint64_t getNbDropped() const { return nDropped_.load(std::memory_order_relaxed); }
+
+private:
+	typedef std::shared_ptr<const std::vector<uint8_t > > BUFFER;
+
+	typedef struct {
+		int fd = -1;
+		std::deque<BUFFER > queue;
+		size_t offset = 0;			// sent bytes of queue.front()
+		size_t nQueued = 0;			// bytes in the queue
+		uint64_t nDropped = 0;		// frames to report with the next batch
+		bool bClosed = false;
+	} SUBSCRIBER;
+
+	void ioLoop();
+	void accept();
+	bool flush(SUBSCRIBER &sub);
+	void wake();
+
+	static BUFFER makeMessage(const STREAM_MSG_TYPE type, const void *pPayload, const uint32_t nPayload);
+
+	STREAM_PARAMS params_;
+	simplelogger::Logger *logger_{ nullptr };
+	std::string unixPath_;
+	int listenFd_{ -1 };
+	int wakeFd_[2]{ -1, -1 };
+	std::thread thIo_;
+	std::atomic<bool > bRunning_{ false };
+	std::atomic<uint64_t > nDropped_{ 0 };
+
+	std::vector<SUBSCRIBER > vSubscribers_;
+	mutable std::mutex mtx_;
+};
+
+// Blocking client of a ResultStreamer, for consumers and tests.
+class ResultStreamClient {
+public:
+	~ResultStreamClient() {
+		close();
+	}
+
+	bool connect(const char *szEndpoint) {
+		struct sockaddr_storage addr;
+		socklen_t addrLen = 0;
+		if (!parseStreamEndpoint(szEndpoint, addr, addrLen)) {
+			return false;
+		}
+		fd_ = socket(addr.ss_family, SOCK_STREAM, 0);
+		if (fd_ < 0) {
+			return false;
+		}
+		if (0 != ::connect(fd_, (struct sockaddr *)&addr, addrLen)) {
+			close();
+			return false;
+		}
+		buffer_.resize(1 << 16);
+		begin_ = end_ = 0;
+		return true;
+	}
+
+	void close() {
+		if (fd_ >= 0) {
+			::close(fd_);
+			fd_ = -1;
+		}
+	}
+
+	// Next message, false once the server closed the stream.
+	bool read(STREAM_MSG_HEADER &header, std::vector<uint8_t > &payload) {
+		if (!fill(sizeof(STREAM_MSG_HEADER))) {
+			return false;
+		}
+		memcpy(&header, &buffer_[begin_], sizeof(header));
+		begin_ += sizeof(header);
+		if (!fill(header.length)) {
+			return false;
+		}
+		payload.assign(buffer_.begin() + begin_, buffer_.begin() + begin_ + header.length);
+		begin_ += header.length;
+		return true;
+	}
+
+private:
+	// at least n unread bytes in the buffer
+	bool fill(const size_t n) {
+		if (end_ - begin_ >= n) {
+			return true;
+		}
+		if (begin_ + n > buffer_.size()) {
+			memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+			end_ -= begin_;
+			begin_ = 0;
+			if (n > buffer_.size()) {
+				buffer_.resize(n);
+			}
+		}
+		while (end_ - begin_ < n) {
+			ssize_t nRead = recv(fd_, &buffer_[end_], buffer_.size() - end_, 0);
+			if (nRead <= 0) {
+				return false;
+			}
+			end_ += nRead;
+		}
+		return true;
+	}
+
+	int fd_{ -1 };
+	std::vector<uint8_t > buffer_;
+	size_t begin_{ 0 };
+	size_t end_{ 0 };
+};
+
+#endif // RESULT_STREAMER_H
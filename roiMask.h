@@ -0,0 +1,201 @@
+#ifndef ROI_MASK_H
+#define ROI_MASK_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include "common/logger.h"
+#include "metrics.h"
+
+// Per-channel regions of interest, compiled into one bit per cell of the
+// detector output grid. The config file has one polygon per line, with
+// coordinates normalized to the frame (0..1):
+//
+//   # channel  include|exclude  x,y x,y x,y ...
+//   0 include 0.0,0.3 1.0,0.3 1.0,1.0 0.0,1.0
+//   0 exclude 0.7,0.9 1.0,0.9 1.0,1.0 0.7,1.0
+//
+// A cell is kept when its center lies in an include polygon, or when the
+// channel has none, and in no exclude polygon. Channels without polygons
+// have no mask at all. The file is reloaded when its mtime changes.
+class RoiMaskSet {
+public:
+	typedef std::vector<uint8_t > MASK;	// gridW * gridH, 1 keeps the cell
+
+	explicit
+	RoiMaskSet(const char *szPath, const int nChannels, const int gridW, const int gridH, const int stride,
+				const int netWidth, const int netHeight, simplelogger::Logger *logger)
+	: path_(szPath), nChannels_(nChannels), gridW_(gridW), gridH_(gridH), stride_(stride),
+	  netWidth_(netWidth), netHeight_(netHeight), logger_(logger),
+	  vpMasks_(nChannels) {}
+
+	bool load() {
+		struct stat st;
+		if (0 != stat(path_.c_str(), &st)) {
+			LOG_ERROR(logger_, "RoiMaskSet: failed to stat " << path_);
+			return false;
+		}
+		std::vector<std::shared_ptr<const MASK> > vpMasks;
+		if (!compile(vpMasks)) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(mtx_);
+		vpMasks_.swap(vpMasks);
+		mtime_ = st.st_mtime;
+		return true;
+	}
+
+	// Cheap enough to call per batch, stats the file at most once a second.
+	// A file which fails to parse keeps the previous masks.
+	void maybeReload() {
+		// the parsers of all workers call in, one of them does the check
+		uint64_t now = metricsNowUs();
+		uint64_t last = lastCheckUs_.load();
+		if (now - last < 1000000 || !lastCheckUs_.compare_exchange_strong(last, now)) {
+			return;
+		}
+		struct stat st;
+		if (0 != stat(path_.c_str(), &st)) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			if (st.st_mtime == mtime_) {
+				return;
+			}
+		}
+		if (load()) {
+			LOG_INFO(logger_, "RoiMaskSet: reloaded " << path_);
+		} else {
+			std::lock_guard<std::mutex> lock(mtx_);
+			mtime_ = st.st_mtime;
+		}
+	}
+
+	// null when every cell of the channel is kept
+	std::shared_ptr<const MASK> getMask(const int channel) const {
+		if (channel < 0 || channel >= nChannels_) {
+			return std::shared_ptr<const MASK>();
+		}
+		std::lock_guard<std::mutex> lock(mtx_);
+		return vpMasks_[channel];
+	}
+
+	int getGridWidth() const { return gridW_; }
+	int getGridHeight() const { return gridH_; }
+
+private:
+	typedef struct {
+		float x;
+		float y;
+	} POINT;
+
+	typedef struct {
+		bool bInclude;
+		std::vector<POINT > vPoints;
+	} POLYGON;
+
+	static bool inside(const std::vector<POINT > &poly, const float x, const float y) {
+		bool bIn = false;
+		for (size_t i = 0, j = poly.size() - 1; i < poly.size(); j = i++) {
+			if ((poly[i].y > y) != (poly[j].y > y)
+				&& x < (poly[j].x - poly[i].x) * (y - poly[i].y) / (poly[j].y - poly[i].y) + poly[i].x) {
+				bIn = !bIn;
+			}
+		}
+		return bIn;
+	}
+
+	bool compile(std::vector<std::shared_ptr<const MASK> > &vpMasks) const {
+		std::ifstream ifs(path_.c_str());
+		if (!ifs.is_open()) {
+			LOG_ERROR(logger_, "RoiMaskSet: failed to open " << path_);
+			return false;
+		}
+		std::vector<std::vector<POLYGON > > vPolygons(nChannels_);
+		std::string line;
+		int lineNo = 0;
+		while (std::getline(ifs, line)) {
+			lineNo++;
+			if (line.empty() || '#' == line[0]) {
+				continue;
+			}
+			std::istringstream iss(line);
+			int channel = -1;
+			std::string kind, point;
+			POLYGON polygon;
+			iss >> channel >> kind;
+			while (iss >> point) {
+				POINT p;
+				if (2 != sscanf(point.c_str(), "%f,%f", &p.x, &p.y)) {
+					break;
+				}
+				polygon.vPoints.push_back(p);
+			}
+			if (channel < 0 || channel >= nChannels_ || (kind != "include" && kind != "exclude")
+				|| polygon.vPoints.size() < 3) {
+				LOG_ERROR(logger_, "RoiMaskSet: " << path_ << ":" << lineNo << " is not a valid polygon");
+				return false;
+			}
+			polygon.bInclude = kind == "include";
+			vPolygons[channel].push_back(polygon);
+		}
+
+		vpMasks.assign(nChannels_, std::shared_ptr<const MASK>());
+		for (int c = 0; c < nChannels_; ++c) {
+			if (vPolygons[c].empty()) {
+				continue;
+			}
+			bool bHasInclude = false;
+			for (size_t i = 0; i < vPolygons[c].size(); ++i) {
+				bHasInclude |= vPolygons[c][i].bInclude;
+			}
+			std::shared_ptr<MASK> pMask = std::make_shared<MASK>(gridW_ * gridH_, 0);
+			for (int h = 0; h < gridH_; ++h) {
+				for (int w = 0; w < gridW_; ++w) {
+					float x = (w * stride_ + stride_ * 0.5f) / netWidth_;
+					float y = (h * stride_ + stride_ * 0.5f) / netHeight_;
+					bool bKeep = !bHasInclude;
+					for (size_t i = 0; i < vPolygons[c].size(); ++i) {
+						const POLYGON &polygon = vPolygons[c][i];
+						if (polygon.bInclude && !bKeep && inside(polygon.vPoints, x, y)) {
+							bKeep = true;
+						}
+					}
+					for (size_t i = 0; i < vPolygons[c].size() && bKeep; ++i) {
+						const POLYGON &polygon = vPolygons[c][i];
+						if (!polygon.bInclude && inside(polygon.vPoints, x, y)) {
+							bKeep = false;
+						}
+					}
+					(*pMask)[w + h * gridW_] = bKeep ? 1 : 0;
+				}
+			}
+			vpMasks[c] = pMask;
+		}
+		return true;
+	}
+
+	std::string path_;
+	int nChannels_{ 0 };
+	int gridW_{ 0 };
+	int gridH_{ 0 };
+	int stride_{ 16 };
+	int netWidth_{ 0 };
+	int netHeight_{ 0 };
+	simplelogger::Logger *logger_{ nullptr };
+
+	std::vector<std::shared_ptr<const MASK> > vpMasks_;
+	time_t mtime_{ 0 };
+	std::atomic<uint64_t > lastCheckUs_{ 0 };
+	mutable std::mutex mtx_;
+};
+
+#endif // ROI_MASK_H
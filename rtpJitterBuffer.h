@@ -0,0 +1,287 @@
+#ifndef RTP_JITTER_BUFFER_H
+#define RTP_JITTER_BUFFER_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <atomic>
+
+enum JITTER_PROFILE {
+	JITTER_DEFAULT = 0,		// leave the source as it is
+	JITTER_LOW_LATENCY,		// no reorder buffer, late packets are dropped
+	JITTER_ROBUST			// reorder window of reorderPackets, held up to maxDelayMs
+};
+
+typedef struct {
+	JITTER_PROFILE profile = JITTER_DEFAULT;
+	int reorderPackets = 0;
+	int maxDelayMs = 0;
+} JITTER_PARAMS;
+
+// "low", "robust" or "robust:<packets>[:<ms>]", false if malformed.
+inline bool parseJitterProfile(const char *szProfile, JITTER_PARAMS &params) {
+	params = JITTER_PARAMS();
+	if (0 == strcmp(szProfile, "low")) {
+		params.profile = JITTER_LOW_LATENCY;
+		return true;
+	}
+	if (0 != strncmp(szProfile, "robust", 6) || (0 != szProfile[6] && ':' != szProfile[6])) {
+		return false;
+	}
+	params.profile = JITTER_ROBUST;
+	params.reorderPackets = 64;
+	params.maxDelayMs = 100;
+	if (':' == szProfile[6]) {
+		char *pEnd = nullptr;
+		params.reorderPackets = (int)strtol(szProfile + 7, &pEnd, 10);
+		if (':' == *pEnd) {
+			params.maxDelayMs = (int)strtol(pEnd + 1, &pEnd, 10);
+		}
+		if (0 != *pEnd) {
+			return false;
+		}
+	}
+	return params.reorderPackets > 0 && params.reorderPackets <= 4096 && params.maxDelayMs > 0;
+}
+
+typedef struct {
+	uint64_t nReceived = 0;
+	uint64_t nLost = 0;			// never arrived, or arrived after it was given up
+	uint64_t nLate = 0;			// arrived behind the output, dropped
+	uint64_t nReordered = 0;	// arrived behind a later packet, put back in order
+	uint64_t nDuplicate = 0;
+	uint64_t nResyncs = 0;		// the sequence restarted, a new SSRC or a jump
+} JITTER_STATS;
+
+// Puts RTP packets back into sequence number order. Packets go out as
+// soon as they are in order; a hole is given up once the window is full
+// or the packet behind it waited maxDelayMs, the next packet out then has
+// bGap set. Without a window packets pass straight through and anything
+// behind the last one out counts as late.
+//
+// The sequence is validated as in RFC 3550 A.1, for every profile. A
+// packet of a new SSRC, or one more than MAX_DROPOUT ahead of or more
+// than MAX_MISORDER behind the highest sequence number, is on probation.
+// It is held until the packet after it follows in sequence. The buffer
+// then releases what it held of the old sequence and restarts at the
+// held packet. A lone stray packet counts as late once the next one
+// replaces it.
+//
+// Single threaded, only the stats are read from other threads.
+class RtpJitterBuffer {
+public:
+	typedef void (*RtpSink)(void *handle, const uint8_t *pPacket, int nPacket, bool bGap);
+
+	explicit
+	RtpJitterBuffer(const JITTER_PARAMS &params = JITTER_PARAMS())
+	: nWindow_(JITTER_ROBUST == params.profile ? params.reorderPackets : 0),
+	  maxDelayUs_((uint64_t)params.maxDelayMs * 1000) {
+		// a power of two keeps the slots of a window distinct across the wrap
+		int nSlots = 1;
+		while (nSlots < nWindow_) {
+			nSlots <<= 1;
+		}
+		vSlots_.resize(nWindow_ > 0 ? nSlots : 0);
+	}
+
+	void setSink(void *handle, RtpSink sink) {
+		handle_ = handle;
+		sink_ = sink;
+	}
+
+	void push(const uint8_t *pPacket, const int nPacket, const uint64_t nowUs) {
+		if (nPacket < 12) {
+			return;
+		}
+		nReceived_.fetch_add(1, std::memory_order_relaxed);
+		const uint16_t seq = (pPacket[2] << 8) | pPacket[3];
+		const uint32_t ssrc = ((uint32_t)pPacket[8] << 24) | (pPacket[9] << 16) | (pPacket[10] << 8) | pPacket[11];
+		bool bInSequence = nextSeq_ >= 0 && ssrc == ssrc_;
+		if (bInSequence) {
+			uint16_t ahead = (uint16_t)(seq - (uint16_t)highestSeq_);
+			bInSequence = ahead < kMaxDropout || ahead > 65536 - kMaxMisorder;
+		}
+		if (!bInSequence) {
+			if (vProbation_.empty() || ssrc != probationSsrc_ || seq != (uint16_t)(probationSeq_ + 1)) {
+				// the one it replaces started nothing, it was late
+				if (!vProbation_.empty()) {
+					nLate_.fetch_add(1, std::memory_order_relaxed);
+				}
+				vProbation_.assign(pPacket, pPacket + nPacket);
+				probationSeq_ = seq;
+				probationSsrc_ = ssrc;
+				return;
+			}
+			restart();
+			std::vector<uint8_t > vFirst;
+			vFirst.swap(vProbation_);
+			accept(vFirst.data(), (int)vFirst.size(), probationSeq_, nowUs);
+		}
+		accept(pPacket, nPacket, seq, nowUs);
+	}
+
+	// Gives up holes whose successor waited longer than maxDelayMs.
+	void flush(const uint64_t nowUs) {
+		while (nHeld_ > 0) {
+			int ahead = 0;
+			while (!slotOf(nextSeq_ + ahead).bUsed) {
+				ahead++;
+			}
+			const SLOT &slot = slotOf(nextSeq_ + ahead);
+			if (nowUs - slot.arrivalUs < maxDelayUs_) {
+				return;
+			}
+			addLost(ahead);
+			nextSeq_ = (uint16_t)(nextSeq_ + ahead);
+			bGap_ = true;
+			drain();
+		}
+	}
+
+	JITTER_STATS getStats() const {
+		JITTER_STATS stats;
+		stats.nReceived = nReceived_.load(std::memory_order_relaxed);
+		stats.nLost = nLost_.load(std::memory_order_relaxed);
+		stats.nLate = nLate_.load(std::memory_order_relaxed);
+		stats.nReordered = nReordered_.load(std::memory_order_relaxed);
+		stats.nDuplicate = nDuplicate_.load(std::memory_order_relaxed);
+		stats.nResyncs = nResyncs_.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+private:
+	typedef struct {
+		std::vector<uint8_t > vData;
+		uint64_t arrivalUs = 0;
+		bool bUsed = false;
+	} SLOT;
+
+	// RFC 3550 A.1
+	static const int kMaxDropout = 3000;
+	static const int kMaxMisorder = 100;
+
+	// The held packet on probation starts the sequence, the packets held
+	// of the old one go out first.
+	void restart() {
+		if (nextSeq_ >= 0) {
+			while (nHeld_ > 0) {
+				skipOne();
+			}
+			bGap_ = true;
+			nResyncs_.fetch_add(1, std::memory_order_relaxed);
+		}
+		ssrc_ = probationSsrc_;
+		nextSeq_ = probationSeq_;
+		highestSeq_ = probationSeq_;
+	}
+
+	// A packet of the current sequence.
+	void accept(const uint8_t *pPacket, const int nPacket, const uint16_t seq, const uint64_t nowUs) {
+		int16_t delta = (int16_t)(uint16_t)(seq - (uint16_t)nextSeq_);
+		if (delta < 0) {
+			nLate_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		if ((int16_t)(uint16_t)(seq - (uint16_t)highestSeq_) < 0) {
+			nReordered_.fetch_add(1, std::memory_order_relaxed);
+		} else {
+			highestSeq_ = seq;
+		}
+
+		if (0 == nWindow_) {
+			addLost(delta);
+			nextSeq_ = (uint16_t)(seq + 1);
+			bool bGap = bGap_ || delta > 0;
+			bGap_ = false;
+			sink_(handle_, pPacket, nPacket, bGap);
+			return;
+		}
+		// make room, the packets in front go out with their holes given up
+		while (delta >= nWindow_ && nHeld_ > 0) {
+			skipOne();
+			delta--;
+		}
+		if (delta >= nWindow_) {
+			// nothing held, jump over the rest of the hole at once
+			addLost(delta - nWindow_ + 1);
+			nextSeq_ = (uint16_t)(nextSeq_ + delta - nWindow_ + 1);
+			bGap_ = true;
+		}
+		SLOT &slot = slotOf(seq);
+		if (slot.bUsed) {
+			nDuplicate_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		slot.vData.assign(pPacket, pPacket + nPacket);
+		slot.arrivalUs = nowUs;
+		slot.bUsed = true;
+		nHeld_++;
+		drain();
+		flush(nowUs);
+	}
+
+	SLOT &slotOf(const int seq) {
+		return vSlots_[(uint16_t)seq & (vSlots_.size() - 1)];
+	}
+
+	void addLost(const int n) {
+		if (n > 0) {
+			nLost_.fetch_add(n, std::memory_order_relaxed);
+		}
+	}
+
+	// Releases nextSeq_, or gives it up when it is missing.
+	void skipOne() {
+		SLOT &slot = slotOf(nextSeq_);
+		if (slot.bUsed) {
+			release(slot);
+		} else {
+			addLost(1);
+			bGap_ = true;
+		}
+		nextSeq_ = (uint16_t)(nextSeq_ + 1);
+	}
+
+	void drain() {
+		while (true) {
+			SLOT &slot = slotOf(nextSeq_);
+			if (!slot.bUsed) {
+				return;
+			}
+			release(slot);
+			nextSeq_ = (uint16_t)(nextSeq_ + 1);
+		}
+	}
+
+	void release(SLOT &slot) {
+		slot.bUsed = false;
+		nHeld_--;
+		bool bGap = bGap_;
+		bGap_ = false;
+		sink_(handle_, slot.vData.data(), (int)slot.vData.size(), bGap);
+	}
+
+	int nWindow_{ 0 };
+	uint64_t maxDelayUs_{ 0 };
+	std::vector<SLOT > vSlots_;
+	int nHeld_{ 0 };
+	int nextSeq_{ -1 };			// next sequence number to go out
+	int highestSeq_{ -1 };
+	uint32_t ssrc_{ 0 };
+	bool bGap_{ false };
+	std::vector<uint8_t > vProbation_;	// the packet on probation
+	uint16_t probationSeq_{ 0 };
+	uint32_t probationSsrc_{ 0 };
+	void *handle_{ nullptr };
+	RtpSink sink_{ nullptr };
+
+	std::atomic<uint64_t > nReceived_{ 0 };
+	std::atomic<uint64_t > nLost_{ 0 };
+	std::atomic<uint64_t > nLate_{ 0 };
+	std::atomic<uint64_t > nReordered_{ 0 };
+	std::atomic<uint64_t > nDuplicate_{ 0 };
+	std::atomic<uint64_t > nResyncs_{ 0 };
+};
+
+#endif // RTP_JITTER_BUFFER_H
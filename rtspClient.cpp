@@ -0,0 +1,1178 @@
+#include "rtspClient.h"
+#include "streamTaker.h"
+#include "metrics.h"
+#include "common/trace.h"
+#include "threadPlacement.h"
+
+extern "C" {
+#include "libavutil/base64.h"
+#include "libavutil/md5.h"
+};
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const int kTimeoutMs = 5000;				// connect and each handshake response
+static const uint64_t kReceiveTimeoutUs = 10000000;
+static const uint64_t kTickUs = 100000;			// jitter buffer flush
+static const uint64_t kStatsUs = 1000000;
+static const uint64_t kLossLogUs = 10000000;
+static const size_t kTcpRxBuf = 16 << 10;
+static const size_t kRtspRxBuf = 4 << 10;
+static const int kDatagramBatch = 8;			// datagrams per recvmmsg
+static const int kDatagramSize = 2048;
+static const int kMaxReadsPerEvent = 16;		// fairness between the streams of a reactor
+
+static RTSP_TRANSPORT s_transport = RTSP_TRANSPORT_TCP;
+static int s_nReactorThreads = 1;
+
+// Serves the sockets of many clients from one thread. Callbacks run with
+// the reactor lock held, so a client is never called after remove().
+class RtspReactor {
+public:
+	RtspReactor() {
+		epfd_ = epoll_create1(EPOLL_CLOEXEC);
+		thread_ = std::thread(&RtspReactor::run, this);
+	}
+
+	~RtspReactor() {
+		bRunning_ = false;
+		thread_.join();
+		close(epfd_);
+	}
+
+	void add(RtspClient *pClient, const int fd) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev);
+		fds_[fd] = pClient;
+		clients_.insert(pClient);
+	}
+
+	void remove(RtspClient *pClient) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		removeLocked(pClient);
+	}
+
+	static RtspReactor *pick() {
+		static std::mutex mtx;
+		static std::vector<std::unique_ptr<RtspReactor> > vReactors;
+		static int next = 0;
+		std::lock_guard<std::mutex> lock(mtx);
+		if (vReactors.empty()) {
+			for (int i = 0; i < std::max(1, s_nReactorThreads); ++i) {
+				vReactors.push_back(std::unique_ptr<RtspReactor>(new RtspReactor()));
+			}
+		}
+		return vReactors[next++ % vReactors.size()].get();
+	}
+
+private:
+	void removeLocked(RtspClient *pClient) {
+		for (std::map<int, RtspClient *>::iterator it = fds_.begin(); it != fds_.end();) {
+			if (it->second == pClient) {
+				epoll_ctl(epfd_, EPOLL_CTL_DEL, it->first, nullptr);
+				fds_.erase(it++);
+			} else {
+				++it;
+			}
+		}
+		clients_.erase(pClient);
+	}
+
+	void run() {
+		TRACE_THREAD_NAME("rtspReactor");
+		placeThread(ROLE_INGEST, "rtspReactor");
+		epoll_event events[64];
+		uint64_t lastTimerUs = 0;
+		while (bRunning_) {
+			int n = epoll_wait(epfd_, events, 64, 100);
+			std::lock_guard<std::mutex> lock(mtx_);
+			for (int i = 0; i < n; ++i) {
+				// the client may have been removed since epoll_wait returned
+				std::map<int, RtspClient *>::iterator it = fds_.find(events[i].data.fd);
+				if (it != fds_.end() && !it->second->onReadable(it->first)) {
+					removeLocked(it->second);
+				}
+			}
+			uint64_t now = metricsNowUs();
+			if (now - lastTimerUs >= kTickUs) {
+				lastTimerUs = now;
+				std::vector<RtspClient *> vClients(clients_.begin(), clients_.end());
+				for (size_t i = 0; i < vClients.size(); ++i) {
+					if (!vClients[i]->onTimer(now)) {
+						removeLocked(vClients[i]);
+					}
+				}
+			}
+		}
+	}
+
+	int epfd_{ -1 };
+	std::atomic<bool > bRunning_{ true };
+	std::map<int, RtspClient *> fds_;
+	std::set<RtspClient *> clients_;
+	std::mutex mtx_;
+	std::thread thread_;
+};
+
+static uint32_t readBE32(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static std::string trim(const std::string &s) {
+	size_t b = s.find_first_not_of(" \t\r\n");
+	size_t e = s.find_last_not_of(" \t\r\n");
+	return std::string::npos == b ? std::string() : s.substr(b, e - b + 1);
+}
+
+// Value of the first header line with this name, prefer is matched
+// against the value when a header repeats (e.g. several WWW-Authenticate).
+static std::string headerValue(const std::string &headers, const char *szName, const char *szPrefer = nullptr) {
+	std::istringstream iss(headers);
+	std::string line, value;
+	size_t nName = strlen(szName);
+	while (std::getline(iss, line)) {
+		if (line.size() > nName && ':' == line[nName] && 0 == strncasecmp(line.c_str(), szName, nName)) {
+			std::string v = trim(line.substr(nName + 1));
+			if (value.empty()) {
+				value = v;
+			}
+			if (nullptr != szPrefer && 0 == strncasecmp(v.c_str(), szPrefer, strlen(szPrefer))) {
+				return v;
+			}
+		}
+	}
+	return value;
+}
+
+// key="value" or key=value inside a header value
+static std::string headerParam(const std::string &value, const char *szKey) {
+	std::string key = std::string(szKey) + "=";
+	size_t pos = 0;
+	while (std::string::npos != (pos = value.find(key, pos))) {
+		if (0 == pos || ' ' == value[pos - 1] || ',' == value[pos - 1] || ';' == value[pos - 1]) {
+			pos += key.size();
+			if (pos < value.size() && '"' == value[pos]) {
+				size_t end = value.find('"', pos + 1);
+				return value.substr(pos + 1, std::string::npos == end ? std::string::npos : end - pos - 1);
+			}
+			size_t end = value.find_first_of(",; ", pos);
+			return value.substr(pos, std::string::npos == end ? std::string::npos : end - pos);
+		}
+		pos += key.size();
+	}
+	return std::string();
+}
+
+static std::string md5Hex(const std::string &s) {
+	uint8_t digest[16];
+	av_md5_sum(digest, (const uint8_t *)s.data(), (int)s.size());
+	char hex[33];
+	for (int i = 0; i < 16; ++i) {
+		snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+	}
+	return std::string(hex, 32);
+}
+
+static std::string resolveUrl(const std::string &base, const std::string &control) {
+	if (control.empty() || "*" == control) {
+		return base;
+	}
+	if (0 == strncasecmp(control.c_str(), "rtsp://", 7)) {
+		return control;
+	}
+	if (!base.empty() && '/' == base[base.size() - 1]) {
+		return base + control;
+	}
+	return base + "/" + control;
+}
+
+// True when the payload begins an access unit: parameter sets, SEI or an
+// aggregate, or the first slice of a picture.
+static bool startsPicture(const VIDEO_CODEC codec, const uint8_t *pPayload, const int nPayload) {
+	PACKET_CLASS c;
+	if (VIDEO_CODEC_HEVC == codec) {
+		if (nPayload < 4) {
+			return false;
+		}
+		int type = (pPayload[0] >> 1) & 0x3f;
+		if (49 == type) {
+			// FU: the NAL type sits in the FU header, the slice data follows it
+			if (0 == (pPayload[2] & 0x80)) {
+				return false;
+			}
+			uint8_t nal[3] = { (uint8_t)((pPayload[2] & 0x3f) << 1), pPayload[1], pPayload[3] };
+			classifyNalHEVC(nal, 3, c);
+		} else if (48 != type) {
+			classifyNalHEVC(pPayload, nPayload, c);
+		}
+	} else {
+		if (nPayload < 3) {
+			return false;
+		}
+		int type = pPayload[0] & 0x1f;
+		if (28 == type) {
+			if (0 == (pPayload[1] & 0x80)) {
+				return false;
+			}
+			uint8_t nal[2] = { (uint8_t)((pPayload[0] & 0xe0) | (pPayload[1] & 0x1f)), pPayload[2] };
+			classifyNalH264(nal, 2, c);
+		} else if (24 != type) {
+			classifyNalH264(pPayload, nPayload, c);
+		}
+	}
+	return !c.bPicture || c.bNewPicture;
+}
+
+static bool setNonBlocking(const int fd, const bool bNonBlocking) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) {
+		return false;
+	}
+	flags = bNonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return 0 == fcntl(fd, F_SETFL, flags);
+}
+
+void RtspClient::configure(const RTSP_TRANSPORT transport, const int nReactorThreads) {
+	s_transport = transport;
+	s_nReactorThreads = std::max(1, nReactorThreads);
+}
+
+RtspClient::RtspClient(simplelogger::Logger *logger)
+: logger_(logger)
+{
+	av_init_packet(&fragment_);
+	fragment_.data = nullptr;
+	fragment_.size = 0;
+}
+
+static void orderedRtpCallback(void *handle, const uint8_t *pPacket, int nPacket, bool bGap) {
+	((RtspClient *)handle)->onOrderedRtp(pPacket, nPacket, bGap);
+}
+
+RtspClient::~RtspClient() {
+	stopTakeStream();
+	if (rtspFd_ >= 0 && !session_.empty()) {
+		// best effort, the server drops the session on close anyway
+		setNonBlocking(rtspFd_, true);
+		sendRequest("TEARDOWN", playUrl_, "");
+	}
+	if (bFragment_) {
+		av_packet_unref(&fragment_);
+	}
+	if (rtspFd_ >= 0) {
+		close(rtspFd_);
+	}
+	if (rtpFd_ >= 0) {
+		close(rtpFd_);
+	}
+	if (rtcpFd_ >= 0) {
+		close(rtcpFd_);
+	}
+	if (pJitter_) {
+		delete pJitter_;
+	}
+}
+
+void RtspClient::setVideoPacketCallback(void *handle, PacketCallback callback) {
+	handle_ = handle;
+	videoCallback_ = callback;
+}
+
+void RtspClient::setChannel(int channel) {
+	channel_ = channel;
+}
+
+void RtspClient::setJitterParams(const JITTER_PARAMS &params) {
+	jitterParams_ = params;
+}
+
+int RtspClient::prepare(const char *url) {
+	isPrepareSuccess_ = false;
+	if (nullptr == url || !parseUrl(url)) {
+		return PARAMS_ERROR;
+	}
+	transport_ = s_transport;
+	if (pJitter_) {
+		delete pJitter_;
+	}
+	pJitter_ = new RtpJitterBuffer(jitterParams_);
+	pJitter_->setSink(this, orderedRtpCallback);
+	if (!connectServer()) {
+		return OPEN_FILE_FAILED;
+	}
+
+	std::string headers, body;
+	if (200 == request("OPTIONS", url_, "", headers, body)) {
+		bGetParameter_ = std::string::npos != headerValue(headers, "Public").find("GET_PARAMETER");
+	}
+	int status = request("DESCRIBE", url_, "Accept: application/sdp\r\n", headers, body);
+	if (200 != status) {
+		LOG_ERROR(logger_, "RtspClient: DESCRIBE " << url_ << " failed with " << status);
+		return OPEN_FILE_FAILED;
+	}
+	std::string base = headerValue(headers, "Content-Base");
+	if (base.empty()) {
+		base = headerValue(headers, "Content-Location");
+	}
+	if (base.empty()) {
+		base = url_;
+	}
+	if (!parseSdp(body, base)) {
+		LOG_ERROR(logger_, "RtspClient: no H.264/HEVC track in " << url_);
+		return FIND_VIDEO_STREAM_FAILED;
+	}
+
+	char szTransport[128];
+	if (RTSP_TRANSPORT_UDP == transport_) {
+		if (!setupUdp()) {
+			return OPEN_FILE_FAILED;
+		}
+		sockaddr_storage addr;
+		socklen_t nAddr = sizeof(addr);
+		getsockname(rtpFd_, (sockaddr *)&addr, &nAddr);
+		int port = ntohs(AF_INET6 == addr.ss_family ? ((sockaddr_in6 *)&addr)->sin6_port
+													: ((sockaddr_in *)&addr)->sin_port);
+		snprintf(szTransport, sizeof(szTransport), "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n", port, port + 1);
+	} else {
+		snprintf(szTransport, sizeof(szTransport), "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+	}
+	status = request("SETUP", controlUrl_, szTransport, headers, body);
+	if (200 != status) {
+		LOG_ERROR(logger_, "RtspClient: SETUP " << controlUrl_ << " failed with " << status);
+		return OPEN_FILE_FAILED;
+	}
+	std::string session = headerValue(headers, "Session");
+	session_ = session.substr(0, session.find(';'));
+	std::string timeout = headerParam(session, "timeout");
+	if (!timeout.empty() && atoi(timeout.c_str()) > 0) {
+		sessionTimeoutSec_ = atoi(timeout.c_str());
+	}
+	std::string interleaved = headerParam(headerValue(headers, "Transport"), "interleaved");
+	if (RTSP_TRANSPORT_TCP == transport_ && !interleaved.empty()) {
+		rtpChannel_ = atoi(interleaved.c_str());
+		size_t dash = interleaved.find('-');
+		rtcpChannel_ = std::string::npos == dash ? rtpChannel_ + 1 : atoi(interleaved.c_str() + dash + 1);
+	}
+
+	status = request("PLAY", playUrl_, "Range: npt=0.000-\r\n", headers, body);
+	if (200 != status) {
+		LOG_ERROR(logger_, "RtspClient: PLAY " << playUrl_ << " failed with " << status);
+		return OPEN_FILE_FAILED;
+	}
+	setNonBlocking(rtspFd_, true);
+	LOG_DEBUG(logger_, "RtspClient: playing " << url_ << " over " << (RTSP_TRANSPORT_UDP == transport_ ? "UDP" : "TCP")
+						<< ", " << (VIDEO_CODEC_HEVC == codec_ ? "HEVC " : "H.264 ") << width_ << "x" << height_);
+	isPrepareSuccess_ = true;
+	return SUCCESS;
+}
+
+void RtspClient::startTakeStream() {
+	if (!isPrepareSuccess_ || !isStop_) {
+		return;
+	}
+	isTake_ = true;
+	isStop_ = false;
+	lastReceiveUs_ = metricsNowUs();
+	lastKeepaliveUs_ = lastReceiveUs_;
+	pReactor_ = RtspReactor::pick();
+	pReactor_->add(this, rtspFd_);
+	if (RTSP_TRANSPORT_UDP == transport_) {
+		pReactor_->add(this, rtpFd_);
+		pReactor_->add(this, rtcpFd_);
+	}
+}
+
+void RtspClient::stopTakeStream() {
+	isTake_ = false;
+	if (nullptr != pReactor_) {
+		// waits for a callback in progress
+		pReactor_->remove(this);
+		pReactor_ = nullptr;
+	}
+	isStop_ = true;
+}
+
+bool RtspClient::getIsStopTaking() {
+	return isStop_;
+}
+
+AVCodecID RtspClient::getVideoCodeID() {
+	if (!isPrepareSuccess_) {
+		return AV_CODEC_ID_NONE;
+	}
+	return VIDEO_CODEC_HEVC == codec_ ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+}
+
+int RtspClient::getFrameWidth() {
+	return width_;
+}
+
+int RtspClient::getFrameHeight() {
+	return height_;
+}
+
+uint64_t RtspClient::getLastReceiveUs() {
+	return lastReceiveUs_;
+}
+
+int64_t RtspClient::getWallclockUs(const AVPacket &packet) {
+	if (srNtpUs_ <= 0 || AV_NOPTS_VALUE == packet.pts) {
+		return 0;
+	}
+	int32_t delta = (int32_t)((uint32_t)packet.pts - srRtpTimestamp_);
+	return srNtpUs_ + (int64_t)delta * 1000000 / clockRate_;
+}
+
+int64_t RtspClient::getPtsUs(const AVPacket &packet) {
+	if (firstTimestamp_ < 0 || AV_NOPTS_VALUE == packet.pts) {
+		return -1;
+	}
+	return (packet.pts - firstTimestamp_) * 1000000 / clockRate_;
+}
+
+// RTP only carries presentation timestamps
+int64_t RtspClient::getDtsUs(const AVPacket &packet) {
+	int64_t ptsUs = getPtsUs(packet);
+	return ptsUs < 0 ? AV_NOPTS_VALUE : ptsUs;
+}
+
+bool RtspClient::parseUrl(const char *url) {
+	if (0 != strncasecmp(url, "rtsp://", 7)) {
+		return false;
+	}
+	std::string rest(url + 7);
+	size_t slash = rest.find('/');
+	std::string authority = rest.substr(0, slash);
+	std::string path = std::string::npos == slash ? "/" : rest.substr(slash);
+	size_t at = authority.rfind('@');
+	if (std::string::npos != at) {
+		std::string userInfo = authority.substr(0, at);
+		authority = authority.substr(at + 1);
+		size_t colon = userInfo.find(':');
+		user_ = userInfo.substr(0, colon);
+		password_ = std::string::npos == colon ? std::string() : userInfo.substr(colon + 1);
+	}
+	size_t colon = authority.rfind(':');
+	if (std::string::npos != colon && std::string::npos == authority.find(']', colon)) {
+		port_ = atoi(authority.c_str() + colon + 1);
+		host_ = authority.substr(0, colon);
+	} else {
+		host_ = authority;
+	}
+	if (host_.size() > 2 && '[' == host_[0]) {
+		host_ = host_.substr(1, host_.size() - 2);
+	}
+	url_ = "rtsp://" + authority + path;
+	return !host_.empty() && port_ > 0;
+}
+
+bool RtspClient::connectServer() {
+	addrinfo hints, *pResult = nullptr;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	char szPort[16];
+	snprintf(szPort, sizeof(szPort), "%d", port_);
+	if (0 != getaddrinfo(host_.c_str(), szPort, &hints, &pResult)) {
+		LOG_ERROR(logger_, "RtspClient: failed to resolve " << host_);
+		return false;
+	}
+	for (addrinfo *p = pResult; p != nullptr && rtspFd_ < 0; p = p->ai_next) {
+		int fd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		setNonBlocking(fd, true);
+		int ret = connect(fd, p->ai_addr, p->ai_addrlen);
+		if (ret < 0 && EINPROGRESS == errno) {
+			pollfd pfd = { fd, POLLOUT, 0 };
+			int err = 0;
+			socklen_t nErr = sizeof(err);
+			if (1 == poll(&pfd, 1, kTimeoutMs) && 0 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &nErr) && 0 == err) {
+				ret = 0;
+			}
+		}
+		if (0 != ret) {
+			close(fd);
+			continue;
+		}
+		setNonBlocking(fd, false);
+		timeval tv = { kTimeoutMs / 1000, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		rtspFd_ = fd;
+		family_ = p->ai_family;
+	}
+	freeaddrinfo(pResult);
+	if (rtspFd_ < 0) {
+		LOG_ERROR(logger_, "RtspClient: failed to connect to " << host_ << ":" << port_);
+		return false;
+	}
+	vRxBuf_.resize(RTSP_TRANSPORT_TCP == transport_ ? kTcpRxBuf : kRtspRxBuf);
+	nRxBuf_ = 0;
+	return true;
+}
+
+// An even RTP port and the next one for RTCP.
+bool RtspClient::setupUdp() {
+	for (int attempt = 0; attempt < 16; ++attempt) {
+		sockaddr_storage addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.ss_family = family_;
+		socklen_t nAddr = AF_INET6 == family_ ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+		int fdRtp = socket(family_, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (fdRtp < 0 || 0 != bind(fdRtp, (sockaddr *)&addr, nAddr) || 0 != getsockname(fdRtp, (sockaddr *)&addr, &nAddr)) {
+			if (fdRtp >= 0) {
+				close(fdRtp);
+			}
+			break;
+		}
+		in_port_t *pPort = AF_INET6 == family_ ? &((sockaddr_in6 *)&addr)->sin6_port : &((sockaddr_in *)&addr)->sin_port;
+		int port = ntohs(*pPort);
+		*pPort = htons(port + 1);
+		int fdRtcp = (port & 1) ? -1 : socket(family_, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (fdRtcp < 0 || 0 != bind(fdRtcp, (sockaddr *)&addr, nAddr)) {
+			close(fdRtp);
+			if (fdRtcp >= 0) {
+				close(fdRtcp);
+			}
+			continue;
+		}
+		// a keyframe arrives as a burst, give the kernel room for it
+		int nRcvBuf = 1 << 20;
+		setsockopt(fdRtp, SOL_SOCKET, SO_RCVBUF, &nRcvBuf, sizeof(nRcvBuf));
+		setNonBlocking(fdRtp, true);
+		setNonBlocking(fdRtcp, true);
+		rtpFd_ = fdRtp;
+		rtcpFd_ = fdRtcp;
+		vDatagrams_.resize(kDatagramBatch * kDatagramSize);
+		return true;
+	}
+	LOG_ERROR(logger_, "RtspClient: failed to bind RTP/RTCP ports");
+	return false;
+}
+
+std::string RtspClient::authorization(const std::string &method, const std::string &uri) const {
+	if (!bAuth_) {
+		return std::string();
+	}
+	if (bDigest_) {
+		std::string ha1 = md5Hex(user_ + ":" + realm_ + ":" + password_);
+		std::string ha2 = md5Hex(method + ":" + uri);
+		return "Authorization: Digest username=\"" + user_ + "\", realm=\"" + realm_ + "\", nonce=\"" + nonce_
+				+ "\", uri=\"" + uri + "\", response=\"" + md5Hex(ha1 + ":" + nonce_ + ":" + ha2) + "\"\r\n";
+	}
+	std::string credentials = user_ + ":" + password_;
+	std::vector<char > vEncoded(AV_BASE64_SIZE(credentials.size()));
+	av_base64_encode(vEncoded.data(), (int)vEncoded.size(), (const uint8_t *)credentials.data(), (int)credentials.size());
+	return std::string("Authorization: Basic ") + vEncoded.data() + "\r\n";
+}
+
+bool RtspClient::sendRequest(const std::string &method, const std::string &uri, const std::string &extraHeaders) {
+	std::ostringstream oss;
+	oss << method << " " << uri << " RTSP/1.0\r\n"
+		<< "CSeq: " << ++cseq_ << "\r\n"
+		<< "User-Agent: sample_detection\r\n";
+	if (!session_.empty()) {
+		oss << "Session: " << session_ << "\r\n";
+	}
+	oss << authorization(method, uri) << extraHeaders << "\r\n";
+	std::string msg = oss.str();
+	size_t sent = 0;
+	while (sent < msg.size()) {
+		ssize_t n = send(rtspFd_, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+		if (n < 0 && EINTR == errno) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		sent += n;
+	}
+	return true;
+}
+
+// Blocking, during the handshake only. Interleaved data ahead of the
+// response is dropped, data behind it stays in the receive buffer.
+int RtspClient::readResponse(std::string &headers, std::string &body) {
+	while (true) {
+		size_t pos = 0;
+		while (pos + 4 <= nRxBuf_ && '$' == vRxBuf_[pos]) {
+			size_t len = 4 + ((vRxBuf_[pos + 2] << 8) | vRxBuf_[pos + 3]);
+			if (pos + len > nRxBuf_) {
+				break;
+			}
+			pos += len;
+		}
+		if (pos > 0) {
+			memmove(vRxBuf_.data(), vRxBuf_.data() + pos, nRxBuf_ - pos);
+			nRxBuf_ -= pos;
+		}
+		const char *p = (const char *)vRxBuf_.data();
+		const char *pEnd = nRxBuf_ > 0 && '$' != p[0] ? (const char *)memmem(p, nRxBuf_, "\r\n\r\n", 4) : nullptr;
+		if (nullptr != pEnd) {
+			size_t nHeaders = pEnd - p + 4;
+			headers.assign(p, nHeaders);
+			size_t nBody = atoi(headerValue(headers, "Content-Length").c_str());
+			if (nHeaders + nBody <= nRxBuf_) {
+				body.assign(p + nHeaders, nBody);
+				memmove(vRxBuf_.data(), vRxBuf_.data() + nHeaders + nBody, nRxBuf_ - nHeaders - nBody);
+				nRxBuf_ -= nHeaders + nBody;
+				int status = 0;
+				if (1 != sscanf(headers.c_str(), "RTSP/%*d.%*d %d", &status)) {
+					return -1;
+				}
+				return status;
+			}
+			if (nHeaders + nBody > vRxBuf_.size()) {
+				vRxBuf_.resize(nHeaders + nBody);
+			}
+		} else if (nRxBuf_ == vRxBuf_.size()) {
+			vRxBuf_.resize(vRxBuf_.size() * 2);
+		}
+		ssize_t n = recv(rtspFd_, vRxBuf_.data() + nRxBuf_, vRxBuf_.size() - nRxBuf_, 0);
+		if (n < 0 && EINTR == errno) {
+			continue;
+		}
+		if (n <= 0) {
+			LOG_ERROR(logger_, "RtspClient: no response from " << host_);
+			return -1;
+		}
+		nRxBuf_ += n;
+	}
+}
+
+int RtspClient::request(const std::string &method, const std::string &uri, const std::string &extraHeaders,
+						std::string &headers, std::string &body) {
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		if (!sendRequest(method, uri, extraHeaders)) {
+			return -1;
+		}
+		int status = readResponse(headers, body);
+		if (401 != status || bAuth_ || user_.empty()) {
+			return status;
+		}
+		std::string challenge = headerValue(headers, "WWW-Authenticate", "Digest");
+		bAuth_ = true;
+		bDigest_ = 0 == strncasecmp(challenge.c_str(), "Digest", 6);
+		realm_ = headerParam(challenge, "realm");
+		nonce_ = headerParam(challenge, "nonce");
+	}
+	return 401;
+}
+
+bool RtspClient::parseSdp(const std::string &sdp, const std::string &base) {
+	std::istringstream iss(sdp);
+	std::string line, sessionControl, control, encoding, vps, sps, pps, parameterSets;
+	bool bVideo = false, bFound = false;
+	while (std::getline(iss, line)) {
+		line = trim(line);
+		if (0 == line.compare(0, 2, "m=")) {
+			if (bFound) {
+				break;
+			}
+			bVideo = 0 == line.compare(0, 8, "m=video ");
+			if (bVideo) {
+				int port = 0;
+				char szProto[32] = { 0 };
+				bFound = 3 == sscanf(line.c_str(), "m=video %d %31s %d", &port, szProto, &payloadType_);
+			}
+		} else if (0 == line.compare(0, 10, "a=control:")) {
+			(bVideo ? control : sessionControl) = line.substr(10);
+		} else if (bVideo && 0 == line.compare(0, 9, "a=rtpmap:")) {
+			int pt = -1, rate = 0;
+			char szEncoding[32] = { 0 };
+			if (sscanf(line.c_str(), "a=rtpmap:%d %31[^/]/%d", &pt, szEncoding, &rate) >= 2 && pt == payloadType_) {
+				encoding = szEncoding;
+				if (rate > 0) {
+					clockRate_ = rate;
+				}
+			}
+		} else if (bVideo && 0 == line.compare(0, 7, "a=fmtp:")) {
+			std::istringstream params(line.substr(line.find(' ') + 1));
+			std::string param;
+			while (std::getline(params, param, ';')) {
+				param = trim(param);
+				size_t eq = param.find('=');
+				std::string key = param.substr(0, eq);
+				std::string value = std::string::npos == eq ? std::string() : param.substr(eq + 1);
+				if ("sprop-parameter-sets" == key) {
+					parameterSets = value;
+				} else if ("sprop-vps" == key) {
+					vps = value;
+				} else if ("sprop-sps" == key) {
+					sps = value;
+				} else if ("sprop-pps" == key) {
+					pps = value;
+				}
+			}
+		}
+	}
+	if (!bFound) {
+		return false;
+	}
+	if (0 == strcasecmp(encoding.c_str(), "H264")) {
+		codec_ = VIDEO_CODEC_H264;
+		addParameterSets(parameterSets);
+	} else if (0 == strcasecmp(encoding.c_str(), "H265")) {
+		codec_ = VIDEO_CODEC_HEVC;
+		addParameterSets(vps);
+		addParameterSets(sps);
+		addParameterSets(pps);
+	} else {
+		return false;
+	}
+	learnResolution(vParameterSets_.data(), (int)vParameterSets_.size());
+	controlUrl_ = resolveUrl(base, control);
+	playUrl_ = resolveUrl(base, sessionControl);
+	return true;
+}
+
+void RtspClient::addParameterSets(const std::string &base64List) {
+	std::istringstream iss(base64List);
+	std::string item;
+	while (std::getline(iss, item, ',')) {
+		std::vector<uint8_t > vNal(item.size() * 3 / 4 + 4);
+		int n = av_base64_decode(vNal.data(), item.c_str(), (int)vNal.size());
+		if (n <= 0) {
+			continue;
+		}
+		static const uint8_t startCode[4] = { 0, 0, 0, 1 };
+		vParameterSets_.insert(vParameterSets_.end(), startCode, startCode + 4);
+		vParameterSets_.insert(vParameterSets_.end(), vNal.begin(), vNal.begin() + n);
+	}
+}
+
+void RtspClient::learnResolution(const uint8_t *pBuf, const int nBuf) {
+	for (int pos = findNalStart(pBuf, nBuf, 0); pos >= 0 && 0 == width_; pos = findNalStart(pBuf, nBuf, pos)) {
+		int end = findNalStart(pBuf, nBuf, pos);
+		int nNal = (end < 0 ? nBuf : end - 3) - pos;
+		int width = 0, height = 0;
+		if (parseSps(pBuf + pos, nNal, codec_, width, height)) {
+			width_ = width;
+			height_ = height;
+		}
+	}
+}
+
+bool RtspClient::onReadable(const int fd) {
+	if (!isTake_) {
+		return false;
+	}
+	TRACE_RANGE("rtspReceive");
+	return fd == rtspFd_ ? drainTcp() : drainUdp(fd);
+}
+
+bool RtspClient::onTimer(const uint64_t nowUs) {
+	pJitter_->flush(nowUs);
+	if (nowUs - lastStatsUs_ >= kStatsUs) {
+		lastStatsUs_ = nowUs;
+		reportStats(nowUs);
+	}
+	if (nowUs - lastReceiveUs_ > kReceiveTimeoutUs) {
+		onStreamEnd("no data for 10 s");
+		return false;
+	}
+	if (nowUs - lastKeepaliveUs_ > (uint64_t)sessionTimeoutSec_ * 1000000 / 2) {
+		lastKeepaliveUs_ = nowUs;
+		// the reply is skipped by parseRxBuffer()
+		sendRequest(bGetParameter_ ? "GET_PARAMETER" : "OPTIONS", playUrl_, "");
+	}
+	return true;
+}
+
+void RtspClient::reportStats(const uint64_t nowUs) {
+	JITTER_STATS stats = getJitterStats();
+	uint64_t nDamaged = nDamaged_.load(std::memory_order_relaxed);
+	if (nullptr != g_pMetrics) {
+		g_pMetrics->setGauge("rtp_packets_lost", channel_, (double)stats.nLost);
+		g_pMetrics->setGauge("rtp_packets_late", channel_, (double)stats.nLate);
+		g_pMetrics->setGauge("rtp_packets_reordered", channel_, (double)stats.nReordered);
+		g_pMetrics->setGauge("rtp_sequence_resyncs", channel_, (double)stats.nResyncs);
+		g_pMetrics->setGauge("rtp_pictures_damaged", channel_, (double)nDamaged);
+	}
+	// without metrics losses still show up in the log, at most every 10 s
+	if (nowUs - lastLossLogUs_ >= kLossLogUs && (stats.nLost != lastLogged_.nLost || stats.nLate != lastLogged_.nLate
+												|| stats.nResyncs != lastLogged_.nResyncs)) {
+		LOG_WARN(logger_, "RtspClient: channel " << channel_ << " lost " << stats.nLost - lastLogged_.nLost
+							<< " packets, " << stats.nLate - lastLogged_.nLate << " late, "
+							<< nDamaged - lastLoggedDamaged_ << " pictures with missing slices, "
+							<< stats.nResyncs - lastLogged_.nResyncs << " sequence restarts");
+		lastLossLogUs_ = nowUs;
+		lastLogged_ = stats;
+		lastLoggedDamaged_ = nDamaged;
+	}
+}
+
+void RtspClient::onStreamEnd(const char *szReason) {
+	LOG_ERROR(logger_, "RtspClient: channel " << channel_ << " stream ended, " << szReason);
+	isTake_ = false;
+	isStop_ = true;
+}
+
+bool RtspClient::drainTcp() {
+	for (int i = 0; i < kMaxReadsPerEvent; ++i) {
+		if (nRxBuf_ == vRxBuf_.size()) {
+			vRxBuf_.resize(vRxBuf_.size() * 2);
+		}
+		ssize_t n = recv(rtspFd_, vRxBuf_.data() + nRxBuf_, vRxBuf_.size() - nRxBuf_, 0);
+		if (n < 0 && EINTR == errno) {
+			continue;
+		}
+		if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+			return true;
+		}
+		if (n <= 0) {
+			onStreamEnd(0 == n ? "connection closed" : strerror(errno));
+			return false;
+		}
+		nRxBuf_ += n;
+		if (!parseRxBuffer()) {
+			return false;
+		}
+	}
+	return isTake_;
+}
+
+// Interleaved frames and RTSP messages (keepalive replies) share the
+// connection. Incomplete data stays at the front of the buffer.
+bool RtspClient::parseRxBuffer() {
+	size_t pos = 0, need = 0;
+	while (pos < nRxBuf_ && isTake_) {
+		const uint8_t *p = vRxBuf_.data() + pos;
+		size_t left = nRxBuf_ - pos;
+		if ('$' == p[0]) {
+			if (left < 4) {
+				break;
+			}
+			size_t len = (p[2] << 8) | p[3];
+			if (left < 4 + len) {
+				need = 4 + len;
+				break;
+			}
+			if (p[1] == rtpChannel_) {
+				onRtp(p + 4, (int)len);
+			} else if (p[1] == rtcpChannel_) {
+				onRtcp(p + 4, (int)len);
+			}
+			pos += 4 + len;
+		} else if ('R' == p[0]) {
+			const uint8_t *pEnd = (const uint8_t *)memmem(p, left, "\r\n\r\n", 4);
+			if (nullptr == pEnd && left < kRtspRxBuf) {
+				need = left + 1;
+				break;
+			}
+			if (nullptr == pEnd) {
+				pos++;
+				continue;
+			}
+			size_t nHeaders = pEnd - p + 4;
+			std::string headers((const char *)p, nHeaders);
+			size_t nBody = atoi(headerValue(headers, "Content-Length").c_str());
+			if (left < nHeaders + nBody) {
+				need = nHeaders + nBody;
+				break;
+			}
+			int status = 0;
+			if (1 == sscanf(headers.c_str(), "RTSP/%*d.%*d %d", &status) && (status < 200 || status >= 300)) {
+				LOG_WARN(logger_, "RtspClient: channel " << channel_ << " keepalive answered with " << status);
+			}
+			pos += nHeaders + nBody;
+		} else {
+			// not at a frame or message boundary, resync
+			pos++;
+		}
+	}
+	if (pos > 0) {
+		memmove(vRxBuf_.data(), vRxBuf_.data() + pos, nRxBuf_ - pos);
+		nRxBuf_ -= pos;
+	}
+	if (need > vRxBuf_.size()) {
+		vRxBuf_.resize(need);
+	}
+	return isTake_;
+}
+
+bool RtspClient::drainUdp(const int fd) {
+	mmsghdr vMsgs[kDatagramBatch];
+	iovec vIov[kDatagramBatch];
+	for (int i = 0; i < kMaxReadsPerEvent; ++i) {
+		memset(vMsgs, 0, sizeof(vMsgs));
+		for (int j = 0; j < kDatagramBatch; ++j) {
+			vIov[j].iov_base = vDatagrams_.data() + j * kDatagramSize;
+			vIov[j].iov_len = kDatagramSize;
+			vMsgs[j].msg_hdr.msg_iov = &vIov[j];
+			vMsgs[j].msg_hdr.msg_iovlen = 1;
+		}
+		int n = recvmmsg(fd, vMsgs, kDatagramBatch, MSG_DONTWAIT, nullptr);
+		if (n <= 0) {
+			break;
+		}
+		for (int j = 0; j < n && isTake_; ++j) {
+			if (vMsgs[j].msg_hdr.msg_flags & MSG_TRUNC) {
+				if (!bTruncatedLogged_) {
+					LOG_WARN(logger_, "RtspClient: channel " << channel_ << " datagrams above " << kDatagramSize << " bytes are dropped");
+					bTruncatedLogged_ = true;
+				}
+				// the sequence gap accounts for it
+				continue;
+			}
+			const uint8_t *p = vDatagrams_.data() + j * kDatagramSize;
+			if (fd == rtpFd_) {
+				onRtp(p, (int)vMsgs[j].msg_len);
+			} else {
+				onRtcp(p, (int)vMsgs[j].msg_len);
+			}
+		}
+		if (n < kDatagramBatch) {
+			break;
+		}
+	}
+	return isTake_;
+}
+
+void RtspClient::onRtp(const uint8_t *pBuf, int nBuf) {
+	if (nBuf < 12 || 2 != (pBuf[0] >> 6) || payloadType_ != (pBuf[1] & 0x7f)) {
+		return;
+	}
+	lastReceiveUs_ = metricsNowUs();
+	pJitter_->push(pBuf, nBuf, lastReceiveUs_);
+}
+
+// Packets in sequence order, bGap when packets in front were lost.
+void RtspClient::onOrderedRtp(const uint8_t *pBuf, int nBuf, const bool bGap) {
+	int offset = 12 + 4 * (pBuf[0] & 0x0f);
+	if ((pBuf[0] & 0x10) && offset + 4 <= nBuf) {
+		offset += 4 + 4 * ((pBuf[offset + 2] << 8) | pBuf[offset + 3]);
+	}
+	if (pBuf[0] & 0x20) {
+		nBuf -= pBuf[nBuf - 1];
+	}
+	if (offset >= nBuf) {
+		return;
+	}
+
+	uint32_t timestamp = readBE32(pBuf + 4);
+	if (bGap) {
+		// the gap cut into a picture unless the last one was complete
+		// (marker bit) and this packet starts the next one
+		if (!bLastMarker_ || !startsPicture(codec_, pBuf + offset, nBuf - offset)) {
+			nDamaged_.fetch_add(1, std::memory_order_relaxed);
+		}
+		// the NAL unit being reassembled lost a fragment
+		if (bFragment_) {
+			av_packet_unref(&fragment_);
+			bFragment_ = false;
+		}
+	}
+	bLastMarker_ = 0 != (pBuf[1] & 0x80);
+	if (firstTimestamp_ < 0) {
+		firstTimestamp_ = timestamp;
+		extTimestamp_ = timestamp;
+	} else {
+		extTimestamp_ += (int32_t)(timestamp - (uint32_t)extTimestamp_);
+	}
+
+	if (VIDEO_CODEC_HEVC == codec_) {
+		depacketizeHEVC(pBuf + offset, nBuf - offset);
+	} else {
+		depacketizeH264(pBuf + offset, nBuf - offset);
+	}
+}
+
+// The sender report maps RTP time to NTP wallclock.
+void RtspClient::onRtcp(const uint8_t *pBuf, const int nBuf) {
+	int pos = 0;
+	while (pos + 8 <= nBuf) {
+		const uint8_t *p = pBuf + pos;
+		int len = (((p[2] << 8) | p[3]) + 1) * 4;
+		if (200 == p[1] && len >= 28 && pos + len <= nBuf) {
+			uint32_t ntpSec = readBE32(p + 8);
+			uint32_t ntpFrac = readBE32(p + 12);
+			srNtpUs_ = ((int64_t)ntpSec - 2208988800LL) * 1000000 + (int64_t)(((uint64_t)ntpFrac * 1000000) >> 32);
+			srRtpTimestamp_ = readBE32(p + 16);
+		}
+		pos += len;
+	}
+}
+
+// RFC 6184: 1-23 single NAL unit, 24 STAP-A, 28 FU-A
+void RtspClient::depacketizeH264(const uint8_t *pPayload, const int nPayload) {
+	int type = pPayload[0] & 0x1f;
+	if (type >= 1 && type <= 23) {
+		emitNal(pPayload, nPayload);
+	} else if (24 == type) {
+		emitAggregate(pPayload, nPayload, 1);
+	} else if (28 == type && nPayload > 2) {
+		uint8_t fuHeader = pPayload[1];
+		if (fuHeader & 0x80) {
+			uint8_t nalHeader = (pPayload[0] & 0xe0) | (fuHeader & 0x1f);
+			beginFragment(&nalHeader, 1, pPayload + 2, nPayload - 2);
+		} else {
+			appendFragment(pPayload + 2, nPayload - 2);
+		}
+		if ((fuHeader & 0x40) && bFragment_) {
+			bFragment_ = false;
+			deliver(fragment_);
+		}
+	}
+}
+
+// RFC 7798: 48 AP, 49 FU, 50 PACI, the rest single NAL units. DONL
+// fields are not expected, sprop-max-don-diff is 0 for cameras.
+void RtspClient::depacketizeHEVC(const uint8_t *pPayload, const int nPayload) {
+	if (nPayload < 3) {
+		return;
+	}
+	int type = (pPayload[0] >> 1) & 0x3f;
+	if (48 == type) {
+		emitAggregate(pPayload, nPayload, 2);
+	} else if (49 == type) {
+		uint8_t fuHeader = pPayload[2];
+		if (fuHeader & 0x80) {
+			uint8_t nalHeader[2] = { (uint8_t)((pPayload[0] & 0x81) | ((fuHeader & 0x3f) << 1)), pPayload[1] };
+			beginFragment(nalHeader, 2, pPayload + 3, nPayload - 3);
+		} else {
+			appendFragment(pPayload + 3, nPayload - 3);
+		}
+		if ((fuHeader & 0x40) && bFragment_) {
+			bFragment_ = false;
+			deliver(fragment_);
+		}
+	} else if (type < 48) {
+		emitNal(pPayload, nPayload);
+	}
+}
+
+// STAP-A and AP: 16 bit size + NAL unit, repeated. One packet for all.
+void RtspClient::emitAggregate(const uint8_t *pPayload, const int nPayload, const int offset) {
+	int total = 0;
+	for (int pos = offset; pos + 2 <= nPayload;) {
+		int size = (pPayload[pos] << 8) | pPayload[pos + 1];
+		if (pos + 2 + size > nPayload) {
+			break;
+		}
+		total += 4 + size;
+		pos += 2 + size;
+	}
+	AVPacket packet;
+	if (0 == total || 0 != av_new_packet(&packet, total)) {
+		return;
+	}
+	uint8_t *pOut = packet.data;
+	for (int pos = offset; pOut < packet.data + total;) {
+		int size = (pPayload[pos] << 8) | pPayload[pos + 1];
+		pOut[0] = 0; pOut[1] = 0; pOut[2] = 0; pOut[3] = 1;
+		memcpy(pOut + 4, pPayload + pos + 2, size);
+		pOut += 4 + size;
+		pos += 2 + size;
+	}
+	deliver(packet);
+}
+
+void RtspClient::emitNal(const uint8_t *pNal, const int nNal) {
+	AVPacket packet;
+	if (0 != av_new_packet(&packet, 4 + nNal)) {
+		return;
+	}
+	packet.data[0] = 0; packet.data[1] = 0; packet.data[2] = 0; packet.data[3] = 1;
+	memcpy(packet.data + 4, pNal, nNal);
+	deliver(packet);
+}
+
+void RtspClient::beginFragment(const uint8_t *pHeader, const int nHeader, const uint8_t *pData, const int nData) {
+	if (bFragment_) {
+		av_packet_unref(&fragment_);
+	}
+	bFragment_ = 0 == av_new_packet(&fragment_, 4 + nHeader + nData);
+	if (!bFragment_) {
+		return;
+	}
+	fragment_.data[0] = 0; fragment_.data[1] = 0; fragment_.data[2] = 0; fragment_.data[3] = 1;
+	memcpy(fragment_.data + 4, pHeader, nHeader);
+	memcpy(fragment_.data + 4 + nHeader, pData, nData);
+}
+
+void RtspClient::appendFragment(const uint8_t *pData, const int nData) {
+	if (!bFragment_) {
+		// the start fragment was lost
+		return;
+	}
+	int size = fragment_.size;
+	// av_grow_packet reallocates to the exact size, double the capacity instead
+	if (size + nData + AV_INPUT_BUFFER_PADDING_SIZE > fragment_.buf->size) {
+		if (0 != av_grow_packet(&fragment_, std::max(nData, size))) {
+			av_packet_unref(&fragment_);
+			bFragment_ = false;
+			return;
+		}
+		av_shrink_packet(&fragment_, size);
+	}
+	av_grow_packet(&fragment_, nData);
+	memcpy(fragment_.data + size, pData, nData);
+}
+
+// The callback refs the packet, the reference taken here is dropped.
+// Keyframes which come without parameter sets of their own get those of
+// the SDP ahead of them, so the decoder and the recorders can start at any
+// keyframe, whenever they joined the stream.
+void RtspClient::deliver(AVPacket &packet) {
+	PACKET_CLASS c = classifyPacket(packet.data, packet.size, codec_);
+	if (hasParameterSets(packet.data, packet.size, codec_)) {
+		bInBandSets_ = true;
+	}
+	if (c.bPicture) {
+		if (c.bKeyframe && c.bNewPicture && !bInBandSets_ && !vParameterSets_.empty()) {
+			AVPacket sets;
+			if (0 == av_new_packet(&sets, (int)vParameterSets_.size())) {
+				memcpy(sets.data, vParameterSets_.data(), vParameterSets_.size());
+				handOver(sets);
+			}
+		}
+		bInBandSets_ = false;
+	}
+	handOver(packet);
+}
+
+void RtspClient::handOver(AVPacket &packet) {
+	packet.pts = extTimestamp_;
+	packet.dts = AV_NOPTS_VALUE;
+	packet.stream_index = 0;
+	if (0 == width_) {
+		learnResolution(packet.data, packet.size);
+	}
+	if (nullptr != videoCallback_ && isTake_) {
+		videoCallback_(handle_, packet);
+	}
+	av_packet_unref(&packet);
+}
+
+IStreamSource *createStreamSource(const char *url, const STREAM_CLIENT client, simplelogger::Logger *logger) {
+	if (STREAM_CLIENT_NATIVE == client && nullptr != url && 0 == strncasecmp(url, "rtsp://", 7)) {
+		return new RtspClient(logger);
+	}
+	return new StreamTaker(logger);
+}
@@ -0,0 +1,180 @@
+#ifndef RTSP_CLIENT_H
+#define RTSP_CLIENT_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include "streamSource.h"
+#include "nalParser.h"
+#include "rtpJitterBuffer.h"
+#include "common/retCode.h"
+#include "common/logger.h"
+
+enum RTSP_TRANSPORT {
+	RTSP_TRANSPORT_TCP = 0,	// RTP interleaved on the RTSP connection
+	RTSP_TRANSPORT_UDP
+};
+
+class RtspReactor;
+
+// Minimal RTSP/RTP client for H.264 and HEVC cameras, an alternative to
+// StreamTaker without an AVFormatContext per stream. prepare() runs
+// DESCRIBE/SETUP/PLAY for the first video track, then the sockets are
+// served by a small pool of reactor threads shared by all clients, the
+// packet callback runs on them. Single NAL units, STAP-A/AP and FU-A/FU
+// are depacketized into Annex-B packets, one per NAL unit or aggregate.
+//
+// Per stream the client keeps one receive buffer (TCP) or one batch of
+// datagram slots (UDP) of a few KB and the NAL unit being reassembled,
+// which is handed over to the callback without a copy.
+class RtspClient : public IStreamSource {
+public:
+	explicit
+	RtspClient(simplelogger::Logger *logger);
+
+	~RtspClient();
+
+	// Process wide, before the first prepare()
+	static void configure(const RTSP_TRANSPORT transport, const int nReactorThreads);
+
+	void setVideoPacketCallback(void *handle, PacketCallback callback);
+	void setChannel(int channel);
+	void setJitterParams(const JITTER_PARAMS &params);
+	// Only the video track is ever set up.
+	void setVideoOnly(bool) {}
+
+	int prepare(const char *url);
+	void startTakeStream();
+	void stopTakeStream();
+	bool getIsStopTaking();
+
+	AVCodecID getVideoCodeID();
+	int getFrameWidth();
+	int getFrameHeight();
+
+	uint64_t getLastReceiveUs();
+	int64_t getWallclockUs(const AVPacket &packet);
+	int64_t getPtsUs(const AVPacket &packet);
+	int64_t getDtsUs(const AVPacket &packet);
+
+	JITTER_STATS getJitterStats() const {
+		return pJitter_ ? pJitter_->getStats() : JITTER_STATS();
+	}
+
+	// pictures which lost a slice on the way
+	uint64_t getNbDamaged() const { return nDamaged_.load(std::memory_order_relaxed); }
+
+	// sink of the jitter buffer
+	void onOrderedRtp(const uint8_t *pBuf, int nBuf, const bool bGap);
+
+private:
+	friend class RtspReactor;
+
+	// reactor side, false once the client is to be removed, onTimer
+	// runs about every 100 ms
+	bool onReadable(const int fd);
+	bool onTimer(const uint64_t nowUs);
+
+	// handshake
+	bool parseUrl(const char *url);
+	bool connectServer();
+	bool setupUdp();
+	int request(const std::string &method, const std::string &uri, const std::string &extraHeaders,
+				std::string &headers, std::string &body);
+	bool sendRequest(const std::string &method, const std::string &uri, const std::string &extraHeaders);
+	int readResponse(std::string &headers, std::string &body);
+	std::string authorization(const std::string &method, const std::string &uri) const;
+	bool parseSdp(const std::string &sdp, const std::string &base);
+	void addParameterSets(const std::string &base64List);
+	void learnResolution(const uint8_t *pBuf, const int nBuf);
+
+	// data path
+	bool drainTcp();
+	bool drainUdp(const int fd);
+	bool parseRxBuffer();
+	void onRtp(const uint8_t *pBuf, int nBuf);
+	void onRtcp(const uint8_t *pBuf, const int nBuf);
+	void depacketizeH264(const uint8_t *pPayload, const int nPayload);
+	void depacketizeHEVC(const uint8_t *pPayload, const int nPayload);
+	void emitAggregate(const uint8_t *pPayload, const int nPayload, const int offset);
+	void emitNal(const uint8_t *pNal, const int nNal);
+	void beginFragment(const uint8_t *pHeader, const int nHeader, const uint8_t *pData, const int nData);
+	void appendFragment(const uint8_t *pData, const int nData);
+	void deliver(AVPacket &packet);
+	void handOver(AVPacket &packet);
+	void reportStats(const uint64_t nowUs);
+	void onStreamEnd(const char *szReason);
+
+	simplelogger::Logger *logger_{ nullptr };
+	int channel_{ -1 };
+	void *handle_{ nullptr };
+	PacketCallback videoCallback_{ nullptr };
+
+	// connection
+	std::string host_;
+	int port_{ 554 };
+	std::string user_;
+	std::string password_;
+	std::string url_;			// without credentials
+	std::string controlUrl_;	// SETUP of the video track
+	std::string playUrl_;		// aggregate control, PLAY and TEARDOWN
+	std::string session_;
+	int sessionTimeoutSec_{ 60 };
+	int cseq_{ 0 };
+	bool bGetParameter_{ false };
+	bool bAuth_{ false };
+	bool bDigest_{ false };
+	std::string realm_;
+	std::string nonce_;
+
+	int rtspFd_{ -1 };
+	int rtpFd_{ -1 };			// UDP only
+	int rtcpFd_{ -1 };
+	int rtpChannel_{ 0 };		// TCP interleaved channels
+	int rtcpChannel_{ 1 };
+	int family_{ 0 };			// of the server address
+	RTSP_TRANSPORT transport_{ RTSP_TRANSPORT_TCP };
+	RtspReactor *pReactor_{ nullptr };
+
+	// track
+	VIDEO_CODEC codec_{ VIDEO_CODEC_H264 };
+	int payloadType_{ 96 };
+	int clockRate_{ 90000 };
+	int width_{ 0 };
+	int height_{ 0 };
+	std::vector<uint8_t > vParameterSets_;	// Annex-B, of the SDP
+	bool bInBandSets_{ false };				// parameter sets since the last slice
+
+	// receive buffers
+	std::vector<uint8_t > vRxBuf_;
+	size_t nRxBuf_{ 0 };
+	std::vector<uint8_t > vDatagrams_;
+
+	// depacketizer
+	JITTER_PARAMS jitterParams_;
+	RtpJitterBuffer *pJitter_{ nullptr };
+	AVPacket fragment_;
+	bool bFragment_{ false };
+	bool bLastMarker_{ true };
+	int64_t extTimestamp_{ 0 };
+	int64_t firstTimestamp_{ -1 };
+	int64_t srNtpUs_{ 0 };		// last RTCP sender report
+	uint32_t srRtpTimestamp_{ 0 };
+	std::atomic<uint64_t > nDamaged_{ 0 };
+	bool bTruncatedLogged_{ false };
+	uint64_t lastStatsUs_{ 0 };
+	uint64_t lastLossLogUs_{ 0 };
+	JITTER_STATS lastLogged_;
+	uint64_t lastLoggedDamaged_{ 0 };
+
+	std::atomic<bool > isTake_{ false };
+	std::atomic<bool > isStop_{ true };
+	bool isPrepareSuccess_{ false };
+	uint64_t lastReceiveUs_{ 0 };
+	uint64_t lastKeepaliveUs_{ 0 };
+};
+
+// StreamTaker, or RtspClient for rtsp:// URLs when client is native
+IStreamSource *createStreamSource(const char *url, const STREAM_CLIENT client, simplelogger::Logger *logger);
+
+#endif // RTSP_CLIENT_H
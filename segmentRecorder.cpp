@@ -0,0 +1,281 @@
+#include "segmentRecorder.h"
+#include "threadPlacement.h"
+#include <cerrno>
+#include <chrono>
+#include <unistd.h>
+
+static int64_t systemNowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool makeDir(const std::string &dir) {
+	return 0 == mkdir(dir.c_str(), 0755) || EEXIST == errno;
+}
+
+bool SegmentRecorder::start() {
+	if (!makeDir(params_.dir)) {
+		LOG_ERROR(logger_, "SegmentRecorder: cannot create " << params_.dir);
+		return false;
+	}
+	std::vector<RECORD_SEGMENT > vSegments;
+	for (int i = 0; i < (int)vChannels_.size(); ++i) {
+		listRecordSegments(recordChannelDir(params_.dir, i), vSegments);
+		for (size_t j = 0; j < vSegments.size(); ++j) {
+			mClosed_.insert(std::make_pair(vSegments[j].startUs, vSegments[j]));
+			nClosedBytes_ += vSegments[j].nBytes;
+		}
+	}
+	applyRetention();
+	LOG_INFO(logger_, "SegmentRecorder: " << params_.segmentSec << " s segments in " << params_.dir << ", "
+						<< mClosed_.size() << " segments of " << (nClosedBytes_ >> 20) << " MB kept from before");
+	bRunning_ = true;
+	thWriter_ = std::thread(&SegmentRecorder::writeLoop, this);
+	return true;
+}
+
+void SegmentRecorder::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		bRunning_ = false;
+	}
+	jobCv_.notify_one();
+	if (thWriter_.joinable()) {
+		thWriter_.join();
+	}
+}
+
+void SegmentRecorder::addChannel(const int channel, const VIDEO_CODEC codec) {
+	std::lock_guard<std::mutex> lock(mtx_);
+	CHANNEL_INPUT &ch = vChannels_[channel];
+	ch = CHANNEL_INPUT();
+	ch.bActive = true;
+	ch.codec = codec;
+}
+
+void SegmentRecorder::removeChannel(const int channel) {
+	std::lock_guard<std::mutex> lock(mtx_);
+	vChannels_[channel].bActive = false;
+	RECORD_JOB job;
+	job.channel = channel;
+	job.codec = vChannels_[channel].codec;
+	av_init_packet(&job.packet);
+	job.packet.data = nullptr;
+	job.packet.size = 0;
+	job.timeUs = 0;
+	job.bKeyframe = false;
+	post(job);
+}
+
+uint64_t SegmentRecorder::getNbDropped() const {
+	std::lock_guard<std::mutex> lock(mtx_);
+	uint64_t n = 0;
+	for (size_t i = 0; i < vChannels_.size(); ++i) {
+		n += vChannels_[i].nDropped;
+	}
+	return n;
+}
+
+void SegmentRecorder::onPacket(const int channel, const AVPacket &packet, const int64_t ptsUs, const int64_t dtsUs,
+								const uint64_t recvUs, const int64_t wallclockUs) {
+	if (channel < 0 || channel >= (int)vChannels_.size()) {
+		return;
+	}
+	// sources without a capture time are indexed by their arrival
+	int64_t timeUs = wallclockUs > 0 ? wallclockUs : systemNowUs();
+	std::lock_guard<std::mutex> lock(mtx_);
+	CHANNEL_INPUT &ch = vChannels_[channel];
+	if (!ch.bActive || !bRunning_) {
+		return;
+	}
+	bool bKeyframe = classifyPacket(packet.data, packet.size, ch.codec).bKeyframe;
+	if (nQueuedBytes_ + packet.size > params_.maxQueuedBytes) {
+		if (!ch.bBehind) {
+			LOG_WARN(logger_, "SegmentRecorder: " << (nQueuedBytes_ >> 20) << " MB behind the disk, channel "
+								<< channel << " skips to its next keyframe");
+		}
+		ch.bBehind = true;
+		ch.bWaitKeyframe = true;
+	}
+	if (ch.bWaitKeyframe && (!bKeyframe || nQueuedBytes_ + packet.size > params_.maxQueuedBytes)) {
+		if (ch.bBehind) {
+			ch.nDropped++;
+		}
+		return;
+	}
+	ch.bWaitKeyframe = false;
+	ch.bBehind = false;
+	RECORD_JOB job;
+	job.channel = channel;
+	job.codec = ch.codec;
+	av_init_packet(&job.packet);
+	if (av_packet_ref(&job.packet, &packet) < 0) {
+		ch.bWaitKeyframe = true;
+		return;
+	}
+	job.timeUs = timeUs;
+	job.bKeyframe = bKeyframe;
+	post(job);
+}
+
+// with mtx_ held
+void SegmentRecorder::post(const RECORD_JOB &job) {
+	jobs_.push_back(job);
+	nQueuedBytes_ += job.packet.size;
+	jobCv_.notify_one();
+}
+
+void SegmentRecorder::writeLoop() {
+	placeThread(ROLE_IO, "segmentWriter");
+	std::deque<RECORD_JOB > batch;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mtx_);
+			jobCv_.wait(lock, [this]() { return !jobs_.empty() || !bRunning_; });
+			if (jobs_.empty()) {
+				break;
+			}
+			batch.swap(jobs_);
+		}
+		size_t nBytes = 0;
+		for (size_t i = 0; i < batch.size(); ++i) {
+			RECORD_JOB &job = batch[i];
+			nBytes += job.packet.size;
+			write(vWriters_[job.channel], job);
+			av_packet_unref(&job.packet);
+		}
+		batch.clear();
+		std::lock_guard<std::mutex> lock(mtx_);
+		nQueuedBytes_ -= nBytes;
+	}
+	for (size_t i = 0; i < vWriters_.size(); ++i) {
+		closeSegment(vWriters_[i]);
+	}
+}
+
+void SegmentRecorder::write(CHANNEL_WRITER &writer, const RECORD_JOB &job) {
+	if (nullptr == job.packet.data) {
+		closeSegment(writer);
+		return;
+	}
+	const uint8_t *pBuf = job.packet.data;
+	const int nBuf = job.packet.size;
+	if (job.bKeyframe) {
+		// kept for keyframes which come without them, every indexed
+		// offset has to start a decodable stream
+		std::vector<uint8_t > vParameterSets;
+		int width = 0, height = 0;
+		bool bInBand = extractParameterSets(pBuf, nBuf, job.codec, vParameterSets, width, height);
+		if (bInBand) {
+			writer.vParameterSets.swap(vParameterSets);
+		}
+		int64_t segmentUs = (int64_t)(params_.segmentSec * 1e6);
+		if (nullptr != writer.fp
+			&& (job.timeUs < writer.segment.startUs || job.timeUs - writer.segment.startUs >= segmentUs)) {
+			closeSegment(writer);
+		}
+		if (nullptr == writer.fp && !openSegment(writer, job)) {
+			return;
+		}
+		// the previous GOP reaches the disk before the index points past it
+		fflush(writer.fp);
+		RECORD_INDEX_ENTRY entry;
+		entry.timeUs = job.timeUs;
+		entry.offset = writer.offset;
+		fwrite(&entry, sizeof(entry), 1, writer.fpIndex);
+		fflush(writer.fpIndex);
+		if (!bInBand && !writer.vParameterSets.empty()) {
+			fwrite(writer.vParameterSets.data(), 1, writer.vParameterSets.size(), writer.fp);
+			writer.offset += writer.vParameterSets.size();
+		}
+	}
+	if (nullptr == writer.fp) {
+		return;
+	}
+	if ((size_t)nBuf != fwrite(pBuf, 1, nBuf, writer.fp)) {
+		LOG_WARN(logger_, "SegmentRecorder: write failed, " << writer.segment.path << " closed");
+		closeSegment(writer);
+		return;
+	}
+	writer.offset += nBuf;
+	writer.segment.endUs = job.timeUs;
+}
+
+bool SegmentRecorder::openSegment(CHANNEL_WRITER &writer, const RECORD_JOB &job) {
+	std::string channelDir = recordChannelDir(params_.dir, job.channel);
+	if (!makeDir(channelDir)) {
+		LOG_WARN(logger_, "SegmentRecorder: cannot create " << channelDir);
+		return false;
+	}
+	std::string base = channelDir + "/" + std::to_string(job.timeUs / 1000);
+	writer.segment = RECORD_SEGMENT();
+	writer.segment.startUs = job.timeUs;
+	writer.segment.endUs = job.timeUs;
+	writer.segment.path = base + (VIDEO_CODEC_HEVC == job.codec ? ".h265" : ".h264");
+	writer.segment.indexPath = base + ".idx";
+	writer.fp = fopen(writer.segment.path.c_str(), "wb");
+	writer.fpIndex = fopen(writer.segment.indexPath.c_str(), "wb");
+	if (nullptr == writer.fp || nullptr == writer.fpIndex) {
+		LOG_WARN(logger_, "SegmentRecorder: cannot write " << writer.segment.path);
+		if (nullptr != writer.fp) {
+			fclose(writer.fp);
+			writer.fp = nullptr;
+		}
+		if (nullptr != writer.fpIndex) {
+			fclose(writer.fpIndex);
+			writer.fpIndex = nullptr;
+		}
+		return false;
+	}
+	writer.vBuffer.resize(params_.ioBufferBytes);
+	setvbuf(writer.fp, writer.vBuffer.data(), _IOFBF, writer.vBuffer.size());
+	RECORD_INDEX_HEADER header;
+	header.magic = RECORD_INDEX_MAGIC;
+	header.version = RECORD_INDEX_VERSION;
+	header.codec = VIDEO_CODEC_HEVC == job.codec ? 1 : 0;
+	header.entrySize = sizeof(RECORD_INDEX_ENTRY);
+	header.reserved = 0;
+	fwrite(&header, sizeof(header), 1, writer.fpIndex);
+	writer.offset = 0;
+	return true;
+}
+
+void SegmentRecorder::closeSegment(CHANNEL_WRITER &writer) {
+	if (nullptr == writer.fp) {
+		return;
+	}
+	writer.segment.nBytes = writer.offset + ftell(writer.fpIndex);
+	fclose(writer.fp);
+	fclose(writer.fpIndex);
+	writer.fp = nullptr;
+	writer.fpIndex = nullptr;
+	mClosed_.insert(std::make_pair(writer.segment.startUs, writer.segment));
+	nClosedBytes_ += writer.segment.nBytes;
+	LOG_DEBUG(logger_, "SegmentRecorder: " << writer.segment.path << ", " << (writer.segment.nBytes >> 10) << " KB");
+	applyRetention();
+}
+
+// Closed segments only, the oldest first. The open ones count towards
+// the size limit.
+void SegmentRecorder::applyRetention() {
+	int64_t expiredUs = params_.keepHours > 0.f ? systemNowUs() - (int64_t)(params_.keepHours * 3600e6) : INT64_MIN;
+	uint64_t nOpenBytes = 0;
+	for (size_t i = 0; i < vWriters_.size(); ++i) {
+		if (nullptr != vWriters_[i].fp) {
+			nOpenBytes += vWriters_[i].offset;
+		}
+	}
+	while (!mClosed_.empty()) {
+		const RECORD_SEGMENT &oldest = mClosed_.begin()->second;
+		bool bExpired = oldest.endUs < expiredUs;
+		bool bOver = params_.maxBytes > 0 && nClosedBytes_ + nOpenBytes > params_.maxBytes;
+		if (!bExpired && !bOver) {
+			break;
+		}
+		unlink(oldest.path.c_str());
+		unlink(oldest.indexPath.c_str());
+		nClosedBytes_ -= std::min(nClosedBytes_, oldest.nBytes);
+		LOG_DEBUG(logger_, "SegmentRecorder: " << oldest.path << (bExpired ? " expired" : " deleted for space"));
+		mClosed_.erase(mClosed_.begin());
+	}
+}
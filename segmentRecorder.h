@@ -0,0 +1,108 @@
+#ifndef SEGMENT_RECORDER_H
+#define SEGMENT_RECORDER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "streamSource.h"
+#include "nalParser.h"
+#include "recordIndex.h"
+#include "common/logger.h"
+
+typedef struct {
+	std::string dir = ".";
+	float segmentSec = 60.f;			// a segment is cut at the first keyframe past this
+	float keepHours = 0.f;				// segments older than this are deleted, 0 keeps them
+	uint64_t maxBytes = 0;				// all channels, the oldest segments go first, 0 for no limit
+	size_t maxQueuedBytes = 64 << 20;	// behind the disk, packets are dropped up to the next keyframe
+	size_t ioBufferBytes = 1 << 20;		// per open segment
+} RECORD_PARAMS;
+
+// Records the packets of the ingest path to keyframe-aligned segments,
+// see recordIndex.h, so one connection per camera serves both analysis
+// and recording. onPacket() only queues a packet reference; one writer
+// thread appends to the segments through large stdio buffers, keeps the
+// keyframe index and deletes old segments by age and total size.
+class SegmentRecorder : public IPacketObserver {
+public:
+	explicit
+	SegmentRecorder(const int nChannels, const RECORD_PARAMS &params, simplelogger::Logger *logger)
+	: params_(params), logger_(logger), vChannels_(nChannels), vWriters_(nChannels) {}
+
+	~SegmentRecorder() {
+		stop();
+	}
+
+	// picks up the segments of earlier runs for the retention
+	bool start();
+	// writes what is queued and closes the open segments
+	void stop();
+
+	void addChannel(const int channel, const VIDEO_CODEC codec);
+	// After the provider stopped calling onPacket(), closes the segment.
+	void removeChannel(const int channel);
+
+	// override, on the taker thread of the channel
+	void onPacket(const int channel, const AVPacket &packet, const int64_t ptsUs, const int64_t dtsUs,
+				const uint64_t recvUs, const int64_t wallclockUs) override;
+
+	uint64_t getNbDropped() const;
+
+private:
+	typedef struct {
+		bool bActive = false;
+		VIDEO_CODEC codec = VIDEO_CODEC_H264;
+		bool bWaitKeyframe = true;		// segments start at a keyframe, so does a gap
+		bool bBehind = false;			// the queue overflowed
+		uint64_t nDropped = 0;
+	} CHANNEL_INPUT;
+
+	typedef struct {
+		int channel;
+		VIDEO_CODEC codec;
+		AVPacket packet;				// a reference of its own, no data to close the segment
+		int64_t timeUs;
+		bool bKeyframe;
+	} RECORD_JOB;
+
+	// state of the writer thread
+	typedef struct {
+		FILE *fp = nullptr;
+		FILE *fpIndex = nullptr;
+		std::vector<char > vBuffer;
+		RECORD_SEGMENT segment;
+		uint64_t offset = 0;
+		std::vector<uint8_t > vParameterSets;	// of the last keyframe which carried them
+	} CHANNEL_WRITER;
+
+	void post(const RECORD_JOB &job);
+	void writeLoop();
+	void write(CHANNEL_WRITER &writer, const RECORD_JOB &job);
+	bool openSegment(CHANNEL_WRITER &writer, const RECORD_JOB &job);
+	void closeSegment(CHANNEL_WRITER &writer);
+	void applyRetention();
+
+	RECORD_PARAMS params_;
+	simplelogger::Logger *logger_{ nullptr };
+	std::vector<CHANNEL_INPUT > vChannels_;
+	mutable std::mutex mtx_;
+
+	std::deque<RECORD_JOB > jobs_;
+	size_t nQueuedBytes_{ 0 };
+	std::condition_variable jobCv_;
+	bool bRunning_{ false };
+	std::thread thWriter_;
+
+	std::vector<CHANNEL_WRITER > vWriters_;
+	// closed segments of all channels by start time, for the retention
+	std::multimap<int64_t, RECORD_SEGMENT > mClosed_;
+	uint64_t nClosedBytes_{ 0 };
+};
+
+#endif // SEGMENT_RECORDER_H
@@ -0,0 +1,246 @@
+#ifndef SHARED_RECORDING_H
+#define SHARED_RECORDING_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nalParser.h"
+#include "common/logger.h"
+
+typedef struct {
+	uint64_t offset = 0;		// of the first start code
+	uint32_t size = 0;
+	bool bKeyframe = false;
+	bool bParameterSets = false;	// carries its own SPS/PPS (VPS)
+} RECORDED_FRAME;
+
+// One Annex-B H.264/HEVC recording, mapped read-only and indexed once,
+// behind any number of VirtualCameraProvider channels. Each index entry
+// is an access unit: the parameter sets, SEI and AUD in front of a
+// picture, and all slices of that picture. The providers hand out
+// pointers into the mapping, the only per-channel state is a cursor.
+class SharedRecording {
+public:
+	explicit
+	SharedRecording(const char *szPath, simplelogger::Logger *logger)
+	: path_(szPath), logger_(logger) {}
+
+	~SharedRecording() {
+		if (nullptr != pData_) {
+			munmap((void *)pData_, nData_);
+		}
+	}
+
+	bool load() {
+		int fd = open(path_.c_str(), O_RDONLY);
+		if (fd < 0) {
+			LOG_ERROR(logger_, "SharedRecording: failed to open " << path_);
+			return false;
+		}
+		struct stat st;
+		if (0 != fstat(fd, &st) || st.st_size < 4) {
+			LOG_ERROR(logger_, "SharedRecording: empty recording " << path_);
+			close(fd);
+			return false;
+		}
+		void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (MAP_FAILED == p) {
+			LOG_ERROR(logger_, "SharedRecording: failed to map " << path_);
+			return false;
+		}
+		pData_ = (const uint8_t *)p;
+		nData_ = st.st_size;
+		madvise(p, nData_, MADV_WILLNEED);
+
+		codec_ = guessCodec();
+		index();
+		if (vKeyframes_.empty()) {
+			LOG_ERROR(logger_, "SharedRecording: no keyframe in " << path_);
+			return false;
+		}
+		LOG_INFO(logger_, "SharedRecording: " << path_ << ", " << (VIDEO_CODEC_HEVC == codec_ ? "HEVC" : "H.264")
+							<< " " << width_ << "x" << height_ << ", " << vFrames_.size() << " pictures, "
+							<< vKeyframes_.size() << " keyframes");
+		return true;
+	}
+
+	const uint8_t *getData(const RECORDED_FRAME &frame) const { return pData_ + frame.offset; }
+	const RECORDED_FRAME &getFrame(const int i) const { return vFrames_[i]; }
+	int getNbFrames() const { return (int)vFrames_.size(); }
+	VIDEO_CODEC getCodec() const { return codec_; }
+	int getWidth() const { return width_; }
+	int getHeight() const { return height_; }
+
+	const std::vector<int > &getKeyframes() const { return vKeyframes_; }
+
+	// SPS/PPS (VPS) with start codes in force at a keyframe which does not
+	// carry them, e.g. when the encoder sent them once at the start and a
+	// decoder joins there; nullptr when it has its own or there are none.
+	const std::vector<uint8_t > *getParameterSets(const int keyframe) const {
+		if (vFrames_[keyframe].bParameterSets) {
+			return nullptr;
+		}
+		std::vector<int >::const_iterator it = std::lower_bound(vKeyframes_.begin(), vKeyframes_.end(), keyframe);
+		if (it == vKeyframes_.end() || *it != keyframe) {
+			return nullptr;
+		}
+		int group = vKeyParameterSets_[it - vKeyframes_.begin()];
+		return group < 0 ? nullptr : &vParameterSets_[group];
+	}
+
+	// The first keyframe at or after frame, wrapping to the start.
+	int keyframeAtOrAfter(const int frame) const {
+		for (size_t i = 0; i < vKeyframes_.size(); ++i) {
+			if (vKeyframes_[i] >= frame) {
+				return vKeyframes_[i];
+			}
+		}
+		return vKeyframes_[0];
+	}
+
+private:
+	// HEVC streams open with a VPS or an AUD, a .265/.hevc name decides otherwise
+	VIDEO_CODEC guessCodec() const {
+		uint64_t pos = nextNal(0);
+		if (pos + 1 < nData_) {
+			int type = (pData_[pos] >> 1) & 0x3f;
+			if (0 == (pData_[pos] & 0x81) && 1 == pData_[pos + 1] && (32 == type || 35 == type)) {
+				return VIDEO_CODEC_HEVC;
+			}
+		}
+		size_t dot = path_.rfind('.');
+		std::string ext = std::string::npos == dot ? "" : path_.substr(dot + 1);
+		return "265" == ext || "h265" == ext || "hevc" == ext ? VIDEO_CODEC_HEVC : VIDEO_CODEC_H264;
+	}
+
+	// NAL units which open an access unit ahead of its first slice
+	bool isPrefixNal(const uint8_t nalHeader) const {
+		if (VIDEO_CODEC_HEVC == codec_) {
+			int type = (nalHeader >> 1) & 0x3f;
+			return (type >= 32 && type <= 36) || 39 == type || (type >= 41 && type <= 44);
+		}
+		int type = nalHeader & 0x1f;
+		return (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+	}
+
+	bool isParameterSetNal(const uint8_t nalHeader) const {
+		if (VIDEO_CODEC_HEVC == codec_) {
+			int type = (nalHeader >> 1) & 0x3f;
+			return type >= 32 && type <= 34;
+		}
+		int type = nalHeader & 0x1f;
+		return 7 == type || 8 == type;
+	}
+
+	// Offset of the NAL header after the next start code at or after pos,
+	// nData_ if there is none. Offsets are 64-bit, recordings may be large.
+	uint64_t nextNal(uint64_t pos) const {
+		while (pos + 2 < nData_) {
+			const uint8_t *pOne = (const uint8_t *)memchr(pData_ + pos + 2, 1, nData_ - pos - 2);
+			if (nullptr == pOne) {
+				break;
+			}
+			uint64_t one = pOne - pData_;
+			if (0 == pData_[one - 1] && 0 == pData_[one - 2]) {
+				return one + 1;
+			}
+			pos = one - 1;
+		}
+		return nData_;
+	}
+
+	// first byte of the 3 or 4 byte start code in front of a NAL header
+	uint64_t startCodeOf(const uint64_t nal) const {
+		return nal >= 4 && 0 == pData_[nal - 4] ? nal - 4 : nal - 3;
+	}
+
+	void index() {
+		RECORDED_FRAME frame;
+		bool bOpen = false;
+		bool bHasPicture = false;
+		uint64_t nal = nextNal(0);
+		while (nal < nData_) {
+			uint64_t next = nextNal(nal);
+			uint64_t end = next < nData_ ? startCodeOf(next) : nData_;
+			if (end > nal) {
+				addNal(frame, bOpen, bHasPicture, nal, end);
+			}
+			nal = next;
+		}
+		if (bHasPicture) {
+			addFrame(frame);
+		}
+	}
+
+	// NAL unit [nal, end), a new access unit starts at a prefix NAL or at
+	// the first slice of a picture once the current one has a picture
+	void addNal(RECORDED_FRAME &frame, bool &bOpen, bool &bHasPicture, const uint64_t nal, const uint64_t end) {
+		int nNal = (int)std::min<uint64_t>(end - nal, 1024);
+		PACKET_CLASS c;
+		if (VIDEO_CODEC_HEVC == codec_) {
+			classifyNalHEVC(pData_ + nal, nNal, c);
+		} else {
+			classifyNalH264(pData_ + nal, nNal, c);
+		}
+		if (0 == width_ && !c.bPicture) {
+			parseSps(pData_ + nal, nNal, codec_, width_, height_);
+		}
+		if (bHasPicture && (c.bPicture ? c.bNewPicture : isPrefixNal(pData_[nal]))) {
+			addFrame(frame);
+			bOpen = false;
+			bHasPicture = false;
+		}
+		if (!bOpen) {
+			frame = RECORDED_FRAME();
+			frame.offset = startCodeOf(nal);
+			bOpen = true;
+		}
+		frame.size = (uint32_t)(end - frame.offset);
+		if (c.bPicture) {
+			bHasPicture = true;
+			frame.bKeyframe = frame.bKeyframe || c.bKeyframe;
+		} else if (isParameterSetNal(pData_[nal])) {
+			// the parameter sets in front of one picture are one group
+			if (!frame.bParameterSets) {
+				vParameterSets_.push_back(std::vector<uint8_t >());
+			}
+			frame.bParameterSets = true;
+			uint64_t start = startCodeOf(nal);
+			vParameterSets_.back().insert(vParameterSets_.back().end(), pData_ + start, pData_ + end);
+		}
+	}
+
+	void addFrame(const RECORDED_FRAME &frame) {
+		// most encoders repeat the same ones at every keyframe
+		size_t nGroups = vParameterSets_.size();
+		if (frame.bParameterSets && nGroups >= 2 && vParameterSets_[nGroups - 1] == vParameterSets_[nGroups - 2]) {
+			vParameterSets_.pop_back();
+		}
+		if (frame.bKeyframe) {
+			vKeyframes_.push_back((int)vFrames_.size());
+			vKeyParameterSets_.push_back((int)vParameterSets_.size() - 1);
+		}
+		vFrames_.push_back(frame);
+	}
+
+	std::string path_;
+	simplelogger::Logger *logger_{ nullptr };
+	const uint8_t *pData_{ nullptr };
+	uint64_t nData_{ 0 };
+	VIDEO_CODEC codec_{ VIDEO_CODEC_H264 };
+	int width_{ 0 };
+	int height_{ 0 };
+	std::vector<RECORDED_FRAME > vFrames_;
+	std::vector<int > vKeyframes_;
+	std::vector<std::vector<uint8_t > > vParameterSets_;
+	std::vector<int > vKeyParameterSets_;	// group in force at each keyframe, -1 for none
+};
+
+#endif // SHARED_RECORDING_H
@@ -0,0 +1,248 @@
+#include "snapshotEncoder.h"
+#include "threadPlacement.h"
+#include <cstdio>
+#include <cstdlib>
+#include <csetjmp>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <sys/stat.h>
+extern "C" {
+#include <jpeglib.h>
+}
+
+// One libjpeg compressor, reused for every picture of a worker. The
+// planes go in as raw 4:2:0 data, which skips the colour conversion and
+// the downsampling of the library.
+class JpegEncoder {
+public:
+	JpegEncoder() {
+		cinfo_.err = jpeg_std_error(&err_.pub);
+		err_.pub.error_exit = onError;
+		jpeg_create_compress(&cinfo_);
+	}
+
+	~JpegEncoder() {
+		jpeg_destroy_compress(&cinfo_);
+		if (nullptr != pBuf_) {
+			free(pBuf_);
+		}
+	}
+
+	// The JPEG stays valid until the next call.
+	bool encode(const I420_IMAGE &image, const int quality, const uint8_t *&pJpeg, size_t &nJpeg) {
+		unsigned char *pOut = pBuf_;
+		unsigned long nOut = nBuf_;
+		if (setjmp(err_.jump)) {
+			jpeg_abort_compress(&cinfo_);
+			return false;
+		}
+		jpeg_mem_dest(&cinfo_, &pOut, &nOut);
+		cinfo_.image_width = image.width;
+		cinfo_.image_height = image.height;
+		cinfo_.input_components = 3;
+		cinfo_.in_color_space = JCS_YCbCr;
+		jpeg_set_defaults(&cinfo_);
+		jpeg_set_quality(&cinfo_, quality, TRUE);
+		cinfo_.raw_data_in = TRUE;
+		cinfo_.dct_method = JDCT_IFAST;
+		cinfo_.comp_info[0].h_samp_factor = 2;
+		cinfo_.comp_info[0].v_samp_factor = 2;
+		for (int i = 1; i < 3; ++i) {
+			cinfo_.comp_info[i].h_samp_factor = 1;
+			cinfo_.comp_info[i].v_samp_factor = 1;
+		}
+		jpeg_start_compress(&cinfo_, TRUE);
+		// one MCU row per call, the planes are padded to whole MCUs
+		JSAMPROW rowsY[16], rowsU[8], rowsV[8];
+		JSAMPARRAY planes[3] = { rowsY, rowsU, rowsV };
+		uint8_t *pY = const_cast<uint8_t *>(image.y.data());
+		uint8_t *pU = const_cast<uint8_t *>(image.u.data());
+		uint8_t *pV = const_cast<uint8_t *>(image.v.data());
+		while (cinfo_.next_scanline < cinfo_.image_height) {
+			int row = cinfo_.next_scanline;
+			for (int i = 0; i < 16; ++i) {
+				rowsY[i] = pY + (row + i) * image.pitchY;
+			}
+			for (int i = 0; i < 8; ++i) {
+				rowsU[i] = pU + (row / 2 + i) * image.pitchC;
+				rowsV[i] = pV + (row / 2 + i) * image.pitchC;
+			}
+			jpeg_write_raw_data(&cinfo_, planes, 16);
+		}
+		jpeg_finish_compress(&cinfo_);
+		// the library moved to a larger buffer, it is ours from now on
+		if (pOut != pBuf_) {
+			if (nullptr != pBuf_) {
+				free(pBuf_);
+			}
+			pBuf_ = pOut;
+			nBuf_ = nOut;
+		}
+		pJpeg = pOut;
+		nJpeg = nOut;
+		return true;
+	}
+
+private:
+	typedef struct {
+		jpeg_error_mgr pub;
+		jmp_buf jump;
+	} ERROR_MANAGER;
+
+	static void onError(j_common_ptr cinfo) {
+		longjmp(reinterpret_cast<ERROR_MANAGER *>(cinfo->err)->jump, 1);
+	}
+
+	jpeg_compress_struct cinfo_;
+	ERROR_MANAGER err_;
+	unsigned char *pBuf_{ nullptr };
+	unsigned long nBuf_{ 0 };
+};
+
+static uint64_t steadyNowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SnapshotEncoderPool::~SnapshotEncoderPool() {
+	stop();
+	for (size_t i = 0; i < vFree_.size(); ++i) {
+		delete vFree_[i];
+	}
+}
+
+bool SnapshotEncoderPool::start() {
+	if (nullptr == callback_ && 0 != mkdir(params_.dir.c_str(), 0755) && EEXIST != errno) {
+		LOG_ERROR(logger_, "SnapshotEncoderPool: cannot create " << params_.dir);
+		return false;
+	}
+	bRunning_ = true;
+	for (int i = 0; i < params_.nWorkers; ++i) {
+		vWorkers_.push_back(std::thread(&SnapshotEncoderPool::workLoop, this));
+	}
+	LOG_INFO(logger_, "SnapshotEncoderPool: " << params_.nWorkers << " encoders, quality " << params_.quality
+						<< ", crops up to " << params_.maxSide << " px, "
+						<< (nullptr == callback_ ? "files in " + params_.dir : std::string("to the callback")));
+	return true;
+}
+
+void SnapshotEncoderPool::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		bRunning_ = false;
+	}
+	cv_.notify_all();
+	for (size_t i = 0; i < vWorkers_.size(); ++i) {
+		vWorkers_[i].join();
+	}
+	vWorkers_.clear();
+}
+
+SNAPSHOT_FRAME *SnapshotEncoderPool::acquire(const size_t nBytes) {
+	SNAPSHOT_FRAME *pFrame = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (!vFree_.empty()) {
+			pFrame = vFree_.back();
+			vFree_.pop_back();
+		} else if (nFrames_ < params_.maxFrames) {
+			pFrame = new SNAPSHOT_FRAME();
+			nFrames_++;
+		}
+	}
+	if (nullptr == pFrame) {
+		nDropped_.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+	// the buffers keep their capacity, the size of the channels settles quickly
+	pFrame->data.resize(nBytes);
+	pFrame->vSnapshots.clear();
+	return pFrame;
+}
+
+void SnapshotEncoderPool::submit(SNAPSHOT_FRAME *pFrame) {
+	pFrame->submitUs = steadyNowUs();
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		queue_.push_back(pFrame);
+	}
+	cv_.notify_one();
+}
+
+void SnapshotEncoderPool::release(SNAPSHOT_FRAME *pFrame) {
+	std::lock_guard<std::mutex> lock(mtx_);
+	vFree_.push_back(pFrame);
+}
+
+void SnapshotEncoderPool::workLoop() {
+	placeThread(ROLE_IO, "snapshot");
+	JpegEncoder encoder;
+	I420_IMAGE image;
+	NV12_SCRATCH scratch;
+	while (true) {
+		SNAPSHOT_FRAME *pFrame = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mtx_);
+			cv_.wait(lock, [this]() { return !queue_.empty() || !bRunning_; });
+			if (queue_.empty()) {
+				break;
+			}
+			pFrame = queue_.front();
+			queue_.pop_front();
+		}
+		encodeFrame(encoder, image, scratch, *pFrame);
+		release(pFrame);
+	}
+}
+
+void SnapshotEncoderPool::encodeFrame(JpegEncoder &encoder, I420_IMAGE &image, NV12_SCRATCH &scratch,
+										const SNAPSHOT_FRAME &frame) {
+	for (size_t i = 0; i < frame.vSnapshots.size(); ++i) {
+		const SNAPSHOT_INFO &info = frame.vSnapshots[i];
+		IMAGE_RECT rect = getSnapshotRect(info, params_.margin, frame.width, frame.height);
+		int maxSide = info.category < 0 ? params_.fullMaxSide : params_.maxSide;
+		const uint8_t *pJpeg = nullptr;
+		size_t nJpeg = 0;
+		if (!cropNv12(frame.data.data(), frame.width, frame.height, rect, maxSide, image, scratch)
+			|| !encoder.encode(image, params_.quality, pJpeg, nJpeg)) {
+			LOG_WARN(logger_, "SnapshotEncoderPool: no snapshot of channel " << info.channel
+								<< ", frame " << info.frameIndex);
+			continue;
+		}
+		deliver(info, i, pJpeg, nJpeg);
+		nEncoded_.fetch_add(1, std::memory_order_relaxed);
+		nBytes_.fetch_add(nJpeg, std::memory_order_relaxed);
+		latency_.record(steadyNowUs() - frame.submitUs);
+	}
+}
+
+// <dir>/ch<N>_<YYYYmmdd-HHMMSS.mmm>_<frame>_<i>_<category|full>.jpg, named
+// after the capture time when the source has one
+void SnapshotEncoderPool::deliver(const SNAPSHOT_INFO &info, const size_t iSnapshot, const uint8_t *pJpeg,
+									const size_t nJpeg) {
+	if (nullptr != callback_) {
+		callback_(handle_, info, pJpeg, nJpeg);
+		return;
+	}
+	int64_t us = info.wallclockUs > 0 ? info.wallclockUs
+				: std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::system_clock::now().time_since_epoch()).count();
+	time_t seconds = (time_t)(us / 1000000);
+	struct tm local;
+	localtime_r(&seconds, &local);
+	char szTime[32];
+	strftime(szTime, sizeof(szTime), "%Y%m%d-%H%M%S", &local);
+	char szName[96];
+	snprintf(szName, sizeof(szName), "ch%d_%s.%03d_%d_%zu_", info.channel, szTime, (int)(us / 1000 % 1000),
+			info.frameIndex, iSnapshot);
+	std::string path = params_.dir + "/" + szName
+						+ (info.category < 0 ? std::string("full") : std::to_string(info.category)) + ".jpg";
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (nullptr == fp) {
+		LOG_WARN(logger_, "SnapshotEncoderPool: cannot write " << path);
+		return;
+	}
+	fwrite(pJpeg, 1, nJpeg, fp);
+	fclose(fp);
+}
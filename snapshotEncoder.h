@@ -0,0 +1,136 @@
+#ifndef SNAPSHOT_ENCODER_H
+#define SNAPSHOT_ENCODER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include "nv12Image.h"
+#include "common/histogram.h"
+#include "common/logger.h"
+
+typedef struct {
+	std::string dir = ".";		// without a callback, see SnapshotEncoderPool::deliver()
+	int nWorkers = 2;
+	int quality = 85;
+	int maxSide = 320;			// longer side of a crop, 0 keeps the size
+	int fullMaxSide = 960;		// of a full frame
+	float margin = 0.2f;		// context around a box, relative to its size
+	float intervalSec = 10.f;	// between snapshots of one channel and class
+	uint32_t categoryMask = 0xFFFFFFFF;
+	bool bFullFrame = false;	// a full frame next to the crops
+	int maxFrames = 8;			// pictures copied and waiting for a worker, more are dropped
+} SNAPSHOT_PARAMS;
+
+typedef struct {
+	int channel = 0;
+	int frameIndex = 0;
+	int64_t wallclockUs = 0;	// capture time, 0 when the source has none
+	int category = -1;			// -1 for the full frame
+	float x = 0.f;				// the box, normalized
+	float y = 0.f;
+	float w = 0.f;
+	float h = 0.f;
+} SNAPSHOT_INFO;
+
+// Called on a worker thread, the JPEG is valid for the call only.
+typedef void (*SnapshotCallback)(void *handle, const SNAPSHOT_INFO &info, const uint8_t *pJpeg, const size_t nJpeg);
+
+// A host copy of one NV12 picture and the snapshots cut out of it.
+typedef struct {
+	std::vector<uint8_t > data;
+	int width = 0;
+	int height = 0;
+	std::vector<SNAPSHOT_INFO > vSnapshots;
+	uint64_t submitUs = 0;
+} SNAPSHOT_FRAME;
+
+// The pixels a snapshot covers, the box with its margin or the full frame,
+// not yet clamped to the picture.
+inline IMAGE_RECT getSnapshotRect(const SNAPSHOT_INFO &info, const float margin, const int width, const int height) {
+	IMAGE_RECT rect;
+	if (info.category < 0) {
+		rect.w = width;
+		rect.h = height;
+		return rect;
+	}
+	float mx = info.w * margin, my = info.h * margin;
+	rect.x = (int)((info.x - mx) * width);
+	rect.y = (int)((info.y - my) * height);
+	rect.w = (int)((info.w + 2.f * mx) * width);
+	rect.h = (int)((info.h + 2.f * my) * height);
+	return rect;
+}
+
+class JpegEncoder;
+
+// Crops, scales and JPEG-encodes snapshots off the pipeline threads. The
+// picture buffers come from a fixed pool: a sink copies a picture only
+// after it got a buffer, and when every buffer waits for a worker the
+// snapshot is dropped instead of stalling the analysis. Each worker keeps
+// its encoder and scaling buffers for the life of the pool.
+class SnapshotEncoderPool {
+public:
+	explicit
+	SnapshotEncoderPool(const SNAPSHOT_PARAMS &params, simplelogger::Logger *logger)
+	: params_(params), logger_(logger) {}
+
+	~SnapshotEncoderPool();
+
+	// Instead of the files, before start().
+	void setCallback(void *handle, SnapshotCallback callback) {
+		handle_ = handle;
+		callback_ = callback;
+	}
+
+	bool start();
+	// encodes what is queued
+	void stop();
+
+	const SNAPSHOT_PARAMS &getParams() const { return params_; }
+
+	// A free buffer for a picture of nBytes, nullptr when all of them are
+	// in use, the frame is counted as dropped then.
+	SNAPSHOT_FRAME *acquire(const size_t nBytes);
+	// Queues the snapshots of the frame, its buffer returns to the pool
+	// once they are encoded.
+	void submit(SNAPSHOT_FRAME *pFrame);
+	// Returns a buffer without encoding it.
+	void release(SNAPSHOT_FRAME *pFrame);
+
+	uint64_t getNbEncoded() const { return nEncoded_.load(std::memory_order_relaxed); }
+	// frames
+	uint64_t getNbDropped() const { return nDropped_.load(std::memory_order_relaxed); }
+	uint64_t getNbBytes() const { return nBytes_.load(std::memory_order_relaxed); }
+	// from submit() to the written JPEG, per snapshot
+	const LatencyHistogram &getLatency() const { return latency_; }
+
+private:
+	void workLoop();
+	void encodeFrame(JpegEncoder &encoder, I420_IMAGE &image, NV12_SCRATCH &scratch, const SNAPSHOT_FRAME &frame);
+	void deliver(const SNAPSHOT_INFO &info, const size_t iSnapshot, const uint8_t *pJpeg, const size_t nJpeg);
+
+	SNAPSHOT_PARAMS params_;
+	simplelogger::Logger *logger_{ nullptr };
+	void *handle_{ nullptr };
+	SnapshotCallback callback_{ nullptr };
+
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	std::vector<SNAPSHOT_FRAME *> vFree_;
+	int nFrames_{ 0 };						// allocated, at most maxFrames
+	std::deque<SNAPSHOT_FRAME *> queue_;
+	bool bRunning_{ false };
+	std::vector<std::thread > vWorkers_;
+
+	std::atomic<uint64_t > nEncoded_{ 0 };
+	std::atomic<uint64_t > nDropped_{ 0 };
+	std::atomic<uint64_t > nBytes_{ 0 };
+	LatencyHistogram latency_;
+};
+
+#endif // SNAPSHOT_ENCODER_H
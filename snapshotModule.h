@@ -0,0 +1,252 @@
+#ifndef SNAPSHOT_MODULE_H
+#define SNAPSHOT_MODULE_H
+
+#include "common.h"
+#include "snapshotEncoder.h"
+
+// Picks the detections worth a snapshot: objects new to the channel, at
+// most one snapshot per channel and class every intervalSec. A box is new
+// when no box of its class in the previous frame of the channel overlaps
+// it by IoU 0.3 or more, so an object is captured when it shows up and not
+// for as long as it stays. Shared by the pipelines, channels move between
+// devices.
+class SnapshotSelector {
+public:
+	explicit
+	SnapshotSelector(const int nChannels, const SNAPSHOT_PARAMS &params)
+	: vChannels_(nChannels), intervalUs_((uint64_t)(params.intervalSec * 1e6)), categoryMask_(params.categoryMask) {}
+
+	// indices of the boxes to capture, timeUs on the clock of the tracer
+	void select(const int channel, const uint64_t timeUs, const BBOXS_PER_FRAME &bboxs, std::vector<int> &vSelected) {
+		vSelected.clear();
+		std::lock_guard<std::mutex> lock(mtx_);
+		CHANNEL_STATE &ch = vChannels_[channel];
+		for (int i = 0; i < bboxs.nBBox; ++i) {
+			const BBOX_INFO &box = bboxs.bbox[i];
+			if (box.bSkip || box.category < 0 || box.category >= MAX_CATEGORIES
+				|| 0 == (categoryMask_ & (1u << box.category))) {
+				continue;
+			}
+			bool bNew = true;
+			for (size_t j = 0; j < ch.vPrevious.size() && bNew; ++j) {
+				bNew = ch.vPrevious[j].category != box.category || getIoU(ch.vPrevious[j], box) < 0.3f;
+			}
+			uint64_t &lastUs = ch.vLastUs[box.category];
+			if (bNew && (0 == lastUs || timeUs - lastUs >= intervalUs_)) {
+				vSelected.push_back(i);
+				lastUs = timeUs;
+			}
+		}
+		ch.vPrevious.clear();
+		for (int i = 0; i < bboxs.nBBox; ++i) {
+			if (!bboxs.bbox[i].bSkip) {
+				ch.vPrevious.push_back(bboxs.bbox[i]);
+			}
+		}
+	}
+
+private:
+	static const int MAX_CATEGORIES = 32;
+
+	typedef struct {
+		std::vector<BBOX_INFO > vPrevious;
+		std::vector<uint64_t > vLastUs = std::vector<uint64_t >(MAX_CATEGORIES, 0);
+	} CHANNEL_STATE;
+
+	static float getIoU(const BBOX_INFO &a, const BBOX_INFO &b) {
+		float w = std::min(a.x + a.w, b.x + b.w) - std::max(a.x, b.x);
+		float h = std::min(a.y + a.h, b.y + b.h) - std::max(a.y, b.y);
+		if (w <= 0.f || h <= 0.f) {
+			return 0.f;
+		}
+		float overlap = w * h;
+		return overlap / (a.w * a.h + b.w * b.h - overlap);
+	}
+
+	std::mutex mtx_;
+	std::vector<CHANNEL_STATE > vChannels_;
+	uint64_t intervalUs_{ 0 };
+	uint32_t categoryMask_{ 0 };
+};
+
+// Hands the frames with new objects to the snapshot encoders. Only the
+// rows the snapshots cover are copied off the device, and only once a
+// pooled buffer is free; the cropping, scaling and encoding happen on the
+// encoder threads.
+class SnapshotModule : public IModule {
+public:
+	explicit
+	SnapshotModule(PRE_MODULE_LIST &preModules,
+					SnapshotEncoderPool *pPool,
+					SnapshotSelector *pSelector,
+					simplelogger::Logger *logger,
+					ChannelScheduler *pScheduler = nullptr,
+					const int workerID = 0)
+	: preModules_(preModules), pPool_(pPool), pSelector_(pSelector), logger_(logger),
+	  pScheduler_(pScheduler), workerID_(workerID) {}
+
+	~SnapshotModule() {}
+
+	// override
+	void initialize() override {}
+
+	void execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) override;
+
+	void destroy() override {}
+
+	int getNbInputs() const override {
+		return preModules_.size();
+	}
+
+	PRE_MODULE getPreModule(const int tensorIndex) const override {
+		return preModules_[tensorIndex];
+	}
+
+	int getNbOutputs() const override {
+		return vpOutputTensors_.size();
+	}
+
+	IStreamTensor* getOutputTensor(const int tensorIndex) const override {
+		return vpOutputTensors_[tensorIndex];
+	}
+
+	void setProfiler(IModuleProfiler *pProfiler) override {
+		pProfiler_ = pProfiler;
+	}
+
+	IModuleProfiler* getProfiler() const override {
+		return pProfiler_;
+	}
+
+	void setCallback(void *pUserData, MODULE_CALLBACK callback) override {
+		pUserData_ = pUserData;
+		callback_ = callback;
+	}
+
+	std::pair<void *, MODULE_CALLBACK> getCallback() const override {
+		return std::pair<void*, MODULE_CALLBACK>(pUserData_, callback_);
+	}
+
+private:
+	SnapshotEncoderPool *pPool_{ nullptr };
+	SnapshotSelector *pSelector_{ nullptr };
+	simplelogger::Logger *logger_{ nullptr };
+	ChannelScheduler *pScheduler_{ nullptr };
+	int workerID_{ 0 };
+	std::vector<int > vSelected_;
+	std::vector<SNAPSHOT_FRAME *> vpFrames_;
+
+	void *pUserData_{ nullptr };
+	MODULE_CALLBACK callback_{ nullptr };
+	IModuleProfiler* pProfiler_{ nullptr };
+
+	PRE_MODULE_LIST preModules_;
+	std::vector<IStreamTensor*> vpOutputTensors_;
+};
+
+void SnapshotModule::execute(const ModuleContext& context, const std::vector<IStreamTensor *>& vpInputTensors,  const std::vector<IStreamTensor *>& vpOutputTensors) {
+	TRACE_RANGE("SnapshotModule::execute");
+	assert(2 == vpInputTensors.size());
+	std::vector<int> shape_nv12 = vpInputTensors[0]->getShape();
+	assert(NV12_FRAME == vpInputTensors[0]->getTensorType());
+	int nFrames = shape_nv12[0];
+	int nHeight = shape_nv12[2] * 2; // NV12, YUV420
+	int nWidth = shape_nv12[3];
+	if (0 == nFrames) {
+		return;
+	}
+	// the GPU convertor leaves the frames on the device, the CPU backend on the host
+	bool bDevice = GPU_DATA == vpInputTensors[0]->getMemoryType();
+	const uint8_t *pFrames = reinterpret_cast<const uint8_t *>(bDevice ? vpInputTensors[0]->getGpuData()
+																		: vpInputTensors[0]->getCpuData());
+	std::vector<TRACE_INFO > tensorInfo_nv12 = vpInputTensors[0]->getTraceInfos();
+	assert(OBJ_COORD == vpInputTensors[1]->getTensorType());
+	BBOXS_PER_FRAME *pBBox_batch = reinterpret_cast<BBOXS_PER_FRAME*>(vpInputTensors[1]->getCpuData());
+	assert(nullptr != pBBox_batch);
+
+	const SNAPSHOT_PARAMS &params = pPool_->getParams();
+	const size_t nLuma = (size_t)nWidth * nHeight;
+	const size_t nFrameSize = nLuma * 3 / 2;
+	vpFrames_.clear();
+	for (int iF = 0; iF < nFrames; ++iF) {
+		int lane = tensorInfo_nv12[iF].videoIndex;
+		int channel = lane;
+		if (nullptr != pScheduler_) {
+			channel = pScheduler_->getChannel(workerID_, lane);
+			if (channel < 0) {
+				continue;
+			}
+		}
+		PACKET_STAMP stamp;
+		if (nullptr == g_pTracer || !g_pTracer->lookup(workerID_, lane, tensorInfo_nv12[iF].frameIndex, stamp)) {
+			stamp.recvUs = metricsNowUs();
+			stamp.wallclockUs = 0;
+		}
+		const BBOXS_PER_FRAME &bboxs = pBBox_batch[iF];
+		pSelector_->select(channel, stamp.recvUs, bboxs, vSelected_);
+		if (vSelected_.empty()) {
+			continue;
+		}
+		SNAPSHOT_FRAME *pFrame = pPool_->acquire(nFrameSize);
+		if (nullptr == pFrame) {
+			LOG_DEBUG(logger_, "SnapshotModule: encoders busy, no snapshot of channel " << channel);
+			continue;
+		}
+		pFrame->width = nWidth;
+		pFrame->height = nHeight;
+		SNAPSHOT_INFO info;
+		info.channel = channel;
+		info.frameIndex = tensorInfo_nv12[iF].frameIndex;
+		info.wallclockUs = stamp.wallclockUs;
+		if (params.bFullFrame) {
+			pFrame->vSnapshots.push_back(info);
+		}
+		for (size_t i = 0; i < vSelected_.size(); ++i) {
+			const BBOX_INFO &box = bboxs.bbox[vSelected_[i]];
+			info.category = box.category;
+			info.x = box.x;
+			info.y = box.y;
+			info.w = box.w;
+			info.h = box.h;
+			pFrame->vSnapshots.push_back(info);
+		}
+		// the rows the snapshots cover, on the chroma grid
+		int y0 = nHeight, y1 = 0;
+		for (size_t i = 0; i < pFrame->vSnapshots.size(); ++i) {
+			IMAGE_RECT rect = getSnapshotRect(pFrame->vSnapshots[i], params.margin, nWidth, nHeight);
+			y0 = std::min(y0, std::max(0, rect.y) & ~1);
+			y1 = std::max(y1, std::min(nHeight, (rect.y + rect.h + 1) & ~1));
+		}
+		if (y1 <= y0) {
+			pPool_->release(pFrame);
+			continue;
+		}
+		const uint8_t *pSrc = pFrames + iF * nFrameSize;
+		uint8_t *pDst = pFrame->data.data();
+		size_t offsetY = (size_t)y0 * nWidth, nY = (size_t)(y1 - y0) * nWidth;
+		size_t offsetUV = nLuma + (size_t)(y0 / 2) * nWidth, nUV = nY / 2;
+		if (bDevice) {
+#ifndef CPU_ONLY
+			ck(cudaMemcpyAsync(pDst + offsetY, pSrc + offsetY, nY, cudaMemcpyDeviceToHost, context.stream));
+			ck(cudaMemcpyAsync(pDst + offsetUV, pSrc + offsetUV, nUV, cudaMemcpyDeviceToHost, context.stream));
+#endif
+		} else {
+			memcpy(pDst + offsetY, pSrc + offsetY, nY);
+			memcpy(pDst + offsetUV, pSrc + offsetUV, nUV);
+		}
+		vpFrames_.push_back(pFrame);
+	}
+	if (vpFrames_.empty()) {
+		return;
+	}
+#ifndef CPU_ONLY
+	if (bDevice) {
+		ck(cudaStreamSynchronize(context.stream));
+	}
+#endif
+	for (size_t i = 0; i < vpFrames_.size(); ++i) {
+		pPool_->submit(vpFrames_[i]);
+	}
+}
+
+#endif // SNAPSHOT_MODULE_H
@@ -0,0 +1,82 @@
+#ifndef STREAM_SOURCE_H
+#define STREAM_SOURCE_H
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+};
+
+#include <cstdint>
+#include <vector>
+#include "rtpJitterBuffer.h"
+
+typedef void (*PacketCallback)(void *handle, AVPacket packet);
+
+// Sees every compressed packet of a channel as it arrives, ahead of the
+// sampler, on the thread of the source. pts and dts are in us on the same
+// time base, the packet is only valid during the call.
+class IPacketObserver {
+public:
+	virtual ~IPacketObserver() {}
+	virtual void onPacket(const int channel, const AVPacket &packet, const int64_t ptsUs, const int64_t dtsUs,
+						const uint64_t recvUs, const int64_t wallclockUs) = 0;
+};
+
+// Hands each packet to several observers in turn. Set up before the first
+// provider takes it, the list does not change afterwards.
+class PacketObserverList : public IPacketObserver {
+public:
+	void add(IPacketObserver *pObserver) {
+		vpObservers_.push_back(pObserver);
+	}
+
+	void onPacket(const int channel, const AVPacket &packet, const int64_t ptsUs, const int64_t dtsUs,
+				const uint64_t recvUs, const int64_t wallclockUs) override {
+		for (size_t i = 0; i < vpObservers_.size(); ++i) {
+			vpObservers_[i]->onPacket(channel, packet, ptsUs, dtsUs, recvUs, wallclockUs);
+		}
+	}
+
+private:
+	std::vector<IPacketObserver *> vpObservers_;
+};
+
+enum STREAM_CLIENT {
+	STREAM_CLIENT_FFMPEG = 0,	// StreamTaker, libavformat
+	STREAM_CLIENT_NATIVE		// RtspClient, rtsp:// URLs only
+};
+
+// Source of compressed video packets behind StreamDataProvider. Packets
+// are Annex-B with start codes and are handed to the callback on the
+// thread of the source, which unrefs them once the callback returns.
+class IStreamSource {
+public:
+	virtual ~IStreamSource() {}
+
+	virtual void setVideoPacketCallback(void *handle, PacketCallback callback) = 0;
+	virtual void setChannel(int channel) = 0;
+	virtual void setVideoOnly(bool videoOnly) = 0;
+	// before prepare(), JITTER_DEFAULT leaves the source as it is
+	virtual void setJitterParams(const JITTER_PARAMS &params) = 0;
+
+	// SUCCESS or an error of RetCodeEnum
+	virtual int prepare(const char *url) = 0;
+	virtual void startTakeStream() = 0;
+	virtual void stopTakeStream() = 0;
+	virtual bool getIsStopTaking() = 0;
+
+	virtual AVCodecID getVideoCodeID() = 0;
+	virtual int getFrameWidth() = 0;
+	virtual int getFrameHeight() = 0;
+
+	// steady clock of the last packet, see metricsNowUs()
+	virtual uint64_t getLastReceiveUs() = 0;
+	// capture time in us since epoch, 0 if unknown
+	virtual int64_t getWallclockUs(const AVPacket &packet) = 0;
+	// pts in us from the start of the stream, -1 if unknown
+	virtual int64_t getPtsUs(const AVPacket &packet) = 0;
+	// dts in us in the time base of the stream, the pts when the source
+	// has no dts, AV_NOPTS_VALUE if unknown
+	virtual int64_t getDtsUs(const AVPacket &packet) = 0;
+};
+
+#endif // STREAM_SOURCE_H
@@ -5,6 +5,9 @@
 #include "streamTaker.h"
 #include "common/retCode.h"
 #include "common/logger.h"
+#include "metrics.h"
+#include "common/trace.h"
+#include "threadPlacement.h"
 
 #define  LOG_TAG    "StreamTaker"
 
@@ -57,10 +60,26 @@ int StreamTaker::prepare(const char *url) {
         return PARAMS_ERROR;
     }
     pFormatCtx = avformat_alloc_context();
-    if (avformat_open_input(&pFormatCtx, url, NULL, NULL) != 0) {
+    AVDictionary *options = NULL;
+    if (videoOnly_) {
+        // rtsp demuxer option, other demuxers leave it unused
+        av_dict_set(&options, "allowed_media_types", "video", 0);
+    }
+    if (JITTER_LOW_LATENCY == jitterParams_.profile) {
+        // 包到即出，迟到的包丢弃
+        av_dict_set(&options, "fflags", "nobuffer", 0);
+        av_dict_set(&options, "reorder_queue_size", "0", 0);
+        av_dict_set(&options, "max_delay", "0", 0);
+    } else if (JITTER_ROBUST == jitterParams_.profile) {
+        av_dict_set_int(&options, "reorder_queue_size", jitterParams_.reorderPackets, 0);
+        av_dict_set_int(&options, "max_delay", (int64_t)jitterParams_.maxDelayMs * 1000, 0);
+    }
+    if (avformat_open_input(&pFormatCtx, url, NULL, &options) != 0) {
     	LOG_DEBUG(logger_,"Couldn't open file:"<<url);
+        av_dict_free(&options);
         return OPEN_FILE_FAILED; // Couldn't open file
     }
+    av_dict_free(&options);
     LOG_DEBUG(logger_," "<<this<<" success open file:"<<url);
 
     // Retrieve stream information,it take a long time
@@ -136,6 +155,16 @@ int StreamTaker::prepare(const char *url) {
         codecParameters->height=videoFrameHeight;
     }
 
+    if (videoOnly_) {
+        // the demuxer drops packets of discarded streams before av_read_frame
+        for (i = 0; i < pFormatCtx->nb_streams; i++) {
+            if (i != videoStream) {
+                pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
+            }
+        }
+        audioStream = -1;
+    }
+
     if (audioStream == -1) {
         LOG_DEBUG(logger_," "<<this<<" Didn't find a audio stream");
         //return FIND_VIDEO_STREAM_FAILED;
@@ -174,6 +203,8 @@ void StreamTaker::startTakeStream() {
         return;
     }
     isTake = true;
+    // taking from here on, not only once the thread runs
+    isStop = false;
     //开启取流线程
     pthread_create(&tid, &attr, takingStreamThread, this);
 }
@@ -202,10 +233,16 @@ void StreamTaker::takingStream() {
     AVPacket packet;
     av_init_packet(&packet);
     isStop = false;
+    TRACE_THREAD_NAME("takingStream");
+    placeThread(ROLE_INGEST, "take", channel_);
+    uint64_t tRead = metricsNowUs();
     while (av_read_frame(pFormatCtx, &packet) >= 0 && isTake) {
+        TRACE_RANGE("takingStream");
         // printf("取到的流格式:%d",packet.stream_index);
         // Is this a packet from the video stream?
         if (packet.stream_index == videoStream && isTake) {
+            lastReceiveUs_ = metricsNowUs();
+            recordMetric(STAGE_DEMUX, channel_, lastReceiveUs_ - tRead);
             if (videoCallback != NULL && isTake) {
                 //printf("取到视频流");
                 hasReceiveVideoPacketCount++;
@@ -220,11 +257,67 @@ void StreamTaker::takingStream() {
             }
         }
         av_packet_unref(&packet);
+        tRead = metricsNowUs();
     }
     printf("**************takingStream exit***************\n ");
     isStop = true;
 }
 
+void StreamTaker::setChannel(int channel) {
+    channel_ = channel;
+}
+
+void StreamTaker::setVideoOnly(bool videoOnly) {
+    videoOnly_ = videoOnly;
+}
+
+void StreamTaker::setJitterParams(const JITTER_PARAMS &params) {
+    jitterParams_ = params;
+}
+
+uint64_t StreamTaker::getLastReceiveUs() {
+    return lastReceiveUs_;
+}
+
+int64_t StreamTaker::getWallclockUs(const AVPacket &packet) {
+    if (pFormatCtx == NULL || videoStream < 0 || pFormatCtx->start_time_realtime == AV_NOPTS_VALUE
+        || pFormatCtx->start_time_realtime <= 0 || packet.pts == AV_NOPTS_VALUE) {
+        return 0;
+    }
+    AVStream *stream = pFormatCtx->streams[videoStream];
+    int64_t pts = packet.pts;
+    if (stream->start_time != AV_NOPTS_VALUE) {
+        pts -= stream->start_time;
+    }
+    AVRational us = {1, 1000000};
+    return pFormatCtx->start_time_realtime + av_rescale_q(pts, stream->time_base, us);
+}
+
+int64_t StreamTaker::getPtsUs(const AVPacket &packet) {
+    if (pFormatCtx == NULL || videoStream < 0 || packet.pts == AV_NOPTS_VALUE) {
+        return -1;
+    }
+    AVStream *stream = pFormatCtx->streams[videoStream];
+    int64_t pts = packet.pts;
+    if (stream->start_time != AV_NOPTS_VALUE) {
+        pts -= stream->start_time;
+    }
+    AVRational us = {1, 1000000};
+    return av_rescale_q(pts, stream->time_base, us);
+}
+
+int64_t StreamTaker::getDtsUs(const AVPacket &packet) {
+    if (pFormatCtx == NULL || videoStream < 0) {
+        return AV_NOPTS_VALUE;
+    }
+    int64_t ts = packet.dts != AV_NOPTS_VALUE ? packet.dts : packet.pts;
+    if (ts == AV_NOPTS_VALUE) {
+        return AV_NOPTS_VALUE;
+    }
+    AVRational us = {1, 1000000};
+    return av_rescale_q(ts, pFormatCtx->streams[videoStream]->time_base, us);
+}
+
 bool StreamTaker::getIsStopTaking()
 {
     return isStop;
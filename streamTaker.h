@@ -14,8 +14,8 @@ extern "C" {
 #include <pthread.h>
 #include "common/retCode.h"
 #include "common/logger.h"
+#include "streamSource.h"
 
-typedef void (*PacketCallback)(void *handle, AVPacket packet);
 typedef struct CodecParameters{
 
     //视频编码类型
@@ -34,7 +34,7 @@ typedef struct CodecParameters{
     int sampleRate=0;
 }CodecParameters,*PCodecParameters;
 
-class StreamTaker {
+class StreamTaker : public IStreamSource {
 public :
     StreamTaker(simplelogger::Logger *logger);
 
@@ -91,6 +91,29 @@ public :
     AVCodecParameters * getVideoCodecParameters();
 
     bool getIsStopTaking();
+
+    //设置通道号，用于统计取流耗时
+    void setChannel(int channel);
+
+    //只取视频流，在prepare前调用
+    //RTSP不SETUP音频等其它轨道，其它文件格式的非视频轨道设为AVDISCARD_ALL
+    void setVideoOnly(bool videoOnly);
+
+    //RTSP抖动缓冲配置，在prepare前调用
+    //低延迟：不重排(reorder_queue_size=0)，nobuffer；稳健：按reorderPackets/maxDelayMs重排
+    void setJitterParams(const JITTER_PARAMS &params);
+
+    //最近一个数据包从av_read_frame返回的时间(steady clock, us)
+    uint64_t getLastReceiveUs();
+
+    //数据包的采集时间(us, 自1970年起)，由RTCP SR的start_time_realtime和pts推算，未知时为0
+    int64_t getWallclockUs(const AVPacket &packet);
+
+    //数据包的pts(us, 相对于流的起点)，没有pts时为-1
+    int64_t getPtsUs(const AVPacket &packet);
+
+    //数据包的dts(us, 流的时间基)，没有dts时用pts，都没有时为AV_NOPTS_VALUE，用于按时间戳回放文件
+    int64_t getDtsUs(const AVPacket &packet);
 private :
 
     //视频编解码器参数
@@ -143,6 +166,14 @@ private :
     pthread_attr_t attr;
 
 
+    int channel_ = -1;
+
+    bool videoOnly_ = false;
+
+    JITTER_PARAMS jitterParams_;
+
+    uint64_t lastReceiveUs_ = 0;
+
     simplelogger::Logger *logger_{ nullptr };
 };
 
@@ -0,0 +1,188 @@
+// ChannelRegistry following a channel file: attach on load, on reload
+// only the slots whose definition changed are attached again and the
+// slots no longer listed are detached. poll() reports when nothing is
+// left to run. Fake providers and lanes, nothing is opened.
+//
+//   channelRegistryTest
+//
+// The channel file goes to /tmp, its mtime is set by the test.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <sys/time.h>
+#include "../channelRegistry.h"
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		g_nFailed++; \
+	} \
+} while (0)
+
+static const int NB_SLOTS = 4;
+
+class NullWorker : public ILaneWorker {
+public:
+	int getDeviceID() const override { return 0; }
+	int getNbLanes() const override { return NB_SLOTS; }
+	void pushPacket(uint8_t *, int, int) override {}
+	void stopPushPacket(int) override {}
+};
+
+// A source which ends by itself when its definition says so.
+class FakeProvider : public DataProvider {
+public:
+	explicit
+	FakeProvider(const std::string &definition) : definition_(definition) {}
+
+	bool getData(uint8_t **ppBuf, int *pnBuf) override {
+		*ppBuf = nullptr;
+		*pnBuf = 0;
+		return std::string::npos == definition_.find("ends");
+	}
+
+	void reload() override {}
+
+	const std::string &getDefinition() const { return definition_; }
+
+private:
+	std::string definition_;
+};
+
+typedef struct {
+	int nCreated = 0;
+	int nReleased = 0;
+} FACTORY_COUNTS;
+
+static DataProvider *createProvider(void *handle, const int, const std::string &definition) {
+	if (0 == definition.compare(0, 3, "bad")) {
+		return nullptr;
+	}
+	((FACTORY_COUNTS *)handle)->nCreated++;
+	return new FakeProvider(definition);
+}
+
+static void releaseProvider(void *handle, const int, DataProvider *) {
+	((FACTORY_COUNTS *)handle)->nReleased++;
+}
+
+static void pushLoop(DataProvider *pProvider, ChannelScheduler *, const int, const std::atomic<bool > *pbRun) {
+	uint8_t *pBuf = nullptr;
+	int nBuf = 0;
+	while (*pbRun && pProvider->getData(&pBuf, &nBuf)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+// The registry reloads when the mtime changed, which has a resolution of
+// a second; each version of the file gets its own.
+static void writeChannelFile(const std::string &path, const char *szContent, const int version) {
+	FILE *fp = fopen(path.c_str(), "w");
+	CHECK(nullptr != fp);
+	if (nullptr == fp) {
+		return;
+	}
+	fputs(szContent, fp);
+	fclose(fp);
+	struct timeval times[2];
+	times[0].tv_sec = times[1].tv_sec = 1000000000 + version;
+	times[0].tv_usec = times[1].tv_usec = 0;
+	CHECK(0 == utimes(path.c_str(), times));
+}
+
+static std::string definitionOf(ChannelRegistry &registry, const int slot) {
+	FakeProvider *pProvider = (FakeProvider *)registry.getProvider(slot);
+	return nullptr == pProvider ? "" : pProvider->getDefinition();
+}
+
+int main() {
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	char szPath[] = "/tmp/channelRegistryTest.XXXXXX";
+	int fd = mkstemp(szPath);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	const std::string path = szPath;
+
+	NullWorker worker;
+	ChannelScheduler scheduler({ &worker }, NB_SLOTS, logger);
+	FACTORY_COUNTS counts;
+	{
+		ChannelRegistry registry(NB_SLOTS, &scheduler, createProvider, releaseProvider, &counts, pushLoop, logger);
+		registry.setChannelFile(path.c_str());
+
+		// comments, a slot out of range and a line without a definition are skipped
+		writeChannelFile(path,
+			"# slot  analysisURL[|mainURL]\n"
+			"0 /data/a.h264\n"
+			"\n"
+			"2 rtsp://cam/sub|rtsp://cam/main\n"
+			"7 /data/x.h264\n"
+			"3\n", 1);
+		CHECK(registry.loadChannelFile());
+		CHECK(2 == counts.nCreated);
+		CHECK("/data/a.h264" == definitionOf(registry, 0));
+		CHECK("" == definitionOf(registry, 1));
+		CHECK("rtsp://cam/sub|rtsp://cam/main" == definitionOf(registry, 2));
+		CHECK("" == definitionOf(registry, 3));
+		DataProvider *pKept = registry.getProvider(0);
+
+		// unchanged, nothing is reloaded
+		CHECK(registry.poll());
+		CHECK(2 == counts.nCreated && 0 == counts.nReleased);
+
+		// slot 0 stays as it is, 1 is new and 2 changed
+		writeChannelFile(path,
+			"0 /data/a.h264\n"
+			"1 /data/b.h264\n"
+			"2 rtsp://cam2/sub\n", 2);
+		CHECK(registry.poll());
+		CHECK(4 == counts.nCreated && 1 == counts.nReleased);
+		CHECK(pKept == registry.getProvider(0));
+		CHECK("/data/b.h264" == definitionOf(registry, 1));
+		CHECK("rtsp://cam2/sub" == definitionOf(registry, 2));
+
+		// slots not listed are detached, a failed attach leaves its slot empty
+		writeChannelFile(path, "1 bad://b\n", 3);
+		CHECK(registry.poll());
+		CHECK(4 == counts.nCreated && 4 == counts.nReleased);
+		for (int i = 0; i < NB_SLOTS; ++i) {
+			CHECK(nullptr == registry.getProvider(i));
+		}
+		// nothing left to run and the file did not change
+		CHECK(!registry.poll());
+
+		// a channel whose source ended keeps its slot, but does not run
+		writeChannelFile(path, "3 /data/ends.h264\n", 4);
+		CHECK(registry.poll());
+		CHECK("/data/ends.h264" == definitionOf(registry, 3));
+		bool bRunning = true;
+		for (int i = 0; i < 1000 && bRunning; ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			bRunning = registry.poll();
+		}
+		CHECK(!bRunning);
+
+		unlink(path.c_str());
+		CHECK(!registry.loadChannelFile());
+	}
+	// the registry detaches what is left
+	CHECK(5 == counts.nCreated && 5 == counts.nReleased);
+
+	delete logger;
+	if (g_nFailed > 0) {
+		fprintf(stderr, "channelRegistryTest: %d checks failed\n", g_nFailed);
+		return 1;
+	}
+	printf("channelRegistryTest: passed\n");
+	return 0;
+}
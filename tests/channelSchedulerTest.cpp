@@ -0,0 +1,210 @@
+// ChannelScheduler against mock device workers: placement by load,
+// migration off a lagging device and reuse of the lanes left behind.
+//
+//   channelSchedulerTest
+
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "../channelScheduler.h"
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		g_nFailed++; \
+	} \
+} while (0)
+
+// Counts the packets per lane; a push into a blocked lane waits until
+// the lane is released, as a full decoder queue does.
+class MockWorker : public ILaneWorker {
+public:
+	MockWorker(const int devID, const int nLanes) : devID_(devID), vPushed_(nLanes, 0), vStopped_(nLanes, false) {}
+
+	int getDeviceID() const override { return devID_; }
+	int getNbLanes() const override { return (int)vPushed_.size(); }
+
+	void pushPacket(uint8_t *, int, int laneID) override {
+		std::unique_lock<std::mutex> lock(mtx_);
+		nWaiting_ += laneID == blockedLane_;
+		cv_.notify_all();
+		cv_.wait(lock, [&]() { return laneID != blockedLane_; });
+		vPushed_[laneID]++;
+	}
+
+	void stopPushPacket(int laneID) override {
+		std::lock_guard<std::mutex> lock(mtx_);
+		vStopped_[laneID] = true;
+	}
+
+	void block(const int lane) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		blockedLane_ = lane;
+		nWaiting_ = 0;
+	}
+
+	void release() {
+		std::lock_guard<std::mutex> lock(mtx_);
+		blockedLane_ = -1;
+		cv_.notify_all();
+	}
+
+	void waitForBlockedPush() {
+		std::unique_lock<std::mutex> lock(mtx_);
+		cv_.wait(lock, [&]() { return nWaiting_ > 0; });
+	}
+
+	int getPushed(const int lane) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		return vPushed_[lane];
+	}
+
+	bool isStopped(const int lane) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		return vStopped_[lane];
+	}
+
+private:
+	int devID_;
+	std::vector<int > vPushed_;
+	std::vector<bool > vStopped_;
+	int blockedLane_{ -1 };
+	int nWaiting_{ 0 };
+	std::mutex mtx_;
+	std::condition_variable cv_;
+};
+
+static SCHEDULER_PARAMS testParams() {
+	SCHEDULER_PARAMS params;
+	params.rebalanceInterval = 0.;
+	params.fpsWindow = 0.01;
+	return params;
+}
+
+// channels go to the device with the lowest summed weight
+static void testPlacementByLoad(simplelogger::Logger *logger) {
+	MockWorker dev0(0, 4), dev1(1, 4);
+	ChannelScheduler scheduler({ &dev0, &dev1 }, 4, logger);
+	CHECK(scheduler.addChannel(0, 4.0));
+	CHECK(scheduler.addChannel(1, 1.0));
+	CHECK(scheduler.addChannel(2, 1.0));
+	CHECK(scheduler.addChannel(3, 1.0));
+	int worker = -1, lane = -1;
+	scheduler.getPlacement(0, &worker, &lane);
+	CHECK(0 == worker && 0 == lane);
+	for (int c = 1; c < 4; ++c) {
+		scheduler.getPlacement(c, &worker, &lane);
+		CHECK(1 == worker && c - 1 == lane);
+	}
+	CHECK(4.0 == scheduler.getDeviceLoad(0));
+	CHECK(3.0 == scheduler.getDeviceLoad(1));
+	for (int c = 0; c < 4; ++c) {
+		scheduler.getPlacement(c, &worker, &lane);
+		CHECK(c == scheduler.getChannel(worker, lane));
+	}
+
+	// full devices refuse more channels
+	MockWorker small0(0, 1), small1(1, 1);
+	ChannelScheduler full({ &small0, &small1 }, 3, logger);
+	CHECK(full.addChannel(0));
+	CHECK(full.addChannel(1));
+	CHECK(!full.addChannel(2));
+}
+
+// the cheapest channel of a lagging device moves, its lane is reused
+static void testRebalance(simplelogger::Logger *logger) {
+	MockWorker dev0(0, 2), dev1(1, 2);
+	ChannelScheduler scheduler({ &dev0, &dev1 }, 4, logger, testParams());
+	CHECK(scheduler.addChannel(0));
+	CHECK(scheduler.addChannel(1));
+	CHECK(scheduler.addChannel(2));
+
+	// nothing measured yet, nothing moves
+	CHECK(-1 == scheduler.rebalance());
+
+	uint8_t packet[16] = { 0 };
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	scheduler.rebalance();
+	for (int i = 0; i < 100; ++i) {
+		scheduler.pushPacket(0, packet, sizeof(packet));
+		scheduler.pushPacket(2, packet, sizeof(packet));
+	}
+	for (int i = 0; i < 10; ++i) {
+		scheduler.pushPacket(1, packet, sizeof(packet));
+	}
+	// device 0 runs channels 0 and 2 and keeps up with a third of them
+	scheduler.reportAnalysis(0, 1, 1000.0 * 0.02 * 3 / 200);
+	scheduler.reportAnalysis(1, 1, 1.0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	int moved = scheduler.rebalance();
+	CHECK(0 == moved || 2 == moved);
+	int worker = -1, lane = -1;
+	scheduler.getPlacement(moved, &worker, &lane);
+	CHECK(1 == worker && 1 == lane);
+	CHECK(moved == scheduler.getChannel(1, 1));
+
+	int before = dev1.getPushed(1);
+	int pushedWorker = -1, pushedLane = -1;
+	CHECK(scheduler.pushPacket(moved, packet, sizeof(packet), &pushedWorker, &pushedLane));
+	CHECK(1 == pushedWorker && 1 == pushedLane);
+	CHECK(before + 1 == dev1.getPushed(1));
+
+	// the lane left on device 0 goes to the next channel
+	int freed = 0 == moved ? 0 : 1;
+	CHECK(scheduler.addChannel(3));
+	scheduler.getPlacement(3, &worker, &lane);
+	CHECK(0 == worker && freed == lane);
+	CHECK(3 == scheduler.getChannel(0, freed));
+
+	scheduler.stopPushPacket(3);
+	CHECK(dev0.isStopped(freed));
+	scheduler.stopIdleLanes();
+	CHECK(dev0.isStopped(1 - freed) && dev1.isStopped(0) && dev1.isStopped(1));
+}
+
+// a lane is not reused while a push of its previous owner is in flight
+static void testNoReuseDuringPush(simplelogger::Logger *logger) {
+	MockWorker dev0(0, 1), dev1(1, 1);
+	ChannelScheduler scheduler({ &dev0, &dev1 }, 2, logger);
+	CHECK(scheduler.addChannel(0));
+	int worker = -1, lane = -1;
+	scheduler.getPlacement(0, &worker, &lane);
+	MockWorker &home = 0 == worker ? dev0 : dev1;
+
+	uint8_t packet[16] = { 0 };
+	home.block(lane);
+	std::thread pusher([&]() { scheduler.pushPacket(0, packet, sizeof(packet)); });
+	home.waitForBlockedPush();
+	scheduler.removeChannel(0);
+	// the only other lane is on the other device
+	CHECK(scheduler.addChannel(1));
+	int worker1 = -1, lane1 = -1;
+	scheduler.getPlacement(1, &worker1, &lane1);
+	CHECK(worker1 != worker);
+	home.release();
+	pusher.join();
+	CHECK(1 == home.getPushed(lane));
+
+	// once the push is done the lane is free again
+	scheduler.removeChannel(1);
+	CHECK(scheduler.addChannel(0));
+	CHECK(scheduler.addChannel(1));
+}
+
+int main() {
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	testPlacementByLoad(logger);
+	testRebalance(logger);
+	testNoReuseDuringPush(logger);
+	delete logger;
+	if (g_nFailed > 0) {
+		fprintf(stderr, "channelSchedulerTest: %d checks failed\n", g_nFailed);
+		return 1;
+	}
+	printf("channelSchedulerTest: passed\n");
+	return 0;
+}
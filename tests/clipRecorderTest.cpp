@@ -0,0 +1,108 @@
+// ClipRecorder's ring: it starts at a keyframe, whole GOPs leave it once
+// the next GOP covers the pre-roll, the byte budget evicts earlier but
+// never the last GOP. No clip is triggered, nothing goes to disk.
+//
+//   clipRecorderTest
+
+#include <cstdio>
+#include <cstring>
+#include "../clipRecorder.h"
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		g_nFailed++; \
+	} \
+} while (0)
+
+// slices starting a picture, first_mb_in_slice 0
+static const uint8_t IDR_SLICE[] = { 0, 0, 0, 1, 0x65, 0x88, 0x84 };
+static const uint8_t P_SLICE[] = { 0, 0, 0, 1, 0x41, 0x9a, 0x02 };
+
+static const uint64_t BASE_US = 1000000000;
+static const uint64_t FRAME_US = 40000;
+static const int GOP = 25;
+static const int PACKET_BYTES = 1000;
+
+// Pictures n0 to n1 - 1 of a stream with a keyframe every GOP pictures.
+static void feed(ClipRecorder &recorder, const int n0, const int n1, const bool bKeyframes = true) {
+	for (int n = n0; n < n1; ++n) {
+		const bool bKeyframe = bKeyframes && 0 == n % GOP;
+		AVPacket packet;
+		av_init_packet(&packet);
+		if (av_new_packet(&packet, PACKET_BYTES) < 0) {
+			CHECK(false);
+			return;
+		}
+		memset(packet.data, 0, PACKET_BYTES);
+		memcpy(packet.data, bKeyframe ? IDR_SLICE : P_SLICE, sizeof(IDR_SLICE));
+		int64_t ptsUs = n * (int64_t)FRAME_US;
+		recorder.onPacket(0, packet, ptsUs, ptsUs, BASE_US + n * FRAME_US, 0);
+		av_packet_unref(&packet);
+	}
+}
+
+static void testPreRoll(simplelogger::Logger *logger) {
+	CLIP_PARAMS params;
+	params.preSec = 1.f;
+	params.latencySec = 0.5f;
+	ClipRecorder recorder(1, params, logger);
+	recorder.addChannel(0, VIDEO_CODEC_H264);
+
+	// nothing is kept ahead of the first keyframe
+	feed(recorder, 1, GOP, false);
+	CHECK(0 == recorder.getRingStats(0).nPackets);
+
+	// up to 10.96 s, the GOP at 10 s alone does not cover 1.5 s of pre-roll
+	// and latency, the one at 9 s stays with it
+	feed(recorder, GOP, 11 * GOP);
+	CLIP_RING_STATS stats = recorder.getRingStats(0);
+	CHECK(stats.bKeyframeFirst);
+	CHECK(BASE_US + 9 * GOP * FRAME_US == stats.firstRecvUs);
+	CHECK(BASE_US + (11 * GOP - 1) * FRAME_US == stats.lastRecvUs);
+	CHECK(2 * GOP == stats.nPackets);
+	CHECK(stats.nPackets * PACKET_BYTES == stats.nBytes);
+
+	recorder.removeChannel(0);
+	stats = recorder.getRingStats(0);
+	CHECK(0 == stats.nPackets && 0 == stats.nBytes);
+}
+
+static void testBudget(simplelogger::Logger *logger) {
+	CLIP_PARAMS params;
+	params.preSec = 5.f;
+	params.budgetBytes = 60 * PACKET_BYTES;
+	ClipRecorder recorder(1, params, logger);
+	recorder.addChannel(0, VIDEO_CODEC_H264);
+
+	// two GOPs fit, the third one pushes the first out
+	feed(recorder, 0, 2 * GOP + 11);
+	CLIP_RING_STATS stats = recorder.getRingStats(0);
+	CHECK(stats.bKeyframeFirst && BASE_US + GOP * FRAME_US == stats.firstRecvUs);
+	CHECK(GOP + 11 == stats.nPackets);
+	CHECK(stats.nBytes <= params.budgetBytes);
+
+	// a GOP larger than the budget stays whole while it is the last one
+	params.budgetBytes = 10 * PACKET_BYTES;
+	ClipRecorder small(1, params, logger);
+	small.addChannel(0, VIDEO_CODEC_H264);
+	feed(small, 0, 3 * GOP);
+	stats = small.getRingStats(0);
+	CHECK(stats.bKeyframeFirst && BASE_US + 2 * GOP * FRAME_US == stats.firstRecvUs);
+	CHECK(GOP == stats.nPackets);
+}
+
+int main() {
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	testPreRoll(logger);
+	testBudget(logger);
+	delete logger;
+	if (g_nFailed > 0) {
+		fprintf(stderr, "clipRecorderTest: %d checks failed\n", g_nFailed);
+		return 1;
+	}
+	printf("clipRecorderTest: passed\n");
+	return 0;
+}
@@ -0,0 +1,173 @@
+// queryDetectionArchive over what DetectionArchiveWriter wrote: ranges by
+// capture time and frame, the class filter which skips blocks undecoded,
+// stopping early, and a file started by a clock step back.
+//
+//   detectionArchiveTest
+//
+// The archive goes to a directory under /tmp, removed at the end.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "../detectionArchiveWriter.h"
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		g_nFailed++; \
+	} \
+} while (0)
+
+static const int64_t T0_US = 1700000000000000LL;
+static const int64_t FRAME_US = 40000;
+static const int64_t STEP_BACK_US = 3600000000LL;
+static const int NB_FRAMES = 1000;
+static const int NB_STEPPED = 100;		// after the clock stepped back
+static const int CHANNEL = 1;
+
+// frames 400 to 449 also have a box of class 5
+static bool hasClass5(const int64_t frame) {
+	return frame >= 400 && frame < 450;
+}
+
+static float xOf(const int64_t frame) {
+	return (frame % 1000) / 1000.f;
+}
+
+static void writeArchive(const std::string &dir, simplelogger::Logger *logger) {
+	ARCHIVE_PARAMS params;
+	params.dir = dir;
+	params.blockBytes = 1024;
+	DetectionArchiveWriter writer(2, params, logger);
+	CHECK(writer.start());
+	for (int i = 0; i < NB_FRAMES + NB_STEPPED; ++i) {
+		ARCHIVE_BOX boxes[2];
+		boxes[0].x = xOf(i);
+		boxes[0].y = 0.25f;
+		boxes[0].w = 0.1f;
+		boxes[0].h = 0.2f;
+		boxes[0].category = 0;
+		boxes[1] = boxes[0];
+		boxes[1].y = 0.5f;
+		boxes[1].category = 5;
+		int64_t timeUs = i < NB_FRAMES ? T0_US + i * FRAME_US : T0_US - STEP_BACK_US + (i - NB_FRAMES) * FRAME_US;
+		writer.append(CHANNEL, timeUs, i, boxes, hasClass5(i) ? 2 : 1);
+	}
+	writer.close();
+	CHECK((uint64_t)(NB_FRAMES + NB_STEPPED + 50) == writer.getNbBoxes());
+}
+
+static std::vector<ARCHIVE_FRAME > query(const std::string &dir, const ARCHIVE_QUERY &q,
+										ARCHIVE_QUERY_STATS *pStats = nullptr, const size_t nMax = 1 << 30) {
+	std::vector<ARCHIVE_FRAME > vFrames;
+	queryDetectionArchive(dir, q, [&](const ARCHIVE_FRAME &frame) {
+		vFrames.push_back(frame);
+		return vFrames.size() < nMax;
+	}, pStats);
+	return vFrames;
+}
+
+static void testAll(const std::string &dir) {
+	ARCHIVE_QUERY q;
+	q.channel = CHANNEL;
+	std::vector<ARCHIVE_FRAME > vFrames = query(dir, q);
+	CHECK(NB_FRAMES + NB_STEPPED == (int)vFrames.size());
+	if (NB_FRAMES + NB_STEPPED != (int)vFrames.size()) {
+		return;
+	}
+	// files by start time, the one after the step back comes first
+	for (int i = 0; i < NB_STEPPED; ++i) {
+		CHECK(NB_FRAMES + i == vFrames[i].frameIndex);
+	}
+	for (int i = 0; i < NB_FRAMES; ++i) {
+		const ARCHIVE_FRAME &frame = vFrames[NB_STEPPED + i];
+		CHECK(i == frame.frameIndex && T0_US + i * FRAME_US == frame.timeUs);
+		CHECK((hasClass5(i) ? 2u : 1u) == frame.vBoxes.size());
+		// quantized to 1/ARCHIVE_QUANT
+		CHECK(fabsf(frame.vBoxes[0].x - xOf(i)) <= 1.f / ARCHIVE_QUANT);
+		CHECK(fabsf(frame.vBoxes[0].h - 0.2f) <= 1.f / ARCHIVE_QUANT);
+	}
+	q.channel = 0;
+	CHECK(query(dir, q).empty());
+}
+
+static void testRanges(const std::string &dir) {
+	ARCHIVE_QUERY q;
+	q.channel = CHANNEL;
+	q.fromUs = T0_US + 100 * FRAME_US;
+	q.toUs = T0_US + 199 * FRAME_US;
+	std::vector<ARCHIVE_FRAME > vFrames = query(dir, q);
+	CHECK(100 == vFrames.size());
+	CHECK(!vFrames.empty() && 100 == vFrames.front().frameIndex && 199 == vFrames.back().frameIndex);
+
+	// frames within the time range
+	q.firstFrame = 150;
+	q.lastFrame = 159;
+	vFrames = query(dir, q);
+	CHECK(10 == vFrames.size());
+	CHECK(!vFrames.empty() && 150 == vFrames.front().frameIndex);
+
+	// the range of the stepped back clock finds only the frames it wrote
+	q = ARCHIVE_QUERY();
+	q.channel = CHANNEL;
+	q.fromUs = T0_US - STEP_BACK_US;
+	q.toUs = T0_US - STEP_BACK_US + (NB_STEPPED - 1) * FRAME_US;
+	vFrames = query(dir, q);
+	CHECK(NB_STEPPED == (int)vFrames.size());
+	CHECK(!vFrames.empty() && NB_FRAMES == vFrames.front().frameIndex);
+}
+
+static void testClassFilter(const std::string &dir) {
+	ARCHIVE_QUERY q;
+	q.channel = CHANNEL;
+	q.classMask = archiveClassBit(5);
+	ARCHIVE_QUERY_STATS stats;
+	std::vector<ARCHIVE_FRAME > vFrames = query(dir, q, &stats);
+	CHECK(50 == vFrames.size());
+	for (size_t i = 0; i < vFrames.size(); ++i) {
+		CHECK(hasClass5(vFrames[i].frameIndex));
+		CHECK(1 == vFrames[i].vBoxes.size() && 5 == vFrames[i].vBoxes[0].category);
+	}
+	CHECK(50 == stats.nFrames && 50 == stats.nBoxes);
+	// only the blocks around frames 400 to 449 are inflated
+	CHECK(stats.nBlocks > 10);
+	CHECK(stats.nBlocksDecoded > 0 && stats.nBlocksDecoded * 4 < stats.nBlocks);
+}
+
+static void testStop(const std::string &dir) {
+	ARCHIVE_QUERY q;
+	q.channel = CHANNEL;
+	q.fromUs = T0_US;
+	ARCHIVE_QUERY_STATS stats;
+	std::vector<ARCHIVE_FRAME > vFrames = query(dir, q, &stats, 3);
+	CHECK(3 == vFrames.size());
+	CHECK(3 == stats.nFrames);
+	CHECK(!vFrames.empty() && 0 == vFrames.front().frameIndex);
+}
+
+int main() {
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	char szDir[] = "/tmp/detectionArchiveTest.XXXXXX";
+	if (nullptr == mkdtemp(szDir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	const std::string dir = szDir;
+	writeArchive(dir, logger);
+	testAll(dir);
+	testRanges(dir);
+	testClassFilter(dir);
+	testStop(dir);
+	CHECK(0 == system(("rm -rf " + dir).c_str()));
+	delete logger;
+	if (g_nFailed > 0) {
+		fprintf(stderr, "detectionArchiveTest: %d checks failed\n", g_nFailed);
+		return 1;
+	}
+	printf("detectionArchiveTest: passed\n");
+	return 0;
+}
@@ -0,0 +1,175 @@
+// nalParser.h classification over short real bitstreams.
+//
+//   nalParserTest [dataDir]
+//
+// tests/data (the default dataDir) holds two 64x64 clips of 14 pictures
+// encoded by x264 and x265 with a fixed GOP of 6, two B pictures between
+// references, no B pyramid and two slices per picture; the HEVC clip has
+// open GOPs, so its CRA keyframes are followed by RASL pictures:
+//
+//   x264 keyint=6:min-keyint=6:scenecut=0:bframes=2:b-adapt=0:b-pyramid=none:slices=2:repeat-headers=1
+//   x265 keyint=6:min-keyint=6:scenecut=0:bframes=2:b-adapt=0:b-pyramid=0:open-gop=1:ctu=16:slices=2:repeat-headers=1
+//
+// The expected pictures in decode order follow from those settings and
+// the picture types a decoder reports: K keyframe, R reference, N
+// non-reference, L non-reference leading picture skipped at a CRA. The
+// slices are read back for their position in the picture.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include "../nalParser.h"
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		g_nFailed++; \
+	} \
+} while (0)
+
+static const char *EXPECTED_H264 = "KRNNRNKRNNRNKR";
+static const char *EXPECTED_HEVC = "KRNNKLLRNNKLLR";
+
+static bool readFile(const std::string &path, std::vector<uint8_t > &vData) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		fprintf(stderr, "failed to open %s\n", path.c_str());
+		return false;
+	}
+	vData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return !vData.empty();
+}
+
+// NAL units behind their start codes, as the file provider cuts them
+static std::vector<std::vector<uint8_t > > splitNals(const std::vector<uint8_t > &vData) {
+	std::vector<std::vector<uint8_t > > vNals;
+	int pos = findNalStart(vData.data(), (int)vData.size(), 0);
+	while (pos >= 0) {
+		int next = findNalStart(vData.data(), (int)vData.size(), pos);
+		int end = next < 0 ? (int)vData.size() : next - 3;
+		while (end > pos && 0 == vData[end - 1]) {
+			end--;
+		}
+		int begin = pos - 3;
+		if (begin > 0 && 0 == vData[begin - 1]) {
+			begin--;
+		}
+		vNals.push_back(std::vector<uint8_t >(vData.begin() + begin, vData.begin() + end));
+		pos = next;
+	}
+	return vNals;
+}
+
+static int headerOffset(const std::vector<uint8_t > &vNal) {
+	return 0 == vNal[2] ? 4 : 3;
+}
+
+static void checkPicture(const PACKET_CLASS &c, const char expected, const int picture, const char *szCodec) {
+	if (!c.bPicture || !c.bNewPicture) {
+		fprintf(stderr, "%s picture %d: not a new picture\n", szCodec, picture);
+		g_nFailed++;
+		return;
+	}
+	bool bOk = false;
+	switch (expected) {
+	case 'K': bOk = c.bKeyframe && c.bReference && !c.bSkippedLeading; break;
+	case 'R': bOk = !c.bKeyframe && c.bReference && !c.bSkippedLeading; break;
+	case 'N': bOk = !c.bKeyframe && !c.bReference && !c.bSkippedLeading; break;
+	case 'L': bOk = !c.bKeyframe && !c.bReference && c.bSkippedLeading; break;
+	}
+	if (!bOk) {
+		fprintf(stderr, "%s picture %d: expected %c, got keyframe %d reference %d leading %d\n", szCodec, picture,
+				expected, c.bKeyframe, c.bReference, c.bSkippedLeading);
+		g_nFailed++;
+	}
+}
+
+static void testClip(const std::string &path, const VIDEO_CODEC codec, const std::string &expected) {
+	const char *szCodec = VIDEO_CODEC_HEVC == codec ? "HEVC" : "H.264";
+	std::vector<uint8_t > vData;
+	if (!readFile(path, vData)) {
+		g_nFailed++;
+		return;
+	}
+	std::vector<std::vector<uint8_t > > vNals = splitNals(vData);
+	CHECK(!vNals.empty());
+
+	// one NAL unit per packet, with and without its start code
+	int nPictures = 0, nSlices = 0, nParameterSets = 0;
+	SLICE_LAYOUT layout;
+	for (size_t i = 0; i < vNals.size(); ++i) {
+		const std::vector<uint8_t > &vNal = vNals[i];
+		const int offset = headerOffset(vNal);
+		PACKET_CLASS c = classifyPacket(vNal.data(), (int)vNal.size(), codec);
+		PACKET_CLASS bare = classifyPacket(vNal.data() + offset, (int)vNal.size() - offset, codec);
+		CHECK(c.bPicture == bare.bPicture && c.bNewPicture == bare.bNewPicture && c.bKeyframe == bare.bKeyframe
+			  && c.bReference == bare.bReference && c.bSkippedLeading == bare.bSkippedLeading);
+		CHECK(c.bPicture == isPictureNal(vNal[offset], codec));
+		if (isParameterSetNal(vNal[offset], codec)) {
+			nParameterSets++;
+			updateSliceLayout(vNal.data() + offset, (int)vNal.size() - offset, codec, layout);
+			CHECK(!c.bPicture);
+			int width = 0, height = 0;
+			if (parseSps(vNal.data() + offset, (int)vNal.size() - offset, codec, width, height)) {
+				CHECK(64 == width && 64 == height);
+			}
+		}
+		if (!c.bPicture) {
+			continue;
+		}
+		nSlices++;
+		// 4x4 macroblocks or 16x16 CTBs, two block rows per slice
+		CHECK(4 == layout.widthBlocks && 4 == layout.heightBlocks);
+		CHECK((c.bNewPicture ? 0 : 8) == sliceAddress(vNal.data() + offset, (int)vNal.size() - offset, codec, layout));
+		if (c.bNewPicture) {
+			if (nPictures < (int)expected.size()) {
+				checkPicture(c, expected[nPictures], nPictures, szCodec);
+			}
+			nPictures++;
+		}
+	}
+	CHECK((int)expected.size() == nPictures);
+	CHECK(2 * nPictures == nSlices);
+	CHECK(nParameterSets > 0);
+
+	// whole access units, parameter sets and SEI ahead of the slices
+	std::vector<std::vector<uint8_t > > vUnits;
+	bool bSlices = false;
+	for (size_t i = 0; i < vNals.size(); ++i) {
+		const std::vector<uint8_t > &vNal = vNals[i];
+		PACKET_CLASS c = classifyPacket(vNal.data(), (int)vNal.size(), codec);
+		if (vUnits.empty() || (bSlices && (!c.bPicture || c.bNewPicture))) {
+			vUnits.push_back(std::vector<uint8_t >());
+			bSlices = false;
+		}
+		vUnits.back().insert(vUnits.back().end(), vNal.begin(), vNal.end());
+		bSlices = bSlices || c.bPicture;
+	}
+	CHECK(expected.size() == vUnits.size());
+	for (size_t i = 0; i < vUnits.size() && i < expected.size(); ++i) {
+		checkPicture(classifyPacket(vUnits[i].data(), (int)vUnits[i].size(), codec), expected[i], (int)i, szCodec);
+	}
+	std::vector<uint8_t > vParameterSets;
+	int width = 0, height = 0;
+	CHECK(extractParameterSets(vUnits[0].data(), (int)vUnits[0].size(), codec, vParameterSets, width, height));
+	CHECK(64 == width && 64 == height);
+	CHECK(!extractParameterSets(vUnits[1].data(), (int)vUnits[1].size(), codec, vParameterSets, width, height));
+	CHECK(hasParameterSets(vUnits[0].data(), (int)vUnits[0].size(), codec));
+	CHECK(!hasParameterSets(vUnits[1].data(), (int)vUnits[1].size(), codec));
+}
+
+int main(int argc, char **argv) {
+	const std::string dir = argc > 1 ? argv[1] : "tests/data";
+	testClip(dir + "/gop.h264", VIDEO_CODEC_H264, EXPECTED_H264);
+	testClip(dir + "/gop.hevc", VIDEO_CODEC_HEVC, EXPECTED_HEVC);
+	if (g_nFailed > 0) {
+		fprintf(stderr, "nalParserTest: %d checks failed\n", g_nFailed);
+		return 1;
+	}
+	printf("nalParserTest: passed\n");
+	return 0;
+}
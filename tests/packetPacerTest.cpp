@@ -0,0 +1,140 @@
+// PacketPacer on the steady clock: packets are due by their dts over the
+// speed, by pictures at a set fps, and a timeline restarts when the file
+// loops or the pacer fell behind. The waits are short, the bounds loose
+// enough for a loaded machine.
+//
+//   packetPacerTest
+
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "../packetPacer.h"
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		g_nFailed++; \
+	} \
+} while (0)
+
+// an IDR slice starting a picture, first_mb_in_slice 0
+static const uint8_t IDR_SLICE[] = { 0, 0, 0, 1, 0x65, 0x88, 0x84, 0x00 };
+// a picture parameter set, it goes with its picture
+static const uint8_t PPS[] = { 0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80 };
+
+static std::atomic<bool > g_bAbort{ false };
+
+static int64_t elapsedMs(const uint64_t t0Us) {
+	return (int64_t)(metricsNowUs() - t0Us) / 1000;
+}
+
+static bool wait(PacketPacer &pacer, const int64_t dtsUs) {
+	return pacer.wait(IDR_SLICE, sizeof(IDR_SLICE), VIDEO_CODEC_H264, dtsUs, g_bAbort);
+}
+
+static void testSpeed() {
+	PACING_PARAMS params;
+	params.bEnabled = true;
+	params.speed = 2.f;
+	PacketPacer pacer(params);
+	uint64_t t0 = metricsNowUs();
+	for (int i = 0; i <= 5; ++i) {
+		CHECK(wait(pacer, 1000000 + i * 40000));
+	}
+	// 200 ms of media at twice the speed
+	int64_t ms = elapsedMs(t0);
+	CHECK(ms >= 95 && ms < 180);
+	CHECK(0 == pacer.getNbRestarts());
+}
+
+static void testStartOffsetAndMax() {
+	PACING_PARAMS params;
+	params.bEnabled = true;
+	params.speed = 0.f;
+	params.startOffsetMs = 60;
+	PacketPacer pacer(params);
+	uint64_t t0 = metricsNowUs();
+	CHECK(wait(pacer, 0));
+	int64_t ms = elapsedMs(t0);
+	CHECK(ms >= 55 && ms < 140);
+	// unlimited, a second of media goes at once
+	t0 = metricsNowUs();
+	for (int i = 1; i <= 25; ++i) {
+		CHECK(wait(pacer, i * 40000));
+	}
+	CHECK(elapsedMs(t0) < 30);
+}
+
+static void testFps() {
+	PACING_PARAMS params;
+	params.bEnabled = true;
+	params.fps = 50.f;
+	PacketPacer pacer(params);
+	uint64_t t0 = metricsNowUs();
+	// the timestamps are ignored, four pictures after the first are 80 ms
+	for (int i = 0; i < 5; ++i) {
+		CHECK(pacer.wait(PPS, sizeof(PPS), VIDEO_CODEC_H264, 0, g_bAbort));
+		CHECK(wait(pacer, 0));
+	}
+	int64_t ms = elapsedMs(t0);
+	CHECK(ms >= 75 && ms < 160);
+}
+
+static void testLoopAndLag() {
+	PACING_PARAMS params;
+	params.bEnabled = true;
+	PacketPacer pacer(params);
+	uint64_t t0 = metricsNowUs();
+	CHECK(wait(pacer, 5000000));
+	CHECK(wait(pacer, 5040000));
+	// the file looped, the next timeline starts a frame after the last packet
+	CHECK(wait(pacer, 0));
+	CHECK(wait(pacer, 40000));
+	int64_t ms = elapsedMs(t0);
+	CHECK(ms >= 110 && ms < 200);
+	CHECK(0 == pacer.getNbRestarts());
+
+	// more than a second behind, the pacer restarts instead of bursting
+	std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+	t0 = metricsNowUs();
+	CHECK(wait(pacer, 80000));
+	CHECK(elapsedMs(t0) < 20);
+	CHECK(1 == pacer.getNbRestarts());
+	CHECK(wait(pacer, 120000));
+	ms = elapsedMs(t0);
+	CHECK(ms >= 35 && ms < 100);
+}
+
+static void testAbort() {
+	PACING_PARAMS params;
+	params.bEnabled = true;
+	PacketPacer pacer(params);
+	CHECK(wait(pacer, 0));
+	std::thread aborter([]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		g_bAbort = true;
+	});
+	uint64_t t0 = metricsNowUs();
+	// due in 5 s
+	CHECK(!wait(pacer, 5000000));
+	CHECK(elapsedMs(t0) < 200);
+	aborter.join();
+	g_bAbort = false;
+}
+
+int main() {
+	testSpeed();
+	testStartOffsetAndMax();
+	testFps();
+	testLoopAndLag();
+	testAbort();
+	if (g_nFailed > 0) {
+		fprintf(stderr, "packetPacerTest: %d checks failed\n", g_nFailed);
+		return 1;
+	}
+	printf("packetPacerTest: passed\n");
+	return 0;
+}
@@ -0,0 +1,146 @@
+// PacketPool: chunks by size class that do not overlap, the fallback past
+// maxBytes, and the counts and slabs once every chunk came back, also
+// when the threads which allocated and released them are gone.
+//
+//   packetPoolTest
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include "../packetPool.h"
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		g_nFailed++; \
+	} \
+} while (0)
+
+typedef struct {
+	uint8_t *pData;
+	void *opaque;
+	size_t nBytes;
+} CHUNK_REF;
+
+static bool filledWith(const CHUNK_REF &chunk, const uint8_t value) {
+	for (size_t i = 0; i < chunk.nBytes; ++i) {
+		if (value != chunk.pData[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void testSizeClasses(simplelogger::Logger *logger) {
+	PACKET_POOL_PARAMS params;
+	PacketPool pool(params, logger);
+	const size_t sizes[] = { 1, 511, 512, 513, 1000, 4096, 4097, 100000, 1 << 20, params.maxBytes };
+	const size_t nSizes = sizeof(sizes) / sizeof(sizes[0]);
+	std::vector<CHUNK_REF > vChunks;
+	uint64_t requested = 0;
+	for (int round = 0; round < 3; ++round) {
+		for (size_t i = 0; i < nSizes; ++i) {
+			CHUNK_REF chunk;
+			chunk.nBytes = sizes[i];
+			chunk.pData = pool.allocate(chunk.nBytes, &chunk.opaque);
+			CHECK(nullptr != chunk.pData);
+			if (nullptr == chunk.pData) {
+				continue;
+			}
+			memset(chunk.pData, (int)vChunks.size(), chunk.nBytes);
+			vChunks.push_back(chunk);
+			requested += chunk.nBytes;
+		}
+	}
+	// no chunk overwrote another
+	for (size_t i = 0; i < vChunks.size(); ++i) {
+		CHECK(filledWith(vChunks[i], (uint8_t)i));
+	}
+	void *opaque = nullptr;
+	CHECK(nullptr == pool.allocate(params.maxBytes + 1, &opaque));
+
+	PACKET_POOL_STATS stats = pool.getStats();
+	CHECK(vChunks.size() == stats.nAllocs);
+	CHECK(1 == stats.nFallbacks);
+	CHECK(requested == stats.requestedBytes);
+	// four classes per power of two waste less than a quarter, the
+	// smallest class aside
+	CHECK(stats.usedBytes >= requested);
+	CHECK(stats.usedBytes <= requested + requested / 4 + vChunks.size() * params.minBytes);
+	CHECK(stats.reservedBytes >= stats.usedBytes + stats.cachedBytes);
+
+	for (size_t i = 0; i < vChunks.size(); ++i) {
+		PacketPool::release(vChunks[i].opaque, vChunks[i].pData);
+	}
+	stats = pool.getStats();
+	CHECK(0 == stats.requestedBytes);
+	CHECK(0 == stats.usedBytes);
+}
+
+// Takers allocate, a recorder thread releases, as in the pipeline. With
+// every thread gone the caches went back to the slabs, and no empty slab
+// is kept.
+static void testAcrossThreads(simplelogger::Logger *logger) {
+	PACKET_POOL_PARAMS params;
+	params.keepEmptySlabs = 0;
+	PacketPool pool(params, logger);
+	const int nTakers = 4;
+	const int nPerTaker = 2000;
+	std::vector<CHUNK_REF > vChunks;
+	std::mutex mtx;
+	std::vector<std::thread > vThreads;
+	for (int t = 0; t < nTakers; ++t) {
+		vThreads.push_back(std::thread([&, t]() {
+			for (int i = 0; i < nPerTaker; ++i) {
+				CHUNK_REF chunk;
+				chunk.nBytes = 200 + (size_t)(i * 7919 + t * 104729) % 60000;
+				chunk.pData = pool.allocate(chunk.nBytes, &chunk.opaque);
+				if (nullptr == chunk.pData) {
+					continue;
+				}
+				memset(chunk.pData, t + 1, chunk.nBytes);
+				std::lock_guard<std::mutex> lock(mtx);
+				vChunks.push_back(chunk);
+			}
+		}));
+	}
+	for (size_t i = 0; i < vThreads.size(); ++i) {
+		vThreads[i].join();
+	}
+	CHECK(nTakers * nPerTaker == (int)vChunks.size());
+	PACKET_POOL_STATS stats = pool.getStats();
+	CHECK(vChunks.size() == stats.nAllocs);
+	CHECK(stats.nSlabs > 0);
+
+	std::thread recorder([&]() {
+		for (size_t i = 0; i < vChunks.size(); ++i) {
+			const uint8_t value = vChunks[i].pData[0];
+			CHECK(value >= 1 && value <= nTakers && filledWith(vChunks[i], value));
+			PacketPool::release(vChunks[i].opaque, vChunks[i].pData);
+		}
+	});
+	recorder.join();
+	stats = pool.getStats();
+	CHECK(0 == stats.requestedBytes);
+	CHECK(0 == stats.usedBytes);
+	CHECK(0 == stats.cachedBytes);
+	CHECK(0 == stats.nSlabs);
+	CHECK(0 == stats.reservedBytes);
+}
+
+int main() {
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	testSizeClasses(logger);
+	testAcrossThreads(logger);
+	delete logger;
+	if (g_nFailed > 0) {
+		fprintf(stderr, "packetPoolTest: %d checks failed\n", g_nFailed);
+		return 1;
+	}
+	printf("packetPoolTest: passed\n");
+	return 0;
+}
@@ -0,0 +1,120 @@
+// seekRecording over hand-made segments of the continuous recording: the
+// keyframe at or before a time, across segments, before the first and
+// past the last one, and an index cut short by a crash.
+//
+//   recordIndexTest
+//
+// The segments go to a directory under /tmp, removed at the end.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "../recordIndex.h"
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		g_nFailed++; \
+	} \
+} while (0)
+
+static const int64_t T0_US = 1700000000000000LL;
+static const int64_t GOP_US = 2000000;
+
+// A segment with a keyframe every GOP_US, its index cut nCut bytes short.
+static void writeSegment(const std::string &channelDir, const int64_t startUs, const int nKeyframes,
+						const int nCut = 0) {
+	const std::string base = channelDir + "/" + std::to_string(startUs / 1000);
+	FILE *fp = fopen((base + ".h264").c_str(), "wb");
+	FILE *fpIndex = fopen((base + ".idx").c_str(), "wb");
+	CHECK(nullptr != fp && nullptr != fpIndex);
+	if (nullptr == fp || nullptr == fpIndex) {
+		return;
+	}
+	std::vector<uint8_t > vIndex(sizeof(RECORD_INDEX_HEADER));
+	RECORD_INDEX_HEADER header;
+	header.magic = RECORD_INDEX_MAGIC;
+	header.version = RECORD_INDEX_VERSION;
+	header.codec = 0;
+	header.entrySize = sizeof(RECORD_INDEX_ENTRY);
+	header.reserved = 0;
+	memcpy(vIndex.data(), &header, sizeof(header));
+	for (int i = 0; i < nKeyframes; ++i) {
+		RECORD_INDEX_ENTRY entry;
+		entry.timeUs = startUs + i * GOP_US;
+		entry.offset = (uint64_t)i * 1000;
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(&entry);
+		vIndex.insert(vIndex.end(), p, p + sizeof(entry));
+	}
+	std::vector<uint8_t > vData((size_t)nKeyframes * 1000, 0);
+	fwrite(vData.data(), 1, vData.size(), fp);
+	fwrite(vIndex.data(), 1, vIndex.size() - nCut, fpIndex);
+	fclose(fp);
+	fclose(fpIndex);
+}
+
+static bool seek(const std::string &dir, const int64_t timeUs, RECORD_POSITION &pos) {
+	pos = RECORD_POSITION();
+	return seekRecording(dir, 0, timeUs, pos);
+}
+
+int main() {
+	char szDir[] = "/tmp/recordIndexTest.XXXXXX";
+	if (nullptr == mkdtemp(szDir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	const std::string dir = szDir;
+	const std::string channelDir = recordChannelDir(dir, 0);
+	CHECK(0 == mkdir(channelDir.c_str(), 0755));
+	// two closed segments of 5 keyframes and an open one whose last entry
+	// is half written
+	writeSegment(channelDir, T0_US, 5);
+	writeSegment(channelDir, T0_US + 10 * GOP_US, 5);
+	writeSegment(channelDir, T0_US + 20 * GOP_US, 4, sizeof(RECORD_INDEX_ENTRY) / 2);
+	// not a segment
+	fclose(fopen((channelDir + "/notes.txt").c_str(), "wb"));
+
+	std::vector<RECORD_SEGMENT > vSegments;
+	listRecordSegments(channelDir, vSegments);
+	CHECK(3 == vSegments.size());
+	for (size_t i = 0; i < vSegments.size(); ++i) {
+		CHECK(T0_US + (int64_t)i * 10 * GOP_US == vSegments[i].startUs);
+	}
+	std::vector<RECORD_INDEX_ENTRY > vEntries;
+	CHECK(readRecordIndex(vSegments.back().indexPath, vEntries));
+	CHECK(3 == vEntries.size());
+
+	RECORD_POSITION pos;
+	// the keyframe at or before the time
+	CHECK(seek(dir, T0_US + 2 * GOP_US + 1, pos));
+	CHECK(vSegments[0].path == pos.path && 2000 == pos.offset && T0_US + 2 * GOP_US == pos.timeUs);
+	CHECK(seek(dir, T0_US + 2 * GOP_US, pos));
+	CHECK(2000 == pos.offset);
+	// in the next segment
+	CHECK(seek(dir, T0_US + 11 * GOP_US + GOP_US / 2, pos));
+	CHECK(vSegments[1].path == pos.path && 1000 == pos.offset);
+	// between segments, the last keyframe of the earlier one
+	CHECK(seek(dir, T0_US + 9 * GOP_US, pos));
+	CHECK(vSegments[0].path == pos.path && 4000 == pos.offset);
+	// before the recording, its first keyframe
+	CHECK(seek(dir, T0_US - 60000000, pos));
+	CHECK(vSegments[0].path == pos.path && 0 == pos.offset && T0_US == pos.timeUs);
+	// past the recording, the last whole entry of the open segment
+	CHECK(seek(dir, T0_US + 100 * GOP_US, pos));
+	CHECK(vSegments[2].path == pos.path && 2000 == pos.offset && T0_US + 22 * GOP_US == pos.timeUs);
+
+	CHECK(!seekRecording(dir, 1, T0_US, pos));
+
+	CHECK(0 == system(("rm -rf " + dir).c_str()));
+	if (g_nFailed > 0) {
+		fprintf(stderr, "recordIndexTest: %d checks failed\n", g_nFailed);
+		return 1;
+	}
+	printf("recordIndexTest: passed\n");
+	return 0;
+}
@@ -0,0 +1,157 @@
+// RtpJitterBuffer resync: a sequence which jumps, as a restarted camera's
+// does, and a new SSRC restart the buffer once the packet after the first
+// one follows in sequence; a lone stray packet restarts nothing.
+//
+//   rtpJitterBufferTest
+
+#include <cstdio>
+#include <vector>
+#include "../rtpJitterBuffer.h"
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		g_nFailed++; \
+	} \
+} while (0)
+
+typedef struct {
+	uint16_t seq;
+	uint32_t ssrc;
+	bool bGap;
+} OUT_PACKET;
+
+static void onPacket(void *handle, const uint8_t *pPacket, int, bool bGap) {
+	OUT_PACKET out;
+	out.seq = (uint16_t)((pPacket[2] << 8) | pPacket[3]);
+	out.ssrc = ((uint32_t)pPacket[8] << 24) | (pPacket[9] << 16) | (pPacket[10] << 8) | pPacket[11];
+	out.bGap = bGap;
+	((std::vector<OUT_PACKET > *)handle)->push_back(out);
+}
+
+static void push(RtpJitterBuffer &buffer, const uint16_t seq, const uint32_t ssrc, const uint64_t nowUs = 0) {
+	uint8_t packet[16] = { 0x80, 96 };
+	packet[2] = (uint8_t)(seq >> 8);
+	packet[3] = (uint8_t)seq;
+	for (int i = 0; i < 4; ++i) {
+		packet[8 + i] = (uint8_t)(ssrc >> (24 - 8 * i));
+	}
+	buffer.push(packet, sizeof(packet), nowUs);
+}
+
+static JITTER_PARAMS robust() {
+	JITTER_PARAMS params;
+	parseJitterProfile("robust:8:100", params);
+	return params;
+}
+
+static void testSequenceJump(const JITTER_PARAMS &params) {
+	RtpJitterBuffer buffer(params);
+	std::vector<OUT_PACKET > vOut;
+	buffer.setSink(&vOut, onPacket);
+	for (uint16_t seq = 100; seq < 105; ++seq) {
+		push(buffer, seq, 1);
+	}
+	// held on probation until the next one follows it
+	push(buffer, 40000, 1);
+	CHECK(5 == vOut.size());
+	push(buffer, 40001, 1);
+	push(buffer, 40002, 1);
+	CHECK(8 == vOut.size());
+	if (8 == vOut.size()) {
+		CHECK(104 == vOut[4].seq && !vOut[4].bGap);
+		CHECK(40000 == vOut[5].seq && vOut[5].bGap);
+		CHECK(40001 == vOut[6].seq && !vOut[6].bGap);
+		CHECK(40002 == vOut[7].seq && !vOut[7].bGap);
+	}
+	JITTER_STATS stats = buffer.getStats();
+	CHECK(1 == stats.nResyncs);
+	CHECK(0 == stats.nLost);
+	CHECK(0 == stats.nLate);
+}
+
+static void testNewSsrc(const JITTER_PARAMS &params) {
+	RtpJitterBuffer buffer(params);
+	std::vector<OUT_PACKET > vOut;
+	buffer.setSink(&vOut, onPacket);
+	for (uint16_t seq = 65530; seq != 3; ++seq) {
+		push(buffer, seq, 1);
+	}
+	// the same sequence numbers would pass as duplicates or late packets
+	push(buffer, 65534, 2);
+	push(buffer, 65535, 2);
+	CHECK(11 == vOut.size());
+	if (11 == vOut.size()) {
+		CHECK(2 == vOut[8].seq && 1 == vOut[8].ssrc);
+		CHECK(65534 == vOut[9].seq && 2 == vOut[9].ssrc && vOut[9].bGap);
+		CHECK(65535 == vOut[10].seq && 2 == vOut[10].ssrc && !vOut[10].bGap);
+	}
+	JITTER_STATS stats = buffer.getStats();
+	CHECK(1 == stats.nResyncs);
+	CHECK(0 == stats.nDuplicate);
+	CHECK(0 == stats.nLate);
+}
+
+static void testStrayPacket(const JITTER_PARAMS &params) {
+	RtpJitterBuffer buffer(params);
+	std::vector<OUT_PACKET > vOut;
+	buffer.setSink(&vOut, onPacket);
+	push(buffer, 500, 7);
+	push(buffer, 501, 7);
+	push(buffer, 20000, 7);
+	push(buffer, 502, 7);
+	// a second stray replaces the first, which started nothing
+	push(buffer, 30000, 7);
+	push(buffer, 503, 7);
+	CHECK(4 == vOut.size());
+	for (size_t i = 0; i < vOut.size(); ++i) {
+		CHECK(500 + i == vOut[i].seq && !vOut[i].bGap);
+	}
+	JITTER_STATS stats = buffer.getStats();
+	CHECK(0 == stats.nResyncs);
+	CHECK(1 == stats.nLate);
+}
+
+// The packets held behind a hole go out before the new sequence, the
+// hole itself is given up.
+static void testResyncReleasesHeld() {
+	RtpJitterBuffer buffer(robust());
+	std::vector<OUT_PACKET > vOut;
+	buffer.setSink(&vOut, onPacket);
+	push(buffer, 10, 3);
+	push(buffer, 11, 3);
+	push(buffer, 13, 3);
+	push(buffer, 14, 3);
+	CHECK(2 == vOut.size());
+	push(buffer, 9000, 3);
+	push(buffer, 9001, 3);
+	CHECK(6 == vOut.size());
+	if (6 == vOut.size()) {
+		CHECK(13 == vOut[2].seq && vOut[2].bGap);
+		CHECK(14 == vOut[3].seq && !vOut[3].bGap);
+		CHECK(9000 == vOut[4].seq && vOut[4].bGap);
+		CHECK(9001 == vOut[5].seq && !vOut[5].bGap);
+	}
+	JITTER_STATS stats = buffer.getStats();
+	CHECK(1 == stats.nResyncs);
+	CHECK(1 == stats.nLost);
+}
+
+int main() {
+	JITTER_PARAMS params;
+	testSequenceJump(params);
+	testSequenceJump(robust());
+	testNewSsrc(params);
+	testNewSsrc(robust());
+	testStrayPacket(params);
+	testStrayPacket(robust());
+	testResyncReleasesHeld();
+	if (g_nFailed > 0) {
+		fprintf(stderr, "rtpJitterBufferTest: %d checks failed\n", g_nFailed);
+		return 1;
+	}
+	printf("rtpJitterBufferTest: passed\n");
+	return 0;
+}
@@ -0,0 +1,324 @@
+#include "threadPlacement.h"
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+
+ThreadPlacement *g_pPlacement = nullptr;
+
+static bool readLine(const std::string &path, std::string &line) {
+	FILE *fp = fopen(path.c_str(), "r");
+	if (nullptr == fp) {
+		return false;
+	}
+	char sz[4096];
+	bool bRead = nullptr != fgets(sz, sizeof(sz), fp);
+	fclose(fp);
+	if (!bRead) {
+		return false;
+	}
+	line = sz;
+	while (!line.empty() && isspace((unsigned char)line.back())) {
+		line.pop_back();
+	}
+	return true;
+}
+
+static void nameThread(const char *szName, const int index) {
+	// 15 characters and the terminator
+	char sz[16];
+	if (index >= 0) {
+		snprintf(sz, sizeof(sz), "%s-%d", szName, index);
+	} else {
+		snprintf(sz, sizeof(sz), "%s", szName);
+	}
+	pthread_setname_np(pthread_self(), sz);
+}
+
+ThreadPlacement::ThreadPlacement(const PLACEMENT_PARAMS &params, simplelogger::Logger *logger)
+: params_(params), logger_(logger) {
+	for (int i = 0; i < ROLE_COUNT; ++i) {
+		nPlaced_[i] = 0;
+	}
+	readTopology();
+	assignRoles();
+	if (PLACEMENT_OFF == params_.mode) {
+		return;
+	}
+	LOG_INFO(logger_, "ThreadPlacement: " << vNodeCpus_.size() << " node(s), " << vAllowed_.size()
+						<< " CPUs allowed, home node " << homeNode_);
+	for (int i = 0; i < ROLE_COUNT; ++i) {
+		LOG_INFO(logger_, "ThreadPlacement: " << roleName((THREAD_ROLE)i) << " on CPUs "
+							<< formatCpuList(vRoleCpus_[i]));
+	}
+}
+
+void ThreadPlacement::readTopology() {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (0 == sched_getaffinity(0, sizeof(set), &set)) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &set)) {
+				vAllowed_.push_back(cpu);
+			}
+		}
+	}
+	if (vAllowed_.empty()) {
+		vAllowed_.push_back(0);
+	}
+	vSiblingOf_.resize(vAllowed_.back() + 1);
+	for (size_t i = 0; i < vSiblingOf_.size(); ++i) {
+		vSiblingOf_[i] = (int)i;
+		std::string line;
+		std::vector<int> vSiblings;
+		if (readLine("/sys/devices/system/cpu/cpu" + std::to_string(i) + "/topology/thread_siblings_list", line)
+			&& parseCpuList(line, vSiblings) && !vSiblings.empty()) {
+			vSiblingOf_[i] = *std::min_element(vSiblings.begin(), vSiblings.end());
+		}
+	}
+
+	// nodes may be numbered sparsely, e.g. after offlining
+	DIR *pDir = opendir("/sys/devices/system/node");
+	if (nullptr != pDir) {
+		struct dirent *pEntry = nullptr;
+		while (nullptr != (pEntry = readdir(pDir))) {
+			int node = -1;
+			char c = 0;
+			if (1 != sscanf(pEntry->d_name, "node%d%c", &node, &c) || node < 0 || node > 1023) {
+				continue;
+			}
+			std::string line;
+			std::vector<int> vCpus;
+			if (!readLine("/sys/devices/system/node/" + std::string(pEntry->d_name) + "/cpulist", line)
+				|| !parseCpuList(line, vCpus)) {
+				continue;
+			}
+			if ((int)vNodeCpus_.size() <= node) {
+				vNodeCpus_.resize(node + 1);
+			}
+			for (size_t i = 0; i < vCpus.size(); ++i) {
+				if (std::binary_search(vAllowed_.begin(), vAllowed_.end(), vCpus[i])) {
+					vNodeCpus_[node].push_back(vCpus[i]);
+				}
+			}
+		}
+		closedir(pDir);
+	}
+	if (vNodeCpus_.empty()) {
+		vNodeCpus_.push_back(vAllowed_);
+	}
+	if (params_.gpuNode >= 0 && params_.gpuNode < (int)vNodeCpus_.size() && !vNodeCpus_[params_.gpuNode].empty()) {
+		homeNode_ = params_.gpuNode;
+	} else if (params_.gpuNode >= 0) {
+		LOG_WARN(logger_, "ThreadPlacement: no allowed CPUs on node " << params_.gpuNode << ", using all nodes");
+	}
+}
+
+void ThreadPlacement::assignRoles() {
+	if (PLACEMENT_OFF == params_.mode) {
+		return;
+	}
+	const std::vector<int> &vHome = homeNode_ >= 0 ? vNodeCpus_[homeNode_] : vAllowed_;
+	std::vector<int> vOther;
+	for (size_t i = 0; i < vAllowed_.size(); ++i) {
+		if (!std::binary_search(vHome.begin(), vHome.end(), vAllowed_[i])) {
+			vOther.push_back(vAllowed_[i]);
+		}
+	}
+	for (int i = 0; i < ROLE_COUNT; ++i) {
+		vRoleCpus_[i] = vHome;
+	}
+	if (PLACEMENT_NODE != params_.mode) {
+		// cores of the home node, whole, by weight: ingest 1, push 1, workers 2
+		std::vector<int> vCores;
+		for (size_t i = 0; i < vHome.size(); ++i) {
+			vCores.push_back(vSiblingOf_[vHome[i]]);
+		}
+		std::sort(vCores.begin(), vCores.end());
+		vCores.erase(std::unique(vCores.begin(), vCores.end()), vCores.end());
+		const int nCores = (int)vCores.size();
+		if (nCores >= 3) {
+			const int nIngest = std::max(1, nCores / 4);
+			const int nPush = std::max(1, nCores / 4);
+			const int bounds[4] = { 0, nIngest, nIngest + nPush, nCores };
+			const THREAD_ROLE roles[3] = { ROLE_INGEST, ROLE_PUSH, ROLE_WORKER };
+			for (int r = 0; r < 3; ++r) {
+				std::vector<int> &vCpus = vRoleCpus_[roles[r]];
+				vCpus.clear();
+				for (size_t i = 0; i < vHome.size(); ++i) {
+					int iCore = (int)(std::lower_bound(vCores.begin(), vCores.end(), vSiblingOf_[vHome[i]]) - vCores.begin());
+					if (iCore >= bounds[r] && iCore < bounds[r + 1]) {
+						vCpus.push_back(vHome[i]);
+					}
+				}
+			}
+		}
+		if (!vOther.empty()) {
+			vRoleCpus_[ROLE_IO] = vOther;
+			vRoleCpus_[ROLE_PRESENTER] = vOther;
+		}
+	}
+	for (int i = 0; i < ROLE_COUNT; ++i) {
+		if (params_.cpuLists[i].empty()) {
+			continue;
+		}
+		std::vector<int> vCpus, vListed;
+		parseCpuList(params_.cpuLists[i], vListed);
+		for (size_t j = 0; j < vListed.size(); ++j) {
+			if (std::binary_search(vAllowed_.begin(), vAllowed_.end(), vListed[j])) {
+				vCpus.push_back(vListed[j]);
+			}
+		}
+		if (vCpus.empty()) {
+			LOG_WARN(logger_, "ThreadPlacement: none of CPUs " << params_.cpuLists[i] << " allowed for "
+								<< roleName((THREAD_ROLE)i) << ", ignored");
+			continue;
+		}
+		vRoleCpus_[i] = vCpus;
+	}
+	if (PLACEMENT_CPU == params_.mode) {
+		// one CPU per core first, the SMT siblings after them
+		for (int i = 0; i < ROLE_COUNT; ++i) {
+			std::vector<int> &vCpus = vRoleCpus_[i];
+			std::vector<int> vRank(vCpus.size());
+			for (size_t j = 0; j < vCpus.size(); ++j) {
+				for (size_t k = 0; k < j; ++k) {
+					vRank[j] += vSiblingOf_[vCpus[k]] == vSiblingOf_[vCpus[j]];
+				}
+			}
+			std::vector<size_t> vOrder(vCpus.size());
+			for (size_t j = 0; j < vOrder.size(); ++j) {
+				vOrder[j] = j;
+			}
+			std::stable_sort(vOrder.begin(), vOrder.end(), [&vRank](size_t a, size_t b) { return vRank[a] < vRank[b]; });
+			std::vector<int> vSorted;
+			for (size_t j = 0; j < vOrder.size(); ++j) {
+				vSorted.push_back(vCpus[vOrder[j]]);
+			}
+			vCpus.swap(vSorted);
+		}
+	}
+}
+
+void ThreadPlacement::place(const THREAD_ROLE role, const char *szName, const int index) {
+	nameThread(szName, index);
+	if (PLACEMENT_OFF == params_.mode || vRoleCpus_[role].empty()) {
+		return;
+	}
+	const std::vector<int> &vCpus = vRoleCpus_[role];
+	int iThread = index >= 0 ? index : nPlaced_[role]++;
+	bool bSet = PLACEMENT_CPU == params_.mode
+				? setAffinity(std::vector<int>(1, vCpus[iThread % vCpus.size()]))
+				: setAffinity(vCpus);
+	if (!bSet && !bWarned_.exchange(true)) {
+		LOG_WARN(logger_, "ThreadPlacement: failed to set the affinity of " << szName << ": " << strerror(errno));
+	}
+}
+
+bool ThreadPlacement::bindToNode(const int node) {
+	if (PLACEMENT_OFF == params_.mode) {
+		return true;
+	}
+	if (node < 0 || node >= (int)vNodeCpus_.size() || vNodeCpus_[node].empty()) {
+		return setAffinity(vAllowed_);
+	}
+	// the library threads of the home device are the workers
+	if (node == homeNode_ && PLACEMENT_NODE != params_.mode) {
+		return setAffinity(vRoleCpus_[ROLE_WORKER]);
+	}
+	return setAffinity(vNodeCpus_[node]);
+}
+
+bool ThreadPlacement::setAffinity(const std::vector<int> &vCpus) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < vCpus.size(); ++i) {
+		CPU_SET(vCpus[i], &set);
+	}
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (0 != err) {
+		errno = err;
+	}
+	return 0 == err;
+}
+
+bool ThreadPlacement::parseCpuList(const std::string &list, std::vector<int> &vCpus) {
+	vCpus.clear();
+	const char *p = list.c_str();
+	while (0 != *p) {
+		char *szEnd = nullptr;
+		long first = strtol(p, &szEnd, 10), last = first;
+		if (szEnd == p || first < 0) {
+			return false;
+		}
+		p = szEnd;
+		if ('-' == *p) {
+			last = strtol(p + 1, &szEnd, 10);
+			if (szEnd == p + 1 || last < first) {
+				return false;
+			}
+			p = szEnd;
+		}
+		if (last >= CPU_SETSIZE || (0 != *p && ',' != *p)) {
+			return false;
+		}
+		for (long cpu = first; cpu <= last; ++cpu) {
+			vCpus.push_back((int)cpu);
+		}
+		p = 0 == *p ? p : p + 1;
+	}
+	std::sort(vCpus.begin(), vCpus.end());
+	vCpus.erase(std::unique(vCpus.begin(), vCpus.end()), vCpus.end());
+	return true;
+}
+
+std::string ThreadPlacement::formatCpuList(const std::vector<int> &vCpus) {
+	std::string list;
+	for (size_t i = 0; i < vCpus.size(); ) {
+		size_t j = i;
+		while (j + 1 < vCpus.size() && vCpus[j + 1] == vCpus[j] + 1) {
+			++j;
+		}
+		list += (list.empty() ? "" : ",") + std::to_string(vCpus[i]);
+		if (j > i) {
+			list += "-" + std::to_string(vCpus[j]);
+		}
+		i = j + 1;
+	}
+	return list.empty() ? "none" : list;
+}
+
+int ThreadPlacement::getPciNode(const std::string &busId) {
+	// sysfs names the device in lower case with a 4 digit domain
+	std::string id;
+	for (size_t i = 0; i < busId.size(); ++i) {
+		id += (char)tolower((unsigned char)busId[i]);
+	}
+	size_t colon = id.find(':');
+	if (colon != std::string::npos && colon > 4) {
+		id = id.substr(colon - 4);
+	}
+	std::string line;
+	if (!readLine("/sys/bus/pci/devices/" + id + "/numa_node", line)) {
+		return -1;
+	}
+	return atoi(line.c_str());
+}
+
+const char *ThreadPlacement::roleName(const THREAD_ROLE role) {
+	static const char *szNames[ROLE_COUNT] = { "ingest", "push", "worker", "io", "presenter" };
+	return role >= 0 && role < ROLE_COUNT ? szNames[role] : "unknown";
+}
+
+void placeThread(const THREAD_ROLE role, const char *szName, const int index) {
+	if (nullptr != g_pPlacement) {
+		g_pPlacement->place(role, szName, index);
+	} else {
+		nameThread(szName, index);
+	}
+}
@@ -0,0 +1,84 @@
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include "common/logger.h"
+
+enum THREAD_ROLE {
+	ROLE_INGEST = 0,	// demuxers and the RTSP reactor, one per channel
+	ROLE_PUSH,			// userPushPacket, one per channel
+	ROLE_WORKER,		// host side decode and analysis
+	ROLE_IO,			// recorders, encoders, exporters
+	ROLE_PRESENTER,		// the GLUT loop
+	ROLE_COUNT
+};
+
+enum PLACEMENT_MODE {
+	PLACEMENT_OFF = 0,	// the threads are only named
+	PLACEMENT_NODE,		// every thread on the CPUs of the GPU's node
+	PLACEMENT_ROLE,		// each role on its own cores of the node
+	PLACEMENT_CPU		// as ROLE, each thread on one CPU of its role
+};
+
+typedef struct {
+	PLACEMENT_MODE mode = PLACEMENT_OFF;
+	int gpuNode = -1;						// NUMA node of the inference device, -1 for none
+	std::string cpuLists[ROLE_COUNT];		// e.g. "0-3,8", overrides the role's share
+} PLACEMENT_PARAMS;
+
+// Places the threads of the process by role on the CPU topology read from
+// sysfs. The home node is the one the GPU hangs off, so the packets the
+// takers write and the worker threads of the inference library stay on
+// the memory controller and PCIe root of the device. In ROLE mode the
+// cores of the node are split between ingest, push and the host workers,
+// SMT siblings kept together, and the I/O threads and the presenter go
+// to the other nodes when there are any, so a recorder flushing to disk
+// is not a neighbour of a demuxer. Only the CPUs the process was started
+// on are used, so taskset and cpusets still apply.
+class ThreadPlacement {
+public:
+	ThreadPlacement(const PLACEMENT_PARAMS &params, simplelogger::Logger *logger);
+
+	// Names the calling thread "<name>-<index>", or "<name>" for a
+	// negative index, and moves it onto the CPUs of its role.
+	void place(const THREAD_ROLE role, const char *szName, const int index);
+
+	// Binds the calling thread to a node, -1 to all allowed CPUs. The
+	// threads it creates afterwards inherit the mask.
+	bool bindToNode(const int node);
+
+	int getHomeNode() const { return homeNode_; }
+	const std::vector<int> &getCpus(const THREAD_ROLE role) const { return vRoleCpus_[role]; }
+
+	// "0-3,8" -> {0, 1, 2, 3, 8}, false if malformed
+	static bool parseCpuList(const std::string &list, std::vector<int> &vCpus);
+	static std::string formatCpuList(const std::vector<int> &vCpus);
+	// node of a PCI device, e.g. "0000:3B:00.0" from cudaDeviceGetPCIBusId, -1 if unknown
+	static int getPciNode(const std::string &busId);
+	static const char *roleName(const THREAD_ROLE role);
+
+private:
+	void readTopology();
+	void assignRoles();
+	bool setAffinity(const std::vector<int> &vCpus);
+
+	PLACEMENT_PARAMS params_;
+	simplelogger::Logger *logger_{ nullptr };
+	int homeNode_{ -1 };
+	std::vector<int> vAllowed_;							// of the process at start
+	std::vector<std::vector<int> > vNodeCpus_;			// allowed CPUs per node
+	std::vector<int> vSiblingOf_;						// CPU -> first CPU of its core
+	std::vector<int> vRoleCpus_[ROLE_COUNT];
+	std::atomic<int> nPlaced_[ROLE_COUNT];
+	std::atomic<bool > bWarned_{ false };
+};
+
+extern ThreadPlacement *g_pPlacement;
+
+// Names the calling thread and places it by g_pPlacement when there is
+// one; to be called first thing in a thread body.
+void placeThread(const THREAD_ROLE role, const char *szName, const int index = -1);
+
+#endif // THREAD_PLACEMENT_H
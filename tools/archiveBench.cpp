@@ -0,0 +1,213 @@
+// Write throughput, size and query latency of the detection archive.
+//
+//   archiveBench [-dir=<dir>] [-detections=N] [-channels=N] [-fps=F]
+//                [-boxes=N] [-queries=N] [-scans=N] [-hours=H]
+//
+// Writes -detections (1e9) synthetic boxes to -dir (/tmp/archiveBench,
+// emptied first) for -channels (16) cameras at -fps (25) with -boxes (4)
+// objects in view on average, back-dated so the archive ends now. The
+// objects move smoothly for 5 to 60 s; class 0 is most of them, classes
+// 3 to 7 are rare. Then -queries (200) random queries of -hours (1) of
+// one channel and one class, common and rare alternately, and -scans (5)
+// of them again by decoding the whole channel, which also checks that
+// both find the same boxes.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "../detectionArchiveWriter.h"
+#include "../common/histogram.h"
+#include "toolArgs.h"
+
+static uint32_t g_seed = 1;
+
+static float uniform() {
+	g_seed = g_seed * 1664525 + 1013904223;
+	return (g_seed >> 8) / 16777216.f;
+}
+
+typedef struct {
+	ARCHIVE_BOX box;
+	float vx;
+	float vy;
+	int nFramesLeft;
+} TRACK;
+
+static int pickClass() {
+	float r = uniform();
+	if (r < 0.7f) {
+		return 0;
+	}
+	if (r < 0.9f) {
+		return 1;
+	}
+	if (r < 0.98f) {
+		return 2;
+	}
+	return 3 + (int)(uniform() * 5) % 5;
+}
+
+static void addTrack(std::vector<TRACK > &vTracks, const float fps) {
+	TRACK track;
+	track.box.category = pickClass();
+	track.box.w = 0.03f + uniform() * 0.15f;
+	track.box.h = 0.05f + uniform() * 0.3f;
+	track.box.x = uniform() * (1.f - track.box.w);
+	track.box.y = uniform() * (1.f - track.box.h);
+	track.vx = (uniform() - 0.5f) * 0.2f / fps;
+	track.vy = (uniform() - 0.5f) * 0.05f / fps;
+	track.nFramesLeft = (int)((5.f + uniform() * 55.f) * fps);
+	vTracks.push_back(track);
+}
+
+// One frame of a channel: the tracks move, end, and begin at the rate
+// which keeps nBoxes in view.
+static void step(std::vector<TRACK > &vTracks, const float fps, const float nBoxes) {
+	for (size_t i = 0; i < vTracks.size(); ) {
+		TRACK &track = vTracks[i];
+		track.box.x += track.vx;
+		track.box.y += track.vy;
+		if (--track.nFramesLeft <= 0 || track.box.x < 0.f || track.box.y < 0.f
+			|| track.box.x + track.box.w > 1.f || track.box.y + track.box.h > 1.f) {
+			vTracks.erase(vTracks.begin() + i);
+		} else {
+			++i;
+		}
+	}
+	// a mean life of about 20 s with the exits at the border
+	if (uniform() < nBoxes / (20.f * fps)) {
+		addTrack(vTracks, fps);
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *szDir = getArg(argc, argv, "dir");
+	const std::string dir = nullptr == szDir ? "/tmp/archiveBench" : szDir;
+	const uint64_t nDetections = (uint64_t)getArg(argc, argv, "detections", 1e9);
+	const int nChannels = (int)getArg(argc, argv, "channels", 16);
+	const float fps = (float)getArg(argc, argv, "fps", 25);
+	const float nBoxes = (float)getArg(argc, argv, "boxes", 4);
+	const int nQueries = (int)getArg(argc, argv, "queries", 200);
+	const int nScans = (int)getArg(argc, argv, "scans", 5);
+	const double hours = getArg(argc, argv, "hours", 1);
+	if (nChannels <= 0 || fps <= 0.f || nBoxes <= 0.f) {
+		fprintf(stderr, "illegal channels, fps or boxes\n");
+		return 1;
+	}
+	if (0 != system(("rm -rf '" + dir + "'").c_str())) {
+		fprintf(stderr, "cannot empty %s\n", dir.c_str());
+		return 1;
+	}
+
+	// back-dated by the span the detections take
+	const int64_t frameUs = (int64_t)(1e6 / fps);
+	const int64_t spanUs = (int64_t)(nDetections / (nChannels * fps * nBoxes) * 1e6);
+	const int64_t startUs = std::chrono::duration_cast<std::chrono::microseconds>(
+								std::chrono::system_clock::now().time_since_epoch()).count() - spanUs;
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	ARCHIVE_PARAMS params;
+	params.dir = dir;
+	DetectionArchiveWriter *pWriter = new DetectionArchiveWriter(nChannels, params, logger);
+	if (!pWriter->start()) {
+		return 1;
+	}
+	std::vector<std::vector<TRACK > > vvTracks(nChannels);
+	std::vector<ARCHIVE_BOX > vBoxes;
+	uint64_t nWritten = 0;
+	int64_t frameIndex = 0;
+	uint64_t t0 = nowUs();
+	for (; nWritten < nDetections; ++frameIndex) {
+		int64_t timeUs = startUs + frameIndex * frameUs;
+		for (int ch = 0; ch < nChannels; ++ch) {
+			std::vector<TRACK > &vTracks = vvTracks[ch];
+			step(vTracks, fps, nBoxes);
+			if (vTracks.empty()) {
+				continue;
+			}
+			vBoxes.resize(vTracks.size());
+			// the detector's jitter, a few px around the track
+			for (size_t i = 0; i < vTracks.size(); ++i) {
+				vBoxes[i] = vTracks[i].box;
+				vBoxes[i].x += (uniform() - 0.5f) * 0.004f;
+				vBoxes[i].y += (uniform() - 0.5f) * 0.004f;
+				vBoxes[i].w += (uniform() - 0.5f) * 0.004f;
+				vBoxes[i].h += (uniform() - 0.5f) * 0.004f;
+			}
+			pWriter->append(ch, timeUs, frameIndex, vBoxes.data(), vBoxes.size());
+			nWritten += vBoxes.size();
+		}
+		if (0 == frameIndex % (int64_t)(3600 * fps)) {
+			fprintf(stderr, "\r%.0f%%", 100.0 * nWritten / nDetections);
+		}
+	}
+	pWriter->close();
+	double writeSec = (nowUs() - t0) / 1e6;
+	uint64_t nBytes = pWriter->getNbBytes();
+	delete pWriter;
+	const int64_t endUs = startUs + frameIndex * frameUs;
+	printf("\rwrote %lu detections of %d channels over %.1f days in %.1f s: %.2f M detections/s, "
+			"%.0f MB, %.2f bytes per detection\n", (unsigned long)nWritten, nChannels, (endUs - startUs) / 86400e6,
+			writeSec, nWritten / writeSec / 1e6, nBytes / 1048576.0, (double)nBytes / nWritten);
+
+	const int64_t rangeUs = (int64_t)(hours * 3600e6);
+	LatencyHistogram common, rare;
+	uint64_t nFramesFound = 0, nBlocks = 0, nBlocksDecoded = 0, nBlocksRare = 0, nBlocksRareDecoded = 0;
+	std::vector<ARCHIVE_QUERY > vQueries;
+	for (int i = 0; i < nQueries; ++i) {
+		ARCHIVE_QUERY query;
+		query.channel = (int)(uniform() * nChannels) % nChannels;
+		query.fromUs = startUs + (int64_t)(uniform() * std::max<int64_t>(0, endUs - startUs - rangeUs));
+		query.toUs = query.fromUs + rangeUs;
+		bool bRare = 1 == i % 2;
+		query.classMask = archiveClassBit(bRare ? 3 + i / 2 % 5 : 0);
+		ARCHIVE_QUERY_STATS stats;
+		uint64_t tQuery = nowUs();
+		queryDetectionArchive(dir, query, [](const ARCHIVE_FRAME &) { return true; }, &stats);
+		(bRare ? rare : common).record(nowUs() - tQuery);
+		nFramesFound += stats.nFrames;
+		(bRare ? nBlocksRare : nBlocks) += stats.nBlocks;
+		(bRare ? nBlocksRareDecoded : nBlocksDecoded) += stats.nBlocksDecoded;
+		vQueries.push_back(query);
+	}
+	std::vector<uint64_t > vCommon, vRare;
+	common.getQuantiles({ 0.5, 0.99 }, vCommon);
+	rare.getQuantiles({ 0.5, 0.99 }, vRare);
+	printf("%d queries of %.1f h, %.0f frames found on average\n", nQueries, hours,
+			(double)nFramesFound / std::max(1, nQueries));
+	printf("  class 0:    p50 %.2f ms p99 %.2f ms, %lu of %lu blocks decoded\n", vCommon[0] / 1e3, vCommon[1] / 1e3,
+			(unsigned long)nBlocksDecoded, (unsigned long)nBlocks);
+	printf("  class 3..7: p50 %.2f ms p99 %.2f ms, %lu of %lu blocks decoded\n", vRare[0] / 1e3, vRare[1] / 1e3,
+			(unsigned long)nBlocksRareDecoded, (unsigned long)nBlocksRare);
+
+	// the same queries by decoding every block of the channel
+	for (int i = 0; i < nScans && i < (int)vQueries.size(); ++i) {
+		const ARCHIVE_QUERY &query = vQueries[i];
+		uint64_t nIndexed = 0, nScanned = 0;
+		queryDetectionArchive(dir, query, [&nIndexed](const ARCHIVE_FRAME &frame) {
+			nIndexed += frame.vBoxes.size();
+			return true;
+		});
+		ARCHIVE_QUERY all;
+		all.channel = query.channel;
+		uint64_t tScan = nowUs();
+		queryDetectionArchive(dir, all, [&](const ARCHIVE_FRAME &frame) {
+			if (frame.timeUs >= query.fromUs && frame.timeUs <= query.toUs) {
+				for (size_t j = 0; j < frame.vBoxes.size(); ++j) {
+					nScanned += 0 != (archiveClassBit(frame.vBoxes[j].category) & query.classMask);
+				}
+			}
+			return true;
+		});
+		printf("scan of channel %d: %.0f ms, %lu boxes, %s\n", query.channel, (nowUs() - tScan) / 1e3,
+				(unsigned long)nScanned, nScanned == nIndexed ? "as the query" : "MISMATCH");
+		if (nScanned != nIndexed) {
+			return 1;
+		}
+	}
+	delete logger;
+	return 0;
+}
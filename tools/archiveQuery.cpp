@@ -0,0 +1,134 @@
+// Queries the detection archive of a channel by capture time, frame index
+// and class.
+//
+//   archiveQuery -dir=<dir> -channel=N [-from=<time>] [-to=<time>]
+//                [-frames=<first>:<last>] [-classes=<c>[,<c>...]]
+//                [-intervals[=<gap seconds>]] [-summary]
+//
+// A time is in epoch seconds or "YYYY-mm-dd HH:MM:SS" local time. The
+// frames in the range are printed one box per line; -intervals prints
+// the spans with a box of the classes instead, a gap longer than
+// <gap seconds> (2) ends a span. -summary adds what the query read.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+#include <string>
+#include "../detectionArchive.h"
+#include "toolArgs.h"
+
+static bool parseTime(const char *szTime, int64_t &timeUs) {
+	struct tm local;
+	memset(&local, 0, sizeof(local));
+	const char *szEnd = strptime(szTime, "%Y-%m-%d %H:%M:%S", &local);
+	if (nullptr != szEnd && 0 == *szEnd) {
+		local.tm_isdst = -1;
+		timeUs = (int64_t)mktime(&local) * 1000000;
+		return true;
+	}
+	char *szNumberEnd = nullptr;
+	double seconds = strtod(szTime, &szNumberEnd);
+	if (szNumberEnd == szTime || 0 != *szNumberEnd) {
+		return false;
+	}
+	timeUs = (int64_t)(seconds * 1e6);
+	return true;
+}
+
+static std::string formatTime(const int64_t timeUs) {
+	time_t seconds = (time_t)(timeUs / 1000000);
+	struct tm local;
+	localtime_r(&seconds, &local);
+	char sz[40];
+	size_t n = strftime(sz, sizeof(sz), "%Y-%m-%d %H:%M:%S", &local);
+	snprintf(sz + n, sizeof(sz) - n, ".%03d", (int)(timeUs / 1000 % 1000));
+	return sz;
+}
+
+int main(int argc, char **argv) {
+	const char *szDir = getArg(argc, argv, "dir");
+	if (nullptr == szDir) {
+		fprintf(stderr, "usage: %s -dir=<dir> -channel=N [-from=<time>] [-to=<time>] [-frames=<first>:<last>]\n"
+						"       [-classes=<c>[,<c>...]] [-intervals[=<gap seconds>]] [-summary]\n"
+						"A time is in epoch seconds or \"YYYY-mm-dd HH:MM:SS\" local time.\n", argv[0]);
+		return 1;
+	}
+	ARCHIVE_QUERY query;
+	query.channel = (int)getArg(argc, argv, "channel", 0);
+	const char *szFrom = getArg(argc, argv, "from");
+	const char *szTo = getArg(argc, argv, "to");
+	if ((nullptr != szFrom && !parseTime(szFrom, query.fromUs)) || (nullptr != szTo && !parseTime(szTo, query.toUs))) {
+		fprintf(stderr, "illegal time, use epoch seconds or \"YYYY-mm-dd HH:MM:SS\"\n");
+		return 1;
+	}
+	const char *szFrames = getArg(argc, argv, "frames");
+	if (nullptr != szFrames) {
+		long long first = 0, last = 0;
+		if (2 != sscanf(szFrames, "%lld:%lld", &first, &last) || first > last) {
+			fprintf(stderr, "illegal frame range %s, use <first>:<last>\n", szFrames);
+			return 1;
+		}
+		query.firstFrame = first;
+		query.lastFrame = last;
+	}
+	const char *szClasses = getArg(argc, argv, "classes");
+	if (nullptr != szClasses && 0 != *szClasses) {
+		query.classMask = 0;
+		for (const char *p = szClasses; 0 != *p; ) {
+			char *szEnd = nullptr;
+			long category = strtol(p, &szEnd, 10);
+			if (szEnd == p || category < 0 || category >= ARCHIVE_MAX_CLASSES || (0 != *szEnd && ',' != *szEnd)) {
+				fprintf(stderr, "illegal classes %s\n", szClasses);
+				return 1;
+			}
+			query.classMask |= archiveClassBit((int)category);
+			p = 0 == *szEnd ? szEnd : szEnd + 1;
+		}
+	}
+	bool bIntervals = nullptr != getArg(argc, argv, "intervals");
+	int64_t gapUs = (int64_t)(getArg(argc, argv, "intervals", 2) * 1e6);
+
+	// spans of the intervals, printed when the next one starts
+	int64_t spanFromUs = 0, spanToUs = 0;
+	uint64_t nSpanFrames = 0, nSpans = 0;
+	auto printSpan = [&]() {
+		if (nSpanFrames > 0) {
+			printf("%s - %s  %.1f s  %lu frames\n", formatTime(spanFromUs).c_str(), formatTime(spanToUs).c_str(),
+					(spanToUs - spanFromUs) * 1e-6, (unsigned long)nSpanFrames);
+			nSpans++;
+		}
+	};
+	ARCHIVE_QUERY_STATS stats;
+	auto t0 = std::chrono::steady_clock::now();
+	queryDetectionArchive(szDir, query, [&](const ARCHIVE_FRAME &frame) {
+		if (bIntervals) {
+			if (0 == nSpanFrames || frame.timeUs - spanToUs > gapUs || frame.timeUs < spanToUs) {
+				printSpan();
+				spanFromUs = frame.timeUs;
+				nSpanFrames = 0;
+			}
+			spanToUs = frame.timeUs;
+			nSpanFrames++;
+			return true;
+		}
+		for (size_t i = 0; i < frame.vBoxes.size(); ++i) {
+			const ARCHIVE_BOX &box = frame.vBoxes[i];
+			printf("%s %lld %d %.4f %.4f %.4f %.4f\n", formatTime(frame.timeUs).c_str(), (long long)frame.frameIndex,
+					box.category, box.x, box.y, box.w, box.h);
+		}
+		return true;
+	}, &stats);
+	if (bIntervals) {
+		printSpan();
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	if (nullptr != getArg(argc, argv, "summary")) {
+		fprintf(stderr, "%lu frames, %lu boxes%s; %lu files, %lu blocks in range, %lu decoded; %.2f ms\n",
+				(unsigned long)stats.nFrames, (unsigned long)stats.nBoxes,
+				bIntervals ? (", " + std::to_string(nSpans) + " intervals").c_str() : "",
+				(unsigned long)stats.nFiles, (unsigned long)stats.nBlocks, (unsigned long)stats.nBlocksDecoded, ms);
+	}
+	return 0;
+}
@@ -0,0 +1,247 @@
+// Precision of the motion gate against a labelled clip set.
+//
+//   motionGateBench -clips=<list> [-ratio=F] [-hold=N] [-warmup=N]
+//                   [-roiFile=<file>] [-au]
+//
+// The list has one Annex-B clip per line with the pictures a person
+// marked as moving, in the regions of interest if the clip has any:
+//
+//   # clip           codec  moving pictures, inclusive ranges
+//   lot_north.h264   h264   120-180 400-460
+//   gate_west.hevc   hevc
+//
+// Clip paths are relative to the list. Pictures are counted in stream
+// order from 0, as the sampler and the Kitti logs number them. Each clip
+// runs through a PacketSampler with the gate of -ratio (2.0), -hold (25)
+// and -warmup (50) pictures, the clip's line number (from 0, comments
+// and blank lines not counted) being its channel in -roiFile. Packets
+// are single NAL units, as the RTSP client and the file provider cut
+// them, or whole access units with -au.
+//
+// A skipped picture is one the gate dropped or passed as a reference
+// only. Precision is the share of the skipped pictures which were
+// static, recall the share of the static pictures skipped. For every
+// moving range, the delay counts the pictures of the range skipped
+// before the first analysed one; a range with none analysed is missed.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include "../packetSampler.h"
+#include "toolArgs.h"
+
+typedef struct {
+	std::string path;
+	VIDEO_CODEC codec;
+	std::vector<std::pair<int64_t, int64_t> > vMoving;
+} CLIP;
+
+typedef struct {
+	uint64_t nPictures = 0;
+	uint64_t nMoving = 0;
+	uint64_t nDropped = 0;
+	uint64_t nReferenceOnly = 0;
+	uint64_t nSkippedMoving = 0;	// skipped although labelled moving
+	uint64_t nRanges = 0;
+	uint64_t nMissed = 0;
+	uint64_t delaySum = 0;			// over the ranges not missed
+	uint64_t delayMax = 0;
+} RESULT;
+
+static bool readList(const std::string &path, std::vector<CLIP> &vClips) {
+	std::ifstream ifs(path.c_str());
+	if (!ifs.is_open()) {
+		fprintf(stderr, "failed to open %s\n", path.c_str());
+		return false;
+	}
+	std::string dir = path.find('/') == std::string::npos ? "" : path.substr(0, path.rfind('/') + 1);
+	std::string line;
+	int lineNo = 0;
+	while (std::getline(ifs, line)) {
+		lineNo++;
+		std::istringstream iss(line);
+		std::string clip, codec, range;
+		if (!(iss >> clip) || '#' == clip[0]) {
+			continue;
+		}
+		CLIP c;
+		c.path = '/' == clip[0] ? clip : dir + clip;
+		iss >> codec;
+		if (codec != "h264" && codec != "hevc") {
+			fprintf(stderr, "%s:%d: codec must be h264 or hevc\n", path.c_str(), lineNo);
+			return false;
+		}
+		c.codec = codec == "hevc" ? VIDEO_CODEC_HEVC : VIDEO_CODEC_H264;
+		while (iss >> range) {
+			long long first = 0, last = 0;
+			if (2 != sscanf(range.c_str(), "%lld-%lld", &first, &last) || first < 0 || first > last) {
+				fprintf(stderr, "%s:%d: illegal range %s, use <first>-<last>\n", path.c_str(), lineNo, range.c_str());
+				return false;
+			}
+			c.vMoving.push_back(std::make_pair((int64_t)first, (int64_t)last));
+		}
+		vClips.push_back(c);
+	}
+	return true;
+}
+
+// NAL units with their start codes, or access units when bAccessUnits
+static std::vector<std::vector<uint8_t > > cutPackets(const std::vector<uint8_t > &vData, const VIDEO_CODEC codec,
+														const bool bAccessUnits) {
+	std::vector<std::vector<uint8_t > > vPackets;
+	bool bSlices = false;
+	int pos = findNalStart(vData.data(), (int)vData.size(), 0);
+	while (pos >= 0) {
+		int next = findNalStart(vData.data(), (int)vData.size(), pos);
+		int end = next < 0 ? (int)vData.size() : next - 3;
+		while (end > pos && 0 == vData[end - 1]) {
+			end--;
+		}
+		if (end > pos) {
+			PACKET_CLASS c = classifyPacket(vData.data() + pos, end - pos, codec);
+			if (vPackets.empty() || !bAccessUnits || (bSlices && (!c.bPicture || c.bNewPicture))) {
+				vPackets.push_back(std::vector<uint8_t >());
+				bSlices = false;
+			}
+			static const uint8_t startCode[4] = { 0, 0, 0, 1 };
+			vPackets.back().insert(vPackets.back().end(), startCode, startCode + 4);
+			vPackets.back().insert(vPackets.back().end(), vData.begin() + pos, vData.begin() + end);
+			bSlices = bSlices || c.bPicture;
+		}
+		pos = next;
+	}
+	return vPackets;
+}
+
+static bool isMoving(const CLIP &clip, const int64_t picture) {
+	for (size_t i = 0; i < clip.vMoving.size(); ++i) {
+		if (picture >= clip.vMoving[i].first && picture <= clip.vMoving[i].second) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void runClip(const CLIP &clip, const int channel, const MOTION_GATE_PARAMS &params, RoiMaskSet *pRoiMasks,
+					const bool bAccessUnits, RESULT &r) {
+	std::ifstream ifs(clip.path.c_str(), std::ios::binary);
+	std::vector<uint8_t > vData((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	if (vData.empty()) {
+		fprintf(stderr, "failed to read %s\n", clip.path.c_str());
+		return;
+	}
+	PacketSampler sampler(SAMPLING_PARAMS(), clip.codec);
+	sampler.setMotionGate(new MotionGate(clip.codec, params, pRoiMasks, channel));
+	// per picture: 0 analysed, 1 dropped, 2 reference only
+	std::vector<int > vOutcome;
+	std::vector<std::vector<uint8_t > > vPackets = cutPackets(vData, clip.codec, bAccessUnits);
+	for (size_t i = 0; i < vPackets.size(); ++i) {
+		const std::vector<uint8_t > &vPacket = vPackets[i];
+		bool bAccepted = sampler.accept(vPacket.data(), (int)vPacket.size(), -1);
+		if ((int64_t)sampler.getNbSeen() > (int64_t)vOutcome.size()) {
+			vOutcome.push_back(!bAccepted ? 1 : sampler.isLastStatic() ? 2 : 0);
+		}
+	}
+
+	for (size_t i = 0; i < vOutcome.size(); ++i) {
+		bool bMoving = isMoving(clip, i);
+		r.nPictures++;
+		r.nMoving += bMoving;
+		r.nDropped += 1 == vOutcome[i];
+		r.nReferenceOnly += 2 == vOutcome[i];
+		r.nSkippedMoving += bMoving && 0 != vOutcome[i];
+	}
+	for (size_t i = 0; i < clip.vMoving.size(); ++i) {
+		int64_t picture = clip.vMoving[i].first;
+		int64_t last = std::min<int64_t>(clip.vMoving[i].second, (int64_t)vOutcome.size() - 1);
+		if (picture > last) {
+			continue;
+		}
+		r.nRanges++;
+		while (picture <= last && 0 != vOutcome[picture]) {
+			picture++;
+		}
+		if (picture > last) {
+			r.nMissed++;
+			continue;
+		}
+		uint64_t delay = picture - clip.vMoving[i].first;
+		r.delaySum += delay;
+		r.delayMax = std::max(r.delayMax, delay);
+	}
+}
+
+static void printResult(const char *szName, const RESULT &r) {
+	uint64_t nSkipped = r.nDropped + r.nReferenceOnly;
+	uint64_t nStatic = r.nPictures - r.nMoving;
+	uint64_t nFound = r.nRanges - r.nMissed;
+	printf("%-24s %7lu pictures %5.1f%% moving, skipped %5.1f%% (%4.1f%% as references), "
+			"precision %6.2f%% recall %5.1f%%, %lu/%lu ranges missed, delay avg %.1f max %lu\n",
+			szName, (unsigned long)r.nPictures, 100.0 * r.nMoving / std::max<uint64_t>(1, r.nPictures),
+			100.0 * nSkipped / std::max<uint64_t>(1, r.nPictures),
+			100.0 * r.nReferenceOnly / std::max<uint64_t>(1, r.nPictures),
+			100.0 * (nSkipped - r.nSkippedMoving) / std::max<uint64_t>(1, nSkipped),
+			100.0 * (nSkipped - r.nSkippedMoving) / std::max<uint64_t>(1, nStatic),
+			(unsigned long)r.nMissed, (unsigned long)r.nRanges,
+			(double)r.delaySum / std::max<uint64_t>(1, nFound), (unsigned long)r.delayMax);
+}
+
+int main(int argc, char **argv) {
+	const char *szClips = getArg(argc, argv, "clips");
+	if (nullptr == szClips) {
+		fprintf(stderr, "usage: %s -clips=<list> [-ratio=F] [-hold=N] [-warmup=N] [-roiFile=<file>] [-au]\n", argv[0]);
+		return 1;
+	}
+	MOTION_GATE_PARAMS params;
+	params.motionRatio = (float)getArg(argc, argv, "ratio", params.motionRatio);
+	params.holdPictures = (int)getArg(argc, argv, "hold", params.holdPictures);
+	params.warmupPictures = (int)getArg(argc, argv, "warmup", params.warmupPictures);
+	if (params.motionRatio <= 1.f) {
+		fprintf(stderr, "ratio must be above 1\n");
+		return 1;
+	}
+	std::vector<CLIP> vClips;
+	if (!readList(szClips, vClips) || vClips.empty()) {
+		return 1;
+	}
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	RoiMaskSet *pRoiMasks = nullptr;
+	const char *szRoiFile = getArg(argc, argv, "roiFile");
+	if (nullptr != szRoiFile) {
+		// the grid of main's parser, 640x368 network input in 16x16 cells
+		pRoiMasks = new RoiMaskSet(szRoiFile, (int)vClips.size(), 40, 23, 16, 640, 368, logger);
+		if (!pRoiMasks->load()) {
+			return 1;
+		}
+	}
+	const bool bAccessUnits = nullptr != getArg(argc, argv, "au");
+
+	RESULT total;
+	for (size_t i = 0; i < vClips.size(); ++i) {
+		RESULT r;
+		runClip(vClips[i], (int)i, params, pRoiMasks, bAccessUnits, r);
+		std::string name = vClips[i].path.substr(vClips[i].path.rfind('/') + 1);
+		printResult(name.c_str(), r);
+		total.nPictures += r.nPictures;
+		total.nMoving += r.nMoving;
+		total.nDropped += r.nDropped;
+		total.nReferenceOnly += r.nReferenceOnly;
+		total.nSkippedMoving += r.nSkippedMoving;
+		total.nRanges += r.nRanges;
+		total.nMissed += r.nMissed;
+		total.delaySum += r.delaySum;
+		total.delayMax = std::max(total.delayMax, r.delayMax);
+	}
+	printResult("total", total);
+	if (nullptr != pRoiMasks) {
+		delete pRoiMasks;
+	}
+	delete logger;
+	return 0;
+}
@@ -0,0 +1,231 @@
+// Long-running fragmentation benchmark of the packet pool against malloc.
+//
+//   packetPoolBench [-allocator=pool|malloc] [-packets=N] [-channels=N]
+//                   [-threads=N] [-fps=F] [-gop=N] [-reports=N]
+//                   [-hugePages=1] [-touch=0]
+//
+// -threads (4) takers allocate the packets of -channels (64) cameras with
+// -gop (50) pictures per GOP, keyframes about ten times the size of the
+// others. Every channel holds its last 2 to 10 s of packets, like the
+// pre-roll of a clip, and changes its bitrate between 0.25 and 8 Mbit/s
+// every few thousand packets, which moves its packets to other size
+// classes. Half of the packets leaving a ring are released on another
+// thread, as a worker or recorder would. The payload is written unless
+// -touch=0, so the resident size is real. -reports (20) times over the
+// run, and at the end, it prints the bytes held against the resident
+// size, and for the pool its own accounting.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <unistd.h>
+#include "../packetPool.h"
+#include "toolArgs.h"
+
+static uint64_t residentBytes() {
+	long nPages = 0, nResident = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (nullptr != fp) {
+		if (2 != fscanf(fp, "%ld %ld", &nPages, &nResident)) {
+			nResident = 0;
+		}
+		fclose(fp);
+	}
+	return (uint64_t)nResident * sysconf(_SC_PAGESIZE);
+}
+
+typedef struct {
+	uint8_t *pData;
+	void *opaque;			// of the pool, nullptr from malloc
+	uint32_t nBytes;
+} PACKET;
+
+// The releasing thread, packets are handed over in batches.
+class Releaser {
+public:
+	void push(std::vector<PACKET > &vPackets) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		vQueue_.insert(vQueue_.end(), vPackets.begin(), vPackets.end());
+		vPackets.clear();
+		cv_.notify_one();
+	}
+
+	void run(std::atomic<int64_t > &liveBytes) {
+		std::vector<PACKET > vBatch;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mtx_);
+				cv_.wait(lock, [this]() { return bStop_ || !vQueue_.empty(); });
+				if (vQueue_.empty()) {
+					return;
+				}
+				vBatch.swap(vQueue_);
+			}
+			for (size_t i = 0; i < vBatch.size(); ++i) {
+				free(vBatch[i], liveBytes);
+			}
+			vBatch.clear();
+		}
+	}
+
+	void stop() {
+		std::lock_guard<std::mutex> lock(mtx_);
+		bStop_ = true;
+		cv_.notify_one();
+	}
+
+	static void free(const PACKET &packet, std::atomic<int64_t > &liveBytes) {
+		if (nullptr != packet.opaque) {
+			PacketPool::release(packet.opaque, packet.pData);
+		} else {
+			::free(packet.pData);
+		}
+		liveBytes -= packet.nBytes;
+	}
+
+private:
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	std::vector<PACKET > vQueue_;
+	bool bStop_{ false };
+};
+
+typedef struct {
+	std::deque<PACKET > ring;
+	size_t nHeld = 0;			// packets the ring keeps
+	double avgBytes = 0.;		// per picture at the current bitrate
+	int picture = 0;
+	int regimeLeft = 0;			// packets until the bitrate changes
+} CHANNEL;
+
+int main(int argc, char **argv) {
+	const char *szAllocator = getArg(argc, argv, "allocator");
+	const bool bPool = nullptr == szAllocator || 0 == strcmp(szAllocator, "pool");
+	const uint64_t nPackets = (uint64_t)getArg(argc, argv, "packets", 2e7);
+	const int nChannels = (int)getArg(argc, argv, "channels", 64);
+	const int nThreads = std::max(1, (int)getArg(argc, argv, "threads", 4));
+	const double fps = getArg(argc, argv, "fps", 25);
+	const int gop = std::max(1, (int)getArg(argc, argv, "gop", 50));
+	const int nReports = std::max(1, (int)getArg(argc, argv, "reports", 20));
+	const bool bTouch = 0 != (int)getArg(argc, argv, "touch", 1);
+
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	PACKET_POOL_PARAMS params;
+	params.bHugePages = 1 == (int)getArg(argc, argv, "hugePages", 0);
+	PacketPool *pPool = bPool ? new PacketPool(params, logger) : nullptr;
+	Releaser releaser;
+	std::atomic<int64_t > liveBytes{ 0 };
+	std::thread thReleaser(&Releaser::run, &releaser, std::ref(liveBytes));
+	std::atomic<uint64_t > nDone{ 0 }, nFailed{ 0 };
+
+	auto taker = [&](const int iThread) {
+		uint32_t seed = 7919 * (iThread + 1);
+		auto uniform = [&seed]() {
+			seed = seed * 1664525 + 1013904223;
+			return (seed >> 8) / 16777216.;
+		};
+		std::vector<CHANNEL > vChannels;
+		for (int ch = iThread; ch < nChannels; ch += nThreads) {
+			vChannels.push_back(CHANNEL());
+		}
+		std::vector<PACKET > vHandOver;
+		uint64_t nMine = nPackets / nThreads;
+		for (uint64_t i = 0; i < nMine; ++i) {
+			CHANNEL &ch = vChannels[i % vChannels.size()];
+			if (ch.regimeLeft-- <= 0) {
+				double mbps = 0.25 * pow(2., (int)(uniform() * 6));
+				ch.avgBytes = mbps * 1e6 / 8 / fps;
+				ch.nHeld = (size_t)((2. + 8. * uniform()) * fps);
+				ch.regimeLeft = (int)((0.5 + uniform()) * 5000);
+			}
+			// keyframes ten times the size of the other pictures
+			double pBytes = gop * ch.avgBytes / (gop + 9);
+			double size = (0 == ch.picture++ % gop ? 10. : 1.) * pBytes * (0.7 + 0.6 * uniform());
+			PACKET packet;
+			packet.nBytes = (uint32_t)std::max(16., size);
+			packet.opaque = nullptr;
+			packet.pData = bPool ? pPool->allocate(packet.nBytes, &packet.opaque) : (uint8_t *)malloc(packet.nBytes);
+			if (nullptr == packet.pData) {
+				nFailed++;
+				continue;
+			}
+			if (bTouch) {
+				memset(packet.pData, (int)i, packet.nBytes);
+			}
+			liveBytes += packet.nBytes;
+			ch.ring.push_back(packet);
+			while (ch.ring.size() > ch.nHeld) {
+				if (uniform() < 0.5) {
+					vHandOver.push_back(ch.ring.front());
+				} else {
+					Releaser::free(ch.ring.front(), liveBytes);
+				}
+				ch.ring.pop_front();
+			}
+			if (vHandOver.size() >= 64) {
+				releaser.push(vHandOver);
+			}
+			nDone++;
+		}
+		releaser.push(vHandOver);
+		for (size_t i = 0; i < vChannels.size(); ++i) {
+			for (size_t j = 0; j < vChannels[i].ring.size(); ++j) {
+				Releaser::free(vChannels[i].ring[j], liveBytes);
+			}
+		}
+	};
+
+	printf("%s, %d channels on %d threads, %lu packets\n", bPool ? "pool" : "malloc", nChannels, nThreads,
+			(unsigned long)nPackets);
+	uint64_t t0 = nowUs();
+	std::vector<std::thread > vThreads;
+	for (int i = 0; i < nThreads; ++i) {
+		vThreads.push_back(std::thread(taker, i));
+	}
+	// samples while the takers run
+	uint64_t nextReport = nPackets / nReports;
+	double worstRatio = 0.;
+	while (nDone < nPackets / nThreads * nThreads) {
+		usleep(20000);
+		// none while the rings are emptied at the end
+		if (nDone < nextReport || nextReport >= nPackets / nThreads * nThreads) {
+			continue;
+		}
+		nextReport += nPackets / nReports;
+		double live = liveBytes.load() / 1048576., rss = residentBytes() / 1048576.;
+		worstRatio = std::max(worstRatio, rss / std::max(1., live));
+		printf("%10lu packets: %7.1f MB held, %7.1f MB resident", (unsigned long)nDone.load(), live, rss);
+		if (bPool) {
+			PACKET_POOL_STATS stats = pPool->getStats();
+			printf(", pool %7.1f MB in %lu slabs, %.1f%% internal, %.1f%% external, %.1f MB cached",
+					stats.reservedBytes / 1048576., (unsigned long)stats.nSlabs, 100. * stats.internalFragmentation,
+					100. * stats.externalFragmentation, stats.cachedBytes / 1048576.);
+		}
+		printf("\n");
+	}
+	for (size_t i = 0; i < vThreads.size(); ++i) {
+		vThreads[i].join();
+	}
+	releaser.stop();
+	thReleaser.join();
+	double elapsed = (nowUs() - t0) / 1e6;
+	printf("%.0f packets/s, %lu failed, worst resident/held %.2f, %.1f MB resident with nothing held\n",
+			nDone / elapsed, (unsigned long)nFailed.load(), worstRatio, residentBytes() / 1048576.);
+	if (bPool) {
+		PACKET_POOL_STATS stats = pPool->getStats();
+		printf("pool after the run: %.1f MB in %lu slabs, %.1f MB in use\n", stats.reservedBytes / 1048576.,
+				(unsigned long)stats.nSlabs, stats.usedBytes / 1048576.);
+		delete pPool;
+	}
+	delete logger;
+	return 0;
+}
@@ -0,0 +1,266 @@
+// Throughput and jitter of the ingest -> push -> worker handoff with and
+// without thread placement.
+//
+//   placementBench [-pin=off|node|role|cpu|all] [-channels=N] [-workers=N]
+//                  [-seconds=S] [-fps=F] [-kbps=N] [-noise=N] [-node=N]
+//
+// Per channel an ingest thread writes packets of about -kbps (4000) into
+// the packet pool and queues them to the channel's push thread, which
+// reads them and queues them to -workers (2) threads, which read them
+// again and release them, as the takers, userPushPacket and the decoders
+// do. -noise (2) threads stream over 64 MB each, the neighbours of a
+// recorder or another process. For each -pin mode, all of them by
+// default, it runs -seconds (5) unpaced for the throughput and -seconds
+// paced at -fps (25) per channel for the latency of the handoffs. -node
+// (0) stands for the node of the GPU.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <unistd.h>
+#include "../threadPlacement.h"
+#include "../packetPool.h"
+#include "../common/histogram.h"
+#include "toolArgs.h"
+
+typedef struct {
+	uint8_t *pData;
+	void *opaque;
+	uint32_t nBytes;
+	uint64_t ingestUs;
+	uint64_t pushUs;
+} PACKET;
+
+// Bounded, the producer waits as StreamDataProvider::putData does.
+class PacketQueue {
+public:
+	explicit
+	PacketQueue(const size_t capacity) : capacity_(capacity) {}
+
+	bool put(const PACKET &packet, const std::atomic<bool > &bRun) {
+		std::unique_lock<std::mutex> lock(mtx_);
+		cvSpace_.wait(lock, [&]() { return queue_.size() < capacity_ || !bRun; });
+		if (!bRun) {
+			return false;
+		}
+		queue_.push_back(packet);
+		cvData_.notify_one();
+		return true;
+	}
+
+	bool get(PACKET &packet, const std::atomic<bool > &bRun) {
+		std::unique_lock<std::mutex> lock(mtx_);
+		cvData_.wait(lock, [&]() { return !queue_.empty() || !bRun; });
+		if (queue_.empty()) {
+			return false;
+		}
+		packet = queue_.front();
+		queue_.pop_front();
+		cvSpace_.notify_one();
+		return true;
+	}
+
+	void wake() {
+		std::lock_guard<std::mutex> lock(mtx_);
+		cvSpace_.notify_all();
+		cvData_.notify_all();
+	}
+
+	// after the threads are gone
+	void drain() {
+		for (size_t i = 0; i < queue_.size(); ++i) {
+			PacketPool::release(queue_[i].opaque, queue_[i].pData);
+		}
+		queue_.clear();
+	}
+
+private:
+	size_t capacity_;
+	std::mutex mtx_;
+	std::condition_variable cvSpace_, cvData_;
+	std::deque<PACKET > queue_;
+};
+
+static uint64_t readPayload(const PACKET &packet) {
+	uint64_t sum = 0;
+	const uint64_t *p = reinterpret_cast<const uint64_t *>(packet.pData);
+	for (size_t i = 0; i < packet.nBytes / 8; ++i) {
+		sum += p[i];
+	}
+	return sum;
+}
+
+typedef struct {
+	double packetsPerSec = 0.;
+	LatencyHistogram push;		// ingest -> push thread
+	LatencyHistogram e2e;		// ingest -> worker
+} RESULT;
+
+static void run(const PLACEMENT_MODE mode, const bool bPaced, int argc, char **argv, RESULT &result) {
+	const int nChannels = std::max(1, (int)getArg(argc, argv, "channels", 16));
+	const int nWorkers = std::max(1, (int)getArg(argc, argv, "workers", 2));
+	const double seconds = getArg(argc, argv, "seconds", 5);
+	const double fps = getArg(argc, argv, "fps", 25);
+	const double kbps = getArg(argc, argv, "kbps", 4000);
+	const int nNoise = (int)getArg(argc, argv, "noise", 2);
+
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	PLACEMENT_PARAMS placementParams;
+	placementParams.mode = mode;
+	placementParams.gpuNode = (int)getArg(argc, argv, "node", 0);
+	g_pPlacement = new ThreadPlacement(placementParams, logger);
+	PACKET_POOL_PARAMS poolParams;
+	poolParams.numaNode = PLACEMENT_OFF == mode ? -1 : g_pPlacement->getHomeNode();
+	PacketPool *pPool = new PacketPool(poolParams, logger);
+
+	std::atomic<bool > bRun{ true }, bNoise{ true };
+	std::atomic<uint64_t > nDone{ 0 }, checksum{ 0 };
+	std::vector<PacketQueue *> vpChannelQueues;
+	for (int ch = 0; ch < nChannels; ++ch) {
+		vpChannelQueues.push_back(new PacketQueue(32));
+	}
+	PacketQueue workQueue(32 * nChannels);
+	const double avgBytes = kbps * 1000. / 8. / fps;
+	const uint64_t frameUs = (uint64_t)(1e6 / fps);
+
+	std::vector<std::thread > vThreads, vNoise;
+	for (int i = 0; i < nNoise; ++i) {
+		vNoise.push_back(std::thread([&, i]() {
+			placeThread(ROLE_IO, "noise", i);
+			std::vector<uint64_t > vBuf((64 << 20) / sizeof(uint64_t), i);
+			uint64_t sum = 0;
+			while (bNoise) {
+				for (size_t j = 0; j < vBuf.size(); j += 8) {
+					sum += vBuf[j]++;
+				}
+			}
+			checksum += sum;
+		}));
+	}
+	for (int ch = 0; ch < nChannels; ++ch) {
+		vThreads.push_back(std::thread([&, ch]() {
+			placeThread(ROLE_INGEST, "take", ch);
+			uint32_t seed = 7919 * (ch + 1);
+			uint64_t nextUs = nowUs() + ch * frameUs / nChannels;
+			for (int picture = 0; bRun; ++picture) {
+				if (bPaced) {
+					uint64_t t = nowUs();
+					if (nextUs > t) {
+						usleep(nextUs - t);
+					}
+					nextUs += frameUs;
+				}
+				seed = seed * 1664525 + 1013904223;
+				double size = (0 == picture % 50 ? 5. : 0.9) * avgBytes * (0.7 + 0.6 * (seed >> 8) / 16777216.);
+				PACKET packet;
+				packet.nBytes = std::max<uint32_t>(64, (uint32_t)size) & ~7u;
+				packet.pData = pPool->allocate(packet.nBytes, &packet.opaque);
+				if (nullptr == packet.pData) {
+					continue;
+				}
+				memset(packet.pData, picture, packet.nBytes);
+				packet.ingestUs = nowUs();
+				if (!vpChannelQueues[ch]->put(packet, bRun)) {
+					PacketPool::release(packet.opaque, packet.pData);
+				}
+			}
+		}));
+		vThreads.push_back(std::thread([&, ch]() {
+			placeThread(ROLE_PUSH, "push", ch);
+			PACKET packet;
+			uint64_t sum = 0;
+			while (vpChannelQueues[ch]->get(packet, bRun)) {
+				packet.pushUs = nowUs();
+				result.push.record(packet.pushUs - packet.ingestUs);
+				sum += readPayload(packet);
+				if (!workQueue.put(packet, bRun)) {
+					PacketPool::release(packet.opaque, packet.pData);
+				}
+			}
+			checksum += sum;
+		}));
+	}
+	for (int i = 0; i < nWorkers; ++i) {
+		vThreads.push_back(std::thread([&, i]() {
+			placeThread(ROLE_WORKER, "decode", i);
+			PACKET packet;
+			uint64_t sum = 0;
+			while (workQueue.get(packet, bRun)) {
+				sum += readPayload(packet);
+				result.e2e.record(nowUs() - packet.ingestUs);
+				PacketPool::release(packet.opaque, packet.pData);
+				nDone++;
+			}
+			checksum += sum;
+		}));
+	}
+
+	// the first second warms the pool and the caches up
+	usleep(1000000);
+	result.push.reset();
+	result.e2e.reset();
+	uint64_t n0 = nDone, t0 = nowUs();
+	usleep((useconds_t)(seconds * 1e6));
+	result.packetsPerSec = (nDone - n0) / ((nowUs() - t0) / 1e6);
+	bRun = false;
+	for (int ch = 0; ch < nChannels; ++ch) {
+		vpChannelQueues[ch]->wake();
+	}
+	workQueue.wake();
+	for (size_t i = 0; i < vThreads.size(); ++i) {
+		vThreads[i].join();
+	}
+	bNoise = false;
+	for (size_t i = 0; i < vNoise.size(); ++i) {
+		vNoise[i].join();
+	}
+	for (int ch = 0; ch < nChannels; ++ch) {
+		vpChannelQueues[ch]->drain();
+		delete vpChannelQueues[ch];
+	}
+	workQueue.drain();
+	delete pPool;
+	delete g_pPlacement;
+	g_pPlacement = nullptr;
+	delete logger;
+}
+
+int main(int argc, char **argv) {
+	const char *szPin = getArg(argc, argv, "pin");
+	const std::string pin = nullptr == szPin ? "all" : szPin;
+	const char *szModes[4] = { "off", "node", "role", "cpu" };
+	std::vector<int> vModes;
+	for (int i = 0; i < 4; ++i) {
+		if ("all" == pin || pin == szModes[i]) {
+			vModes.push_back(i);
+		}
+	}
+	if (vModes.empty()) {
+		fprintf(stderr, "illegal -pin=%s, use off, node, role, cpu or all\n", pin.c_str());
+		return 1;
+	}
+	printf("%u CPUs online, %d channels, %d workers, %d noise threads\n", (unsigned)sysconf(_SC_NPROCESSORS_ONLN),
+			(int)getArg(argc, argv, "channels", 16), (int)getArg(argc, argv, "workers", 2),
+			(int)getArg(argc, argv, "noise", 2));
+	printf("%-5s %12s | %26s | %26s\n", "pin", "packets/s", "push p50/p99/max us", "e2e p50/p99/max us");
+	for (size_t i = 0; i < vModes.size(); ++i) {
+		RESULT unpaced, paced;
+		run((PLACEMENT_MODE)vModes[i], false, argc, argv, unpaced);
+		run((PLACEMENT_MODE)vModes[i], true, argc, argv, paced);
+		std::vector<uint64_t > vPush, vE2e;
+		paced.push.getQuantiles({ 0.5, 0.99 }, vPush);
+		paced.e2e.getQuantiles({ 0.5, 0.99 }, vE2e);
+		printf("%-5s %12.0f | %8lu %8lu %8lu | %8lu %8lu %8lu\n", szModes[vModes[i]], unpaced.packetsPerSec,
+				(unsigned long)vPush[0], (unsigned long)vPush[1], (unsigned long)paced.push.getMax(),
+				(unsigned long)vE2e[0], (unsigned long)vE2e[1], (unsigned long)paced.e2e.getMax());
+	}
+	return 0;
+}
@@ -0,0 +1,136 @@
+// Lists the recording of a channel, or cuts a span of it out through the
+// keyframe index without reading the segments before it.
+//
+//   recordCat -dir=<dir> -channel=N -list
+//   recordCat -dir=<dir> -channel=N -from=<epoch seconds> [-seconds=S] [-out=<file>]
+//
+// The span starts at the last keyframe at or before -from and ends at the
+// first keyframe after -from + -seconds (10). The output is Annex-B, to
+// stdout unless -out is given, e.g. recordCat ... | ffplay -f h264 -
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "../recordIndex.h"
+#include "toolArgs.h"
+
+static std::string formatTime(const int64_t timeUs) {
+	time_t seconds = (time_t)(timeUs / 1000000);
+	struct tm local;
+	localtime_r(&seconds, &local);
+	char sz[32];
+	strftime(sz, sizeof(sz), "%Y-%m-%d %H:%M:%S", &local);
+	return sz;
+}
+
+static void list(const std::string &dir, const int channel) {
+	std::vector<RECORD_SEGMENT > vSegments;
+	listRecordSegments(recordChannelDir(dir, channel), vSegments);
+	std::vector<RECORD_INDEX_ENTRY > vEntries;
+	uint64_t nBytes = 0;
+	for (size_t i = 0; i < vSegments.size(); ++i) {
+		const RECORD_SEGMENT &segment = vSegments[i];
+		readRecordIndex(segment.indexPath, vEntries);
+		int64_t lastUs = vEntries.empty() ? segment.startUs : vEntries.back().timeUs;
+		printf("%s  %s - %s  %zu keyframes  %lu KB\n", segment.path.c_str(), formatTime(segment.startUs).c_str(),
+				formatTime(lastUs).c_str(), vEntries.size(), (unsigned long)(segment.nBytes >> 10));
+		nBytes += segment.nBytes;
+	}
+	printf("%zu segments, %lu MB\n", vSegments.size(), (unsigned long)(nBytes >> 20));
+}
+
+// Copies [offset, end) of a segment, end is -1 for the rest of it.
+static bool copy(const std::string &path, const uint64_t offset, const int64_t end, FILE *fpOut) {
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (nullptr == fp || 0 != fseeko(fp, (off_t)offset, SEEK_SET)) {
+		fprintf(stderr, "cannot read %s\n", path.c_str());
+		if (nullptr != fp) {
+			fclose(fp);
+		}
+		return false;
+	}
+	std::vector<char > buffer(1 << 20);
+	uint64_t pos = offset;
+	while (end < 0 || (int64_t)pos < end) {
+		size_t n = buffer.size();
+		if (end >= 0) {
+			n = std::min<uint64_t>(n, end - pos);
+		}
+		n = fread(buffer.data(), 1, n, fp);
+		if (0 == n) {
+			break;
+		}
+		fwrite(buffer.data(), 1, n, fpOut);
+		pos += n;
+	}
+	fclose(fp);
+	return true;
+}
+
+static int cut(const std::string &dir, const int channel, const int64_t fromUs, const int64_t toUs, FILE *fpOut) {
+	RECORD_POSITION pos;
+	if (!seekRecording(dir, channel, fromUs, pos)) {
+		fprintf(stderr, "no recording of channel %d\n", channel);
+		return 1;
+	}
+	fprintf(stderr, "from %s at %s offset %lu\n", formatTime(pos.timeUs).c_str(), pos.path.c_str(),
+			(unsigned long)pos.offset);
+	std::vector<RECORD_SEGMENT > vSegments;
+	listRecordSegments(recordChannelDir(dir, channel), vSegments);
+	std::vector<RECORD_INDEX_ENTRY > vEntries;
+	bool bStarted = false;
+	for (size_t i = 0; i < vSegments.size(); ++i) {
+		if (!bStarted && vSegments[i].path != pos.path) {
+			continue;
+		}
+		uint64_t offset = bStarted ? 0 : pos.offset;
+		bStarted = true;
+		readRecordIndex(vSegments[i].indexPath, vEntries);
+		// the first keyframe past the span ends it
+		int64_t end = -1;
+		for (size_t j = 0; j < vEntries.size(); ++j) {
+			if (vEntries[j].timeUs > toUs && vEntries[j].offset > offset) {
+				end = (int64_t)vEntries[j].offset;
+				break;
+			}
+		}
+		if (!copy(vSegments[i].path, offset, end, fpOut)) {
+			return 1;
+		}
+		if (end >= 0 || (i + 1 < vSegments.size() && vSegments[i + 1].startUs > toUs)) {
+			break;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *szDir = getArg(argc, argv, "dir");
+	int channel = (int)getArg(argc, argv, "channel", 0);
+	if (nullptr == szDir || (nullptr == getArg(argc, argv, "list") && nullptr == getArg(argc, argv, "from"))) {
+		fprintf(stderr, "usage: %s -dir=<dir> -channel=N -list\n"
+						"       %s -dir=<dir> -channel=N -from=<epoch seconds> [-seconds=S] [-out=<file>]\n",
+				argv[0], argv[0]);
+		return 1;
+	}
+	if (nullptr != getArg(argc, argv, "list")) {
+		list(szDir, channel);
+		return 0;
+	}
+	int64_t fromUs = (int64_t)(getArg(argc, argv, "from", 0) * 1e6);
+	int64_t toUs = fromUs + (int64_t)(getArg(argc, argv, "seconds", 10) * 1e6);
+	const char *szOut = getArg(argc, argv, "out");
+	FILE *fpOut = nullptr == szOut ? stdout : fopen(szOut, "wb");
+	if (nullptr == fpOut) {
+		fprintf(stderr, "cannot write %s\n", szOut);
+		return 1;
+	}
+	int ret = cut(szDir, channel, fromUs, toUs, fpOut);
+	if (stdout != fpOut) {
+		fclose(fpOut);
+	}
+	return ret;
+}
@@ -0,0 +1,216 @@
+// Subscriber of the result stream, and a throughput comparison against
+// tailing the KITTI logs.
+//
+//   resultClient -connect=unix:<path>|tcp:<host>:<port> [-print] [-seconds=S]
+//   resultClient -bench [-clients=N] [-seconds=S] [-boxes=N] [-batch=N]
+//                [-policy=drop|block] [-slow]
+//
+// -bench serves synthetic batches of -batch frames over a Unix socket to
+// -clients subscriber processes, then writes the same frames as KITTI
+// lines, flushed per frame like KittiLoggerModule, while a reader tails
+// and parses the file. -slow makes the first subscriber sleep 1 ms per
+// message to show the policy at work.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sys/wait.h>
+#include "../resultStreamer.h"
+#include "toolArgs.h"
+
+// Reads until the stream ends or seconds passed, returns the RESULT count.
+static uint64_t subscribe(const char *szEndpoint, const double seconds, const bool bPrint, const bool bSlow,
+						const char *szName) {
+	ResultStreamClient client;
+	uint64_t tConnect = nowUs();
+	while (!client.connect(szEndpoint)) {
+		if (nowUs() - tConnect > 5000000) {
+			fprintf(stderr, "%s: cannot connect to %s\n", szName, szEndpoint);
+			return 0;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	STREAM_MSG_HEADER header;
+	std::vector<uint8_t > payload;
+	uint64_t nResults = 0, nBoxes = 0, nDropped = 0;
+	uint64_t t0 = nowUs(), tEnd = t0 + (uint64_t)(seconds * 1e6);
+	while (nowUs() < tEnd && client.read(header, payload)) {
+		if (STREAM_VERSION != header.version) {
+			fprintf(stderr, "%s: stream version %d, expected %d\n", szName, header.version, STREAM_VERSION);
+			return 0;
+		}
+		if (STREAM_MSG_DROPPED == header.type) {
+			uint64_t n = 0;
+			memcpy(&n, payload.data(), sizeof(n));
+			nDropped += n;
+			continue;
+		}
+		if (STREAM_MSG_RESULT != header.type) {
+			continue;
+		}
+		STREAM_RESULT result;
+		memcpy(&result, payload.data(), sizeof(result));
+		nResults++;
+		nBoxes += result.nBoxes;
+		if (bPrint) {
+			const STREAM_BOX *pBoxes = (const STREAM_BOX *)(payload.data() + sizeof(result));
+			printf("ch %d frame %ld ts %ld:", header.channel, (long)result.frameIndex, (long)result.timestampUs);
+			for (int i = 0; i < result.nBoxes; ++i) {
+				printf(" [%d %.3f %.3f %.3f %.3f]", pBoxes[i].category, pBoxes[i].x / 65535.f,
+						pBoxes[i].y / 65535.f, pBoxes[i].w / 65535.f, pBoxes[i].h / 65535.f);
+			}
+			printf("\n");
+		}
+		if (bSlow) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	double dt = (nowUs() - t0) / 1e6;
+	printf("%s: %.0f frames/s, %.0f boxes/s, %lu dropped\n", szName, nResults / dt, nBoxes / dt, (unsigned long)nDropped);
+	fflush(stdout);
+	return nResults;
+}
+
+static void fillBoxes(std::vector<STREAM_BOX > &vBoxes, const int nBoxes, const int64_t frame) {
+	vBoxes.resize(nBoxes);
+	for (int i = 0; i < nBoxes; ++i) {
+		vBoxes[i].category = i % 3;
+		vBoxes[i].x = streamCoord(((frame + i) % 100) / 100.f);
+		vBoxes[i].y = streamCoord((i % 10) / 10.f);
+		vBoxes[i].w = streamCoord(0.05f);
+		vBoxes[i].h = streamCoord(0.1f);
+	}
+}
+
+static void benchStream(const int nClients, const double seconds, const int nBoxes, const int nBatch,
+						const STREAM_POLICY policy, const bool bSlow) {
+	const char *szEndpoint = "unix:/tmp/resultClient.sock";
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	STREAM_PARAMS params;
+	params.policy = policy;
+	ResultStreamer streamer(params, logger);
+	fflush(stdout);
+	std::vector<pid_t > vClients;
+	for (int i = 0; i < nClients; ++i) {
+		pid_t pid = fork();
+		if (0 == pid) {
+			std::string name = "subscriber " + std::to_string(i);
+			// outlive the publisher so every sent frame is counted
+			subscribe(szEndpoint, seconds + 5, false, bSlow && 0 == i, name.c_str());
+			_exit(0);
+		}
+		vClients.push_back(pid);
+	}
+	if (!streamer.start(szEndpoint)) {
+		return;
+	}
+	while (streamer.getNbSubscribers() < nClients) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	std::vector<STREAM_BOX > vBoxes;
+	uint64_t nFrames = 0;
+	uint64_t t0 = nowUs(), tEnd = t0 + (uint64_t)(seconds * 1e6);
+	while (nowUs() < tEnd) {
+		std::vector<uint8_t > batch;
+		for (int i = 0; i < nBatch; ++i, ++nFrames) {
+			fillBoxes(vBoxes, nBoxes, nFrames);
+			ResultStreamer::appendResult(batch, i, nFrames, 0, vBoxes.data(), nBoxes);
+		}
+		streamer.publish(std::move(batch), nBatch);
+	}
+	double dt = (nowUs() - t0) / 1e6;
+	printf("stream publisher: %.0f frames/s, %lu dropped over all subscribers\n",
+			nFrames / dt, (unsigned long)streamer.getNbDropped());
+	fflush(stdout);
+	// let the subscribers drain, then end their streams
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	streamer.stop();
+	for (size_t i = 0; i < vClients.size(); ++i) {
+		waitpid(vClients[i], nullptr, 0);
+	}
+	delete logger;
+}
+
+// KittiLoggerModule writes one line per box and flushes per frame, a
+// consumer tails the file and parses the lines back.
+static void benchKitti(const double seconds, const int nBoxes) {
+	const char *szPath = "/tmp/resultClient_kitti.txt";
+	std::ofstream log(szPath, std::ios::trunc);
+	std::atomic<bool > bDone{ false };
+	std::atomic<uint64_t > nRead{ 0 };
+	std::thread tail([&]() {
+		FILE *fp = fopen(szPath, "r");
+		char line[512];
+		int64_t lastFrame = -1;
+		while (true) {
+			if (nullptr == fgets(line, sizeof(line), fp)) {
+				if (bDone) {
+					break;
+				}
+				clearerr(fp);
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				continue;
+			}
+			long frame = 0;
+			char label[64];
+			float x0, y0, x1, y1;
+			if (6 == sscanf(line, "Frame [%ld]%63s 0.0 0 0.0 %f %f %f %f", &frame, label, &x0, &y0, &x1, &y1)
+				&& frame != lastFrame) {
+				lastFrame = frame;
+				nRead++;
+			}
+		}
+		fclose(fp);
+	});
+	const char *labels[3] = { "Car", "Bicycle", "Person" };
+	std::vector<STREAM_BOX > vBoxes;
+	uint64_t nFrames = 0;
+	uint64_t t0 = nowUs(), tEnd = t0 + (uint64_t)(seconds * 1e6);
+	while (nowUs() < tEnd) {
+		fillBoxes(vBoxes, nBoxes, nFrames);
+		for (int i = 0; i < nBoxes; ++i) {
+			float x = vBoxes[i].x / 65535.f, y = vBoxes[i].y / 65535.f;
+			log << "Frame [" << nFrames << "]" << labels[vBoxes[i].category] << " 0.0 0 0.0 " << x * 1920 << " "
+				<< y * 1080 << " " << (x + 0.05f) * 1920 << " " << (y + 0.1f) * 1080
+				<< " 0.0 0.0 0.0 0.0 0.0 0.0 0.0\n";
+		}
+		log.flush();
+		nFrames++;
+	}
+	double dtWrite = (nowUs() - t0) / 1e6;
+	bDone = true;
+	tail.join();
+	double dt = (nowUs() - t0) / 1e6;
+	printf("kitti writer: %.0f frames/s, tail reader: %.0f frames/s\n", nFrames / dtWrite, nRead / dt);
+	unlink(szPath);
+}
+
+int main(int argc, char **argv) {
+	double seconds = getArg(argc, argv, "seconds", 5);
+	if (nullptr != getArg(argc, argv, "bench")) {
+		int nClients = (int)getArg(argc, argv, "clients", 2);
+		int nBoxes = (int)getArg(argc, argv, "boxes", 8);
+		int nBatch = (int)getArg(argc, argv, "batch", 16);
+		const char *szPolicy = getArg(argc, argv, "policy");
+		STREAM_POLICY policy = nullptr != szPolicy && 0 == strcmp(szPolicy, "block") ? STREAM_BLOCK : STREAM_DROP;
+		printf("%d subscribers, %d boxes per frame, %d frames per batch, %s policy\n",
+				nClients, nBoxes, nBatch, STREAM_BLOCK == policy ? "block" : "drop");
+		benchStream(nClients, seconds, nBoxes, nBatch, policy, nullptr != getArg(argc, argv, "slow"));
+		benchKitti(seconds, nBoxes);
+		return 0;
+	}
+	const char *szEndpoint = getArg(argc, argv, "connect");
+	if (nullptr == szEndpoint) {
+		fprintf(stderr, "usage: %s -connect=unix:<path>|tcp:<host>:<port> [-print] [-seconds=S]\n"
+						"       %s -bench [-clients=N] [-seconds=S] [-boxes=N] [-batch=N] [-policy=drop|block] [-slow]\n",
+				argv[0], argv[0]);
+		return 1;
+	}
+	return 0 == subscribe(szEndpoint, seconds, nullptr != getArg(argc, argv, "print"), false, szEndpoint) ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+// Throughput and latency of the detection ring with concurrent readers.
+//
+//   ringBench [-writers=N] [-readers=N] [-seconds=S] [-boxes=N]
+//             [-capacity=N] [-rate=R] [-ring=/name]
+//
+// The writer threads publish records of -boxes boxes over 16 channels as
+// fast as they can, or -rate records per second each; every reader is a
+// separate process. With -writers=0 the readers attach to the ring of a
+// running pipeline instead (-detectionRing=/name).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <sys/wait.h>
+#include "../detectionRing.h"
+#include "../common/histogram.h"
+#include "toolArgs.h"
+
+static const int NB_CHANNELS = 16;
+
+static int runReader(const int id, const char *szRing, const double seconds) {
+	DetectionRingReader reader(szRing);
+	uint64_t tOpen = nowUs();
+	while (!reader.open()) {
+		if (nowUs() - tOpen > 5000000) {
+			fprintf(stderr, "reader %d: no ring %s\n", id, szRing);
+			return 1;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	LatencyHistogram latency;
+	std::vector<uint64_t > vLastSeq(DETECTION_RING_MAX_CHANNELS, 0);
+	uint64_t nRecords = 0, nGaps = 0, nBoxes = 0;
+	DETECTION_RECORD record;
+	uint64_t t0 = nowUs(), tEnd = t0 + (uint64_t)(seconds * 1e6);
+	while (nowUs() < tEnd) {
+		if (!reader.readWait(record, 10000)) {
+			continue;
+		}
+		latency.record(nowUs() - record.sinkUs);
+		uint64_t &last = vLastSeq[record.channel];
+		if (0 != last && record.channelSeq > last + 1) {
+			nGaps += record.channelSeq - last - 1;
+		}
+		last = std::max(last, record.channelSeq);
+		nBoxes += record.nBoxes;
+		nRecords++;
+	}
+	double dt = (nowUs() - t0) / 1e6;
+	std::vector<uint64_t > vValues;
+	latency.getQuantiles({ 0.5, 0.99, 0.999 }, vValues);
+	printf("reader %d: %.0f records/s, %.0f boxes/s, lost %lu, channel gaps %lu, latency p50 %lu us p99 %lu us p99.9 %lu us max %lu us\n",
+			id, nRecords / dt, nBoxes / dt, (unsigned long)reader.getNbLost(), (unsigned long)nGaps,
+			(unsigned long)vValues[0], (unsigned long)vValues[1], (unsigned long)vValues[2],
+			(unsigned long)latency.getMax());
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int nWriters = (int)getArg(argc, argv, "writers", 2);
+	int nReaders = (int)getArg(argc, argv, "readers", 4);
+	double seconds = getArg(argc, argv, "seconds", 5);
+	int nBoxes = std::min((int)getArg(argc, argv, "boxes", 8), DETECTION_RING_MAX_BOXES);
+	int capacity = (int)getArg(argc, argv, "capacity", 4096);
+	double rate = getArg(argc, argv, "rate", 0);
+	const char *szRing = getArg(argc, argv, "ring");
+	if (nullptr == szRing) {
+		szRing = "/ringBench";
+	}
+
+	DetectionRingWriter *pWriter = nullptr;
+	if (nWriters > 0) {
+		pWriter = new DetectionRingWriter(szRing, capacity);
+		if (!pWriter->create()) {
+			fprintf(stderr, "failed to create %s\n", szRing);
+			return 1;
+		}
+		printf("%s: %u slots of %zu bytes, %d writers, %d readers, %d boxes per record\n",
+				szRing, pWriter->getCapacity(), sizeof(RING_SLOT), nWriters, nReaders, nBoxes);
+	}
+
+	fflush(stdout);
+	std::vector<pid_t > vReaders;
+	for (int i = 0; i < nReaders; ++i) {
+		pid_t pid = fork();
+		if (0 == pid) {
+			_exit(runReader(i, szRing, seconds));
+		}
+		vReaders.push_back(pid);
+	}
+
+	// the writers start once the readers had time to attach
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	std::atomic<uint64_t > nWritten{ 0 };
+	std::vector<std::thread > vWriters;
+	uint64_t t0 = nowUs(), tEnd = t0 + (uint64_t)(seconds * 1e6);
+	for (int iW = 0; iW < nWriters; ++iW) {
+		vWriters.push_back(std::thread([&, iW]() {
+			DETECTION_RECORD record;
+			memset(&record, 0, sizeof(record));
+			record.outputWidth = 1920;
+			record.outputHeight = 1080;
+			record.nBoxes = nBoxes;
+			uint64_t n = 0;
+			for (int64_t frame = 0; ; ++frame) {
+				uint64_t t = nowUs();
+				if (t >= tEnd) {
+					break;
+				}
+				if (rate > 0. && n >= (t - t0) * rate / 1e6) {
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+					continue;
+				}
+				// every writer owns a share of the channels, like a device worker
+				record.channel = (int)(n % std::max(1, NB_CHANNELS / nWriters)) * nWriters + iW;
+				record.frameIndex = frame;
+				for (int i = 0; i < nBoxes; ++i) {
+					record.boxes[i].x = (i % 8) / 8.f;
+					record.boxes[i].category = i % 3;
+				}
+				record.sinkUs = nowUs();
+				pWriter->publish(record);
+				n++;
+			}
+			nWritten.fetch_add(n);
+		}));
+	}
+	for (size_t i = 0; i < vWriters.size(); ++i) {
+		vWriters[i].join();
+	}
+	if (nWriters > 0) {
+		printf("writers: %.0f records/s\n", nWritten.load() / ((nowUs() - t0) / 1e6));
+	}
+
+	int ret = 0;
+	for (size_t i = 0; i < vReaders.size(); ++i) {
+		int status = 0;
+		waitpid(vReaders[i], &status, 0);
+		if (!WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+			ret = 1;
+		}
+	}
+	delete pWriter;
+	return ret;
+}
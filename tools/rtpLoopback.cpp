@@ -0,0 +1,229 @@
+// Loopback check of the RTP jitter buffer against injected impairments.
+//
+//   rtpLoopback -clip=<file> [-codec=h264|hevc] [-jitter=<profile>]
+//               [-loss=P] [-reorder=P] [-depth=N] [-restart=N]
+//               [-newSsrc=N] [-rate=N] [-loops=N] [-seed=N]
+//
+// Sends an Annex-B clip as RTP over UDP to a socket on 127.0.0.1, the
+// way a camera packetizes it, and receives it through an RtpJitterBuffer:
+// once per profile (default, low, robust) or only with -jitter's, given
+// as main's -jitterProfile. The sender drops a packet with probability
+// -loss (0.01) and holds one back by -depth (8) packets with probability
+// -reorder (0.02). Every -restart packets the sequence number jumps by half its
+// range, as a restarted camera's would, and every -newSsrc packets the
+// SSRC changes; 0 (the default) for neither. A packet leaves every
+// 1e6 / -rate (2000) us of simulated time, the buffer's hold time runs
+// on that clock, so a run is repeatable for a -seed.
+//
+// For each profile it prints what was injected against what the buffer
+// counted. Without a window every reordered packet leaves a hole behind
+// and arrives late; with one it is put back. A packet which leaves the
+// buffer behind the one before it, within one SSRC and sequence, is an
+// error.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../rtpJitterBuffer.h"
+#include "rtpPacketizer.h"
+#include "toolArgs.h"
+
+typedef struct {
+	double loss = 0.01;
+	double reorder = 0.02;
+	int depth = 8;
+	int restartEvery = 0;
+	int newSsrcEvery = 0;
+	int rate = 2000;
+	int loops = 1;
+	unsigned seed = 1;
+} IMPAIRMENTS;
+
+typedef struct {
+	uint64_t nSent = 0;
+	uint64_t nLost = 0;
+	uint64_t nReordered = 0;
+	uint64_t nRestarts = 0;
+	uint64_t nNewSsrcs = 0;
+} INJECTED;
+
+typedef struct {
+	uint64_t nOut = 0;
+	uint64_t nGaps = 0;
+	uint64_t nMisordered = 0;
+	bool bFirst = true;
+	uint16_t lastSeq = 0;
+	uint32_t lastSsrc = 0;
+} RECEIVED;
+
+static void onOrdered(void *handle, const uint8_t *pPacket, int, bool bGap) {
+	RECEIVED &r = *(RECEIVED *)handle;
+	uint16_t seq = (pPacket[2] << 8) | pPacket[3];
+	uint32_t ssrc = ((uint32_t)pPacket[8] << 24) | (pPacket[9] << 16) | (pPacket[10] << 8) | pPacket[11];
+	// a step back, a restarted sequence jumps further
+	int16_t delta = (int16_t)(uint16_t)(seq - r.lastSeq);
+	if (!r.bFirst && ssrc == r.lastSsrc && delta <= 0 && delta > -3000) {
+		r.nMisordered++;
+	}
+	r.bFirst = false;
+	r.lastSeq = seq;
+	r.lastSsrc = ssrc;
+	r.nOut++;
+	r.nGaps += bGap;
+}
+
+// What arrived on the socket goes into the buffer.
+static void receive(const int fd, RtpJitterBuffer &buffer, const uint64_t nowUs) {
+	uint8_t buf[2048];
+	ssize_t n;
+	while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		buffer.push(buf, (int)n, nowUs);
+	}
+	buffer.flush(nowUs);
+}
+
+static bool run(const std::vector<RTP_PAYLOAD > &vPayloads, const char *szProfile, const JITTER_PARAMS &params,
+				const IMPAIRMENTS &imp, const int rxFd, const int txFd) {
+	RtpJitterBuffer buffer(params);
+	RECEIVED r;
+	buffer.setSink(&r, onOrdered);
+	INJECTED in;
+	srand(imp.seed);
+	uint16_t seq = (uint16_t)rand();
+	uint32_t ssrc = (uint32_t)rand();
+	const uint64_t intervalUs = 1000000 / imp.rate;
+	uint64_t nowUs = 0;
+	// packets held back, with the packet count they go out after
+	std::deque<std::pair<uint64_t, std::vector<uint8_t > > > held;
+	uint64_t i = 0;
+	for (int loop = 0; loop < imp.loops; ++loop) {
+		for (size_t j = 0; j < vPayloads.size(); ++j, ++i) {
+			const RTP_PAYLOAD &payload = vPayloads[j];
+			if (imp.restartEvery > 0 && i > 0 && 0 == i % imp.restartEvery) {
+				seq += 32768;
+				in.nRestarts++;
+			}
+			if (imp.newSsrcEvery > 0 && i > 0 && 0 == i % imp.newSsrcEvery) {
+				ssrc = (uint32_t)rand();
+				in.nNewSsrcs++;
+			}
+			std::vector<uint8_t > vPacket(12 + payload.vPayload.size());
+			uint32_t timestamp = (uint32_t)((loop * (vPayloads.back().picture + 1) + payload.picture) * 3600);
+			writeRtpHeader(vPacket.data(), 96, payload.bMarker, seq++, timestamp, ssrc);
+			memcpy(vPacket.data() + 12, payload.vPayload.data(), payload.vPayload.size());
+			nowUs += intervalUs;
+			in.nSent++;
+			double dice = (double)rand() / RAND_MAX;
+			if (dice < imp.loss) {
+				in.nLost++;
+			} else if (dice < imp.loss + imp.reorder) {
+				in.nReordered++;
+				held.push_back(std::make_pair(i + imp.depth, vPacket));
+			} else {
+				send(txFd, vPacket.data(), vPacket.size(), 0);
+			}
+			while (!held.empty() && held.front().first <= i) {
+				send(txFd, held.front().second.data(), held.front().second.size(), 0);
+				held.pop_front();
+			}
+			receive(rxFd, buffer, nowUs);
+		}
+	}
+	while (!held.empty()) {
+		send(txFd, held.front().second.data(), held.front().second.size(), 0);
+		held.pop_front();
+	}
+	receive(rxFd, buffer, nowUs);
+	// whatever still waits behind a hole is given up
+	receive(rxFd, buffer, nowUs + 10000000);
+
+	JITTER_STATS stats = buffer.getStats();
+	printf("%-16s sent %lu: lost %lu, reordered %lu, restarts %lu, new SSRCs %lu | "
+			"buffer received %lu: lost %lu, late %lu, reordered %lu, duplicate %lu, resyncs %lu | "
+			"out %lu, gaps %lu, out of order %lu\n",
+			szProfile, (unsigned long)in.nSent, (unsigned long)in.nLost, (unsigned long)in.nReordered,
+			(unsigned long)in.nRestarts, (unsigned long)in.nNewSsrcs,
+			(unsigned long)stats.nReceived, (unsigned long)stats.nLost, (unsigned long)stats.nLate,
+			(unsigned long)stats.nReordered, (unsigned long)stats.nDuplicate, (unsigned long)stats.nResyncs,
+			(unsigned long)r.nOut, (unsigned long)r.nGaps, (unsigned long)r.nMisordered);
+	return 0 == r.nMisordered;
+}
+
+int main(int argc, char **argv) {
+	const char *szClip = getArg(argc, argv, "clip");
+	if (nullptr == szClip) {
+		fprintf(stderr, "usage: %s -clip=<file> [-codec=h264|hevc] [-jitter=<profile>] [-loss=P] [-reorder=P] "
+						"[-depth=N] [-restart=N] [-newSsrc=N] [-rate=N] [-loops=N] [-seed=N]\n", argv[0]);
+		return 1;
+	}
+	const char *szCodec = getArg(argc, argv, "codec");
+	const VIDEO_CODEC codec = nullptr != szCodec && 0 == strcmp(szCodec, "hevc") ? VIDEO_CODEC_HEVC : VIDEO_CODEC_H264;
+	IMPAIRMENTS imp;
+	imp.loss = getArg(argc, argv, "loss", imp.loss);
+	imp.reorder = getArg(argc, argv, "reorder", imp.reorder);
+	imp.depth = (int)getArg(argc, argv, "depth", imp.depth);
+	imp.restartEvery = (int)getArg(argc, argv, "restart", imp.restartEvery);
+	imp.newSsrcEvery = (int)getArg(argc, argv, "newSsrc", imp.newSsrcEvery);
+	imp.rate = (int)getArg(argc, argv, "rate", imp.rate);
+	imp.loops = (int)getArg(argc, argv, "loops", imp.loops);
+	imp.seed = (unsigned)getArg(argc, argv, "seed", imp.seed);
+	if (imp.loss < 0. || imp.reorder < 0. || imp.loss + imp.reorder > 1. || imp.depth < 1 || imp.rate <= 0
+		|| imp.loops < 1) {
+		fprintf(stderr, "illegal impairments\n");
+		return 1;
+	}
+
+	std::ifstream ifs(szClip, std::ios::binary);
+	std::vector<uint8_t > vData((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	std::vector<RTP_PAYLOAD > vPayloads = packetizeClip(vData, codec);
+	if (vPayloads.empty()) {
+		fprintf(stderr, "no NAL units in %s\n", szClip);
+		return 1;
+	}
+
+	int rxFd = socket(AF_INET, SOCK_DGRAM, 0);
+	int txFd = socket(AF_INET, SOCK_DGRAM, 0);
+	int rcvBuf = 8 << 20;
+	setsockopt(rxFd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t nAddr = sizeof(addr);
+	if (rxFd < 0 || txFd < 0 || 0 != bind(rxFd, (sockaddr *)&addr, sizeof(addr))
+		|| 0 != getsockname(rxFd, (sockaddr *)&addr, &nAddr) || 0 != connect(txFd, (sockaddr *)&addr, sizeof(addr))) {
+		perror("loopback socket");
+		return 1;
+	}
+
+	std::vector<std::string > vProfiles;
+	const char *szProfile = getArg(argc, argv, "jitter");
+	if (nullptr != szProfile) {
+		vProfiles.push_back(szProfile);
+	} else {
+		vProfiles.push_back("default");
+		vProfiles.push_back("low");
+		vProfiles.push_back("robust");
+	}
+	bool bPassed = true;
+	for (size_t i = 0; i < vProfiles.size(); ++i) {
+		JITTER_PARAMS params;
+		if ("default" != vProfiles[i] && !parseJitterProfile(vProfiles[i].c_str(), params)) {
+			fprintf(stderr, "illegal jitter profile %s\n", vProfiles[i].c_str());
+			return 1;
+		}
+		bPassed = run(vPayloads, vProfiles[i].c_str(), params, imp, rxFd, txFd) && bPassed;
+	}
+	close(rxFd);
+	close(txFd);
+	return bPassed ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#ifndef RTP_PACKETIZER_H
+#define RTP_PACKETIZER_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "../nalParser.h"
+
+// RTP payloads of an Annex-B clip as a camera sends them, RFC 6184 and
+// RFC 7798 in non-interleaved mode: NAL units which fit the MTU go as
+// they are, larger ones in FU-A or HEVC FU fragments. All payloads of a
+// picture share its timestamp, the last one carries the marker.
+typedef struct {
+	std::vector<uint8_t > vPayload;
+	int picture;		// access unit of the clip, from 0
+	bool bMarker;
+} RTP_PAYLOAD;
+
+// NAL units of the clip without their start codes.
+inline std::vector<std::vector<uint8_t > > splitNals(const std::vector<uint8_t > &vData) {
+	std::vector<std::vector<uint8_t > > vNals;
+	int pos = findNalStart(vData.data(), (int)vData.size(), 0);
+	while (pos >= 0) {
+		int next = findNalStart(vData.data(), (int)vData.size(), pos);
+		int end = next < 0 ? (int)vData.size() : next - 3;
+		while (end > pos && 0 == vData[end - 1]) {
+			end--;
+		}
+		if (end > pos) {
+			vNals.push_back(std::vector<uint8_t >(vData.begin() + pos, vData.begin() + end));
+		}
+		pos = next;
+	}
+	return vNals;
+}
+
+inline std::vector<RTP_PAYLOAD > packetizeClip(const std::vector<uint8_t > &vData, const VIDEO_CODEC codec,
+												const int mtu = 1400) {
+	std::vector<RTP_PAYLOAD > vPayloads;
+	std::vector<std::vector<uint8_t > > vNals = splitNals(vData);
+	const int nHeader = VIDEO_CODEC_HEVC == codec ? 2 : 1;
+	int picture = 0;
+	bool bSlices = false;
+	for (size_t i = 0; i < vNals.size(); ++i) {
+		const std::vector<uint8_t > &vNal = vNals[i];
+		PACKET_CLASS c = classifyPacket(vNal.data(), (int)vNal.size(), codec);
+		// the next access unit, the marker goes on the last payload of this one
+		if (bSlices && (!c.bPicture || c.bNewPicture)) {
+			vPayloads.back().bMarker = true;
+			picture++;
+			bSlices = false;
+		}
+		bSlices = bSlices || c.bPicture;
+		RTP_PAYLOAD payload;
+		payload.picture = picture;
+		payload.bMarker = false;
+		if ((int)vNal.size() <= mtu) {
+			payload.vPayload = vNal;
+			vPayloads.push_back(payload);
+			continue;
+		}
+		// FU indicator and FU header, the NAL header goes into them
+		for (int pos = nHeader; pos < (int)vNal.size(); ) {
+			int n = std::min(mtu - nHeader - 1, (int)vNal.size() - pos);
+			payload.vPayload.clear();
+			if (VIDEO_CODEC_HEVC == codec) {
+				payload.vPayload.push_back((uint8_t)((vNal[0] & 0x81) | (49 << 1)));
+				payload.vPayload.push_back(vNal[1]);
+				payload.vPayload.push_back((uint8_t)((vNal[0] >> 1) & 0x3f));
+			} else {
+				payload.vPayload.push_back((uint8_t)((vNal[0] & 0xe0) | 28));
+				payload.vPayload.push_back((uint8_t)(vNal[0] & 0x1f));
+			}
+			if (nHeader == pos) {
+				payload.vPayload.back() |= 0x80;
+			}
+			if (pos + n == (int)vNal.size()) {
+				payload.vPayload.back() |= 0x40;
+			}
+			payload.vPayload.insert(payload.vPayload.end(), vNal.begin() + pos, vNal.begin() + pos + n);
+			vPayloads.push_back(payload);
+			pos += n;
+		}
+	}
+	if (!vPayloads.empty()) {
+		vPayloads.back().bMarker = true;
+	}
+	return vPayloads;
+}
+
+// The 12 byte RTP header, version 2 without CSRCs or extension.
+inline void writeRtpHeader(uint8_t *pHeader, const int payloadType, const bool bMarker, const uint16_t seq,
+							const uint32_t timestamp, const uint32_t ssrc) {
+	pHeader[0] = 0x80;
+	pHeader[1] = (uint8_t)((bMarker ? 0x80 : 0) | (payloadType & 0x7f));
+	pHeader[2] = (uint8_t)(seq >> 8);
+	pHeader[3] = (uint8_t)seq;
+	for (int i = 0; i < 4; ++i) {
+		pHeader[4 + i] = (uint8_t)(timestamp >> (24 - 8 * i));
+		pHeader[8 + i] = (uint8_t)(ssrc >> (24 - 8 * i));
+	}
+}
+
+#endif // RTP_PACKETIZER_H
@@ -0,0 +1,503 @@
+// Scripted stand-in for an RTSP camera, to test the native client
+// (-streamClient=native) and the jitter profiles without one.
+//
+//   rtspServer -clip=<file> [-codec=h264|hevc] [-port=8554] [-fps=F]
+//              [-script=<file>] [-noSprop] [-loops=N]
+//
+// Serves an Annex-B clip on 127.0.0.1:-port (8554) under any path, at
+// -fps (25) pictures a second, -loops (0, endless) times. RTP goes over
+// TCP interleaved or UDP, as the client asks in SETUP, with an RTCP
+// sender report every second. The SDP carries the clip's parameter sets
+// unless -noSprop is set; then only the ones in band remain. Every client
+// gets a thread of its own.
+//
+// The script makes each session misbehave at fixed packets, counted from
+// PLAY on, one event per line:
+//
+//   # packet  event    argument
+//   200       drop     5         the next 5 packets are lost
+//   400       reorder  3         the packet goes out 3 packets later
+//   600       jump     30000     the sequence number jumps
+//   800       ssrc               a new SSRC, as a restarted camera
+//   1000      stall    2000      nothing is sent for 2000 ms
+//   1200      close              the connection drops
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "rtpPacketizer.h"
+#include "toolArgs.h"
+
+enum EVENT_TYPE {
+	EVENT_DROP,
+	EVENT_REORDER,
+	EVENT_JUMP,
+	EVENT_SSRC,
+	EVENT_STALL,
+	EVENT_CLOSE
+};
+
+typedef struct {
+	uint64_t packet;
+	EVENT_TYPE type;
+	int argument;
+} EVENT;
+
+typedef struct {
+	VIDEO_CODEC codec;
+	std::vector<RTP_PAYLOAD > vPayloads;
+	int nPictures;
+	std::string sprop;			// the fmtp parameter sets, empty with -noSprop
+	double fps;
+	int loops;
+	std::vector<EVENT > vEvents;
+} CONFIG;
+
+static bool readScript(const std::string &path, std::vector<EVENT > &vEvents) {
+	std::ifstream ifs(path.c_str());
+	if (!ifs.is_open()) {
+		fprintf(stderr, "failed to open %s\n", path.c_str());
+		return false;
+	}
+	static const char *szTypes[] = { "drop", "reorder", "jump", "ssrc", "stall", "close" };
+	std::string line;
+	int lineNo = 0;
+	while (std::getline(ifs, line)) {
+		lineNo++;
+		std::istringstream iss(line);
+		std::string packet, type;
+		if (!(iss >> packet) || '#' == packet[0]) {
+			continue;
+		}
+		EVENT e;
+		e.packet = strtoull(packet.c_str(), nullptr, 10);
+		e.argument = 1;
+		iss >> type >> e.argument;
+		int i = 0;
+		while (i < 6 && type != szTypes[i]) {
+			i++;
+		}
+		if (6 == i || e.argument < 0) {
+			fprintf(stderr, "%s:%d: unknown event\n", path.c_str(), lineNo);
+			return false;
+		}
+		e.type = (EVENT_TYPE)i;
+		vEvents.push_back(e);
+	}
+	return true;
+}
+
+static std::string base64(const uint8_t *pData, const int nData) {
+	static const char szTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	for (int i = 0; i < nData; i += 3) {
+		uint32_t v = pData[i] << 16 | (i + 1 < nData ? pData[i + 1] << 8 : 0) | (i + 2 < nData ? pData[i + 2] : 0);
+		out += szTable[(v >> 18) & 0x3f];
+		out += szTable[(v >> 12) & 0x3f];
+		out += i + 1 < nData ? szTable[(v >> 6) & 0x3f] : '=';
+		out += i + 2 < nData ? szTable[v & 0x3f] : '=';
+	}
+	return out;
+}
+
+// sprop-parameter-sets for H.264, sprop-vps/sps/pps for HEVC, of the
+// first parameter sets of the clip
+static std::string makeSprop(const std::vector<uint8_t > &vData, const VIDEO_CODEC codec) {
+	std::vector<std::vector<uint8_t > > vNals = splitNals(vData);
+	std::string vps, sps, pps;
+	for (size_t i = 0; i < vNals.size(); ++i) {
+		const std::vector<uint8_t > &vNal = vNals[i];
+		if (isPictureNal(vNal[0], codec)) {
+			break;
+		}
+		if (!isParameterSetNal(vNal[0], codec)) {
+			continue;
+		}
+		int type = VIDEO_CODEC_HEVC == codec ? (vNal[0] >> 1) & 0x3f : vNal[0] & 0x1f;
+		std::string &list = (32 == type) ? vps : (33 == type || 7 == type) ? sps : pps;
+		list += (list.empty() ? "" : ",") + base64(vNal.data(), (int)vNal.size());
+	}
+	if (sps.empty() || pps.empty()) {
+		return std::string();
+	}
+	if (VIDEO_CODEC_HEVC == codec) {
+		return "sprop-vps=" + vps + ";sprop-sps=" + sps + ";sprop-pps=" + pps;
+	}
+	return "packetization-mode=1;sprop-parameter-sets=" + sps + "," + pps;
+}
+
+static std::string headerValue(const std::string &request, const char *szName) {
+	std::istringstream iss(request);
+	std::string line;
+	size_t n = strlen(szName);
+	while (std::getline(iss, line)) {
+		if (line.size() > n && 0 == strncasecmp(line.c_str(), szName, n) && ':' == line[n]) {
+			size_t first = line.find_first_not_of(' ', n + 1);
+			size_t last = line.find_last_not_of("\r ");
+			return std::string::npos == first ? std::string() : line.substr(first, last + 1 - first);
+		}
+	}
+	return std::string();
+}
+
+// One client, from OPTIONS to TEARDOWN or until the connection drops.
+class Session {
+public:
+	Session(const CONFIG &config, const int fd, const sockaddr_in &peer, const int id)
+	: config_(config), fd_(fd), peer_(peer), id_(id), seed_((unsigned)id + 1) {
+		seq_ = (uint16_t)rand_r(&seed_);
+		ssrc_ = (uint32_t)rand_r(&seed_);
+	}
+
+	~Session() {
+		close(fd_);
+		if (udpFd_ >= 0) {
+			close(udpFd_);
+		}
+	}
+
+	void run() {
+		char szPeer[INET_ADDRSTRLEN] = { 0 };
+		inet_ntop(AF_INET, &peer_.sin_addr, szPeer, sizeof(szPeer));
+		printf("session %d: %s connected\n", id_, szPeer);
+		while (bOpen_) {
+			if (bPlaying_) {
+				stream();
+			} else if (!waitRequests(-1)) {
+				break;
+			}
+		}
+		printf("session %d: closed after %lu packets\n", id_, (unsigned long)nPackets_);
+	}
+
+private:
+	// Answers what the client sent, up to timeoutMs for it to arrive.
+	bool waitRequests(const int timeoutMs) {
+		pollfd pfd = { fd_, POLLIN, 0 };
+		if (poll(&pfd, 1, timeoutMs) <= 0) {
+			return true;
+		}
+		char buf[4096];
+		ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+		if (n <= 0) {
+			bOpen_ = false;
+			return false;
+		}
+		rx_.append(buf, n);
+		while (!rx_.empty()) {
+			// interleaved RTCP of the client
+			if ('$' == rx_[0]) {
+				if (rx_.size() < 4) {
+					break;
+				}
+				size_t len = 4 + (((uint8_t)rx_[2] << 8) | (uint8_t)rx_[3]);
+				if (rx_.size() < len) {
+					break;
+				}
+				rx_.erase(0, len);
+				continue;
+			}
+			size_t end = rx_.find("\r\n\r\n");
+			if (std::string::npos == end) {
+				break;
+			}
+			size_t len = end + 4 + atoi(headerValue(rx_.substr(0, end + 2), "Content-Length").c_str());
+			if (rx_.size() < len) {
+				break;
+			}
+			std::string request = rx_.substr(0, end + 2);
+			rx_.erase(0, len);
+			answer(request);
+		}
+		return bOpen_;
+	}
+
+	void answer(const std::string &request) {
+		char szMethod[32] = { 0 }, szUri[1024] = { 0 };
+		sscanf(request.c_str(), "%31s %1023s", szMethod, szUri);
+		std::string method = szMethod, uri = szUri;
+		std::ostringstream extra;
+		std::string body;
+		int status = 200;
+		if ("OPTIONS" == method) {
+			extra << "Public: OPTIONS, DESCRIBE, SETUP, PLAY, GET_PARAMETER, TEARDOWN\r\n";
+		} else if ("DESCRIBE" == method) {
+			std::ostringstream sdp;
+			sdp << "v=0\r\no=- " << id_ << " 1 IN IP4 127.0.0.1\r\ns=rtspServer\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\n"
+				<< "a=control:*\r\nm=video 0 RTP/AVP 96\r\n"
+				<< "a=rtpmap:96 " << (VIDEO_CODEC_HEVC == config_.codec ? "H265" : "H264") << "/90000\r\n";
+			if (!config_.sprop.empty()) {
+				sdp << "a=fmtp:96 " << config_.sprop << "\r\n";
+			}
+			sdp << "a=control:track1\r\n";
+			body = sdp.str();
+			extra << "Content-Base: " << uri << ('/' == uri[uri.size() - 1] ? "" : "/") << "\r\n"
+				<< "Content-Type: application/sdp\r\n";
+		} else if ("SETUP" == method) {
+			status = setup(headerValue(request, "Transport"), extra) ? 200 : 461;
+		} else if ("PLAY" == method) {
+			status = session_.empty() ? 455 : 200;
+			bPlaying_ = 200 == status;
+		} else if ("TEARDOWN" == method) {
+			bOpen_ = false;
+		} else if ("GET_PARAMETER" != method) {
+			status = 405;
+		}
+		std::ostringstream response;
+		response << "RTSP/1.0 " << status << (200 == status ? " OK" : " Error") << "\r\n"
+				<< "CSeq: " << headerValue(request, "CSeq") << "\r\n";
+		if (!session_.empty()) {
+			response << "Session: " << session_ << ";timeout=60\r\n";
+		}
+		response << extra.str() << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+		printf("session %d: %s %d\n", id_, method.c_str(), status);
+		sendAll(response.str().data(), response.str().size());
+	}
+
+	bool setup(const std::string &transport, std::ostringstream &extra) {
+		char szSession[16];
+		snprintf(szSession, sizeof(szSession), "%08X", (unsigned)rand_r(&seed_));
+		session_ = szSession;
+		if (std::string::npos != transport.find("RTP/AVP/TCP")) {
+			extra << "Transport: RTP/AVP/TCP;unicast;interleaved=" << rtpChannel_ << "-" << rtpChannel_ + 1
+				<< ";ssrc=" << std::hex << ssrc_ << std::dec << "\r\n";
+			return true;
+		}
+		size_t pos = transport.find("client_port=");
+		if (std::string::npos == pos) {
+			return false;
+		}
+		int clientPort = atoi(transport.c_str() + pos + 12);
+		udpFd_ = socket(AF_INET, SOCK_DGRAM, 0);
+		sockaddr_in addr = peer_;
+		addr.sin_port = 0;
+		socklen_t nAddr = sizeof(addr);
+		if (udpFd_ < 0 || 0 != bind(udpFd_, (sockaddr *)&addr, sizeof(addr))
+			|| 0 != getsockname(udpFd_, (sockaddr *)&addr, &nAddr)) {
+			return false;
+		}
+		rtpAddr_ = peer_;
+		rtpAddr_.sin_port = htons(clientPort);
+		rtcpAddr_ = peer_;
+		rtcpAddr_.sin_port = htons(clientPort + 1);
+		bUdp_ = true;
+		extra << "Transport: RTP/AVP;unicast;client_port=" << clientPort << "-" << clientPort + 1
+			<< ";server_port=" << ntohs(addr.sin_port) << "-" << ntohs(addr.sin_port) + 1 << "\r\n";
+		return true;
+	}
+
+	// Paced by picture, the script applied by packet, requests answered
+	// in between.
+	void stream() {
+		const uint64_t startUs = nowUs();
+		uint64_t stallUs = 0;
+		uint64_t lastReportUs = 0;
+		size_t nextEvent = 0;
+		int dropLeft = 0;
+		std::deque<std::pair<uint64_t, std::vector<uint8_t > > > held;
+		for (int loop = 0; bOpen_ && (0 == config_.loops || loop < config_.loops); ++loop) {
+			for (size_t i = 0; bOpen_ && i < config_.vPayloads.size(); ++i) {
+				const RTP_PAYLOAD &payload = config_.vPayloads[i];
+				const int64_t picture = (int64_t)loop * config_.nPictures + payload.picture;
+				const uint64_t dueUs = startUs + stallUs + (uint64_t)(picture * 1e6 / config_.fps);
+				while (bOpen_ && nowUs() < dueUs) {
+					waitRequests((int)std::max<int64_t>(1, (int64_t)(dueUs - nowUs()) / 1000));
+				}
+				timestamp_ = (uint32_t)(picture * 90000 / config_.fps);
+				if (nowUs() - lastReportUs >= 1000000) {
+					sendReport();
+					lastReportUs = nowUs();
+				}
+
+				int reorder = 0;
+				for (; nextEvent < config_.vEvents.size() && config_.vEvents[nextEvent].packet <= nPackets_; ++nextEvent) {
+					const EVENT &e = config_.vEvents[nextEvent];
+					printf("session %d: packet %lu, event %d %d\n", id_, (unsigned long)nPackets_, e.type, e.argument);
+					if (EVENT_DROP == e.type) {
+						dropLeft = e.argument;
+					} else if (EVENT_REORDER == e.type) {
+						reorder = std::max(1, e.argument);
+					} else if (EVENT_JUMP == e.type) {
+						seq_ += e.argument;
+					} else if (EVENT_SSRC == e.type) {
+						ssrc_ = (uint32_t)rand_r(&seed_);
+					} else if (EVENT_STALL == e.type) {
+						stallUs += (uint64_t)e.argument * 1000;
+						uint64_t untilUs = nowUs() + (uint64_t)e.argument * 1000;
+						while (bOpen_ && nowUs() < untilUs) {
+							waitRequests((int)std::max<int64_t>(1, (int64_t)(untilUs - nowUs()) / 1000));
+						}
+					} else {
+						bOpen_ = false;
+					}
+				}
+				if (!bOpen_) {
+					break;
+				}
+				std::vector<uint8_t > vPacket(12 + payload.vPayload.size());
+				writeRtpHeader(vPacket.data(), 96, payload.bMarker, seq_++, timestamp_, ssrc_);
+				memcpy(vPacket.data() + 12, payload.vPayload.data(), payload.vPayload.size());
+				if (dropLeft > 0) {
+					dropLeft--;
+				} else if (reorder > 0) {
+					held.push_back(std::make_pair(nPackets_ + reorder, vPacket));
+				} else {
+					sendRtp(vPacket, false);
+				}
+				while (!held.empty() && held.front().first <= nPackets_) {
+					sendRtp(held.front().second, false);
+					held.pop_front();
+				}
+				nPackets_++;
+			}
+		}
+		bPlaying_ = false;
+		// the end of the clip, the client sees no more packets
+		while (bOpen_ && waitRequests(1000)) {
+		}
+	}
+
+	// RTCP SR, the wallclock of the current timestamp
+	void sendReport() {
+		std::vector<uint8_t > vReport(28, 0);
+		timeval tv;
+		gettimeofday(&tv, nullptr);
+		uint64_t ntp = ((uint64_t)(tv.tv_sec + 2208988800u) << 32) | (uint32_t)((uint64_t)tv.tv_usec * 4294967296ull / 1000000);
+		vReport[0] = 0x80;
+		vReport[1] = 200;
+		vReport[3] = 6;
+		for (int i = 0; i < 4; ++i) {
+			vReport[4 + i] = (uint8_t)(ssrc_ >> (24 - 8 * i));
+			vReport[8 + i] = (uint8_t)(ntp >> (56 - 8 * i));
+			vReport[12 + i] = (uint8_t)(ntp >> (24 - 8 * i));
+			vReport[16 + i] = (uint8_t)(timestamp_ >> (24 - 8 * i));
+			vReport[20 + i] = (uint8_t)(nPackets_ >> (24 - 8 * i));
+		}
+		sendRtp(vReport, true);
+	}
+
+	void sendRtp(const std::vector<uint8_t > &vPacket, const bool bRtcp) {
+		if (bUdp_) {
+			const sockaddr_in &addr = bRtcp ? rtcpAddr_ : rtpAddr_;
+			sendto(udpFd_, vPacket.data(), vPacket.size(), 0, (const sockaddr *)&addr, sizeof(addr));
+			return;
+		}
+		uint8_t header[4] = { '$', (uint8_t)(rtpChannel_ + (bRtcp ? 1 : 0)),
+							(uint8_t)(vPacket.size() >> 8), (uint8_t)vPacket.size() };
+		if (!sendAll((const char *)header, 4) || !sendAll((const char *)vPacket.data(), vPacket.size())) {
+			bOpen_ = false;
+		}
+	}
+
+	bool sendAll(const char *pData, const size_t nData) {
+		for (size_t sent = 0; sent < nData; ) {
+			ssize_t n = send(fd_, pData + sent, nData - sent, MSG_NOSIGNAL);
+			if (n <= 0) {
+				return false;
+			}
+			sent += n;
+		}
+		return true;
+	}
+
+	const CONFIG &config_;
+	int fd_{ -1 };
+	sockaddr_in peer_;
+	int id_{ 0 };
+	unsigned seed_{ 1 };
+	std::string rx_;
+	std::string session_;
+	bool bOpen_{ true };
+	bool bPlaying_{ false };
+	bool bUdp_{ false };
+	int udpFd_{ -1 };
+	sockaddr_in rtpAddr_;
+	sockaddr_in rtcpAddr_;
+	int rtpChannel_{ 0 };
+	uint16_t seq_{ 0 };
+	uint32_t ssrc_{ 0 };
+	uint32_t timestamp_{ 0 };
+	uint64_t nPackets_{ 0 };
+};
+
+int main(int argc, char **argv) {
+	const char *szClip = getArg(argc, argv, "clip");
+	if (nullptr == szClip) {
+		fprintf(stderr, "usage: %s -clip=<file> [-codec=h264|hevc] [-port=N] [-fps=F] [-script=<file>] [-noSprop] "
+						"[-loops=N]\n", argv[0]);
+		return 1;
+	}
+	// the sessions print from their threads
+	setvbuf(stdout, nullptr, _IOLBF, 0);
+	CONFIG config;
+	const char *szCodec = getArg(argc, argv, "codec");
+	config.codec = nullptr != szCodec && 0 == strcmp(szCodec, "hevc") ? VIDEO_CODEC_HEVC : VIDEO_CODEC_H264;
+	config.fps = getArg(argc, argv, "fps", 25.);
+	config.loops = (int)getArg(argc, argv, "loops", 0);
+	const int port = (int)getArg(argc, argv, "port", 8554);
+	const char *szScript = getArg(argc, argv, "script");
+	if (nullptr != szScript && !readScript(szScript, config.vEvents)) {
+		return 1;
+	}
+	if (config.fps <= 0. || config.loops < 0) {
+		fprintf(stderr, "illegal -fps or -loops\n");
+		return 1;
+	}
+	std::ifstream ifs(szClip, std::ios::binary);
+	std::vector<uint8_t > vData((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	config.vPayloads = packetizeClip(vData, config.codec);
+	if (config.vPayloads.empty()) {
+		fprintf(stderr, "no NAL units in %s\n", szClip);
+		return 1;
+	}
+	config.nPictures = config.vPayloads.back().picture + 1;
+	if (nullptr == getArg(argc, argv, "noSprop")) {
+		config.sprop = makeSprop(vData, config.codec);
+	}
+
+	int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (listenFd < 0 || 0 != bind(listenFd, (sockaddr *)&addr, sizeof(addr)) || 0 != listen(listenFd, 16)) {
+		perror("listen");
+		return 1;
+	}
+	printf("serving %s, %d pictures in %lu packets, at rtsp://127.0.0.1:%d/\n", szClip, config.nPictures,
+			(unsigned long)config.vPayloads.size(), port);
+	for (int id = 0; ; ++id) {
+		sockaddr_in peer;
+		socklen_t nPeer = sizeof(peer);
+		int fd = accept(listenFd, (sockaddr *)&peer, &nPeer);
+		if (fd < 0) {
+			continue;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		std::thread([&config, fd, peer, id]() {
+			Session session(config, fd, peer, id);
+			session.run();
+		}).detach();
+	}
+	return 0;
+}
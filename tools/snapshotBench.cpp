@@ -0,0 +1,137 @@
+// Throughput and latency of the snapshot encoders on the CPU.
+//
+//   snapshotBench [-workers=N] [-seconds=S] [-crops=N] [-size=PX] [-full=1]
+//                 [-quality=Q] [-rate=R] [-width=W] [-height=H] [-out=<dir>]
+//
+// Submits synthetic NV12 pictures (1920x1080 by default) with -crops
+// boxes each, as fast as the pool takes them, or -rate pictures per
+// second. Latency is per snapshot, from the submit to the finished JPEG;
+// at full speed it includes the wait for a worker. The JPEGs are counted
+// and thrown away unless -out is given.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "../snapshotEncoder.h"
+#include "toolArgs.h"
+
+// Gradients with a noisy texture, which costs the entropy coder about
+// what a camera picture does.
+static void makePicture(std::vector<uint8_t > &vNv12, const int width, const int height) {
+	vNv12.resize((size_t)width * height * 3 / 2);
+	uint32_t seed = 12345;
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			seed = seed * 1664525 + 1013904223;
+			int v = (x * 255 / width + y * 255 / height) / 2 + (int)(seed >> 28) - 8 + (((x / 64) + (y / 64)) % 2) * 24;
+			vNv12[(size_t)y * width + x] = (uint8_t)std::min(255, std::max(0, v));
+		}
+	}
+	uint8_t *pUV = vNv12.data() + (size_t)width * height;
+	for (int y = 0; y < height / 2; ++y) {
+		for (int x = 0; x < width / 2; ++x) {
+			pUV[(size_t)y * width + 2 * x] = (uint8_t)(96 + x * 64 / width);
+			pUV[(size_t)y * width + 2 * x + 1] = (uint8_t)(160 - y * 64 / height);
+		}
+	}
+}
+
+static void countJpeg(void *, const SNAPSHOT_INFO &, const uint8_t *, const size_t) {}
+
+int main(int argc, char **argv) {
+	SNAPSHOT_PARAMS params;
+	params.nWorkers = (int)getArg(argc, argv, "workers", 2);
+	params.quality = (int)getArg(argc, argv, "quality", 85);
+	params.maxSide = (int)getArg(argc, argv, "size", 320);
+	params.maxFrames = 4 * params.nWorkers;
+	const bool bFull = 1 == (int)getArg(argc, argv, "full", 0);
+	const int nCrops = (int)getArg(argc, argv, "crops", 4);
+	const double seconds = getArg(argc, argv, "seconds", 5);
+	const double rate = getArg(argc, argv, "rate", 0);
+	const int width = (int)getArg(argc, argv, "width", 1920) & ~1;
+	const int height = (int)getArg(argc, argv, "height", 1080) & ~1;
+	const char *szOut = getArg(argc, argv, "out");
+
+	std::vector<uint8_t > vNv12;
+	makePicture(vNv12, width, height);
+
+	// crop and scale alone, on this thread
+	{
+		I420_IMAGE image;
+		NV12_SCRATCH scratch;
+		IMAGE_RECT rect;
+		rect.x = width / 4;
+		rect.y = height / 4;
+		rect.w = width / 4;
+		rect.h = height / 2;
+		const int nRuns = 2000;
+		uint64_t t0 = nowUs();
+		for (int i = 0; i < nRuns; ++i) {
+			cropNv12(vNv12.data(), width, height, rect, params.maxSide, image, scratch);
+		}
+		printf("crop %dx%d -> %dx%d: %.1f us\n", rect.w, rect.h, image.width, image.height,
+				(double)(nowUs() - t0) / nRuns);
+	}
+
+	simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(simplelogger::WARN);
+	if (nullptr != szOut) {
+		params.dir = szOut;
+	}
+	SnapshotEncoderPool pool(params, logger);
+	if (nullptr == szOut) {
+		pool.setCallback(nullptr, countJpeg);
+	}
+	if (!pool.start()) {
+		return 1;
+	}
+	uint64_t nSubmitted = 0, nWaits = 0;
+	uint64_t t0 = nowUs(), tEnd = t0 + (uint64_t)(seconds * 1e6);
+	uint32_t seed = 1;
+	for (uint64_t now = t0; now < tEnd; now = nowUs()) {
+		if (rate > 0 && nSubmitted >= (now - t0) * rate / 1e6) {
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+			continue;
+		}
+		SNAPSHOT_FRAME *pFrame = pool.acquire(vNv12.size());
+		if (nullptr == pFrame) {
+			nWaits++;
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			continue;
+		}
+		memcpy(pFrame->data.data(), vNv12.data(), vNv12.size());
+		pFrame->width = width;
+		pFrame->height = height;
+		SNAPSHOT_INFO info;
+		info.frameIndex = (int)nSubmitted;
+		if (bFull) {
+			pFrame->vSnapshots.push_back(info);
+		}
+		for (int i = 0; i < nCrops; ++i) {
+			seed = seed * 1664525 + 1013904223;
+			info.category = i;
+			info.w = 0.05f + (seed >> 24) / 255.f * 0.25f;
+			info.h = 0.1f + ((seed >> 16) & 0xFF) / 255.f * 0.4f;
+			info.x = ((seed >> 8) & 0xFF) / 255.f * (1.f - info.w);
+			info.y = (seed & 0xFF) / 255.f * (1.f - info.h);
+			pFrame->vSnapshots.push_back(info);
+		}
+		pool.submit(pFrame);
+		nSubmitted++;
+	}
+	pool.stop();
+	double elapsed = (nowUs() - t0) / 1e6;
+	std::vector<uint64_t > vValues;
+	pool.getLatency().getQuantiles({ 0.5, 0.99, 0.999 }, vValues);
+	printf("%d workers, %d crops%s per picture, quality %d: %.0f pictures/s, %.0f snapshots/s, %.1f KB per snapshot\n",
+			params.nWorkers, nCrops, bFull ? " and the full frame" : "", params.quality, nSubmitted / elapsed,
+			pool.getNbEncoded() / elapsed, pool.getNbBytes() / 1024.0 / std::max<uint64_t>(1, pool.getNbEncoded()));
+	printf("latency p50 %lu us p99 %lu us p99.9 %lu us max %lu us, %lu waits for a free buffer\n",
+			(unsigned long)vValues[0], (unsigned long)vValues[1], (unsigned long)vValues[2],
+			(unsigned long)pool.getLatency().getMax(), (unsigned long)nWaits);
+	delete logger;
+	return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef TOOL_ARGS_H
+#define TOOL_ARGS_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+// Options of the tools are "-name=value", a flag is "-name" alone and
+// reads as "". nullptr when the option is not given.
+inline const char *getArg(int argc, char **argv, const char *szName) {
+	size_t n = strlen(szName);
+	for (int i = 1; i < argc; ++i) {
+		if ('-' == argv[i][0] && 0 == strncmp(argv[i] + 1, szName, n)
+			&& ('=' == argv[i][1 + n] || 0 == argv[i][1 + n])) {
+			return '=' == argv[i][1 + n] ? argv[i] + 2 + n : "";
+		}
+	}
+	return nullptr;
+}
+
+// A number, the default when the option is missing or has no value.
+inline double getArg(int argc, char **argv, const char *szName, const double defaultValue) {
+	const char *szValue = getArg(argc, argv, szName);
+	return nullptr == szValue || 0 == *szValue ? defaultValue : atof(szValue);
+}
+
+inline uint64_t nowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // TOOL_ARGS_H
@@ -0,0 +1,75 @@
+#include "workerBackend.h"
+#include "cpuWorker.h"
+
+#ifndef CPU_ONLY
+// Forwards the task flow to a DeepStream device worker.
+class DeepStreamBackend : public IWorkerBackend {
+public:
+	DeepStreamBackend(const int nLanes, const int devID)
+	: devID_(devID), nLanes_(nLanes) {
+		pDeviceWorker_ = createDeviceWorker(nLanes, devID);
+		assert(nullptr != pDeviceWorker_);
+	}
+
+	int getDeviceID() const override { return devID_; }
+	int getNbLanes() const override { return nLanes_; }
+	void pushPacket(uint8_t *pBuf, int nBuf, int laneID) override {
+		pDeviceWorker_->pushPacket(pBuf, nBuf, laneID);
+	}
+	void stopPushPacket(int laneID) override {
+		pDeviceWorker_->stopPushPacket(laneID);
+	}
+
+	void addDecodeTask(cudaVideoCodec codec) override {
+		pDeviceWorker_->addDecodeTask(codec);
+	}
+	IModule *addColorSpaceConvertorTask(COLOR_FORMAT format) override {
+		return pDeviceWorker_->addColorSpaceConvertorTask(format);
+	}
+	IModule *addInferenceTask(PRE_MODULE preModule,
+							char *deployFile,
+							char *modelFile,
+							char *meanFile,
+							std::string &inputLayerName,
+							std::vector<std::string > &outputLayerNames,
+							const int maxBatchSize,
+							inferenceParams *pParams) override {
+		return pDeviceWorker_->addInferenceTask(preModule, deployFile, modelFile, meanFile,
+												inputLayerName, outputLayerNames,
+												maxBatchSize, pParams);
+	}
+	void addCustomerTask(IModule *pModule) override {
+		pDeviceWorker_->addCustomerTask(pModule);
+	}
+	void setDecodeProfiler(IDecodeProfiler *pProfiler, const int laneID) override {
+		pDeviceWorker_->setDecodeProfiler(pProfiler, laneID);
+	}
+	void setAnalysisProfiler(IAnalysisProfiler *pProfiler) override {
+		pDeviceWorker_->setAnalysisProfiler(pProfiler);
+	}
+	// no hook between the decoder and the convertor, ParserModule drops them
+	void skipStaticFrames(const int) override {}
+	void start() override { pDeviceWorker_->start(); }
+	void stop() override { pDeviceWorker_->stop(); }
+	void destroy() override { pDeviceWorker_->destroy(); }
+
+private:
+	IDeviceWorker *pDeviceWorker_{ nullptr };
+	int devID_{ -1 };
+	int nLanes_{ 0 };
+};
+
+#endif // CPU_ONLY
+
+IWorkerBackend *createWorkerBackend(BACKEND_TYPE type, const int nLanes, const int devID,
+									simplelogger::Logger *logger) {
+	if (BACKEND_CPU == type) {
+		return new CpuWorker(nLanes, logger);
+	}
+#ifdef CPU_ONLY
+	LOG_ERROR(logger, "createWorkerBackend: built without CUDA, only the CPU backend is there");
+	return nullptr;
+#else
+	return new DeepStreamBackend(nLanes, devID);
+#endif
+}
@@ -0,0 +1,48 @@
+#ifndef WORKER_BACKEND_H
+#define WORKER_BACKEND_H
+
+#include <string>
+#include <vector>
+#include "deepStream.h"
+#include "channelScheduler.h"
+
+enum BACKEND_TYPE {
+	BACKEND_DEEPSTREAM = 0,	// NVDEC + TensorRT through IDeviceWorker
+	BACKEND_CPU				// FFmpeg software decode, swscale and a stub network
+};
+
+// The task flow of IDeviceWorker, implemented either by DeepStream or by
+// the CPU reference pipeline so the host-side modules run without a GPU.
+class IWorkerBackend : public ILaneWorker {
+public:
+	virtual ~IWorkerBackend() {}
+
+	virtual void addDecodeTask(cudaVideoCodec codec) = 0;
+	virtual IModule *addColorSpaceConvertorTask(COLOR_FORMAT format) = 0;
+	virtual IModule *addInferenceTask(PRE_MODULE preModule,
+									char *deployFile,
+									char *modelFile,
+									char *meanFile,
+									std::string &inputLayerName,
+									std::vector<std::string > &outputLayerNames,
+									const int maxBatchSize,
+									inferenceParams *pParams) = 0;
+	virtual void addCustomerTask(IModule *pModule) = 0;
+
+	virtual void setDecodeProfiler(IDecodeProfiler *pProfiler, const int laneID) = 0;
+	virtual void setAnalysisProfiler(IAnalysisProfiler *pProfiler) = 0;
+
+	// Leaves the frames the motion gate marked static out before colour
+	// conversion and inference, by the stamps of this worker in g_pTracer.
+	virtual void skipStaticFrames(const int workerID) = 0;
+
+	virtual void start() = 0;
+	virtual void stop() = 0;
+	virtual void destroy() = 0;
+};
+
+// The DeepStream backend is not there in CPU_ONLY builds, see make cpu.
+IWorkerBackend *createWorkerBackend(BACKEND_TYPE type, const int nLanes, const int devID,
+									simplelogger::Logger *logger);
+
+#endif // WORKER_BACKEND_H